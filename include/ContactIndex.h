@@ -0,0 +1,113 @@
+/*
+================================================================================
+    File: ContactIndex.h
+    Description:
+        Contact lookups between root bodies for one MuJoCo data state. The geom
+        to root body table is computed once per model, building an index is a
+        single pass over d->contact that collects the sorted, unique root body
+        pairs in contact and sets bits in a per root body bitset. Body queries
+        are constant time and pair queries a binary search over the few pairs
+        in contact, so a state can be queried many times without rescanning
+        the contact list. Memory grows with the number of contacts, not with
+        the number of root bodies squared (every flex vertex is a root body).
+================================================================================
+*/
+#pragma once
+
+#include "StdInclude.h"
+#include "mujoco.h"
+#include <cstdint>
+
+struct contact_index_tables{
+    // Root body of every geom
+    std::vector<int> geom_root;
+    // Root body of every flex vertex, indexed by flex_vert_adr[flex] + vertex
+    std::vector<int> flex_vert_root;
+    std::vector<int> flex_vert_adr;
+    // Root body of the first vertex of every flex element, indexed by flex_elem_adr[flex] + element
+    std::vector<int> flex_elem_root;
+    std::vector<int> flex_elem_adr;
+    // Per body, its slot in the bitsets if it is a root body, otherwise -1
+    std::vector<int> root_slot;
+    int num_roots = 0;
+
+    /**
+     * Root body of one side of a contact. Flex contacts have no geom (-1), their body is resolved through the
+     * contacting flex vertex, or the first vertex of the contacting flex element.
+     *
+     * @param contact The MuJoCo contact.
+     * @param side 0 or 1, which side of the contact.
+     *
+     * @return int - The root body id, -1 if the side cannot be resolved.
+     */
+    int ContactRoot(const mjContact &contact, int side) const{
+        if(contact.geom[side] >= 0){
+            return geom_root[contact.geom[side]];
+        }
+
+        const int flex = contact.flex[side];
+        if(flex < 0){
+            return -1;
+        }
+        if(contact.vert[side] >= 0){
+            return flex_vert_root[flex_vert_adr[flex] + contact.vert[side]];
+        }
+        if(contact.elem[side] >= 0){
+            return flex_elem_root[flex_elem_adr[flex] + contact.elem[side]];
+        }
+        return -1;
+    }
+};
+
+class ContactIndex{
+public:
+    ContactIndex() = default;
+    explicit ContactIndex(std::shared_ptr<const contact_index_tables> _tables);
+
+    /**
+     * Computes the geom to root body tables for a model, shared by every index built for that model.
+     *
+     * @param m The MuJoCo model.
+     */
+    static std::shared_ptr<const contact_index_tables> BuildTables(const mjModel *m);
+
+    /**
+     * Indexes the contacts of a data state, replacing the previous contents. The contacts are used as they are,
+     * callers run mj_forward first if the contact list may be stale. Contacts whose bodies cannot be resolved
+     * are skipped.
+     *
+     * @param d The MuJoCo data.
+     */
+    void Build(const mjData *d);
+
+    /**
+     * Whether the two root bodies are in contact, O(log pairs). Bodies that are not root bodies are never in contact.
+     */
+    bool Pair(int body_1, int body_2) const;
+
+    /**
+     * Whether the root body is in contact with anything other than the world body.
+     */
+    bool Body(int body) const;
+
+    // Number of contacts between two different root bodies, neither of them the world body
+    int NumCollisions() const { return num_collisions; }
+
+    // Unique root body pairs in contact, smaller id first, sorted
+    const std::vector<std::pair<int, int>>& Pairs() const { return pairs; }
+
+private:
+    static bool TestBit(const std::vector<uint64_t> &bits, int index){
+        return (bits[index >> 6] >> (index & 63)) & 1ULL;
+    }
+
+    static void SetBit(std::vector<uint64_t> &bits, int index){
+        bits[index >> 6] |= 1ULL << (index & 63);
+    }
+
+    std::shared_ptr<const contact_index_tables> tables;
+
+    std::vector<uint64_t> body_bits;
+    std::vector<std::pair<int, int>> pairs;
+    int num_collisions = 0;
+};
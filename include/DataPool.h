@@ -0,0 +1,102 @@
+/*
+================================================================================
+    File: DataPool.h
+    Description:
+        Pool of preallocated MuJoCo data objects. Data is handed out either as
+        raw pointers (for long lived owners such as the saved system state list
+        and the finite differencing data) or as RAII leases that return the data
+        to the pool when they go out of scope. Released data is kept and reused
+        rather than freed, so changing the horizon does not reallocate.
+================================================================================
+*/
+#pragma once
+
+#include "StdInclude.h"
+#include "mujoco.h"
+#include <mutex>
+
+class DataPool;
+
+class DataLease{
+public:
+    DataLease() = default;
+    DataLease(DataPool *_pool, mjData *_data) : pool(_pool), data(_data) {}
+
+    DataLease(const DataLease&) = delete;
+    DataLease& operator=(const DataLease&) = delete;
+
+    DataLease(DataLease &&other) noexcept;
+    DataLease& operator=(DataLease &&other) noexcept;
+
+    ~DataLease();
+
+    mjData* get() const { return data; }
+    mjData* operator->() const { return data; }
+    explicit operator bool() const { return data != nullptr; }
+
+    /**
+     * Returns the data to the pool early, the lease is empty afterwards.
+     */
+    void Reset();
+
+private:
+    DataPool *pool = nullptr;
+    mjData *data = nullptr;
+};
+
+class DataPool{
+public:
+    DataPool() = default;
+
+    DataPool(const DataPool&) = delete;
+    DataPool& operator=(const DataPool&) = delete;
+
+    ~DataPool();
+
+    /**
+     * Sets the model the pooled data is made for. Must be called before any data is acquired.
+     *
+     * @param m The MuJoCo model.
+     */
+    void Init(const mjModel *m);
+
+    /**
+     * Sets the maximum number of data objects the pool may allocate, 0 means unlimited.
+     * Exceeding the cap is an error, as it means something is leaking data.
+     */
+    void SetCapacity(int _capacity);
+
+    /**
+     * Acquires a data object, reusing a released one if possible. The caller must return it with Release.
+     * Released data is not reset, callers are expected to copy a full state into it.
+     */
+    mjData* Acquire();
+
+    /**
+     * Returns a data object acquired from this pool.
+     */
+    void Release(mjData *d);
+
+    /**
+     * Acquires a data object that is returned to the pool when the lease is destroyed.
+     */
+    DataLease Lease();
+
+    int NumAllocated() const;
+    int NumInUse() const;
+
+    // Largest number of data objects simultaneously in use
+    int HighWaterMark() const;
+
+private:
+    const mjModel *model = nullptr;
+
+    std::vector<mjData*> all_data;
+    std::vector<mjData*> free_data;
+
+    int capacity = 0;
+    int num_in_use = 0;
+    int high_water_mark = 0;
+
+    mutable std::mutex mtx;
+};
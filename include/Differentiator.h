@@ -20,9 +20,30 @@ public:
                              int data_index, int thread_id,
                              bool central_diff, double eps);
 
-    void ResidualDerivatives(vector<MatrixXd> &r_x, vector<MatrixXd> &r_u,
+    void ResidualDerivatives(MatrixXd &r_x, MatrixXd &r_u,
                              int data_index, int tid, bool central_diff, double eps);
 
+    /**
+     * Fills the residual derivative rows of every analytic term in the model translator's
+     * compiled residual program, mapping MuJoCo body Jacobians into the current state vector.
+     * Rows of non-analytic terms are left untouched.
+     *
+     * @param r_x Stacked residual derivatives with respect to the state (num_residuals x 2*dof).
+     * @param r_u Stacked residual derivatives with respect to the controls (num_residuals x num_ctrl).
+     * @param data_index Index of the saved system state to linearise about.
+     * @param tid Thread id, selects which finite-differencing data to use as scratch.
+     */
+    void AnalyticResidualDerivatives(MatrixXd &r_x, MatrixXd &r_u,
+                                     int data_index, int tid);
+
+    /**
+     * Sizes the per thread scratch buffers, one per finite-differencing data. Must be called before worker
+     * threads use a new thread id.
+     *
+     * @param num_threads Number of thread ids.
+     */
+    void ResizeThreadBuffers(int num_threads);
+
     // timing variables
     double time_mj_forwards = 0.0f;
     int count_integrations = 0;
@@ -35,4 +56,14 @@ private:
     int dof = 0;
     int dim_state = 0;
     int num_ctrl = 0;
+
+    // Scratch for the analytic residual Jacobians, reused between calls so they are only allocated once
+    struct residual_jacobian_buffers{
+        MatrixXd J_pos;
+        MatrixXd J_vel;
+        MatrixXd J_ctrl;
+        VectorXd J_pos_row;
+        VectorXd J_vel_row;
+    };
+    std::vector<residual_jacobian_buffers> jacobian_buffers;
 };
\ No newline at end of file
@@ -17,6 +17,12 @@ public:
 
     void ReadSettingsFile(const std::string& settingsFilePath);
 
+    /**
+     * Lists every task config file under /TaskConfigs, as paths relative to the project (the format
+     * ReadModelConfigFile expects).
+     */
+    std::vector<std::string> TaskConfigFiles() const;
+
     void SaveTrajecInformation(std::vector<MatrixXd> A_matrices, std::vector<MatrixXd> B_matrices,
                                std::vector<MatrixXd> states, std::vector<MatrixXd> controls, std::string file_prefix);
 
@@ -48,6 +54,42 @@ public:
     int minIter;
     int maxIter;
 
+    // Parallelism settings (optional in the general config file)
+    // Number of worker threads for derivative computation, 0 means hardware_concurrency() - 1
+    int num_worker_threads = 0;
+    // Number of parallel forwards pass rollouts (line search alphas)
+    int num_parallel_rollouts = 6;
+    // Core the simulation / visualisation thread is pinned to, -1 means no pinning
+    int sim_thread_core = -1;
+    // Cores worker threads are pinned to (round robin), empty means no pinning
+    std::vector<int> cpu_affinity;
+
+    // Max absolute state / control change at a timestep for derivatives from the last iteration to be reused
+    // (0 disables derivative reuse)
+    double derivative_reuse_threshold = 0.0;
+
+    // Keep l_xx as the residual Jacobian factor (r_x^T W r_x) instead of a dense 2dof x 2dof matrix per timestep
+    bool low_rank_cost_hessian = false;
+
+    // Store only the velocity rows of A, position rows follow from the semi-implicit Euler structure
+    bool compact_dynamics = false;
+
+    // Binary compiled model cache (mj_saveModel / mj_loadModel), skips compiling the XML on later launches
+    bool model_cache = false;
+    // Absolute cache directory, set from the project relative model_cache_directory option
+    std::string model_cache_directory;
+    // Compile and cache the models of every task config before running
+    bool prewarm_model_cache = false;
+
+    // Max number of pooled MuJoCo data objects (saved states and finite differencing data), 0 means unlimited
+    int data_pool_capacity = 0;
+
+    // MPC settings (optional in the general config file)
+    // Number of controls applied by the simulation thread before a replan is triggered
+    int mpc_replan_interval = 1;
+    // Whether the simulation thread applies the feedback policy u = U + K(x - X) instead of open loop controls
+    bool mpc_feedback_policy = false;
+
 private:
     std::string projectParentPath;
 
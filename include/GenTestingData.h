@@ -5,6 +5,9 @@
 #include <thread>
 #include <mutex>
 #include <filesystem>
+#include <numeric>
+#include <functional>
+#include <algorithm>
 #include <yaml-cpp/yaml.h>
 
 class GenTestingData{
@@ -28,6 +31,21 @@ public:
 
     int GenDataOpenloopOptimisation(int task_horizon);
 
+    /**
+     * Offline tuner for the keypoint parameters. Samples a set of keypoint configurations and
+     * evaluates them with successive halving over the test scene CSV files, each rung doubles the
+     * number of test scenes and keeps the better half of configurations (ranked by Pareto front over
+     * optimisation time and final cost). The results of every configuration, the Pareto frontier of
+     * the final rung and the recommended task config parameters (YAML snippets) are saved to file.
+     *
+     * @Param task_horizon: Optimisation horizon of the task
+     * @Param num_configs: Number of sampled keypoint configurations in the first rung
+     * @Param max_tasks: Number of test scenes used in the final rung
+     *
+     * @Return: 1 if successful, 0 if not
+     */
+    int TuneKeypointParameters(int task_horizon, int num_configs, int max_tasks);
+
     int GenDataMPCHorizons(int task_timeout);
 
     /**
@@ -82,6 +100,14 @@ public:
 
     int AnalyseToyContactKeypoints(int horizon);
 
+    /**
+     * Times ReturnStateVector / SetStateVector for the current task and, for soft body tasks, compares the
+     * bulk soft body accessors against per vertex access. Results are printed.
+     *
+     * @param num_repeats - Number of timed calls per method.
+     */
+    int BenchmarkStateVector(int num_repeats);
+
     void SetParamsiLQR_SVR(int re_add_dofs, double threshold){
         optimiser->num_dofs_readd = re_add_dofs;
         optimiser->K_matrix_threshold = threshold;
@@ -97,6 +123,43 @@ private:
 
     std::string CreateTestName(const std::string& testing_method);
 
+    /**
+     * Loads test scene task_number from CSV, initialises the system and performs one open loop
+     * optimisation with the current optimiser and keypoint method.
+     *
+     * @Param task_number: The test scene to be loaded
+     * @Param task_horizon: The optimisation horizon
+     */
+    void OpenloopTrial(int task_number, int task_horizon);
+
+    struct tuner_config{
+        keypoint_method method;
+        double threshold_scale = 1.0;
+        std::vector<double> opt_times_ms;
+        std::vector<double> final_costs;
+        double mean_opt_time_ms = 0.0;
+        double mean_final_cost = 0.0;
+        int rung = 0;
+    };
+
+    /**
+     * Returns the indices of configs that are not dominated in (mean optimisation time, mean final cost).
+     */
+    std::vector<int> ParetoFrontier(const std::vector<tuner_config>& configs,
+                                    const std::vector<int>& candidates);
+
+    /**
+     * Writes the robot and rigid body thresholds used by a keypoint method, scaled by threshold_scale, in the
+     * task config format.
+     *
+     * @Param out: Emitter positioned inside a map
+     * @Param method_name: "adaptive_jerk" writes jerk thresholds, otherwise velocity change thresholds
+     * @Param threshold_scale: Scale applied to the task config thresholds
+     */
+    void EmitScaledThresholds(YAML::Emitter &out, const std::string &method_name, double threshold_scale);
+
+    std::string KeypointMethodName(const keypoint_method& keypoint_method);
+
     void SaveTestSummaryData(keypoint_method keypoint_method,
                              int opt_horizon,
                              double control_noise,
@@ -113,6 +176,8 @@ private:
 
     int num_controls_apply = 80;
     int num_steps_replan = 1;
+    bool use_feedback_policy = false;
+    feedback_policy mpc_policy;
     volatile bool reoptimise = true;
 
     double final_cost = 0.0;
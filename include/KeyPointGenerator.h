@@ -30,6 +30,8 @@
 #include "StdInclude.h"
 #include "Differentiator.h"
 #include <algorithm>
+#include <atomic>
+#include <thread>
 
 struct keypoint_method{
     std::string name;
@@ -40,6 +42,17 @@ struct keypoint_method{
     std::vector<double> accell_thresholds;
     double iterative_error_threshold;
     std::vector<double> velocity_change_thresholds;
+    // How derivatives are interpolated between keypoints - "linear", "cubic_hermite" (monotone) or "natural_spline"
+    std::string interpolation = "linear";
+    // Additionally force keypoints at contact make / break events, for the dofs of the bodies in contact
+    bool contact_keypoints = false;
+    // Online interpolation error estimation. Each iteration a sampled budget of extra columns is finite-differenced
+    // at non-keypoint time indices, the measured errors set per dof min_N / max_N for the next iteration.
+    bool error_estimation = false;
+    // Percentage of all columns (horizon * dof) spent on error samples
+    double error_sample_percentage = 2.0;
+    // Upper limit on the percentage of columns computed by finite-differencing (keypoints + samples)
+    double target_percentage_derivs = 25.0;
 };
 
 struct index_tuple{
@@ -94,13 +107,35 @@ public:
 
     void PrintKeypointMethod();
 
+    /**
+     * Fills in the columns of the dynamics derivatives between keypoints, per degree of freedom, using the
+     * interpolation set in the current keypoint method.
+     *
+     * @param keyPoints The keypoints (dofs with computed columns) at each time index.
+     * @param T The number of time indices to interpolate over.
+     * @param A Dynamics gradients with respect to the state vector, keypoint columns must already be computed.
+     * @param B Dynamics gradients with respect to the control vector, keypoint columns must already be computed.
+     */
     void InterpolateDerivatives(const std::vector<std::vector<int>> &keyPoints, int T,
                                    std::vector<MatrixXd> &A, std::vector<MatrixXd> &B,
-                                   std::vector<std::vector<MatrixXd>> &r_x, std::vector<std::vector<MatrixXd>> &r_u,
+                                   std::vector<MatrixXd> &r_x, std::vector<MatrixXd> &r_u,
                                    bool residual_derivs, int num_ctrl);
 
     void ResetCache();
 
+    /**
+     * Online interpolation error estimator. Finite-differences a sampled budget of columns at non-keypoint time
+     * indices, compares them against the interpolated values, and updates a per dof error model. The model sets
+     * per dof min_N / max_N for the next iteration, scaled so the keypoints plus the sampled columns stay within
+     * target_percentage_derivs. The error model uses the error order of the interpolation method. Not used by
+     * set_interval or iterative_error. Must be called after InterpolateDerivatives. The sampled columns are left
+     * with their exact values.
+     *
+     * @param A Dynamics gradients with respect to the state vector.
+     * @param B Dynamics gradients with respect to the control vector.
+     */
+    void EstimateInterpolationError(std::vector<MatrixXd> &A, std::vector<MatrixXd> &B);
+
     double surprise_lower = 0.2;
 
     int dof;
@@ -109,35 +144,41 @@ public:
     std::vector<std::vector<int>> keypoints;
     std::vector<double> last_percentages;
 
+    // Number of threads (and finite-differencing data objects) used by the iterative error method
+    int num_threads = 1;
+
+    // Cores the iterative error threads are pinned to (round robin), empty for no pinning
+    std::vector<int> worker_cores;
+
+    // Root body id of each dof in the state vector, needed for contact keypoints
+    std::vector<int> dof_root_bodies;
+
 private:
 
     /**
-     * Loops through a trajectory of states and computes a jerk profile for each degree of freedom. Jerk
-     * is the time-derivative of acceleration.
+     * Copies the first horizon states of a trajectory into trajectory_matrix (state x horizon), so the
+     * profiles below can be computed with whole matrix expressions.
      *
      * @param  trajectory_states A sequence of states of the system over a trajectory.
-     *
      */
-    void GenerateJerkProfile(const std::vector<MatrixXd> &trajectory_states);
+    void StackTrajectory(const std::vector<MatrixXd> &trajectory_states);
 
     /**
-     * Loops through a trajectory of states and computes an acceleration profile for each degree of freedom.
-     *
-     * @param  horizon The length of the trajectory.
-     * @param  trajectory_states A sequence of states of the system over a trajectory.
-     *
-     * @return std::vector<std::vector<MatrixXd>> An acceleration profile for each degree of freedom.
+     * Computes a jerk profile (dof x horizon) for each degree of freedom from trajectory_matrix. Jerk
+     * is the time-derivative of acceleration.
      */
-    std::vector<MatrixXd> GenerateAccellerationProfile(int horizon, std::vector<MatrixXd> trajectory_states);
+    void GenerateJerkProfile();
 
     /**
-     * Loops through a trajectory of states and computes a velocity profile for each degree of freedom. Velocity
-     * is already present in the state vector, this function effectively just returns that half of the state vector.
-     *
-     * @param  trajectory_states A sequence of states of the system over a trajectory.
-     *
+     * Computes an acceleration profile (dof x horizon) for each degree of freedom from trajectory_matrix.
      */
-    void GenerateVelocityProfile(const std::vector<MatrixXd> &trajectory_states);
+    void GenerateAccellerationProfile();
+
+    /**
+     * Computes a velocity profile (dof x horizon) for each degree of freedom from trajectory_matrix. Velocity
+     * is already present in the state vector, this function effectively just copies that half of the state vector.
+     */
+    void GenerateVelocityProfile();
 
     void GenerateKeyPointsSetInterval();
 
@@ -148,6 +189,7 @@ private:
      * via interpolation and exactly via F.D and checks the error between them. If the error is above "Iterative_Error_Threshold"
      * Then we subdivide our approximation for that degree of freedom. This process is repeated until the error is below
      * "Iterative_Error_Threshold" for all degrees of freedom, over all segments of the trajectory.
+     * Segments are refined breadth first over all degrees of freedom, the F.D computations for each level are done in parallel.
      *
      * @param  horizon The length of the trajectory.
      * @param  trajectory_states A sequence of states of the system over a trajectory.
@@ -163,18 +205,27 @@ private:
     std::vector<std::vector<int>> GenerateKeyPointsIteratively(int horizon, std::vector<MatrixXd> trajectory_states,
                                                                std::vector<MatrixXd> &A, std::vector<MatrixXd> &B);
 
+    /**
+     * Computes the requested columns of the dynamics derivatives via finite-differencing, spread over num_threads threads.
+     * All columns at the same time index are computed in one call, so columns shared across dofs are only simulated once.
+     *
+     * @param cols_to_compute The columns (dofs) to compute at each time index.
+     * @param A A vector of all the dynamics gradients matrix with respect to the state vector.
+     * @param B A vector of all the dynamics gradients matrix with respect to the control vector.
+     */
+    void ComputeColumnsInParallel(const std::vector<std::vector<int>> &cols_to_compute,
+                                  std::vector<MatrixXd> &A, std::vector<MatrixXd> &B);
+
     /**
      * This method is a helper function for the "GenerateKeyPointsIteratively" method. It computes the error between an approximation and
      * actual column of the dynamics gradient matrix. If the error is above "Iterative_Error_Threshold" then we subdivide the approximation
-     * for that degree of freedom.
+     * for that degree of freedom. The start, middle and end columns must already be computed.
      *
      * @param indices Start and end index of the current linear approximation.
      * @param dof_index The current degree of freedom of index that we are computing the error for.
      * @param num_dofs The number of dofs in the system, important so we update the correct column of the dynamics gradient matrix.
-     * @param A A vector of all the dynamics gradients matrix with respect to the state vector. Since this method has to compute
-     *         some F.D values, we cache them for later so we dont need to re-compute them.
-     * @param B A vector of all the dynamics gradients matrix with respect to the control vector. Since this method has to compute
-     *          some F.D values, we cache them for later so we dont need to re-compute them.
+     * @param A A vector of all the dynamics gradients matrix with respect to the state vector.
+     * @param B A vector of all the dynamics gradients matrix with respect to the control vector.
      *
      * @return true if error < "Iterative_Error_Threshold", false otherwise.
      */
@@ -187,18 +238,50 @@ private:
      * exceeds some threshold, as defined by keypoint_method. This method is not iterative, it is a one pass method.
      * Keypoints cannot be located closer than "min_N" steps apart, and must be located at msot "max_N" steps apart.
      *
-     * @param trajec_profile The dynamics quality we are currently assessing, either acceleration or jerk., for each degree of freedom.
+     * @param trajec_profile The dynamics quality we are currently assessing, either acceleration or jerk., for each degree of freedom (dof x horizon).
      */
-    void GenerateKeyPointsAdaptive(const std::vector<MatrixXd> &trajec_profile);
+    void GenerateKeyPointsAdaptive(const MatrixXd &trajec_profile);
 
     /**
      * This method of generating keypoints considers the velocity profile for each degree of freedom. When the velocity has changed substantially
      * since the last keypoint, we assign a new keypoint. We also assign keypoints when we detect the velocity changes direction (turning points).
      * Keypoints cannot be located closer than "min_N" steps apart, and must be located at msot "max_N" steps apart.
      *
-     * @param velocity_profile A velocity profile (per degree of freedom) over the trajectory.
+     * @param velocity_profile A velocity profile (per degree of freedom) over the trajectory (dof x horizon).
+     */
+    void GenerateKeyPointsVelocityChange(const MatrixXd &velocity_profile);
+
+    /**
+     * Interpolates a single column of a sequence of matrices between knots (time indices where the column is known).
+     * Indices after the last knot are left unchanged.
+     *
+     * @param knots Sorted time indices with known values, at least two.
+     * @param matrices The matrices to interpolate, one per time index.
+     * @param col The column of the matrices to interpolate.
+     */
+    void InterpolateColumn(const std::vector<int> &knots, std::vector<MatrixXd> &matrices, int col);
+
+    /**
+     * Scans the contacts of the saved trajectory for contact mode switches (a pair of root bodies starting or stopping
+     * contact between two time indices). Keypoints are added either side of the switch for all dofs whose root body
+     * is in that pair. Works on top of whichever keypoint method generated the current keypoints.
+     *
+     * @return std::vector<std::vector<int>> The keypoints that were added at each time index.
      */
-    void GenerateKeyPointsVelocityChange(const std::vector<MatrixXd> &velocity_profile);
+    std::vector<std::vector<int>> AddContactKeypoints();
+
+    /**
+     * Returns the minimum / maximum interval between keypoints for a dof. These are set per dof by the interpolation
+     * error estimator if enabled, otherwise they are the min_N / max_N of the keypoint method.
+     */
+    int MinN(int dof_index) const;
+    int MaxN(int dof_index) const;
+
+    // Error model per dof, mean squared interpolation error of a segment of length h is approximately c * h^4
+    std::vector<double> interpolation_error_coefficients;
+    std::vector<int> dof_min_N;
+    std::vector<int> dof_max_N;
+    std::mt19937 error_sample_generator{0};
 
     void UpdateLastPercentageDerivatives(std::vector<std::vector<int>> &keypoints);
 
@@ -229,8 +312,11 @@ private:
 
     bool auto_adjust_initialisation_occured = false;
 
-    std::vector<MatrixXd> jerk_profile;
-    std::vector<MatrixXd> velocity_profile;
+    // Trajectory states (state x horizon) and the profiles computed from it (dof x horizon)
+    MatrixXd trajectory_matrix;
+    MatrixXd jerk_profile;
+    MatrixXd acceleration_profile;
+    MatrixXd velocity_profile;
 
     std::vector<double> max_last_jerk;
     std::vector<double> min_last_jerk;
@@ -241,4 +327,14 @@ private:
     //Cache system to prevent recomputation
     bool keypoints_computed = false;
 
+    // Interpolation workspace, reused between calls to avoid reallocating per column
+    std::vector<std::vector<int>> interpolation_knots;
+    std::vector<double> interpolation_slope;
+    std::vector<double> interpolation_h;
+    std::vector<double> interpolation_c_prime;
+    MatrixXd interpolation_delta;
+    MatrixXd interpolation_tangents;
+    MatrixXd interpolation_second_derivs;
+    MatrixXd interpolation_d_prime;
+
 };
@@ -0,0 +1,73 @@
+/*
+================================================================================
+    File: ModelCache.h
+    Description:
+        Cache of compiled MuJoCo models. Models are compiled from MJCF once and
+        saved as MJB files (mj_saveModel), keyed by a hash of the XML, every
+        included XML file and every referenced asset. Later launches load the
+        binary model with mj_loadModel, skipping the XML compiler.
+================================================================================
+*/
+#pragma once
+
+#include "StdInclude.h"
+#include "mujoco.h"
+#include <cstdint>
+#include <filesystem>
+
+class ModelCache{
+public:
+    /**
+     * @param cache_directory Directory the MJB files are stored in, created if it does not exist.
+     */
+    explicit ModelCache(std::string cache_directory);
+
+    /**
+     * Loads the model from the cache if a binary model with a matching hash exists, otherwise
+     * compiles the XML and stores the result in the cache.
+     *
+     * @param xml_path Absolute path to the MJCF model file.
+     * @param error Buffer for the compiler error message.
+     * @param error_sz Size of the error buffer.
+     *
+     * @return mjModel* The loaded model, nullptr if compilation failed (error is then filled).
+     */
+    mjModel* LoadModel(const std::string &xml_path, char *error, int error_sz);
+
+    /**
+     * Compiles and stores the model if it is not already cached.
+     *
+     * @param xml_path Absolute path to the MJCF model file.
+     *
+     * @return bool True if the model is in the cache afterwards.
+     */
+    bool Prewarm(const std::string &xml_path);
+
+    /**
+     * Hash of the model file, included XML files and referenced assets (meshes, textures, etc.),
+     * combined with the MuJoCo version so stale binaries are never loaded.
+     */
+    uint64_t HashModelFiles(const std::string &xml_path) const;
+
+    /**
+     * Path of the MJB file the model would be cached at.
+     */
+    std::string CachePath(const std::string &xml_path) const;
+
+    // Whether the last LoadModel call was served from the cache
+    bool last_load_cached = false;
+
+private:
+    void HashXMLFile(const std::filesystem::path &xml_file, const std::filesystem::path &model_dir,
+                     std::vector<std::string> &asset_dirs, std::vector<std::string> &visited, uint64_t &hash) const;
+
+    static bool HashFileContents(const std::filesystem::path &file, uint64_t &hash);
+
+    static void HashBytes(const void *data, size_t size, uint64_t &hash);
+
+    static std::vector<std::string> AttributeValues(const std::string &text, const std::string &attribute);
+
+    mjModel* CompileAndSave(const std::string &xml_path, const std::string &cache_path, char *error, int error_sz) const;
+
+    std::string cache_directory;
+};
@@ -19,7 +19,9 @@
 #include "StdInclude.h"
 #include "MuJoCoHelper.h"
 #include "FileHandler.h"
+#include "ModelTranslator/ResidualProgram.h"
 #include <random>
+#include <unordered_map>
 
 enum clutterLevels{
     noClutter = 0,
@@ -90,6 +92,15 @@ public:
     //--------------------------------------------------------------------------------
     virtual void Residuals(mjData *d, MatrixXd &residual);
 
+    /**
+     * Computes the residuals of the system. Uses the compiled residual program when the task
+     * configuration declares typed residuals, otherwise falls back to the Residuals override.
+     *
+     * @param d The MuJoCo data to compute the residuals from.
+     * @param residuals The residual vector to fill, sized to the number of residuals.
+     */
+    void ComputeResiduals(mjData *d, MatrixXd &residuals);
+
     /**
      * Returns the current cost of the system at the given data index.
      *
@@ -135,14 +146,26 @@ public:
      * @param l_u The first order cost derivative with respect to the control vector. Passed by reference.
      * @param l_uu The second order cost derivative with respect to the control vector. Passed by reference.
      * @param residuals The residuals of the system at the given data index. Passed by reference.
-     * @param r_x The first order residual derivative with respect to the state vector. Passed by reference.
-     * @param r_u The first order residual derivative with respect to the control vector. Passed by reference.
+     * @param r_x Stacked residual derivatives with respect to the state vector (num_residuals x 2*dof).
+     * @param r_u Stacked residual derivatives with respect to the control vector (num_residuals x num_ctrl).
      * @param terminal Whether or not this is the terminal state or not.
+     * @param compute_l_xx Whether to form the dense l_xx, false when the optimiser keeps it in low-rank form.
      *
      */
     void CostDerivativesFromResiduals(const struct stateVectorList &state_vector,
                                         MatrixXd &l_x, MatrixXd &l_xx, MatrixXd &l_u, MatrixXd &l_uu,
-                                        const MatrixXd &residuals, const vector<MatrixXd> r_x, const vector<MatrixXd> r_u, bool terminal);
+                                        const MatrixXd &residuals, const MatrixXd &r_x, const MatrixXd &r_u, bool terminal,
+                                        bool compute_l_xx = true);
+
+    /**
+     * Returns the second derivative of the cost with respect to each residual (2 * weight, as the norm is r^2),
+     * so that l_xx = r_x^T * diag(weights) * r_x.
+     *
+     * @param terminal Whether to use the terminal residual weights.
+     *
+     * @return VectorXd The hessian weight of each residual.
+     */
+    VectorXd ResidualHessianWeights(bool terminal) const;
 
     /**
      * Returns whether the task has been completed yet. Distance is sometimes useful depending on the task. E.g. for
@@ -222,6 +245,17 @@ public:
      */
     bool SetStateVectorQuat(MatrixXd state_vector_values, mjData* d, const struct stateVectorList &state_vector);
 
+    /**
+     * Returns, for every element of the quaternion state representation of state_vector, the index of the
+     * same element in the quaternion state representation of the full state vector. Allows a reduced state
+     * to be gathered from a stored full state (e.g. X(indices)) instead of querying MuJoCo again.
+     *
+     * @param state_vector The state vector object, must be a subset of the full state vector.
+     *
+     * @return std::vector<int> Indices into the full state vector, length dof_quat + dof.
+     */
+    std::vector<int> FullStateIndicesQuat(const struct stateVectorList &state_vector);
+
     /**
      * Sets the current state vector of the system in the specified data index, using quaternion representation
      * for state vectors.
@@ -357,19 +391,76 @@ public:
      */
     bool SetVelocityVector(MatrixXd velocity_vector, mjData* d, const struct stateVectorList &state_vector);
 
+    /**
+     * Resolves the model handles of every robot, rigid body and soft body in a state vector. The state vector
+     * accessors above use these handles, state vectors without them are resolved on a copy for every call.
+     *
+     * @param state_vector The state vector to resolve the handles of.
+     */
+    void ResolveStateVectorHandles(struct stateVectorList &state_vector) const;
+
     /**
      * Converts a state vector index to a position vector index in MuJoCo
      *
      * @param state_index The state index to convert to a position vector index.
      * @param state_vector The state vector object to use to create the state vector values.
      *
-     * @return int the position vector index in MuJoCo
+     * @return int the position vector index in MuJoCo, -1 if the state element moves no dofs
      *
      */
     int StateIndexToQposIndex(int state_index, const struct stateVectorList &state_vector);
 
+    /**
+     * Value of a state element in a vector over MuJoCo dofs (e.g. a position difference from mj_differentiatePos).
+     * Reduced order soft body elements average over the dofs of their vertex cluster.
+     *
+     * @param state_index The state index.
+     * @param dof_vector Vector of size nv.
+     */
+    double ProjectDofVectorToState(int state_index, const double *dof_vector) const;
+
+    /**
+     * Adds scale times the direction of a state element to a vector over MuJoCo dofs. Reduced order soft body
+     * elements move every vertex of their cluster.
+     *
+     * @param state_index The state index.
+     * @param dof_vector Vector of size nv.
+     * @param scale Size of the step along the state element.
+     */
+    void LiftStateToDofVector(int state_index, double *dof_vector, double scale) const;
+
+    /**
+     * Dot product of a vector over MuJoCo dofs with the direction of a state element, i.e. the chain rule from a
+     * Jacobian row with respect to the dofs to the state element.
+     */
+    double StateDirectionDot(int state_index, const double *dof_vector) const;
+
+    /**
+     * Root body of every state element, from the body that owns its MuJoCo dof. Used to work out which state
+     * elements are involved in a contact.
+     *
+     * @return std::vector<int> One root body id per state element.
+     */
+    std::vector<int> ReturnDofRootBodies() const;
+
+    /**
+     * Actuator id of every control in the state vector, from the robot tables of the physics simulator.
+     *
+     * @return std::vector<int> One actuator id per control.
+     */
+    std::vector<int> ReturnControlActuatorIds() const;
+
     void ComputeStateDofAdrIndices(mjData* d, const struct stateVectorList &state_vector);
 
+    /**
+     * Sets the target of a residual. A residual with resid_dimension n is stored as n copies in residual_list
+     * and typed residuals read the target from their own copy, so every copy is updated.
+     *
+     * @param residual_name Name of the residual in the task configuration.
+     * @param target The new target values.
+     */
+    void SetResidualTarget(const std::string &residual_name, const std::vector<double> &target);
+
     void InitialiseSystemToStartState(mjData* d);
 
     virtual void SetGoalVisuals(mjData *d){
@@ -401,7 +492,10 @@ public:
 
     std::vector<std::string> iteration_readded_state_elements;
 
+    // First MuJoCo dof of each state element, -1 for a cluster coordinate with no active member vertices
     std::vector<int> state_dof_adr_indices;
+    // Dofs moved by each state element, empty unless the element is a reduced order soft body cluster coordinate
+    std::vector<std::vector<int>> state_dof_adr_groups;
 
     // mujoco helper object
     std::shared_ptr<MuJoCoHelper> MuJoCo_helper;
@@ -421,6 +515,11 @@ public:
     std::vector<double> accel_thresholds;
     double iterative_error_threshold;
     std::vector<double> velocity_change_thresholds;
+    std::string interpolation_method = "linear";
+    bool contact_keypoints = false;
+    bool error_estimation = false;
+    double error_sample_percentage = 2.0;
+    double target_percentage_derivs = 25.0;
 
     // openloop_horizon
     int openloop_horizon;
@@ -430,6 +529,9 @@ public:
 
     vector<residual> residual_list;
 
+    // Residual program compiled from typed residuals in the task configuration, empty if none
+    ResidualProgram residual_program;
+
 //    int num_residual_terms;
 //    vector<double> residual_weights;
 //    vector<double> residual_weights_terminal;
@@ -0,0 +1,120 @@
+/*
+================================================================================
+    File: ResidualProgram.h
+    Description:
+        Compiles declarative residual descriptions from a task YAML file into a
+        flat array of typed operations with pre-resolved MuJoCo ids. The program
+        is evaluated without any string lookups or allocations, so it can be
+        used inside finite-differencing and rollouts instead of a hand written
+        Residuals override.
+================================================================================
+*/
+#pragma once
+
+#include "StdInclude.h"
+#include "mujoco.h"
+
+enum residual_op_type{
+    RESIDUAL_BODY_POSITION = 0,
+    RESIDUAL_BODY_VELOCITY = 1,
+    RESIDUAL_BODY_DISTANCE = 2,
+    RESIDUAL_JOINT_POSITION = 3,
+    RESIDUAL_JOINT_VELOCITY = 4,
+    RESIDUAL_CONTROL = 5
+};
+
+struct residual_op{
+    residual_op_type type;
+
+    // Row in the residual vector
+    int row;
+
+    // residual_list entry at the head of this row's resid_dimension group, the only copy that owns the targets
+    int target_row;
+
+    // Offset into the target vector of the owning residual
+    int target_offset = 0;
+
+    // Body ids for body operations
+    int body_a = -1;
+    int body_b = -1;
+
+    // qpos / dof address for joint and body velocity operations, actuator id for controls
+    int address = -1;
+
+    // dof address for joint operations, used to place analytic Jacobian entries
+    int dof_address = -1;
+
+    // Whether this op supplies an analytic Jacobian, otherwise finite-differencing is used
+    bool analytic = true;
+
+    // Axes used by body operations, a single axis gives a signed residual, more give a norm
+    int axes[3] = {0, 1, 2};
+    int num_axes = 3;
+};
+
+class ResidualProgram{
+public:
+    /**
+     * Compiles the typed residuals in the residual list into a program of residual operations.
+     * Residuals with a resid_dimension greater than one are expected to be stored consecutively
+     * under the same name (as done by FileHandler::ReadModelConfigFile).
+     *
+     * @param m The MuJoCo model used to resolve body, joint and actuator names.
+     * @param residual_list The residuals read from the task configuration file.
+     * @param _control_actuator_ids Actuator id of each control in the state vector, used to place analytic
+     * Jacobian entries with respect to the controls.
+     *
+     * @return bool True if the residuals were typed and a program was compiled, false if
+     * no residuals declared a type (the task then falls back to its Residuals override).
+     */
+    bool Compile(const mjModel *m, const std::vector<residual> &residual_list,
+                 const std::vector<int> &_control_actuator_ids = {});
+
+    /**
+     * Evaluates the compiled program into the residual vector. Targets are read from the
+     * residual list at evaluation time so goal changes (e.g. loading a task from file)
+     * are picked up without recompiling.
+     *
+     * @param m The MuJoCo model.
+     * @param d The MuJoCo data to evaluate the residuals from.
+     * @param residual_list The residual list the program was compiled from.
+     * @param residuals Output residual vector, must already be sized to residual_list.size().
+     */
+    void Evaluate(const mjModel *m, mjData *d, const std::vector<residual> &residual_list,
+                  MatrixXd &residuals) const;
+
+    /**
+     * Computes analytic Jacobians of the residuals with respect to the MuJoCo tangent space
+     * (qpos perturbations as applied by mj_integratePos, qvel and ctrl). Body terms use
+     * mj_jacBody. Rows of ops that are not analytic are left at zero.
+     *
+     * @param m The MuJoCo model.
+     * @param d The MuJoCo data to linearise about, kinematics are recomputed if required.
+     * @param residual_list The residual list the program was compiled from.
+     * @param J_pos Output (num_residuals x nv) derivatives with respect to positions.
+     * @param J_vel Output (num_residuals x nv) derivatives with respect to velocities.
+     * @param J_ctrl Output (num_residuals x nu) derivatives with respect to controls.
+     */
+    void Jacobians(const mjModel *m, mjData *d, const std::vector<residual> &residual_list,
+                   MatrixXd &J_pos, MatrixXd &J_vel, MatrixXd &J_ctrl) const;
+
+    bool Compiled() const { return !ops.empty(); }
+
+    bool AllAnalytic() const;
+
+    bool AnyAnalytic() const;
+
+    std::vector<residual_op> ops;
+
+    // Actuator id of each control in the state vector, resolved at compile time
+    std::vector<int> control_actuator_ids;
+
+    // Whether any operation reads body poses, requiring a kinematics pass before evaluation
+    bool needs_kinematics = false;
+
+private:
+    static double Target(const residual &resid, int index);
+
+    static int NameToId(const mjModel *m, mjtObj type, const std::string &name, const std::string &residual_name);
+};
@@ -6,8 +6,12 @@
 
 #include "StdInclude.h"
 #include "mujoco.h"
+#include "ModelCache.h"
+#include "DataPool.h"
+#include "ContactIndex.h"
 #include <GLFW/glfw3.h>
 #include <thread>
+#include <unordered_map>
 
 struct pose_7{
     m_point position;
@@ -35,6 +39,14 @@ public:
     // Constructor
     MuJoCoHelper(vector<robot> robots, vector<string> _bodies);
 
+    // Handles -- resolved from the name tables built when the model is loaded, unknown names are an error
+    body_handle BodyHandle(const string& body_name) const;
+    joint_handle JointHandle(const string& joint_name) const;
+    actuator_handle ActuatorHandle(const string& actuator_name) const;
+    flex_handle FlexHandle(const string& flex_name) const;
+    sensor_handle SensorHandle(const string& sensor_name) const;
+    const robot_handle& RobotHandle(const string& robot_name) const;
+
     // Utility functions -- robots
     bool IsValidRobotName(const string& robot_name, int &robotIndex, string &robotBaseJointName);
     void SetRobotJointPositions(const string& robot_name, vector<double> joint_positions, mjData *d);
@@ -49,6 +61,15 @@ public:
     void GetRobotControlLimits(const string& robot_name, vector<double> &control_limits);
     void GetRobotJointLimits(const string& robot_name, vector<double> &joint_limits, mjData *d);
 
+    void SetRobotJointPositions(const robot_handle &robot, const vector<double> &joint_positions, mjData *d) const;
+    void SetRobotJointsVelocities(const robot_handle &robot, const vector<double> &joint_velocities, mjData *d) const;
+    void SetRobotJointsControls(const robot_handle &robot, const vector<double> &joint_controls, mjData *d) const;
+
+    void GetRobotJointsPositions(const robot_handle &robot, vector<double> &joint_positions, mjData *d) const;
+    void GetRobotJointsVelocities(const robot_handle &robot, vector<double> &joint_velocities, mjData *d) const;
+    void GetRobotJointsAccelerations(const robot_handle &robot, vector<double> &joint_accelerations, mjData *d) const;
+    void GetRobotJointsControls(const robot_handle &robot, vector<double> &joint_controls, mjData *d) const;
+
     // Utility functions -- rigid bodies
     bool BodyExists(const string& body_name, int &body_index);
     void SetBodyColor(const string& body_name, const float color[4]) const;
@@ -65,6 +86,18 @@ public:
     void GetBodyPoseQuatViaXpos(const string& body_name, pose_7 &pose, mjData *d) const;
     void GetBodyPoseAngleViaXpos(const string& body_name, pose_6 &pose, mjData *d) const;
 
+    void SetBodyPoseQuat(const body_handle &body, const pose_7 &pose, mjData *d) const;
+    void SetBodyPoseAngle(const body_handle &body, const pose_6 &pose, mjData *d) const;
+    void SetBodyVelocity(const body_handle &body, const pose_6 &velocity, mjData *d) const;
+
+    void GetBodyPoseQuat(const body_handle &body, pose_7 &pose, mjData *d) const;
+    void GetBodyPoseAngle(const body_handle &body, pose_6 &pose, mjData *d) const;
+    void GetBodyVelocity(const body_handle &body, pose_6 &velocity, mjData *d) const;
+    void GetBodyAcceleration(const body_handle &body, pose_6 &acceleration, mjData *d) const;
+
+    void GetBodyPoseQuatViaXpos(const body_handle &body, pose_7 &pose, mjData *d) const;
+    void GetBodyPoseAngleViaXpos(const body_handle &body, pose_6 &pose, mjData *d) const;
+
     // Utility functions -- soft bodies
     void SetSoftBodyVertexPos(const string& flex_name, int vertex_id, pose_6 &pose, mjData *d) const;
     void SetSoftBodyVertexVel(const string& flex_name, int vertex_id, pose_6 &pose, mjData *d) const;
@@ -73,6 +106,51 @@ public:
     void GetSoftBodyVertexPosGlobal(const string& flex_name, int vertex_id, pose_6 &pose, mjData *d) const;
     void GetSoftBodyVertexVel(const string& flex_name, int vertex_id, pose_6 &pose, mjData *d) const;
 
+    void SetSoftBodyVertexPos(const flex_handle &flex, int vertex_id, const pose_6 &pose, mjData *d) const;
+    void SetSoftBodyVertexVel(const flex_handle &flex, int vertex_id, const pose_6 &pose, mjData *d) const;
+
+    void GetSoftBodyVertexPos(const flex_handle &flex, int vertex_id, pose_6 &pose, mjData *d) const;
+    void GetSoftBodyVertexPosGlobal(const flex_handle &flex, int vertex_id, pose_6 &pose, mjData *d) const;
+    void GetSoftBodyVertexVel(const flex_handle &flex, int vertex_id, pose_6 &pose, mjData *d) const;
+
+    /**
+     * Bulk soft body access. Copies the active vertex coordinates of a flex (in state vector order, vertex by
+     * vertex, x y z) between mjData and a contiguous segment, using the vertex qpos / dof addresses resolved
+     * when the model was loaded.
+     *
+     * @param flex - Handle of the flex object.
+     * @param body - Soft body description, provides the active vertex coordinates.
+     * @param segment - Segment to write to / read from, must hold at least the number of active coordinates.
+     * @param d - The MuJoCo data.
+     *
+     * @return int - The number of coordinates copied.
+     */
+    int GetSoftBodyPositions(const flex_handle &flex, const soft_body &body, Ref<VectorXd> segment, mjData *d) const;
+    int GetSoftBodyVelocities(const flex_handle &flex, const soft_body &body, Ref<VectorXd> segment, mjData *d) const;
+    int SetSoftBodyPositions(const flex_handle &flex, const soft_body &body, const Ref<const VectorXd> &segment, mjData *d) const;
+    int SetSoftBodyVelocities(const flex_handle &flex, const soft_body &body, const Ref<const VectorXd> &segment, mjData *d) const;
+
+    /**
+     * Groups the vertices of a reduced order soft body (num_clusters > 0) into clusters by k-means on the vertex
+     * positions of the rest configuration (qpos0). The bulk accessors then read the mean displacement of each
+     * cluster and writes move every vertex of a cluster by the same amount. Vertices without joints are left out.
+     *
+     * @param body - Soft body description, its clusters are overwritten.
+     */
+    void ClusterSoftBodyVertices(soft_body &body);
+
+    /**
+     * The MuJoCo dof addresses moved by one coordinate of a soft body cluster.
+     *
+     * @param flex - Handle of the flex object.
+     * @param body - Reduced order soft body description.
+     * @param cluster - Index of the cluster.
+     * @param axis - 0, 1 or 2 for x, y or z.
+     *
+     * @return std::vector<int> - The dof address of every member vertex active on that axis.
+     */
+    std::vector<int> SoftBodyClusterDofs(const flex_handle &flex, const soft_body &body, int cluster, int axis) const;
+
 
 
     // Extras
@@ -82,6 +160,34 @@ public:
     std::vector<int> GetContactList(mjData *d) const;
     bool CheckPairForCollisions(const string& body_name_1, const string& body_name_2, mjData *d) const;
 
+    Eigen::MatrixXd GetJacobian(const body_handle &body, mjData *d) const;
+    bool CheckBodyForCollisions(const body_handle &body, mjData *d) const;
+    bool CheckPairForCollisions(const body_handle &body_1, const body_handle &body_2, mjData *d) const;
+
+    /**
+     * Runs mj_forward on the data and indexes its contacts, for repeated pair / body queries on one state.
+     *
+     * @param d - The MuJoCo data.
+     *
+     * @return ContactIndex - Root body contact lookups for the state.
+     */
+    ContactIndex BuildContactIndex(mjData *d) const;
+
+    /**
+     * Runs mj_forward on the data and rebuilds an existing index in place, reusing its buffers.
+     */
+    void BuildContactIndex(mjData *d, ContactIndex &index) const;
+
+    /**
+     * Root body pairs in contact (smaller id first, sorted) at each of the first num_states saved system states.
+     */
+    std::vector<std::vector<std::pair<int, int>>> TrajectoryContactPairs(int num_states) const;
+
+    /**
+     * Contact mask between two root bodies over the first num_states saved system states.
+     */
+    std::vector<bool> TrajectoryPairContacts(const body_handle &body_1, const body_handle &body_2, int num_states) const;
+
     // ----- Loading and saving system states -----
     bool AppendSystemStateToEnd(mjData *d);
     bool CheckIfDataIndexExists(int list_index) const;
@@ -100,7 +206,23 @@ public:
     void MouseMove(double dx, double dy, bool button_left, bool button_right, GLFWwindow *window);
     void Scroll(double yoffset);
 
+    /**
+     * Loads the model and makes the MuJoCo data objects. If model_cache_directory is set, the compiled model
+     * is loaded from / saved to the binary model cache instead of always compiling the XML.
+     *
+     * @param timestep - Model timestep.
+     * @param file_name - Absolute path to the MJCF model file.
+     * @param use_plugins - Whether MuJoCo plugin libraries need to be loaded (e.g. soft bodies).
+     */
     void InitSimulator(double timestep, const char* file_name, bool use_plugins);
+
+    /**
+     * Resize the pool of finite differencing data objects. One is needed per parallel worker (derivative threads
+     * and forwards pass rollouts share the pool as they never run at the same time).
+     *
+     * @param num_data - The number of finite differencing data objects required.
+     */
+    void ResizeFiniteDifferencingData(int num_data);
     bool ForwardSimulator(mjData *d) const;
     bool ForwardSimulatorWithSkip(mjData *d, int skip_stage, int skip_sensor) const;
 
@@ -112,15 +234,20 @@ public:
     double ReturnModelTimeStep() const;
 
     double* SensorState(mjData *d, const std::string& sensor_name);
+    double* SensorState(mjData *d, const sensor_handle &sensor) const;
+
+    static void InitialisePlugins();
 
-    void InitialisePlugins();
+    // Directory of the binary compiled model cache, empty disables the cache
+    static std::string model_cache_directory;
 
     vector<mjData*> saved_systems_state_list;       // List of saved system states
     mjData* master_reset_data{};                    // Master reset mujoco data
     mjData* main_data{};                            // main MuJoCo data
     mjData* vis_data{};                             // Visualisation MuJoCo data
     mjModel* model{};                               // MuJoCo model
-    std::vector<mjData*> fd_data;                   // Finite differencing MuJoCo data - instantiated with the number of cores on the pc
+    std::vector<mjData*> fd_data;                   // Finite differencing MuJoCo data - one per parallel worker (defaults to number of cores)
+    DataPool data_pool;                             // Owns the saved system states and finite differencing data, reused when released
 
     mjvCamera cam{};                                // abstract camera
     mjvScene scn{};                                 // abstract scene
@@ -128,6 +255,40 @@ public:
     mjrContext con{};				                // custom GPU context
 
 private:
+    void BuildHandleTables();
+
+    // Exits if fewer than num_states system states are saved
+    void CheckTrajectoryLength(int num_states) const;
+
+    int SoftBodyVertexBody(const flex_handle &flex, int vertex_id, const char* caller) const;
+
+    const std::vector<int>& SoftBodyVertexAddresses(const std::vector<std::vector<int>> &table, const flex_handle &flex,
+                                                    const soft_body &body) const;
+    static int GatherSoftBodyVertices(const std::vector<int> &vertex_adr, const soft_body &body, const mjtNum *source,
+                                      Ref<VectorXd> segment);
+    static int ScatterSoftBodyVertices(const std::vector<int> &vertex_adr, const soft_body &body,
+                                       const Ref<const VectorXd> &segment, mjtNum *dest);
+    static int GatherSoftBodyClusters(const std::vector<int> &vertex_adr, const soft_body &body, const mjtNum *source,
+                                      Ref<VectorXd> segment);
+    static int ScatterSoftBodyClusters(const std::vector<int> &vertex_adr, const soft_body &body,
+                                       const Ref<const VectorXd> &segment, mjtNum *dest);
+
+    // Name to id tables, built once the model is loaded
+    std::unordered_map<string, int> body_ids;
+    std::unordered_map<string, int> joint_ids;
+    std::unordered_map<string, int> actuator_ids;
+    std::unordered_map<string, int> flex_ids;
+    std::unordered_map<string, int> sensor_ids;
+    std::unordered_map<string, int> robot_indices;
+    std::vector<robot_handle> robot_handles;
+
+    // Geom to root body tables shared by every contact index
+    std::shared_ptr<const contact_index_tables> contact_tables;
+
+    // Per flex, the qpos / dof address of each vertex body (-1 for vertices without joints, e.g. pinned)
+    std::vector<std::vector<int>> flex_vertex_qpos_adr;
+    std::vector<std::vector<int>> flex_vertex_dof_adr;
+
     int save_iterations{};
     mjtNum save_tolerance{};
 
@@ -16,7 +16,38 @@
 #include "ModelTranslator/ModelTranslator.h"
 #include "Differentiator.h"
 #include "KeyPointGenerator.h"
+#include <algorithm>
 #include <atomic>
+#include <deque>
+#include <mutex>
+
+/**
+ * A unit of finite-differencing work, a subset of the keypoint columns at a single time index.
+ */
+struct fd_task{
+    int time_index;
+    std::vector<int> cols;
+    double estimated_cost;
+    double measured_time_us;
+};
+
+/**
+ * Time-varying feedback policy handed from the optimiser to the simulation thread between replans. The control at
+ * time index t is u = U[t] + K[t](x - X[t]). If K is empty the policy is open loop.
+ */
+struct feedback_policy{
+    std::vector<MatrixXd> U;
+    std::vector<MatrixXd> K;
+    // Nominal state vectors (with quaternions) the policy was computed about
+    std::vector<MatrixXd> X;
+    // Nominal qpos, used for position differences of quaternion dofs
+    std::vector<std::vector<double>> q_pos;
+    // qpos index of each dof in the state vector, gathered when the policy is created
+    std::vector<int> q_pos_indices;
+    // Dofs of each reduced order soft body element (empty for all other elements), differences are averaged over them
+    std::vector<std::vector<int>> q_pos_groups;
+    struct stateVectorList state_vector;
+};
 
 class Optimiser{
 public:
@@ -90,6 +121,7 @@ public:
         time_backwards_pass_ms.clear();
         time_forwardsPass_ms.clear();
         percentage_derivs_per_iteration.clear();
+        percentage_derivs_reused_per_iteration.clear();
     }
 
     /**
@@ -101,6 +133,69 @@ public:
      */
     virtual void Resize(int new_num_dofs, int new_num_ctrl, int new_horizon);
 
+    /**
+     * Shifts the per-timestep optimisation data (derivatives and derivative cache) forwards in time by a number
+     * of timesteps. Used between MPC replans, so that the region of the new horizon that overlaps the old horizon
+     * starts from the old linearisation. Overlapped derivatives are seeded into the derivative cache, the new
+     * timesteps at the end of the horizon are marked invalid. Keypoints are not shifted, they are regenerated from
+     * the new nominal trajectory on every replan.
+     *
+     * @param shift - The number of timesteps the start of the horizon moved forwards by (controls applied).
+     */
+    virtual void ShiftHorizon(int shift);
+
+    /**
+     * Returns the time-varying feedback gains from the last backwards pass. Optimisers that do not compute
+     * feedback gains return an empty vector.
+     */
+    virtual std::vector<MatrixXd> ReturnFeedbackGains(){
+        return {};
+    }
+
+    /**
+     * Creates a feedback policy from the current nominal trajectory and the last feedback gains, so a
+     * simulation thread can track the plan between replans.
+     *
+     * @return feedback_policy - The policy over the current horizon.
+     */
+    feedback_policy ReturnFeedbackPolicy();
+
+    /**
+     * Evaluates a feedback policy, u = U[t] + K[t](x - X[t]), clamped to the control limits. Only reads from the
+     * supplied data and the policy, so can be called from the simulation thread while the optimiser is running.
+     *
+     * @param policy - The feedback policy to evaluate.
+     * @param t - The time index into the policy.
+     * @param d - The data object holding the current state x.
+     *
+     * @return MatrixXd - The control to apply.
+     */
+    MatrixXd FeedbackPolicyControl(const feedback_policy &policy, int t, mjData *d);
+
+    /**
+     * Set the parallelism used by the optimiser. Resizes the MuJoCo finite differencing data pool and rollout
+     * buffers to match.
+     *
+     * @param _num_worker_threads - Number of threads used for dynamics and residual derivatives.
+     * @param _num_parallel_rollouts - Number of parallel forwards pass rollouts.
+     * @param _worker_cores - Cores worker threads are pinned to (round robin), empty for no pinning.
+     */
+    void SetParallelism(int _num_worker_threads, int _num_parallel_rollouts, const std::vector<int> &_worker_cores);
+
+    /**
+     * Restricts the calling thread (the thread running the optimiser) to the worker cores, so it and every pool it
+     * creates stay off a reserved simulation core. With no affinity set the thread may run on any core.
+     */
+    void PinOptimiserThread() const;
+
+    int ReturnNumWorkerThreads() const{
+        return num_worker_threads;
+    }
+
+    int ReturnNumParallelRollouts() const{
+        return num_parallel_rollouts;
+    }
+
     /**
      * Returns the current active keypoint method, and its associating parameters.
      *
@@ -117,8 +212,8 @@ public:
     void SetCurrentKeypointMethod(keypoint_method _derivativeInterpolator);
 
     /**
-     * Worker function for computing dynamics derivatives in parallel. Uses a global variable of the keypoints
-     * to know which columns of the dynamics matrices need computing at which time indices.
+     * Worker function for computing dynamics derivatives in parallel. Pops finite-differencing tasks from its own
+     * queue (largest estimated cost first) and steals from the back of other threads queues when its own is empty.
      *
      * @param threadId - The thread id of the worker thread.
      *
@@ -143,6 +238,12 @@ public:
     void ComputeDynamicsDerivatives();
     void ComputeCostDerivatives();
 
+    /**
+     * Marks all cached dynamics and residual derivatives as invalid, so they are recomputed on the next call to
+     * GenerateDerivatives. Should be called whenever the state vector, controls, horizon or cost function changes.
+     */
+    void InvalidateDerivativeCache();
+
     /**
      * This function sets the current FIR filter coefficients.
      *
@@ -151,17 +252,19 @@ public:
     void setFIRFilter(std::vector<double> _FIRCoefficients);
 
     // List of differentiator function callbacks, for parallelisation.
-    std::vector<void (Differentiator::*)(MatrixXd &A, MatrixXd &B, const std::vector<int> &cols,
-                                        int dataIndex, int threadId,
-                                        bool central_diff, double eps)> tasks_dynamics_derivs;
-
-    std::vector<void (Differentiator::*)(vector<MatrixXd> &r_x, vector<MatrixXd> &r_u,
+    std::vector<void (Differentiator::*)(MatrixXd &r_x, MatrixXd &r_u,
                                             int dataIndex, int tid, bool central_diff, double eps)> tasks_residual_derivs;
 
-    // current_iteration used for parallelisation of dynamics derivatives
+    // current_iteration used for parallelisation of residual derivatives
     std::atomic<int> current_iteration;
     int num_threads_iterations;
-    std::vector<int> timeIndicesGlobal;
+
+    // Target number of finite-differencing tasks per worker thread, time indices with a large estimated cost
+    // are split into multiple column subsets until roughly this many tasks exist per thread.
+    int fd_tasks_per_thread = 4;
+
+    // Fraction of the wall time each worker thread spent computing derivatives during the last call
+    std::vector<double> fd_thread_utilisation;
 
     double initial_cost = 0.0;
     double cost_reduction = 0.0;
@@ -183,6 +286,11 @@ public:
     double avg_time_forwards_pass_ms = 0.0;
     std::vector<double> percentage_derivs_per_iteration;
     double avg_percent_derivs = 0.0;
+    // Percentage of keypoint columns (dynamics) and timesteps (residuals) reused from the derivative cache
+    double percentage_derivs_reused = 0.0;
+    double percentage_residual_derivs_reused = 0.0;
+    std::vector<double> percentage_derivs_reused_per_iteration;
+    double avg_percent_derivs_reused = 0.0;
     std::vector<int> num_dofs;
     double avg_dofs = 0.0;
     bool verbose_output = true;
@@ -201,8 +309,10 @@ public:
     vector<MatrixXd> l_uu;
 
     vector<MatrixXd> residuals;
-    vector<vector<MatrixXd>> r_x;
-    vector<vector<MatrixXd>> r_u;
+
+    // Stacked residual derivatives per timestep, (num_residuals x 2*dof) and (num_residuals x num_ctrl)
+    vector<MatrixXd> r_x;
+    vector<MatrixXd> r_u;
 
     // Saved states and controls
 //    vector<MatrixXd> U_new;
@@ -235,6 +345,21 @@ public:
     int num_ctrl = 0;
     int dof_used_last_optimisation = 0;
 
+    // Derivatives at a timestep are reused from the last computation if the nominal state and control at that
+    // timestep changed by less than this (max absolute change). A value <= 0 disables derivative reuse.
+    double derivative_reuse_threshold = 0.0;
+
+    // If true, l_xx is not materialised. The backwards pass applies it as the low-rank product r_x^T * l_xx_factor,
+    // where l_xx_factor = W * r_x holds the weighted residual Jacobian at each timestep. This saves storing a
+    // 2*dof x 2*dof matrix per timestep, not time: the update costs num_residuals * (2*dof)^2 flops per add
+    // against (2*dof)^2 for the dense add.
+    bool low_rank_cost_hessian = false;
+    vector<MatrixXd> l_xx_factor;
+
+    // If true, A[t] only holds the velocity rows (dof x 2*dof). The position rows of a semi-implicit Euler step are
+    // [I 0] + h * A_v and are reconstructed blockwise in the backwards pass (see DynamicsProducts).
+    bool compact_dynamics = false;
+
     // Lambda value which is added to the diagonal of the Q_uu matrix for regularisation purposes.
     double lambda = 0.1;
     double max_lambda = 10.0;
@@ -250,28 +375,143 @@ protected:
     std::shared_ptr<ModelTranslator> activeModelTranslator;
     std::shared_ptr<MuJoCoHelper> MuJoCo_helper;
 
-    std::vector<std::vector<int>> keypointsGlobal;
-
     std::shared_ptr<FileHandler> activeYamlReader;
     std::shared_ptr<Differentiator> activeDifferentiator;
 
     std::vector<std::vector<mujoco_data_min>> rollout_data;
     int num_parallel_rollouts = 6;
 
+    // Number of threads used for derivative computation and the cores they are pinned to (empty for no pinning)
+    int num_worker_threads = 1;
+    std::vector<int> worker_cores;
+
+    /**
+     * Pins the calling worker thread to its core from worker_cores, does nothing if no affinity is set.
+     *
+     * @param worker_index - Index of the worker thread.
+     */
+    void PinWorkerThread(int worker_index) const;
+
+    // Finite-differencing tasks and the per thread work-stealing queues (indices into fd_tasks)
+    std::vector<fd_task> fd_tasks;
+    std::vector<std::deque<int>> fd_task_queues;
+    std::vector<std::unique_ptr<std::mutex>> fd_task_queue_mutexes;
+    std::vector<double> fd_thread_busy_time_us;
+
+    // ------- Derivative reuse cache --------
+    // Nominal state and control that the cached derivatives at each timestep were computed about
+    std::vector<MatrixXd> X_cached;
+    std::vector<MatrixXd> U_cached;
+    // Whether the A / B columns for each dof hold finite-differenced values at each timestep
+    std::vector<std::vector<bool>> dynamics_cache_valid;
+    // Whether r_x / r_u hold valid values at each timestep
+    std::vector<bool> residual_cache_valid;
+    // Time indices whose residual derivatives need computing (used by WorkerComputeResidualDerivatives)
+    std::vector<int> residual_time_indices;
+
+    /**
+     * Trust test for the derivative cache. Compares the current nominal trajectory against the state and control
+     * the cache was computed about. Timesteps that moved more than derivative_reuse_threshold have their cache
+     * entries invalidated and their reference updated to the current nominal trajectory.
+     */
+    void UpdateDerivativeCacheTrust();
+
+    /**
+     * Removes the keypoint columns that can be reused from the derivative cache.
+     *
+     * @param keyPoints - The keypoints, one list of dofs per time index.
+     *
+     * @return std::vector<std::vector<int>> - The keypoints that need computing by finite-differencing.
+     */
+    std::vector<std::vector<int>> RemoveCachedKeypoints(const std::vector<std::vector<int>> &keyPoints);
+
+    /**
+     * Shifts a per-timestep vector forwards in time, element t becomes element t + shift. The freed entries at the
+     * end are filled with the last element of the overlapped region.
+     *
+     * @param vec - The vector to shift in place.
+     * @param shift - The number of timesteps to shift by, must be less than the size of the vector.
+     */
+    template<typename T>
+    static void ShiftTimeIndexedVector(std::vector<T> &vec, int shift){
+        if(shift <= 0 || shift >= static_cast<int>(vec.size())){
+            return;
+        }
+        std::rotate(vec.begin(), vec.begin() + shift, vec.end());
+        const T last_overlapped = vec[vec.size() - shift - 1];
+        std::fill(vec.end() - shift, vec.end(), last_overlapped);
+    }
+
+    // Running estimate of the time (us) of one simulator step when finite-differencing at each time index
+    std::vector<double> fd_step_time_estimate_us;
+    double fd_step_time_smoothing = 0.5;
+
     /**
      * Computes the dynamics derivatives at the specified indices. This function is used after computing a set of keypoints
-     * based on the previous trajectory.
+     * based on the previous trajectory. Work is split into cost-estimated tasks which are scheduled longest first
+     * over the worker threads with work stealing.
      *
-     * @param keyPoints - The keypoints to compute the derivatives at. A list of lists, where each sublist refers to a different
-     * degree of freedom. The elements in the list are the time indices to compute the derivatives at.
+     * @param keyPoints - The keypoints to compute the derivatives at. A list of lists, one per time index. The elements
+     * in each list are the degrees of freedom to compute derivatives for at that time index.
      */
-    void ComputeDynamicsDerivativesAtKeypoints(std::vector<std::vector<int>> keyPoints);
+    void ComputeDynamicsDerivativesAtKeypoints(const std::vector<std::vector<int>> &keyPoints);
+
+    /**
+     * Splits the keypoints into finite-differencing tasks, estimates their cost (number of simulator steps
+     * multiplied by the recent per-step time at that time index) and distributes them, largest first, to the
+     * queue with the least estimated work.
+     *
+     * @param keyPoints - The keypoints to compute the derivatives at, one list of dofs per time index.
+     * @param num_threads - Number of worker threads.
+     */
+    void ScheduleFiniteDifferencingTasks(const std::vector<std::vector<int>> &keyPoints, int num_threads);
+
+    /**
+     * Returns the next task for this thread. Takes from the front of its own queue first, then steals from
+     * the back of the other threads queues.
+     *
+     * @param thread_id - The thread id of the worker requesting work.
+     * @param task_index - Index into fd_tasks of the returned task.
+     *
+     * @return bool - false when no work remains.
+     */
+    bool PopFiniteDifferencingTask(int thread_id, int &task_index);
+
+    /**
+     * Number of simulator steps required to finite-difference the given dofs (central differences over
+     * positions, velocities and, where a control exists, controls). Excludes the nominal step.
+     */
+    int NumStepsForColumns(const std::vector<int> &cols) const;
 
     /**
      * Computes the residual derivatives over the entire trajectory.
      */
     void ComputeResidualDerivatives();
 
+    /**
+     * Adds the second order cost derivative with respect to the state at time t (l_xx[t]) to the given matrix,
+     * either from the dense l_xx or as the low-rank update r_x^T * l_xx_factor when low_rank_cost_hessian is set.
+     *
+     * @param t Time index of the cost derivative.
+     * @param Q_xx Matrix (2*dof x 2*dof) the cost hessian is added to.
+     */
+    void AddStateCostHessian(int t, MatrixXd &Q_xx) const;
+
+    /**
+     * Computes the products of the dynamics derivatives at time t needed by the backwards pass. Works on dense
+     * A (2*dof x 2*dof) as well as compact A (dof x 2*dof, velocity rows only), in which case the full A is never
+     * formed.
+     *
+     * @param t Time index of the dynamics derivatives.
+     * @param V_x Value function gradient (2*dof x 1).
+     * @param V_xx Value function hessian (2*dof x 2*dof), must be symmetric.
+     * @param A_T_V_x Output A^T * V_x.
+     * @param A_T_V_xx_A Output A^T * V_xx * A.
+     * @param B_T_V_xx_A Output B^T * V_xx * A.
+     */
+    void DynamicsProducts(int t, const MatrixXd &V_x, const MatrixXd &V_xx,
+                          MatrixXd &A_T_V_x, MatrixXd &A_T_V_xx_A, MatrixXd &B_T_V_xx_A) const;
+
     /**
      * Applies a filter to the internal dynamics derivatives.
      */
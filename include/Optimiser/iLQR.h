@@ -78,11 +78,22 @@ public:
     void PrintBanner(double time_rollout);
 
     void PrintBannerIteration(int iteration, double new_cost, double old_cost, double eps,
-                              double lambda, double percent_derivatives, double time_derivs, double time_bp,
+                              double lambda, double percent_derivatives, double percent_reused, double time_derivs, double time_bp,
                               double time_fp, double best_alpha);
 
     void Resize(int new_num_dofs, int new_num_ctrl, int new_horizon) override;
 
+    /**
+     * Shifts the derivatives, derivative cache and feedback gains K / k forwards in time between MPC replans.
+     *
+     * @param shift - The number of timesteps to shift by.
+     */
+    void ShiftHorizon(int shift) override;
+
+    std::vector<MatrixXd> ReturnFeedbackGains() override{
+        return K;
+    }
+
     std::string ReturnName() override{
         return "iLQR";
     }
@@ -33,7 +33,11 @@
 #include "Visualiser.h"
 #include "FileHandler.h"
 #include <algorithm>
+#include <numeric>
+#include <unordered_map>
 #include <future>
+#include <atomic>
+#include <thread>
 
 class iLQR_SVR: public Optimiser{
 public:
@@ -80,11 +84,22 @@ public:
     static void PrintBanner(double time_rollout);
 
     void PrintBannerIteration(int iteration, double _new_cost, double _old_cost, double eps,
-                              double _lambda, int num_dofs, double percent_derivatives, double time_derivs, double time_bp,
+                              double _lambda, int num_dofs, double percent_derivatives, double percent_reused, double time_derivs, double time_bp,
                               double time_fp, double best_alpha);
 
     void Resize(int new_num_dofs, int new_num_ctrl, int new_horizon) override;
 
+    /**
+     * Shifts the derivatives, derivative cache and feedback gains K / k forwards in time between MPC replans.
+     *
+     * @param shift - The number of timesteps to shift by.
+     */
+    void ShiftHorizon(int shift) override;
+
+    std::vector<MatrixXd> ReturnFeedbackGains() override{
+        return K;
+    }
+
     std::string ReturnName() override{
         return "iLQR_SVR";
     }
@@ -152,6 +167,36 @@ private:
 
     std::vector<std::string> LeastImportantDofs();
 
+    /**
+     * Importance of every dof from the dominant singular vectors of the feedback gains, K[t] = U S V^T, summed over
+     * timesteps sampled every sampling_k_interval. Sampled timesteps are processed in parallel.
+     *
+     * @return std::vector<double> - Sum over samples of |sigma_m * V(j, m)| + |sigma_m * V(j + dof, m)| for the first
+     * importance_rank singular values, per dof j.
+     */
+    std::vector<double> DofImportanceEigen();
+
+    /**
+     * Importance of every dof for a single feedback gain matrix. Uses an eigen-solve of the smaller Gram matrix
+     * (K K^T or K^T K), or a single subspace iteration from the previous iteration's subspace when that is accurate.
+     *
+     * @param K_t - Feedback gains at this timestep.
+     * @param rank - Number of singular vectors to use.
+     * @param subspace - Dominant eigenvectors of the Gram matrix from the previous iteration, updated in place.
+     *
+     * @return VectorXd - Importance per dof.
+     */
+    VectorXd DofImportanceAtTimestep(const MatrixXd &K_t, int rank, MatrixXd &subspace);
+
+    // Number of singular vectors of K used for dof importance
+    int importance_rank = 3;
+
+    // Relative residual below which the incrementally updated subspace is accepted
+    double importance_subspace_tolerance = 1e-6;
+
+    // Dominant Gram matrix eigenvectors per sampled timestep, reused between iterations
+    std::vector<MatrixXd> importance_subspace;
+
     /**
      * Perform a rollout with the previously computed k and K matrices but nullify feedback rows for the specified
      * dof indices. The cumulated cost is compared against the cost from the rollout using all the elements in the
@@ -174,6 +219,31 @@ private:
     void RemoveDofs();
     void AdjustCurrentStateVector();
 
+    /**
+     * Updates all dof dependant buffers after the current state vector has changed. Derivatives, feedback gains and
+     * the derivative cache are compacted (or expanded) in place by index permutation and X_old is gathered from the
+     * stored full state trajectory, rather than reallocating everything and querying MuJoCo for the whole horizon.
+     *
+     * @param old_state_vector - The state vector before it was changed.
+     */
+    void UpdateStateVectorBuffers(const struct stateVectorList &old_state_vector);
+
+    /**
+     * Gathers X_old for the current state vector from X_full_old, using active_state_indices.
+     */
+    void GatherNominalFromFullState();
+
+    /**
+     * Returns matrix(rows, cols), indices of -1 give a row / column of zeros.
+     */
+    static MatrixXd GatherMatrix(const MatrixXd &matrix, const std::vector<int> &rows, const std::vector<int> &cols);
+
+    // Nominal trajectory for the full state vector (quaternion representation)
+    vector<MatrixXd> X_full_old;
+
+    // Indices of the current state vector elements in the full state vector (quaternion representation)
+    std::vector<int> active_state_indices;
+
     // Visualiser object
     std::shared_ptr<Visualiser> active_visualiser;
 };
@@ -54,12 +54,24 @@ struct vertex{
     double linear_vel_change_threshold[3];
 };
 
+struct soft_body_cluster{
+    // Indices of the member vertices within the soft body
+    std::vector<int> vertices;
+    bool active_linear_dof[3];
+};
+
 struct soft_body{
     std::string name;
     int num_vertices;
 //    std::vector<bool> active_linear_dof;
     std::vector<vertex> vertices;
 
+    // Reduced order representation. 0 keeps one state per active vertex coordinate, otherwise the soft body is
+    // represented in the state vector by the centroids of (up to) num_clusters vertex clusters, computed from the
+    // rest configuration when the model is loaded (MuJoCoHelper::ClusterSoftBodyVertices).
+    int num_clusters = 0;
+    std::vector<soft_body_cluster> clusters;
+
     // Centroid of the soft body
     double start_linear_pos[3];
     double start_angular_pos[3];
@@ -85,6 +97,15 @@ struct residual{
     int resid_dimension;
     double weight;
     double weight_terminal;
+
+    // Optional typed residual description, compiled into a ResidualProgram at load time
+    std::string type;
+    std::string body;
+    std::string body_b;
+    std::vector<std::string> joints;
+    std::vector<std::string> actuators;
+    std::vector<int> axes;
+    bool analytic_jacobian = true;
 };
 
 struct task{
@@ -97,6 +118,11 @@ struct task{
     std::string modelName;
     std::string modelFilePath;
     std::string keypointMethod;
+    std::string interpolationMethod;
+    bool contactKeypoints;
+    bool errorEstimation;
+    double errorSamplePercentage;
+    double targetPercentageDerivs;
     bool auto_adjust;
     int minN;
     int maxN;
@@ -107,6 +133,43 @@ struct task{
     std::vector<residual> residuals;
 };
 
+// Typed handles to model objects. Names are resolved once (see MuJoCoHelper::BodyHandle etc.) and the
+// handle overloads of the accessors then only index the model and data arrays.
+struct body_handle{
+    int id = -1;
+    int qpos_adr = -1;      // qpos / dof address of the body's first joint, -1 if the body has no joints
+    int dof_adr = -1;
+};
+
+struct joint_handle{
+    int id = -1;
+    int qpos_adr = -1;
+    int dof_adr = -1;
+};
+
+struct actuator_handle{
+    int id = -1;
+};
+
+struct flex_handle{
+    int id = -1;
+    int vert_adr = 0;
+    int num_vertices = 0;
+};
+
+struct sensor_handle{
+    int id = -1;
+    int adr = -1;
+};
+
+struct robot_handle{
+    int index = -1;
+    std::vector<int> qpos_adr;
+    std::vector<int> dof_adr;
+    std::vector<int> actuator_ids;
+    int base_dof_adr = -1;
+};
+
 struct stateVectorList{
     int dof = 0;
     int dof_quat = 0;
@@ -116,6 +179,19 @@ struct stateVectorList{
     std::vector<rigid_body> rigid_bodies;
     std::vector<soft_body> soft_bodies;
 
+    // Model handles of the robots (and their root bodies), rigid bodies and soft bodies above, in the same order.
+    // Resolved once when the model is loaded (ModelTranslator::ResolveStateVectorHandles) and copied with the
+    // state vector, so reading and writing states does no name lookups.
+    std::vector<robot_handle> robot_handles;
+    std::vector<body_handle> robot_root_handles;
+    std::vector<body_handle> rigid_body_handles;
+    std::vector<flex_handle> soft_body_handles;
+
+    bool HandlesResolved() const{
+        return robot_handles.size() == robots.size() && rigid_body_handles.size() == rigid_bodies.size() &&
+               soft_body_handles.size() == soft_bodies.size();
+    }
+
     void Update(){
         dof = 0;
         dof_quat = 0;
@@ -175,6 +251,19 @@ struct stateVectorList{
         }
 
         for(auto & soft_body: soft_bodies){
+            if(soft_body.num_clusters > 0){
+                for(int i = 0; i < static_cast<int>(soft_body.clusters.size()); i++){
+                    for(int j = 0; j < 3; j++){
+                        if(soft_body.clusters[i].active_linear_dof[j]){
+                            dof++;
+                            dof_quat++;
+                            state_names.push_back(soft_body.name + "_C" + std::to_string(i) + lin_suffixes[j]);
+                        }
+                    }
+                }
+                continue;
+            }
+
             for(int i = 0; i < soft_body.num_vertices; i++){
                 for(int j = 0; j < 3; j++){
                     if(soft_body.vertices[i].active_linear_dof[j]){
@@ -236,7 +325,14 @@ struct stateVectorList{
         std::cout << "------ soft bodies -----\n";
         for(auto& soft_body: soft_bodies){
             std::cout << soft_body.name << ": ";
-            for(int i = 0; i < soft_body.num_vertices; i++){
+            for(int i = 0; i < static_cast<int>(soft_body.clusters.size()) && soft_body.num_clusters > 0; i++){
+                for(int j = 0; j < 3; j++){
+                    if(soft_body.clusters[i].active_linear_dof[j]){
+                        std::cout << "_C" + std::to_string(i) + lin_suffixes[j] << " ";
+                    }
+                }
+            }
+            for(int i = 0; i < soft_body.num_vertices && soft_body.num_clusters == 0; i++){
                 for(int j = 0; j < 3; j++){
                     if(soft_body.vertices[i].active_linear_dof[j]){
                         std::cout << "_V" + std::to_string(i) + lin_suffixes[j] << " ";
@@ -295,3 +391,28 @@ inline std::string GetCurrentTimestamp() {
 }
 
 bool endsWith(const std::string& mainString, const std::string& subString);
+
+/**
+ * Pins the calling thread to a single CPU core.
+ *
+ * @param core - Core index to pin to, a negative value leaves the thread unpinned.
+ *
+ * @return bool - true if the thread was pinned.
+ */
+bool PinCurrentThreadToCore(int core);
+
+/**
+ * Restricts the calling thread to a set of CPU cores. Threads it creates inherit the set.
+ *
+ * @param cores - Cores the thread may run on, empty leaves the current affinity untouched.
+ *
+ * @return bool - true if the affinity was set.
+ */
+bool PinCurrentThreadToCores(const std::vector<int> &cores);
+
+/**
+ * Cores the calling thread is currently allowed to run on, respects any mask inherited from taskset or cgroups.
+ *
+ * @return std::vector<int> - Allowed core indices in ascending order.
+ */
+std::vector<int> CurrentThreadCores();
@@ -3,6 +3,12 @@
 Differentiator::Differentiator(std::shared_ptr<ModelTranslator> model_translator, std::shared_ptr<MuJoCoHelper> MuJoCo_helper){
     this->model_translator = model_translator;
     this->MuJoCo_helper = MuJoCo_helper;
+
+    ResizeThreadBuffers(std::max(1, static_cast<int>(MuJoCo_helper->fd_data.size())));
+}
+
+void Differentiator::ResizeThreadBuffers(int num_threads){
+    jacobian_buffers.resize(num_threads);
 }
 
 void Differentiator::DynamicsDerivatives(MatrixXd &A, MatrixXd &B, const std::vector<int> &cols,
@@ -169,8 +175,7 @@ void Differentiator::DynamicsDerivatives(MatrixXd &A, MatrixXd &B, const std::ve
             // Compute one column of the A matrix
             mj_differentiatePos(MuJoCo_helper->model, vel_diff, (2 * eps), next_full_state_minus, next_full_state_pos);
             for(int j = 0; j < dim_state / 2; j++){
-                int q_index = model_translator->StateIndexToQposIndex(j, model_translator->current_state_vector);
-                dstatedctrl(j, i) = vel_diff[q_index];
+                dstatedctrl(j, i) = model_translator->ProjectDofVectorToState(j, vel_diff);
             }
 
             for(int j = dim_state / 2; j < dim_state; j++){
@@ -188,8 +193,7 @@ void Differentiator::DynamicsDerivatives(MatrixXd &A, MatrixXd &B, const std::ve
             // Compute one column of the A matrix
             mj_differentiatePos(MuJoCo_helper->model, vel_diff, (eps), next_full_state, next_full_state_pos);
             for(int j = 0; j < dim_state / 2; j++){
-                int q_index = model_translator->StateIndexToQposIndex(j, model_translator->current_state_vector);
-                dstatedctrl(j, i) = vel_diff[q_index];
+                dstatedctrl(j, i) = model_translator->ProjectDofVectorToState(j, vel_diff);
             }
 
             for(int j = dim_state / 2; j < dim_state; j++){
@@ -206,8 +210,7 @@ void Differentiator::DynamicsDerivatives(MatrixXd &A, MatrixXd &B, const std::ve
             // Compute one column of the A matrix
             mj_differentiatePos(MuJoCo_helper->model, vel_diff, (eps), next_full_state_minus, next_full_state);
             for(int j = 0; j < dim_state / 2; j++){
-                int q_index = model_translator->StateIndexToQposIndex(j, model_translator->current_state_vector);
-                dstatedctrl(j, i) = vel_diff[q_index];
+                dstatedctrl(j, i) = model_translator->ProjectDofVectorToState(j, vel_diff);
             }
 
             for(int j = dim_state / 2; j < dim_state; j++){
@@ -287,8 +290,7 @@ void Differentiator::DynamicsDerivatives(MatrixXd &A, MatrixXd &B, const std::ve
             // Compute one column of the A matrix
             mj_differentiatePos(MuJoCo_helper->model, vel_diff, (2 * eps), next_full_state_minus, next_full_state_pos);
             for(int j = 0; j < dim_state / 2; j++){
-                int q_index = model_translator->StateIndexToQposIndex(j, model_translator->current_state_vector);
-                dstatedqvel(j, i) = vel_diff[q_index];
+                dstatedqvel(j, i) = model_translator->ProjectDofVectorToState(j, vel_diff);
             }
 
             for(int j = dim_state / 2; j < dim_state; j++){
@@ -305,8 +307,7 @@ void Differentiator::DynamicsDerivatives(MatrixXd &A, MatrixXd &B, const std::ve
         else{
             mj_differentiatePos(MuJoCo_helper->model, vel_diff, eps, next_full_state, next_full_state_pos);
             for(int j = 0; j < dim_state / 2; j++){
-                int q_index = model_translator->StateIndexToQposIndex(j, model_translator->current_state_vector);
-                dstatedqvel(j, i) = vel_diff[q_index];
+                dstatedqvel(j, i) = model_translator->ProjectDofVectorToState(j, vel_diff);
             }
 
             for(int j = dim_state / 2; j < dim_state; j++){
@@ -338,14 +339,12 @@ void Differentiator::DynamicsDerivatives(MatrixXd &A, MatrixXd &B, const std::ve
             continue;
         }
 
-        // Compute the index of the position vector in MuJoCo that corresponds to the index of the state vector
-        int dpos_index = model_translator->StateIndexToQposIndex(i, model_translator->current_state_vector);
-
         count_integrations++;
 
-        // Perturb position vector positively
+        // Perturb position vector positively, along the dof direction of the state element (every vertex of the
+        // cluster for reduced order soft bodies)
         mju_zero(dpos, nv);
-        dpos[dpos_index] = 1;
+        model_translator->LiftStateToDofVector(i, dpos, 1.0);
         mj_integratePos(MuJoCo_helper->model, MuJoCo_helper->fd_data[tid]->qpos, dpos, eps);
 
 //        if(cost_derivs){
@@ -388,8 +387,7 @@ void Differentiator::DynamicsDerivatives(MatrixXd &A, MatrixXd &B, const std::ve
             mj_differentiatePos(MuJoCo_helper->model, vel_diff, (2 * eps), next_full_state_minus, next_full_state_pos);
 
             for(int j = 0; j < dim_state / 2; j++){
-                int q_index = model_translator->StateIndexToQposIndex(j, model_translator->current_state_vector);
-                dstatedqpos(j, i) = vel_diff[q_index];
+                dstatedqpos(j, i) = model_translator->ProjectDofVectorToState(j, vel_diff);
             }
 
             for(int j = dim_state / 2; j < dim_state; j++){
@@ -406,8 +404,7 @@ void Differentiator::DynamicsDerivatives(MatrixXd &A, MatrixXd &B, const std::ve
             mj_differentiatePos(MuJoCo_helper->model, vel_diff, eps, next_full_state, next_full_state_pos);
 
             for(int j = 0; j < dim_state / 2; j++){
-                int q_index = model_translator->StateIndexToQposIndex(j, model_translator->current_state_vector);
-                dstatedqpos(j, i) = vel_diff[q_index];
+                dstatedqpos(j, i) = model_translator->ProjectDofVectorToState(j, vel_diff);
             }
 
             for(int j = dim_state / 2; j < dim_state; j++){
@@ -438,12 +435,15 @@ void Differentiator::DynamicsDerivatives(MatrixXd &A, MatrixXd &B, const std::ve
     //
     // dqveldqpos       dqveldqvel
     // --------------------------------
+    // A with only dof rows is stored compactly (velocity rows only), see Optimiser::compact_dynamics
+    int A_rows = static_cast<int>(A.rows());
+    int row_offset = dim_state - A_rows;
     for(int col : cols){
-        A.block(0, col, dim_state, 1) =
-                dstatedqpos.block(0, col, dim_state, 1);
+        A.block(0, col, A_rows, 1) =
+                dstatedqpos.block(row_offset, col, A_rows, 1);
 
-        A.block(0, col + dof, dim_state, 1) =
-                dstatedqvel.block(0, col, dim_state, 1);
+        A.block(0, col + dof, A_rows, 1) =
+                dstatedqvel.block(row_offset, col, A_rows, 1);
     }
 
     // ------------- B -------------------
@@ -461,13 +461,20 @@ void Differentiator::DynamicsDerivatives(MatrixXd &A, MatrixXd &B, const std::ve
 //    std::cout << "diff time: "  << std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::high_resolution_clock::now() - diff_start).count() / 1000.0 << std::endl;
 }
 
-void Differentiator::ResidualDerivatives(vector<MatrixXd> &r_x, vector<MatrixXd> &r_u,
+void Differentiator::ResidualDerivatives(MatrixXd &r_x, MatrixXd &r_u,
                          int data_index, int tid, bool central_diff, double eps){
     // Aliases
     dof = model_translator->current_state_vector.dof;
     num_ctrl = model_translator->current_state_vector.num_ctrl;
     dim_state = 2 * dof;
 
+    // Every residual term supplies its own Jacobian, no finite-differencing required
+    const ResidualProgram &residual_program = model_translator->residual_program;
+    if(residual_program.AllAnalytic()){
+        AnalyticResidualDerivatives(r_x, r_u, data_index, tid);
+        return;
+    }
+
     // Aliases
     int nq = MuJoCo_helper->model->nq, nv = MuJoCo_helper->model->nv,
             na = MuJoCo_helper->model->na;
@@ -505,7 +512,7 @@ void Differentiator::ResidualDerivatives(vector<MatrixXd> &r_x, vector<MatrixXd>
     MuJoCo_helper->CopySystemState(MuJoCo_helper->fd_data[tid], MuJoCo_helper->saved_systems_state_list[data_index]);
 
     // Compute unperturbed residuals
-    model_translator->Residuals(MuJoCo_helper->fd_data[tid], residuals);
+    model_translator->ComputeResiduals(MuJoCo_helper->fd_data[tid], residuals);
 
     unperturbed_controls = model_translator->ReturnControlVector(MuJoCo_helper->fd_data[tid], model_translator->current_state_vector);
     unperturbed_velocities = model_translator->ReturnVelocityVector(MuJoCo_helper->fd_data[tid], model_translator->current_state_vector);
@@ -529,7 +536,7 @@ void Differentiator::ResidualDerivatives(vector<MatrixXd> &r_x, vector<MatrixXd>
             model_translator->SetControlVector(perturbed_controls, MuJoCo_helper->fd_data[tid], model_translator->current_state_vector);
 
             // Compute residuals
-            model_translator->Residuals(MuJoCo_helper->fd_data[tid], residuals_inc);
+            model_translator->ComputeResiduals(MuJoCo_helper->fd_data[tid], residuals_inc);
 
             // Undo the perturbation
             MuJoCo_helper->CopySystemState(MuJoCo_helper->fd_data[tid], MuJoCo_helper->saved_systems_state_list[data_index]);
@@ -556,7 +563,7 @@ void Differentiator::ResidualDerivatives(vector<MatrixXd> &r_x, vector<MatrixXd>
             model_translator->SetControlVector(perturbed_controls, MuJoCo_helper->fd_data[tid], model_translator->current_state_vector);
 
             // Compute residuals
-            model_translator->Residuals(MuJoCo_helper->fd_data[tid], residuals_dec);
+            model_translator->ComputeResiduals(MuJoCo_helper->fd_data[tid], residuals_dec);
 
             // Undo perturbation
             MuJoCo_helper->CopySystemState(MuJoCo_helper->fd_data[tid], MuJoCo_helper->saved_systems_state_list[data_index]);
@@ -565,18 +572,18 @@ void Differentiator::ResidualDerivatives(vector<MatrixXd> &r_x, vector<MatrixXd>
         // Compute finite differences, depending on what perturbations were made
         if(nudge_forward && nudge_back){
             for(int j = 0; j < model_translator->residual_list.size(); j++){
-                r_u[j](i, 0) = (residuals_inc(j) - residuals_dec(j)) / (2 * eps);
+                r_u(j, i) = (residuals_inc(j) - residuals_dec(j)) / (2 * eps);
             }
         }
         else if(nudge_forward){
             for(int j = 0; j < model_translator->residual_list.size(); j++){
-                r_u[j](i, 0) = (residuals_inc(j) - residuals(j)) / (eps);
+                r_u(j, i) = (residuals_inc(j) - residuals(j)) / (eps);
             }
 
         }
         else if(nudge_back){
             for(int j = 0; j < model_translator->residual_list.size(); j++) {
-                r_u[j](i, 0) = (residuals(j) - residuals_dec(j)) / (eps);
+                r_u(j, i) = (residuals(j) - residuals_dec(j)) / (eps);
             }
         }
     }
@@ -589,7 +596,7 @@ void Differentiator::ResidualDerivatives(vector<MatrixXd> &r_x, vector<MatrixXd>
         perturbed_velocities(i) += eps;
         model_translator->SetVelocityVector(perturbed_velocities, MuJoCo_helper->fd_data[tid], model_translator->current_state_vector);
 
-        model_translator->Residuals(MuJoCo_helper->fd_data[tid], residuals_inc);
+        model_translator->ComputeResiduals(MuJoCo_helper->fd_data[tid], residuals_inc);
 
         if(central_diff){
             // reset the data state back to initial data state
@@ -600,18 +607,18 @@ void Differentiator::ResidualDerivatives(vector<MatrixXd> &r_x, vector<MatrixXd>
             perturbed_velocities(i) -= eps;
             model_translator->SetVelocityVector(perturbed_velocities, MuJoCo_helper->fd_data[tid], model_translator->current_state_vector);
 
-            model_translator->Residuals(MuJoCo_helper->fd_data[tid], residuals_dec);
+            model_translator->ComputeResiduals(MuJoCo_helper->fd_data[tid], residuals_dec);
 
         }
 
         if(central_diff){
             for(int j = 0; j < model_translator->residual_list.size(); j++){
-                r_x[j](i + dof, 0) = (residuals_inc(j) - residuals_dec(j)) / (2 * eps);
+                r_x(j, i + dof) = (residuals_inc(j) - residuals_dec(j)) / (2 * eps);
             }
         }
         else{
             for(int j = 0; j < model_translator->residual_list.size(); j++){
-                r_x[j](i + dof, 0) = (residuals_inc(j) - residuals(j)) / (eps);
+                r_x(j, i + dof) = (residuals_inc(j) - residuals(j)) / (eps);
             }
         }
 
@@ -622,15 +629,13 @@ void Differentiator::ResidualDerivatives(vector<MatrixXd> &r_x, vector<MatrixXd>
     // ----------------------------------------------- FD for positions ---------------------------------------------
     for(int i = 0; i < dof; i++){
 
-        // Compute the index of the position vector in MuJoCo that corresponds to the index of the state vector
-        int dpos_index = model_translator->StateIndexToQposIndex(i, model_translator->current_state_vector);
-
-        // Perturb position vector positively
+        // Perturb position vector positively, along the dof direction of the state element (every vertex of the
+        // cluster for reduced order soft bodies)
         mju_zero(dpos, nv);
-        dpos[dpos_index] = 1;
+        model_translator->LiftStateToDofVector(i, dpos, 1.0);
         mj_integratePos(MuJoCo_helper->model, MuJoCo_helper->fd_data[tid]->qpos, dpos, eps);
 
-        model_translator->Residuals(MuJoCo_helper->fd_data[tid], residuals_inc);
+        model_translator->ComputeResiduals(MuJoCo_helper->fd_data[tid], residuals_inc);
 
         if(central_diff){
             // reset the data state back to initial data state dataIndex
@@ -639,17 +644,17 @@ void Differentiator::ResidualDerivatives(vector<MatrixXd> &r_x, vector<MatrixXd>
             // perturb position vector negatively
             mj_integratePos(MuJoCo_helper->model, MuJoCo_helper->fd_data[tid]->qpos, dpos, -eps);
 
-            model_translator->Residuals(MuJoCo_helper->fd_data[tid], residuals_dec);
+            model_translator->ComputeResiduals(MuJoCo_helper->fd_data[tid], residuals_dec);
         }
 
         if(central_diff){
             for(int j = 0; j < model_translator->residual_list.size(); j++){
-                r_x[j](i, 0) = (residuals_inc(j) - residuals_dec(j)) / (2 * eps);
+                r_x(j, i) = (residuals_inc(j) - residuals_dec(j)) / (2 * eps);
             }
         }
         else{
             for(int j = 0; j < model_translator->residual_list.size(); j++){
-                r_x[j](i, 0) = (residuals_inc(j) - residuals(j)) / (eps);
+                r_x(j, i) = (residuals_inc(j) - residuals(j)) / (eps);
             }
         }
 
@@ -660,5 +665,58 @@ void Differentiator::ResidualDerivatives(vector<MatrixXd> &r_x, vector<MatrixXd>
 
     // free the stack allocated variables
     mj_freeStack(MuJoCo_helper->fd_data[tid]);
+
+    // Overwrite the finite-differenced rows of terms that supply an analytic Jacobian
+    if(residual_program.AnyAnalytic()){
+        AnalyticResidualDerivatives(r_x, r_u, data_index, tid);
+    }
+}
+
+void Differentiator::AnalyticResidualDerivatives(MatrixXd &r_x, MatrixXd &r_u,
+                                                 int data_index, int tid){
+    const ResidualProgram &residual_program = model_translator->residual_program;
+    const stateVectorList &state_vector = model_translator->current_state_vector;
+    mjData *d = MuJoCo_helper->fd_data[tid];
+
+    dof = state_vector.dof;
+    num_ctrl = state_vector.num_ctrl;
+
+    if(tid >= static_cast<int>(jacobian_buffers.size())){
+        std::cerr << "No residual Jacobian buffers for thread " << tid << ", exiting \n";
+        exit(1);
+    }
+
+    // Controls map to the actuator ids resolved when the program was compiled
+    const std::vector<int> &actuator_ids = residual_program.control_actuator_ids;
+    if(static_cast<int>(actuator_ids.size()) != num_ctrl){
+        std::cerr << "Residual program has " << actuator_ids.size() << " control actuators, state vector has "
+                  << num_ctrl << " controls, exiting \n";
+        exit(1);
+    }
+
+    MuJoCo_helper->CopySystemState(d, MuJoCo_helper->saved_systems_state_list[data_index]);
+
+    residual_jacobian_buffers &buffers = jacobian_buffers[tid];
+    residual_program.Jacobians(MuJoCo_helper->model, d, model_translator->residual_list,
+                               buffers.J_pos, buffers.J_vel, buffers.J_ctrl);
+
+    // State elements are mapped through their dof directions
+    for(const auto & op : residual_program.ops){
+        if(!op.analytic){
+            continue;
+        }
+
+        const int j = op.row;
+        buffers.J_pos_row = buffers.J_pos.row(j).transpose();
+        buffers.J_vel_row = buffers.J_vel.row(j).transpose();
+        for(int i = 0; i < dof; i++){
+            r_x(j, i) = model_translator->StateDirectionDot(i, buffers.J_pos_row.data());
+            r_x(j, i + dof) = model_translator->StateDirectionDot(i, buffers.J_vel_row.data());
+        }
+
+        for(int i = 0; i < num_ctrl; i++){
+            r_u(j, i) = buffers.J_ctrl(j, actuator_ids[i]);
+        }
+    }
 }
 
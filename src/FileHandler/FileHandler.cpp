@@ -1,4 +1,5 @@
 #include "FileHandler.h"
+#include <algorithm>
 
 FileHandler::FileHandler(){
     // Init Controls
@@ -50,6 +51,44 @@ void FileHandler::ReadModelConfigFile(const std::string& yamlFilePath, task &_ta
     }
 
     _taskConfig.keypointMethod = node["keypointMethod"].as<std::string>();
+
+    // Interpolation between keypoints - linear, cubic_hermite or natural_spline
+    if(node["interpolationMethod"]){
+        _taskConfig.interpolationMethod = node["interpolationMethod"].as<std::string>();
+    }
+    else{
+        _taskConfig.interpolationMethod = "linear";
+    }
+
+    // Force keypoints at contact make / break events, combined with the keypoint method above
+    if(node["contactKeypoints"]){
+        _taskConfig.contactKeypoints = node["contactKeypoints"].as<bool>();
+    }
+    else{
+        _taskConfig.contactKeypoints = false;
+    }
+
+    // Online interpolation error estimation, sets per dof min_N / max_N from sampled interpolation errors
+    if(node["errorEstimation"]){
+        _taskConfig.errorEstimation = node["errorEstimation"].as<bool>();
+    }
+    else{
+        _taskConfig.errorEstimation = false;
+    }
+
+    if(node["errorSamplePercentage"]){
+        _taskConfig.errorSamplePercentage = node["errorSamplePercentage"].as<double>();
+    }
+    else{
+        _taskConfig.errorSamplePercentage = 2.0;
+    }
+
+    if(node["targetPercentageDerivs"]){
+        _taskConfig.targetPercentageDerivs = node["targetPercentageDerivs"].as<double>();
+    }
+    else{
+        _taskConfig.targetPercentageDerivs = 25.0;
+    }
     if(node["auto_adjust"]){
         _taskConfig.auto_adjust = node["auto_adjust"].as<bool>();
     }
@@ -250,6 +289,15 @@ void FileHandler::ReadModelConfigFile(const std::string& yamlFilePath, task &_ta
         _soft_body.name = bodyName;
         _soft_body.num_vertices = num_vertices;
 
+        // Optional reduced order state, vertices are grouped into clusters once the model is loaded
+        if(body_it->second["num_clusters"]){
+            _soft_body.num_clusters = body_it->second["num_clusters"].as<int>();
+            if(_soft_body.num_clusters < 0){
+                std::cerr << "num_clusters for soft body " << bodyName << " must be 0 (per vertex state) or positive, exiting \n";
+                exit(1);
+            }
+        }
+
         // Soft body vertices
         for(int i = 0; i < num_vertices; i++){
             _soft_body.vertices.push_back(vertices[i]);
@@ -282,6 +330,41 @@ void FileHandler::ReadModelConfigFile(const std::string& yamlFilePath, task &_ta
         _residual.weight = residual_it->second["weight"].as<double>();
         _residual.weight_terminal = residual_it->second["weight_terminal"].as<double>();
 
+        // Optional typed residual keys
+        if(residual_it->second["type"]){
+            _residual.type = residual_it->second["type"].as<string>();
+        }
+
+        if(residual_it->second["body"]){
+            _residual.body = residual_it->second["body"].as<string>();
+        }
+
+        if(residual_it->second["body_b"]){
+            _residual.body_b = residual_it->second["body_b"].as<string>();
+        }
+
+        if(residual_it->second["joints"]){
+            for(int i = 0; i < residual_it->second["joints"].size(); i++){
+                _residual.joints.push_back(residual_it->second["joints"][i].as<string>());
+            }
+        }
+
+        if(residual_it->second["actuators"]){
+            for(int i = 0; i < residual_it->second["actuators"].size(); i++){
+                _residual.actuators.push_back(residual_it->second["actuators"][i].as<string>());
+            }
+        }
+
+        if(residual_it->second["analytic_jacobian"]){
+            _residual.analytic_jacobian = residual_it->second["analytic_jacobian"].as<bool>();
+        }
+
+        if(residual_it->second["axes"]){
+            for(int i = 0; i < residual_it->second["axes"].size(); i++){
+                _residual.axes.push_back(residual_it->second["axes"][i].as<int>());
+            }
+        }
+
         for(int i = 0; i < _residual.resid_dimension; i++){
             _taskConfig.residuals.push_back(_residual);
         }
@@ -307,6 +390,80 @@ void FileHandler::ReadSettingsFile(const std::string& settingsFilePath){
 
     async_mpc = node["async_mpc"].as<bool>();
     record_trajectory = node["record"].as<bool>();
+
+    // Parallelism settings
+    if(node["num_worker_threads"]){
+        num_worker_threads = node["num_worker_threads"].as<int>();
+    }
+
+    if(node["num_parallel_rollouts"]){
+        num_parallel_rollouts = node["num_parallel_rollouts"].as<int>();
+    }
+
+    if(node["sim_thread_core"]){
+        sim_thread_core = node["sim_thread_core"].as<int>();
+    }
+
+    if(node["cpu_affinity"]){
+        cpu_affinity = node["cpu_affinity"].as<std::vector<int>>();
+    }
+
+    // Derivative reuse between iterations
+    if(node["derivative_reuse_threshold"]){
+        derivative_reuse_threshold = node["derivative_reuse_threshold"].as<double>();
+    }
+
+    if(node["low_rank_cost_hessian"]){
+        low_rank_cost_hessian = node["low_rank_cost_hessian"].as<bool>();
+    }
+
+    if(node["compact_dynamics"]){
+        compact_dynamics = node["compact_dynamics"].as<bool>();
+    }
+
+    // Binary model cache
+    if(node["model_cache"]){
+        model_cache = node["model_cache"].as<bool>();
+    }
+
+    model_cache_directory = projectParentPath + "/modelCache";
+    if(node["model_cache_directory"]){
+        model_cache_directory = projectParentPath + node["model_cache_directory"].as<std::string>();
+    }
+
+    if(node["prewarm_model_cache"]){
+        prewarm_model_cache = node["prewarm_model_cache"].as<bool>();
+    }
+
+    if(node["data_pool_capacity"]){
+        data_pool_capacity = node["data_pool_capacity"].as<int>();
+    }
+
+    // MPC settings
+    if(node["mpc_replan_interval"]){
+        mpc_replan_interval = node["mpc_replan_interval"].as<int>();
+        if(mpc_replan_interval < 1){
+            std::cerr << "mpc_replan_interval must be at least 1 \n";
+            exit(1);
+        }
+    }
+
+    if(node["mpc_feedback_policy"]){
+        mpc_feedback_policy = node["mpc_feedback_policy"].as<bool>();
+    }
+}
+
+std::vector<std::string> FileHandler::TaskConfigFiles() const{
+    std::vector<std::string> task_configs;
+
+    for(const auto &entry : std::filesystem::recursive_directory_iterator(projectParentPath + "/TaskConfigs")){
+        if(entry.is_regular_file() && entry.path().extension() == ".yaml"){
+            task_configs.push_back(entry.path().string().substr(projectParentPath.size()));
+        }
+    }
+    std::sort(task_configs.begin(), task_configs.end());
+
+    return task_configs;
 }
 
 void FileHandler::SaveTrajecInformation(std::vector<MatrixXd> A_matrices, std::vector<MatrixXd> B_matrices,
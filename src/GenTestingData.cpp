@@ -12,6 +12,9 @@ GenTestingData::GenTestingData(std::shared_ptr<Optimiser> optimiser_,
     activeVisualiser = activeVisualiser_;
     yamlReader = yamlReader_;
 
+    num_steps_replan = yamlReader->mpc_replan_interval;
+    use_feedback_policy = yamlReader->mpc_feedback_policy;
+
     activeDifferentiator = activeDifferentiator_;
 }
 
@@ -164,61 +167,7 @@ int GenTestingData::GenDataOpenloopOptimisation(int task_horizon){
     for (int i = 0; i < 100; i++) {
         std::cout << "trial: " << i << "\n";
 
-        // Reset internal optimisation data and clear key-points cache
-        optimiser->Reset();
-        optimiser->keypoint_generator->ResetCache();
-        // Load start and desired state from csv file
-
-        // Load the task from CSV file
-        yamlReader->LoadTaskFromFile(activeModelTranslator->model_name, i, activeModelTranslator->full_state_vector, activeModelTranslator->residual_list);
-
-        // Reset state vector (only really applicable for iLQR_SVR method)
-        activeModelTranslator->ResetSVR();
-        activeModelTranslator->InitialiseSystemToStartState(activeModelTranslator->MuJoCo_helper->master_reset_data);
-
-        // Setup mj data objects
-        activeModelTranslator->MuJoCo_helper->CopySystemState(activeModelTranslator->MuJoCo_helper->main_data,
-                                                              activeModelTranslator->MuJoCo_helper->master_reset_data);
-        activeModelTranslator->MuJoCo_helper->CopySystemState(activeModelTranslator->MuJoCo_helper->vis_data,
-                                                              activeModelTranslator->MuJoCo_helper->master_reset_data);
-
-//        MatrixXd test_state_start = activeModelTranslator->ReturnStateVector(activeModelTranslator->MuJoCo_helper->master_reset_data,
-//                                                                             activeModelTranslator->full_state_vector);
-//        std::cout << "state vector after initialised: " << test_state_start.transpose() << "\n";
-
-        mj_step(activeModelTranslator->MuJoCo_helper->model, activeModelTranslator->MuJoCo_helper->master_reset_data);
-//        test_state_start = activeModelTranslator->ReturnStateVector(activeModelTranslator->MuJoCo_helper->master_reset_data,
-//                                                                    activeModelTranslator->full_state_vector);
-//        std::cout << "state vector after step: " << test_state_start.transpose() << "\n";
-
-        if (!activeModelTranslator->MuJoCo_helper->CheckIfDataIndexExists(0)) {
-            activeModelTranslator->MuJoCo_helper->AppendSystemStateToEnd(
-                    activeModelTranslator->MuJoCo_helper->master_reset_data);
-        }
-
-        // Perform any setup controls for this task
-        std::vector<MatrixXd> initSetupControls = activeModelTranslator->CreateInitSetupControls(1000);
-        activeModelTranslator->MuJoCo_helper->CopySystemState(activeModelTranslator->MuJoCo_helper->master_reset_data,
-                                                              activeModelTranslator->MuJoCo_helper->main_data);
-        activeModelTranslator->MuJoCo_helper->CopySystemState(activeModelTranslator->MuJoCo_helper->main_data,
-                                                              activeModelTranslator->MuJoCo_helper->master_reset_data);
-        activeModelTranslator->MuJoCo_helper->CopySystemState(activeModelTranslator->MuJoCo_helper->vis_data,
-                                                              activeModelTranslator->MuJoCo_helper->master_reset_data);
-
-        // Create init optimisation controls
-        std::vector<MatrixXd> init_opt_controls = activeModelTranslator->CreateInitOptimisationControls(task_horizon);
-        activeModelTranslator->MuJoCo_helper->CopySystemState(activeModelTranslator->MuJoCo_helper->main_data,
-                                                              activeModelTranslator->MuJoCo_helper->master_reset_data);
-        activeModelTranslator->MuJoCo_helper->CopySystemState(
-                activeModelTranslator->MuJoCo_helper->saved_systems_state_list[0],
-                activeModelTranslator->MuJoCo_helper->master_reset_data);
-
-        // Do the optimisation!
-        optimiser->lambda = 0.01;
-        std::vector<MatrixXd> optimised_controls = optimiser->Optimise(
-                activeModelTranslator->MuJoCo_helper->saved_systems_state_list[0], init_opt_controls, 10, 3,
-                task_horizon);
-
+        OpenloopTrial(i, task_horizon);
 
         // ------------------------- Update the data storages -------------------------------------
         cost_reductions.push_back(optimiser->cost_reduction);
@@ -258,6 +207,327 @@ int GenTestingData::GenDataOpenloopOptimisation(int task_horizon){
     return EXIT_SUCCESS;
 }
 
+int GenTestingData::TuneKeypointParameters(int task_horizon, int num_configs, int max_tasks){
+    std::cout << "begining keypoint parameter tuning for " << activeModelTranslator->model_name << std::endl;
+    std::cout << "optimisation horizon is: " << task_horizon << ", configurations: " << num_configs
+              << ", test scenes: " << max_tasks << std::endl;
+
+    if(num_configs < 1 || max_tasks < 1){
+        std::cerr << "keypoint tuner needs at least one configuration and one test scene \n";
+        exit(1);
+    }
+
+    std::string method_directory = CreateTestName("keypoint_tuner");
+
+    // ------------------------- Sample keypoint configurations -------------------------
+    // Thresholds are per dof and task specific, so the tuner samples a scale applied to the
+    // thresholds from the task config rather than absolute values.
+    keypoint_method base_method = optimiser->ReturnCurrentKeypointMethod();
+    std::vector<std::string> method_names = {"set_interval", "adaptive_jerk", "velocity_change", "iterative_error"};
+    std::vector<std::string> interpolation_methods = {"linear", "cubic_hermite", "natural_spline"};
+    std::vector<int> min_Ns = {1, 2, 5, 10};
+    std::vector<int> max_Ns = {10, 20, 50, 100};
+
+    std::mt19937 generator(0);
+    std::uniform_real_distribution<double> log_scale(std::log(0.1), std::log(10.0));
+
+    std::vector<tuner_config> configs(num_configs);
+    for(int i = 0; i < num_configs; i++){
+        tuner_config &config = configs[i];
+        config.method = base_method;
+        config.method.auto_adjust = false;
+        config.method.name = method_names[i % method_names.size()];
+        config.method.interpolation = interpolation_methods[generator() % interpolation_methods.size()];
+        config.method.min_N = min_Ns[generator() % min_Ns.size()];
+        config.method.max_N = std::max(config.method.min_N, max_Ns[generator() % max_Ns.size()]);
+        config.threshold_scale = std::exp(log_scale(generator));
+
+        // Set interval ignores the thresholds, leave them as they are so they are not reported as tuned
+        if(config.method.name == "set_interval"){
+            config.threshold_scale = 1.0;
+            continue;
+        }
+
+        for(double &threshold : config.method.jerk_thresholds){
+            threshold *= config.threshold_scale;
+        }
+        for(double &threshold : config.method.velocity_change_thresholds){
+            threshold *= config.threshold_scale;
+        }
+        config.method.iterative_error_threshold *= config.threshold_scale;
+    }
+
+    // ------------------------- Successive halving -------------------------------------
+    // Halve the configurations each rung until roughly 4 remain, the number of test scenes
+    // doubles each rung so the final rung is evaluated on max_tasks scenes.
+    int num_rungs = 1;
+    while((num_configs >> num_rungs) >= 4){
+        num_rungs++;
+    }
+
+    bool verbose_output = optimiser->verbose_output;
+    optimiser->verbose_output = false;
+
+    std::vector<int> survivors(num_configs);
+    std::iota(survivors.begin(), survivors.end(), 0);
+
+    for(int rung = 0; rung < num_rungs; rung++){
+        int num_tasks = std::max(1, max_tasks >> (num_rungs - 1 - rung));
+        std::cout << "rung " << rung << ": " << survivors.size() << " configurations on " << num_tasks << " test scenes \n";
+
+        for(int config_index : survivors){
+            tuner_config &config = configs[config_index];
+            optimiser->SetCurrentKeypointMethod(config.method);
+
+            // Test scenes evaluated in previous rungs are reused
+            for(int task = config.opt_times_ms.size(); task < num_tasks; task++){
+                OpenloopTrial(task, task_horizon);
+
+                config.opt_times_ms.push_back(optimiser->opt_time_ms);
+                config.final_costs.push_back(optimiser->initial_cost * (1.0 - optimiser->cost_reduction));
+            }
+
+            config.mean_opt_time_ms = std::accumulate(config.opt_times_ms.begin(), config.opt_times_ms.end(), 0.0) / num_tasks;
+            config.mean_final_cost = std::accumulate(config.final_costs.begin(), config.final_costs.end(), 0.0) / num_tasks;
+            config.rung = rung;
+
+            std::cout << "config " << config_index << " " << KeypointMethodName(config.method) << " "
+                      << config.method.interpolation << " - time (ms): " << config.mean_opt_time_ms
+                      << ", final cost: " << config.mean_final_cost << "\n";
+        }
+
+        if(rung == num_rungs - 1){
+            break;
+        }
+
+        // Rank by Pareto front, then by normalised time + cost within a front
+        double min_time = configs[survivors[0]].mean_opt_time_ms;
+        double max_time = min_time;
+        double min_cost = configs[survivors[0]].mean_final_cost;
+        double max_cost = min_cost;
+        for(int config_index : survivors){
+            min_time = std::min(min_time, configs[config_index].mean_opt_time_ms);
+            max_time = std::max(max_time, configs[config_index].mean_opt_time_ms);
+            min_cost = std::min(min_cost, configs[config_index].mean_final_cost);
+            max_cost = std::max(max_cost, configs[config_index].mean_final_cost);
+        }
+        double time_range = std::max(max_time - min_time, 1e-12);
+        double cost_range = std::max(max_cost - min_cost, 1e-12);
+
+        std::vector<int> ranked;
+        std::vector<int> remaining = survivors;
+        while(!remaining.empty()){
+            std::vector<int> front = ParetoFrontier(configs, remaining);
+            std::sort(front.begin(), front.end(), [&](int a, int b){
+                double score_a = (configs[a].mean_opt_time_ms - min_time) / time_range + (configs[a].mean_final_cost - min_cost) / cost_range;
+                double score_b = (configs[b].mean_opt_time_ms - min_time) / time_range + (configs[b].mean_final_cost - min_cost) / cost_range;
+                return score_a < score_b;
+            });
+            ranked.insert(ranked.end(), front.begin(), front.end());
+
+            std::vector<int> next_remaining;
+            for(int config_index : remaining){
+                if(std::find(front.begin(), front.end(), config_index) == front.end()){
+                    next_remaining.push_back(config_index);
+                }
+            }
+            remaining = next_remaining;
+        }
+
+        ranked.resize((ranked.size() + 1) / 2);
+        survivors = ranked;
+    }
+
+    std::vector<int> frontier = ParetoFrontier(configs, survivors);
+    std::sort(frontier.begin(), frontier.end(), [&](int a, int b){
+        return configs[a].mean_opt_time_ms < configs[b].mean_opt_time_ms;
+    });
+
+    // ----------------------- Save data to file -------------------------------------
+    auto save_configs = [&](const std::string& filename, const std::vector<int>& config_indices){
+        ofstream file_output;
+        file_output.open(filename);
+
+        file_output << "Config" << "," << "Keypoint method" << "," << "Interpolation" << "," << "Min N" << ",";
+        file_output << "Max N" << "," << "Threshold scale" << "," << "Rung" << "," << "Num test scenes" << ",";
+        file_output << "Mean optimisation time (ms)" << "," << "Mean final cost" << std::endl;
+
+        for(int config_index : config_indices){
+            const tuner_config &config = configs[config_index];
+            file_output << config_index << "," << KeypointMethodName(config.method) << "," << config.method.interpolation << ",";
+            file_output << config.method.min_N << "," << config.method.max_N << "," << config.threshold_scale << ",";
+            file_output << config.rung << "," << config.opt_times_ms.size() << ",";
+            file_output << config.mean_opt_time_ms << "," << config.mean_final_cost << std::endl;
+        }
+
+        file_output.close();
+    };
+
+    std::vector<int> all_configs(num_configs);
+    std::iota(all_configs.begin(), all_configs.end(), 0);
+    save_configs(method_directory + "/tuner_results.csv", all_configs);
+    save_configs(method_directory + "/pareto_frontier.csv", frontier);
+
+    // Recommended parameters, one YAML document per frontier configuration in task config format
+    YAML::Emitter out;
+    for(int config_index : frontier){
+        const tuner_config &config = configs[config_index];
+
+        out << YAML::BeginDoc;
+        out << YAML::Comment("mean optimisation time (ms): " + std::to_string(config.mean_opt_time_ms) +
+                             ", mean final cost: " + std::to_string(config.mean_final_cost));
+        out << YAML::BeginMap;
+        out << YAML::Key << "keypointMethod" << YAML::Value << config.method.name;
+        out << YAML::Key << "auto_adjust" << YAML::Value << false;
+        out << YAML::Key << "minN" << YAML::Value << config.method.min_N;
+        out << YAML::Key << "maxN" << YAML::Value << config.method.max_N;
+        out << YAML::Key << "interpolationMethod" << YAML::Value << config.method.interpolation;
+        if(config.method.name == "iterative_error"){
+            out << YAML::Key << "iterativeErrorThreshold" << YAML::Value << config.method.iterative_error_threshold;
+        }
+        else if(config.method.name == "adaptive_jerk" || config.method.name == "velocity_change"){
+            EmitScaledThresholds(out, config.method.name, config.threshold_scale);
+        }
+        out << YAML::EndMap;
+    }
+
+    std::ofstream fout(method_directory + "/recommended_keypoints.yaml");
+    fout << out.c_str();
+    fout.close();
+
+    // Leave the optimiser with the original keypoint method and output settings
+    optimiser->SetCurrentKeypointMethod(base_method);
+    optimiser->verbose_output = verbose_output;
+
+    std::cout << "keypoint tuning finished, " << frontier.size() << " configurations on the Pareto frontier, results saved to "
+              << method_directory << std::endl;
+
+    return EXIT_SUCCESS;
+}
+
+void GenTestingData::EmitScaledThresholds(YAML::Emitter &out, const std::string &method_name, double threshold_scale){
+    const bool jerk = method_name == "adaptive_jerk";
+
+    auto scaled = [threshold_scale](const double *thresholds, int size){
+        std::vector<double> values(thresholds, thresholds + size);
+        for(double &value : values){
+            value *= threshold_scale;
+        }
+        return values;
+    };
+
+    // Same keys as the task config, so the entries can replace the matching ones there
+    out << YAML::Key << "robots" << YAML::Value << YAML::BeginMap;
+    for(const auto &robot : activeModelTranslator->full_state_vector.robots){
+        const std::vector<double> &thresholds = jerk ? robot.jerk_thresholds : robot.vel_change_thresholds;
+        out << YAML::Key << robot.name << YAML::Value << YAML::BeginMap;
+        out << YAML::Key << (jerk ? "jointJerkThresholds" : "magVelThresholds") << YAML::Value << YAML::Flow
+            << scaled(thresholds.data(), static_cast<int>(thresholds.size()));
+        out << YAML::EndMap;
+    }
+    out << YAML::EndMap;
+
+    out << YAML::Key << "bodies" << YAML::Value << YAML::BeginMap;
+    for(const auto &body : activeModelTranslator->full_state_vector.rigid_bodies){
+        out << YAML::Key << body.name << YAML::Value << YAML::BeginMap;
+        if(jerk){
+            out << YAML::Key << "linearJerkThreshold" << YAML::Value << YAML::Flow << scaled(body.linear_jerk_threshold, 3);
+            out << YAML::Key << "angularJerkThreshold" << YAML::Value << YAML::Flow << scaled(body.angular_jerk_threshold, 3);
+        }
+        else{
+            out << YAML::Key << "linearMagVelThreshold" << YAML::Value << YAML::Flow << scaled(body.linear_vel_change_threshold, 3);
+            out << YAML::Key << "angularMagVelThreshold" << YAML::Value << YAML::Flow << scaled(body.angular_vel_change_threshold, 3);
+        }
+        out << YAML::EndMap;
+    }
+    out << YAML::EndMap;
+}
+
+std::vector<int> GenTestingData::ParetoFrontier(const std::vector<tuner_config>& configs,
+                                                const std::vector<int>& candidates){
+    std::vector<int> frontier;
+    for(int i : candidates){
+        bool dominated = false;
+        for(int j : candidates){
+            if(i == j){
+                continue;
+            }
+
+            bool no_worse = configs[j].mean_opt_time_ms <= configs[i].mean_opt_time_ms &&
+                            configs[j].mean_final_cost <= configs[i].mean_final_cost;
+            bool better = configs[j].mean_opt_time_ms < configs[i].mean_opt_time_ms ||
+                          configs[j].mean_final_cost < configs[i].mean_final_cost;
+            if(no_worse && better){
+                dominated = true;
+                break;
+            }
+        }
+
+        if(!dominated){
+            frontier.push_back(i);
+        }
+    }
+
+    return frontier;
+}
+
+void GenTestingData::OpenloopTrial(int task_number, int task_horizon){
+    // Reset internal optimisation data and clear key-points cache
+    optimiser->Reset();
+    optimiser->keypoint_generator->ResetCache();
+    // Load start and desired state from csv file
+
+    // Load the task from CSV file
+    yamlReader->LoadTaskFromFile(activeModelTranslator->model_name, task_number, activeModelTranslator->full_state_vector, activeModelTranslator->residual_list);
+
+    // Reset state vector (only really applicable for iLQR_SVR method)
+    activeModelTranslator->ResetSVR();
+    activeModelTranslator->InitialiseSystemToStartState(activeModelTranslator->MuJoCo_helper->master_reset_data);
+
+    // Setup mj data objects
+    activeModelTranslator->MuJoCo_helper->CopySystemState(activeModelTranslator->MuJoCo_helper->main_data,
+                                                          activeModelTranslator->MuJoCo_helper->master_reset_data);
+    activeModelTranslator->MuJoCo_helper->CopySystemState(activeModelTranslator->MuJoCo_helper->vis_data,
+                                                          activeModelTranslator->MuJoCo_helper->master_reset_data);
+
+//    MatrixXd test_state_start = activeModelTranslator->ReturnStateVector(activeModelTranslator->MuJoCo_helper->master_reset_data,
+//                                                                         activeModelTranslator->full_state_vector);
+//    std::cout << "state vector after initialised: " << test_state_start.transpose() << "\n";
+
+    mj_step(activeModelTranslator->MuJoCo_helper->model, activeModelTranslator->MuJoCo_helper->master_reset_data);
+//    test_state_start = activeModelTranslator->ReturnStateVector(activeModelTranslator->MuJoCo_helper->master_reset_data,
+//                                                                activeModelTranslator->full_state_vector);
+//    std::cout << "state vector after step: " << test_state_start.transpose() << "\n";
+
+    if (!activeModelTranslator->MuJoCo_helper->CheckIfDataIndexExists(0)) {
+        activeModelTranslator->MuJoCo_helper->AppendSystemStateToEnd(
+                activeModelTranslator->MuJoCo_helper->master_reset_data);
+    }
+
+    // Perform any setup controls for this task
+    std::vector<MatrixXd> initSetupControls = activeModelTranslator->CreateInitSetupControls(1000);
+    activeModelTranslator->MuJoCo_helper->CopySystemState(activeModelTranslator->MuJoCo_helper->master_reset_data,
+                                                          activeModelTranslator->MuJoCo_helper->main_data);
+    activeModelTranslator->MuJoCo_helper->CopySystemState(activeModelTranslator->MuJoCo_helper->main_data,
+                                                          activeModelTranslator->MuJoCo_helper->master_reset_data);
+    activeModelTranslator->MuJoCo_helper->CopySystemState(activeModelTranslator->MuJoCo_helper->vis_data,
+                                                          activeModelTranslator->MuJoCo_helper->master_reset_data);
+
+    // Create init optimisation controls
+    std::vector<MatrixXd> init_opt_controls = activeModelTranslator->CreateInitOptimisationControls(task_horizon);
+    activeModelTranslator->MuJoCo_helper->CopySystemState(activeModelTranslator->MuJoCo_helper->main_data,
+                                                          activeModelTranslator->MuJoCo_helper->master_reset_data);
+    activeModelTranslator->MuJoCo_helper->CopySystemState(
+            activeModelTranslator->MuJoCo_helper->saved_systems_state_list[0],
+            activeModelTranslator->MuJoCo_helper->master_reset_data);
+
+    // Do the optimisation!
+    optimiser->lambda = 0.01;
+    std::vector<MatrixXd> optimised_controls = optimiser->Optimise(
+            activeModelTranslator->MuJoCo_helper->saved_systems_state_list[0], init_opt_controls, 10, 3,
+            task_horizon);
+}
+
 int GenTestingData::GenDataAsyncMPC(int task_horizon, int task_timeout){
 
     std::cout << "beginning testing asynchronus MPC for " << activeModelTranslator->model_name << std::endl;
@@ -428,6 +698,7 @@ int GenTestingData::SingleMPCRun(bool visualise, bool asynchronus,
     activeVisualiser->trajectory_controls.clear();
     activeVisualiser->trajectory_states.clear();
     activeVisualiser->controlBuffer.clear();
+    mpc_policy = feedback_policy();
     activeVisualiser->current_control_index = 0;
     stop_opt_thread = false;
     apply_next_control = false;
@@ -437,6 +708,10 @@ int GenTestingData::SingleMPCRun(bool visualise, bool asynchronus,
     // Start the thread running
     MPC_controls_thread = std::thread(&GenTestingData::AsyncronusMPCWorker, this, method_directory, task_number, task_horizon);
 
+    // Reserve a core for the simulation thread, after creating the optimiser thread so it does not inherit it
+    std::vector<int> inherited_cores = CurrentThreadCores();
+    PinCurrentThreadToCore(yamlReader->sim_thread_core);
+
     int vis_counter = 0;
     MatrixXd next_control;
 
@@ -453,7 +728,14 @@ int GenTestingData::SingleMPCRun(bool visualise, bool asynchronus,
 
             if(activeVisualiser->current_control_index < num_controls_apply && activeVisualiser->current_control_index < activeVisualiser->controlBuffer.size()){
 
-                next_control = activeVisualiser->controlBuffer[activeVisualiser->current_control_index];
+                if(use_feedback_policy){
+                    std::unique_lock<std::mutex> lock(mtx);
+                    next_control = optimiser->FeedbackPolicyControl(mpc_policy, activeVisualiser->current_control_index,
+                                                                    activeModelTranslator->MuJoCo_helper->vis_data);
+                }
+                else{
+                    next_control = activeVisualiser->controlBuffer[activeVisualiser->current_control_index];
+                }
                 // Increment the current control index
                 activeVisualiser->current_control_index++;
 
@@ -545,6 +827,11 @@ int GenTestingData::SingleMPCRun(bool visualise, bool asynchronus,
 
     MPC_controls_thread.join();
 
+    // Runs continue on this thread (open loop optimisation, the next MPC run), release the reserved core
+    if(yamlReader->sim_thread_core >= 0){
+        PinCurrentThreadToCores(inherited_cores);
+    }
+
     // NOTE - we change cost function of push soft to track how well we managed to push the soft body.
     // These cost function elements dont work in normal traj opt for some reason, so we counte this
     // by using a terminal position cost, however this then isnt trakced by our evaluation
@@ -577,7 +864,7 @@ int GenTestingData::SingleMPCRun(bool visualise, bool asynchronus,
         }
 
         MatrixXd residuals(activeModelTranslator->residual_list.size(), 1);
-        activeModelTranslator->Residuals(activeModelTranslator->MuJoCo_helper->vis_data, residuals);
+        activeModelTranslator->ComputeResiduals(activeModelTranslator->MuJoCo_helper->vis_data, residuals);
         final_cost += activeModelTranslator->CostFunction(residuals,
                                           activeModelTranslator->full_state_vector, terminal);
     }
@@ -601,6 +888,9 @@ int GenTestingData::SingleMPCRun(bool visualise, bool asynchronus,
 }
 
 void GenTestingData::AsyncronusMPCWorker(const std::string& method_directory, int task_number, int task_horizon){
+    // Keep the optimiser, and every pool it spawns, off the core reserved for the simulation thread
+    optimiser->PinOptimiserThread();
+
     std::vector<double> time_iteration;
     std::vector<int> num_dofs;
     std::vector<double> time_get_derivs;
@@ -644,6 +934,9 @@ void GenTestingData::AsyncronusMPCWorker(const std::string& method_directory, in
                 optimised_controls.push_back(last_control);
             }
 
+            // Shift derivatives and feedback gains so the overlapping part of the horizon is warm started
+            optimiser->ShiftHorizon(bestMatchingStateIndex);
+
             optimised_controls = optimiser->Optimise(activeModelTranslator->MuJoCo_helper->saved_systems_state_list[0],
                                                      optimised_controls, 1, 1, task_horizon);
 
@@ -687,11 +980,17 @@ void GenTestingData::AsyncronusMPCWorker(const std::string& method_directory, in
             }
 //            bestMatchingStateIndex = 1;
 
+            feedback_policy new_policy;
+            if(use_feedback_policy){
+                new_policy = optimiser->ReturnFeedbackPolicy();
+            }
+
             // Mutex lock
             {
                 std::unique_lock<std::mutex> lock(mtx);
 
                 activeVisualiser->controlBuffer = optimised_controls;
+                mpc_policy = std::move(new_policy);
 
                 // Set the current control index to the best matching state index
                 activeVisualiser->current_control_index = bestMatchingStateIndex;
@@ -859,13 +1158,7 @@ std::string GenTestingData::CreateTestName(const std::string& testing_method) {
     return method_directory;
 }
 
-void GenTestingData::SaveTestSummaryData(keypoint_method keypoint_method,
-                                         int opt_horizon,
-                                         double control_noise,
-                                         const std::string& optimiser_name,
-                                         const std::string& testing_directory){
-
-//  ------------------ make method name ------------------
+std::string GenTestingData::KeypointMethodName(const keypoint_method& keypoint_method){
     std::string keypoint_method_name;
     if(keypoint_method.auto_adjust){
         keypoint_method_name = "AA_" + std::to_string(keypoint_method.min_N) + "_" + std::to_string(keypoint_method.max_N);
@@ -891,6 +1184,17 @@ void GenTestingData::SaveTestSummaryData(keypoint_method keypoint_method,
         }
     }
 
+    return keypoint_method_name;
+}
+
+void GenTestingData::SaveTestSummaryData(keypoint_method keypoint_method,
+                                         int opt_horizon,
+                                         double control_noise,
+                                         const std::string& optimiser_name,
+                                         const std::string& testing_directory){
+
+    std::string keypoint_method_name = KeypointMethodName(keypoint_method);
+
     YAML::Emitter out;
 
     out << YAML::BeginMap;
@@ -1043,12 +1347,9 @@ int GenTestingData::AnalyseToyContact(int horizon){
                                                        true, init_opt_controls);
 
         // Get the contact change list
-        contact.clear();
-        for(int t = 0; t < horizon; t++){
-            bool contact_found = activeModelTranslator->MuJoCo_helper->CheckPairForCollisions("goal", "piston_rod",
-                                                                                              activeModelTranslator->MuJoCo_helper->saved_systems_state_list[t]);
-            contact.push_back(contact_found);
-        }
+        std::vector<bool> contact_mask = activeModelTranslator->MuJoCo_helper->TrajectoryPairContacts(
+                activeModelTranslator->MuJoCo_helper->BodyHandle("goal"), activeModelTranslator->MuJoCo_helper->BodyHandle("piston_rod"), horizon);
+        contact.assign(contact_mask.begin(), contact_mask.end());
 
         // Set the optimiser to smooth contact
         optimiser->smoothing_contact = true;
@@ -1325,4 +1626,104 @@ int GenTestingData::AnalyseToyContactKeypoints(int horizon){
 //    fout.close();
 
     return EXIT_SUCCESS;
-}
\ No newline at end of file
+}
+
+int GenTestingData::BenchmarkStateVector(int num_repeats){
+    std::shared_ptr<MuJoCoHelper> MuJoCo_helper = activeModelTranslator->MuJoCo_helper;
+    mjData *d = MuJoCo_helper->main_data;
+    const stateVectorList &state_vector = activeModelTranslator->current_state_vector;
+
+    activeModelTranslator->InitialiseSystemToStartState(MuJoCo_helper->master_reset_data);
+    MuJoCo_helper->CopySystemState(d, MuJoCo_helper->master_reset_data);
+
+    // Move the system away from its start state so the benchmark reads non trivial values
+    for(int i = 0; i < 10; i++){
+        mj_step(MuJoCo_helper->model, d);
+    }
+
+    auto time_per_call_us = [num_repeats](const std::function<void()> &call){
+        call();
+        auto start = std::chrono::high_resolution_clock::now();
+        for(int i = 0; i < num_repeats; i++){
+            call();
+        }
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::high_resolution_clock::now() - start).count()
+               / (1000.0 * num_repeats);
+    };
+
+    MatrixXd state;
+    double return_time = time_per_call_us([&](){ state = activeModelTranslator->ReturnStateVector(d, state_vector); });
+    double set_time = time_per_call_us([&](){ activeModelTranslator->SetStateVector(state, d, state_vector); });
+
+    std::cout << "task: " << activeModelTranslator->model_name << ", dof: " << state_vector.dof << "\n";
+    std::cout << "ReturnStateVector: " << return_time << " us \n";
+    std::cout << "SetStateVector: " << set_time << " us \n";
+
+    for(const auto &soft_body : state_vector.soft_bodies){
+        flex_handle flex = MuJoCo_helper->FlexHandle(soft_body.name);
+
+        int num_active = 0;
+        for(int i = 0; i < soft_body.num_vertices; i++){
+            for(int j = 0; j < 3; j++){
+                num_active += soft_body.vertices[i].active_linear_dof[j];
+            }
+        }
+
+        if(num_active == 0){
+            std::cout << "soft body " << soft_body.name << " has no active coordinates, skipped \n";
+            continue;
+        }
+
+        VectorXd name_lookup(num_active);
+        VectorXd per_vertex(num_active);
+        VectorXd bulk(num_active);
+
+        // Per vertex access with an mj_name2id lookup for every vertex (how the translator read soft bodies before)
+        const mjModel *m = MuJoCo_helper->model;
+        double name_lookup_time = time_per_call_us([&](){
+            int index = 0;
+            for(int i = 0; i < soft_body.num_vertices; i++){
+                int flex_id = mj_name2id(m, mjOBJ_FLEX, soft_body.name.c_str());
+                int body_id = m->flex_vertbodyid[m->flex_vertadr[flex_id] + i];
+                int qpos_index = m->jnt_qposadr[m->body_jntadr[body_id]];
+                for(int j = 0; j < 3; j++){
+                    if(soft_body.vertices[i].active_linear_dof[j]){
+                        name_lookup(index++) = d->qpos[qpos_index + j];
+                    }
+                }
+            }
+        });
+
+        // Per vertex access through the string accessor, which now resolves the flex through its cached handle
+        double per_vertex_time = time_per_call_us([&](){
+            pose_6 vertex_pose;
+            int index = 0;
+            for(int i = 0; i < soft_body.num_vertices; i++){
+                MuJoCo_helper->GetSoftBodyVertexPos(soft_body.name, i, vertex_pose, d);
+                for(int j = 0; j < 3; j++){
+                    if(soft_body.vertices[i].active_linear_dof[j]){
+                        per_vertex(index++) = vertex_pose.position[j];
+                    }
+                }
+            }
+        });
+
+        // Compare vertex by vertex, also for soft bodies the optimiser sees in reduced order
+        auto vertex_body = soft_body;
+        vertex_body.num_clusters = 0;
+        double bulk_time = time_per_call_us([&](){ MuJoCo_helper->GetSoftBodyPositions(flex, vertex_body, bulk, d); });
+
+        std::cout << "soft body " << soft_body.name << " (" << soft_body.num_vertices << " vertices, "
+                  << num_active << " active coordinates) \n";
+        std::cout << "    per vertex positions (mj_name2id): " << name_lookup_time << " us \n";
+        std::cout << "    per vertex positions (flex handle): " << per_vertex_time << " us \n";
+        std::cout << "    bulk positions: " << bulk_time << " us \n";
+
+        if((name_lookup - bulk).cwiseAbs().maxCoeff() > 0.0 || (per_vertex - bulk).cwiseAbs().maxCoeff() > 0.0){
+            std::cerr << "bulk soft body positions do not match per vertex positions \n";
+            return EXIT_FAILURE;
+        }
+    }
+
+    return EXIT_SUCCESS;
+}
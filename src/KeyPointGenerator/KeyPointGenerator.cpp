@@ -19,13 +19,19 @@ KeypointGenerator::KeypointGenerator(std::shared_ptr<Differentiator> _differenti
     max_last_velocity.resize(dof);
     min_last_velocity.resize(dof);
 
-    for(int t = 0; t < horizon; t++){
-        jerk_profile.push_back(MatrixXd(dof, 1));
-        velocity_profile.push_back(MatrixXd(dof, 1));
-    }
+    jerk_profile = MatrixXd::Zero(dof, horizon);
+    acceleration_profile = MatrixXd::Zero(dof, horizon);
+    velocity_profile = MatrixXd::Zero(dof, horizon);
 }
 
 void KeypointGenerator::Resize(int new_num_dofs, int new_num_ctrl, int new_horizon){
+    // Interpolation error model is per dof, start again if the dofs change
+    if(new_num_dofs != dof){
+        interpolation_error_coefficients.clear();
+        dof_min_N.clear();
+        dof_max_N.clear();
+    }
+
     horizon = new_horizon;
     dof = new_num_dofs;
 
@@ -38,14 +44,10 @@ void KeypointGenerator::Resize(int new_num_dofs, int new_num_ctrl, int new_horiz
     max_last_velocity.resize(dof);
     min_last_velocity.resize(dof);
 
-    // Setup the size of the jerk and velocity profiles
-    jerk_profile.clear();
-    velocity_profile.clear();
-
-    for(int t = 0; t < horizon; t++){
-        jerk_profile.push_back(MatrixXd(dof, 1));
-        velocity_profile.push_back(MatrixXd(dof, 1));
-    }
+    // Setup the size of the jerk, acceleration and velocity profiles
+    jerk_profile = MatrixXd::Zero(dof, horizon);
+    acceleration_profile = MatrixXd::Zero(dof, horizon);
+    velocity_profile = MatrixXd::Zero(dof, horizon);
 }
 
 keypoint_method KeypointGenerator::ReturnCurrentKeypointMethod() {
@@ -53,6 +55,10 @@ keypoint_method KeypointGenerator::ReturnCurrentKeypointMethod() {
 }
 
 void KeypointGenerator::SetKeypointMethod(keypoint_method method){
+    // The interpolation error model depends on the error order of the interpolation method
+    if(method.interpolation != current_keypoint_method.interpolation){
+        interpolation_error_coefficients.clear();
+    }
     current_keypoint_method = method;
 }
 
@@ -91,23 +97,31 @@ void KeypointGenerator::GenerateKeyPoints(const std::vector<MatrixXd> &trajector
     }
     else if(current_keypoint_method.name == "adaptive_jerk"){
         auto start_jerk = std::chrono::high_resolution_clock::now();
-        GenerateJerkProfile(trajectory_states);
+        StackTrajectory(trajectory_states);
+        GenerateJerkProfile();
 //        std::cout << "Jerk profile generation time: " << std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::high_resolution_clock::now() - start_jerk).count() / 1000.0f << "ms\n";
         GenerateKeyPointsAdaptive(jerk_profile);
     }
     else if(current_keypoint_method.name == "adaptive_accel"){
-        std::vector<MatrixXd> acceleration_profile = GenerateAccellerationProfile(horizon, trajectory_states);
+        StackTrajectory(trajectory_states);
+        GenerateAccellerationProfile();
         GenerateKeyPointsAdaptive(acceleration_profile);
     }
     else if(current_keypoint_method.name == "iterative_error"){
         computed_keypoints.clear();
         physics_simulator->InitModelForFiniteDifferencing();
         keypoints = GenerateKeyPointsIteratively(horizon, trajectory_states, A, B);
+
+        // The optimiser skips finite-differencing for this method, so compute any contact keypoints here
+        if(current_keypoint_method.contact_keypoints){
+            ComputeColumnsInParallel(AddContactKeypoints(), A, B);
+        }
         physics_simulator->ResetModelAfterFiniteDifferencing();
 
     }
     else if(current_keypoint_method.name == "velocity_change"){
-        GenerateVelocityProfile(trajectory_states);
+        StackTrajectory(trajectory_states);
+        GenerateVelocityProfile();
         GenerateKeyPointsVelocityChange(velocity_profile);
     }
     else{
@@ -115,6 +129,10 @@ void KeypointGenerator::GenerateKeyPoints(const std::vector<MatrixXd> &trajector
         exit(1);
     }
 
+    if(current_keypoint_method.contact_keypoints && current_keypoint_method.name != "iterative_error"){
+        AddContactKeypoints();
+    }
+
     //Print out the key points
 //    for(int t = 0; t < horizon; t++){
 //        std::cout << "time " << t << " :";
@@ -338,60 +356,66 @@ void KeypointGenerator::GenerateKeyPointsSetInterval(){
     keypoints.push_back(full_row);
 }
 
-void KeypointGenerator::GenerateKeyPointsAdaptive(const std::vector<MatrixXd> &trajec_profile) {
+void KeypointGenerator::GenerateKeyPointsAdaptive(const MatrixXd &trajec_profile) {
     std::vector<int> full_row(dof, 0);
 
     for(int i = 0; i < dof; i++){
         full_row[i] = i;
     }
-    keypoints.push_back(full_row);
 
-    int last_indices[dof];
-    for(int i = 0; i < dof; i++){
-        last_indices[i] = 0;
-        max_last_jerk[i] = trajec_profile[0](i, 0);
-        min_last_jerk[i] = trajec_profile[0](i, 0);
-    }
-
-    for(int t = 1; t < horizon - 1; t++){
-        std::vector<int> row;
-        for(int j = 0; j < dof; j++){
-            if((t - last_indices[j]) >= current_keypoint_method.min_N){
-                if(trajec_profile[t](j, 0) > current_keypoint_method.jerk_thresholds[j]){
-                    row.push_back(j);
-                    last_indices[j] = t;
+    keypoints.assign(horizon, std::vector<int>());
+    keypoints[0] = full_row;
+
+    // Threshold crossings over the whole profile in one pass, then per dof the next keypoint is the first
+    // crossing at least min_N after the last keypoint, or max_N after it if there is no crossing before that.
+    int last_index = std::max(horizon - 1, 1);
+    Map<const VectorXd> thresholds(current_keypoint_method.jerk_thresholds.data(), dof);
+    Eigen::Array<bool, Eigen::Dynamic, Eigen::Dynamic, Eigen::RowMajor> crossings =
+            trajec_profile.leftCols(last_index).array() > thresholds.replicate(1, last_index).array();
+
+    for(int j = 0; j < dof; j++){
+        const bool *row_crossings = crossings.row(j).data();
+        int last_keypoint = 0;
+        while(true){
+            int max_interval_index = last_keypoint + std::max(MaxN(j), 1);
+            int search_end = std::min(max_interval_index, last_index);
+            int search_start = std::min(last_keypoint + std::max(MinN(j), 1), search_end);
+
+            const bool *first_crossing = std::find(row_crossings + search_start, row_crossings + search_end, true);
+            int next_keypoint = first_crossing - row_crossings;
+            if(next_keypoint == search_end){
+                if(max_interval_index >= last_index){
+                    break;
                 }
-            }
-            if((t - last_indices[j]) >= current_keypoint_method.max_N){
-                row.push_back(j);
-                last_indices[j] = t;
-            }
-
-            // Update min and max values
-            if(trajec_profile[t](j, 0) > max_last_jerk[j]){
-                max_last_jerk[j] = trajec_profile[t](j, 0);
+                next_keypoint = max_interval_index;
             }
 
-            if(trajec_profile[t](j, 0) < min_last_jerk[j]){
-                min_last_jerk[j] = trajec_profile[t](j, 0);
-            }
+            keypoints[next_keypoint].push_back(j);
+            last_keypoint = next_keypoint;
         }
-        keypoints.push_back(row);
     }
-    keypoints.push_back(full_row);
+
+    // Range of the profile, over the time indices keypoints are assigned
+    for(int j = 0; j < dof; j++){
+        max_last_jerk[j] = trajec_profile.row(j).head(last_index).maxCoeff();
+        min_last_jerk[j] = trajec_profile.row(j).head(last_index).minCoeff();
+    }
+
+    keypoints[horizon - 1] = full_row;
 }
 
 void KeypointGenerator::GenerateKeypointsOrderOfImportance(const std::vector<MatrixXd> &trajectory_states,
                                                            const std::vector<int> &num_keypoints){
     // Generate jerk profile.
-    GenerateJerkProfile(trajectory_states);
+    StackTrajectory(trajectory_states);
+    GenerateJerkProfile();
 
     std::vector<std::vector<int>> keypoints_per_dof(dof);
 
     for(int i = 0; i < dof; i++){
         std::vector<double> jerk_vals;
         for(int t = 1; t < horizon - 2; t++) {
-            jerk_vals.push_back(jerk_profile[t](i, 0));
+            jerk_vals.push_back(jerk_profile(i, t));
         }
 
         // Sort jerks in order of magnitude
@@ -450,83 +474,65 @@ std::vector<std::vector<int>> KeypointGenerator::GenerateKeyPointsIteratively(in
                                                                               std::vector<MatrixXd> &A, std::vector<MatrixXd> &B) {
     int dof = trajectory_states[0].rows() / 2;
 
-    std::vector<std::vector<int>> keypoints;
-    bool bins_complete[dof];
-    std::vector<index_tuple> index_tuples;
-    int start_index = 0;
-    int end_index = horizon - 1;
+    std::vector<std::vector<int>> keypoints(horizon);
 
-    // Initialise variables
-    for(int i = 0; i < dof; i++){
-        bins_complete[i] = false;
-//        computed_keypoints.push_back(std::vector<int>());
-    }
+    // Resize the outer vector to 'dof' and each inner vector to 'T', initialised with 'false'
+    computed_keypoints.assign(dof, std::vector<bool>(horizon, false));
 
-    // Resize the outer vector to 'dof'
-    computed_keypoints.resize(dof);
-
-    // Resize each inner vector to 'T' and initialize with 'false'
-    for (auto& innerVec : computed_keypoints) {
-        innerVec.resize(horizon, false);
+    // Breadth first worklist of (dof, segment) checks, all dofs start with a segment over the whole trajectory
+    std::vector<std::pair<int, index_tuple>> worklist;
+    for(int i = 0; i < dof; i++){
+        index_tuple initial_tuple;
+        initial_tuple.start_index = 0;
+        initial_tuple.end_index = horizon - 1;
+        worklist.emplace_back(i, initial_tuple);
     }
 
-    for(int i = 0; i < horizon; i++){
-        keypoints.push_back(std::vector<int>());
-    }
+    while(!worklist.empty()){
+        // Gather the columns needed to check every segment at this level. Columns for different dofs at the same
+        // time index are merged so they share a single finite-differencing call.
+        std::vector<std::vector<int>> cols_to_compute(horizon);
+        for(const auto &check : worklist){
+            const index_tuple &indices = check.second;
+            if((indices.end_index - indices.start_index) <= current_keypoint_method.min_N){
+                continue;
+            }
 
-    // Loop through all dofs in the system
-//    #pragma omp parallel for
-    for(int i = 0; i < dof; i++){
-//        std::cout << "---------------------  Generating key points for dof --------------------------------- " << i << std::endl;
-        std::vector<index_tuple> list_of_indices_check;
-        index_tuple initial_tuple;
-        initial_tuple.start_index = start_index;
-        initial_tuple.end_index = end_index;
-        list_of_indices_check.push_back(initial_tuple);
-
-        std::vector<index_tuple> sub_list_indices;
-        std::vector<int> sub_list_with_midpoints;
-
-        while(!bins_complete[i]){
-            bool allChecksComplete = true;
-
-            for(int j = 0; j < list_of_indices_check.size(); j++) {
-
-                int midIndex = (list_of_indices_check[j].start_index + list_of_indices_check[j].end_index) / 2;
-//                cout <<"dof: " << i <<  ": index tuple: " << list_of_indices_check[j].start_index << " " << list_of_indices_check[j].end_index << endl;
-                bool approximationGood = CheckDOFColumnError(list_of_indices_check[j], i, dof, A, B);
-
-                if (!approximationGood) {
-                    allChecksComplete = false;
-                    index_tuple tuple1;
-                    tuple1.start_index = list_of_indices_check[j].start_index;
-                    tuple1.end_index = midIndex;
-                    index_tuple tuple2;
-                    tuple2.start_index = midIndex;
-                    tuple2.end_index = list_of_indices_check[j].end_index;
-                    sub_list_indices.push_back(tuple1);
-                    sub_list_indices.push_back(tuple2);
-                }
-                else{
-                    sub_list_with_midpoints.push_back(list_of_indices_check[j].start_index);
-                    sub_list_with_midpoints.push_back(midIndex);
-                    sub_list_with_midpoints.push_back(list_of_indices_check[j].end_index);
+            int mid_index = (indices.start_index + indices.end_index) / 2;
+            for(int t : {indices.start_index, mid_index, indices.end_index}){
+                if(!computed_keypoints[check.first][t]){
+                    computed_keypoints[check.first][t] = true;
+                    cols_to_compute[t].push_back(check.first);
                 }
             }
+        }
 
-            if(allChecksComplete){
-                bins_complete[i] = true;
-                sub_list_with_midpoints.clear();
+        ComputeColumnsInParallel(cols_to_compute, A, B);
+
+        // Subdivide segments whose approximation is not good enough
+        std::vector<std::pair<int, index_tuple>> next_worklist;
+        for(const auto &check : worklist){
+            const index_tuple &indices = check.second;
+            if(CheckDOFColumnError(indices, check.first, dof, A, B)){
+                continue;
             }
 
-            list_of_indices_check = sub_list_indices;
-            sub_list_indices.clear();
+            int mid_index = (indices.start_index + indices.end_index) / 2;
+            index_tuple tuple1;
+            tuple1.start_index = indices.start_index;
+            tuple1.end_index = mid_index;
+            index_tuple tuple2;
+            tuple2.start_index = mid_index;
+            tuple2.end_index = indices.end_index;
+            next_worklist.emplace_back(check.first, tuple1);
+            next_worklist.emplace_back(check.first, tuple2);
         }
+
+        worklist = std::move(next_worklist);
     }
 
-    // Loop over the horizon
+    // Loop over the horizon, dofs are visited in order so each list is sorted and unique
     for(int i = 0; i < horizon; i++){
-        // Loop over the dofs
         for(int j = 0; j < dof; j++){
             if(computed_keypoints[j][i]){
                 keypoints[i].push_back(j);
@@ -534,86 +540,74 @@ std::vector<std::vector<int>> KeypointGenerator::GenerateKeyPointsIteratively(in
         }
     }
 
-    // Sort list into order
-    for(int i = 0; i < horizon; i++){
-        std::sort(keypoints[i].begin(), keypoints[i].end());
-    }
-
-    // Remove duplicates
-    for(int i = 0; i < horizon; i++){
-        keypoints[i].erase(std::unique(keypoints[i].begin(), keypoints[i].end()), keypoints[i].end());
-    }
-
     return keypoints;
 }
 
-bool KeypointGenerator::CheckDOFColumnError(index_tuple indices, int dof_index, int num_dofs,
-                                            std::vector<MatrixXd> &A, std::vector<MatrixXd> &B) {
-    int state_vector_size = num_dofs * 2;
-
-    // The two columns of the "A" matrix we will compare (position, velocity) for that dof to evaluate our approximation
-    MatrixXd mid_columns_approximated[2];
-    for(int i = 0; i < 2; i++){
-        mid_columns_approximated[i] = MatrixXd::Zero(state_vector_size, 1);
+void KeypointGenerator::ComputeColumnsInParallel(const std::vector<std::vector<int>> &cols_to_compute,
+                                                 std::vector<MatrixXd> &A, std::vector<MatrixXd> &B){
+    std::vector<int> time_indices;
+    for(int t = 0; t < cols_to_compute.size(); t++){
+        if(!cols_to_compute[t].empty()){
+            time_indices.push_back(t);
+        }
     }
 
-    // Middle index in trajectory between start and end index passed from "indices" struct
-    int mid_index = (indices.start_index + indices.end_index) / 2;
-    if((indices.end_index - indices.start_index) <= current_keypoint_method.min_N){
-        return true;
+    if(time_indices.empty()){
+        return;
     }
 
-    MatrixXd blank1, blank2, blank3, blank4;
-
-    bool start_index_computed = false;
-    bool mid_index_computed = false;
-    bool end_index_computed = false;
+    // Each task writes only to A[t] and B[t] of its own time index, so tasks can run concurrently
+    std::atomic<int> next_task(0);
+    auto worker = [&](int tid){
+        if(!worker_cores.empty()){
+            PinCurrentThreadToCore(worker_cores[tid % worker_cores.size()]);
+        }
 
-    if(computed_keypoints[dof_index][indices.start_index]){
-        start_index_computed = true;
-    }
+        while(true){
+            int task = next_task.fetch_add(1);
+            if(task >= time_indices.size()){
+                break;
+            }
 
-    if(computed_keypoints[dof_index][mid_index]){
-        mid_index_computed = true;
-    }
+            int t = time_indices[task];
+            differentiator->DynamicsDerivatives(A[t], B[t], cols_to_compute[t], t, tid, true, 1e-6);
+        }
+    };
 
-    if(computed_keypoints[dof_index][indices.end_index]){
-        end_index_computed = true;
+    // The calling thread only waits, so pinning a worker never narrows the optimiser thread's affinity
+    int threads = std::max(1, std::min(num_threads, static_cast<int>(time_indices.size())));
+    std::vector<std::thread> thread_pool;
+    for(int i = 0; i < threads; i++){
+        thread_pool.emplace_back(worker, i);
     }
 
-    std::vector<int> cols;
-    cols.push_back(dof_index);
-
-    // Gets thread id so we can make sure we use different data structure for F.D computations
-    int tid = omp_get_thread_num();
-
-    if(!start_index_computed){
-        differentiator->DynamicsDerivatives(A[indices.start_index], B[indices.start_index], cols,
-                                            indices.start_index, tid, true, 1e-6);
-        computed_keypoints[dof_index][indices.start_index] = true;
+    for(std::thread &thread : thread_pool){
+        thread.join();
     }
+}
 
-    if(!mid_index_computed){
-        differentiator->DynamicsDerivatives(A[mid_index], B[mid_index], cols,
-                                            mid_index, tid, true, 1e-6);
-        computed_keypoints[dof_index][mid_index] = true;
-    }
+bool KeypointGenerator::CheckDOFColumnError(index_tuple indices, int dof_index, int num_dofs,
+                                            std::vector<MatrixXd> &A, std::vector<MatrixXd> &B) {
+    // The two columns of the "A" matrix we will compare (position, velocity) for that dof to evaluate our approximation
+    MatrixXd mid_columns_approximated[2];
 
-    if(!end_index_computed){
-        differentiator->DynamicsDerivatives(A[indices.end_index], B[indices.end_index], cols,
-                                            indices.end_index, tid, true, 1e-6);
-        computed_keypoints[dof_index][indices.end_index] = true;
+    // Middle index in trajectory between start and end index passed from "indices" struct
+    int mid_index = (indices.start_index + indices.end_index) / 2;
+    if((indices.end_index - indices.start_index) <= current_keypoint_method.min_N){
+        return true;
     }
 
-    mid_columns_approximated[0] = (A[indices.start_index].block(0, dof_index, num_dofs * 2, 1) + A[indices.end_index].block(0, dof_index, num_dofs * 2, 1)) / 2;
-    mid_columns_approximated[1] = (A[indices.start_index].block(0, dof_index + num_dofs, num_dofs * 2, 1) + A[indices.end_index].block(0, dof_index + num_dofs, num_dofs * 2, 1)) / 2;
+    // A may be stored compactly (velocity rows only), the velocity rows are always the last num_dofs rows
+    int A_rows = static_cast<int>(A[mid_index].rows());
+    mid_columns_approximated[0] = (A[indices.start_index].block(0, dof_index, A_rows, 1) + A[indices.end_index].block(0, dof_index, A_rows, 1)) / 2;
+    mid_columns_approximated[1] = (A[indices.start_index].block(0, dof_index + num_dofs, A_rows, 1) + A[indices.end_index].block(0, dof_index + num_dofs, A_rows, 1)) / 2;
 
     double error_sum = 0.0f;
     int counter = 0;
 
     for(int i = 0; i < 2; i++){
         int A_col_indices[2] = {dof_index, dof_index + num_dofs};
-        for(int j = num_dofs; j < num_dofs*2; j++){
+        for(int j = A_rows - num_dofs; j < A_rows; j++){
             double square_difference = pow((A[mid_index](j, A_col_indices[i]) - mid_columns_approximated[i](j, 0)), 2);
 
             counter++;
@@ -629,96 +623,69 @@ bool KeypointGenerator::CheckDOFColumnError(index_tuple indices, int dof_index,
         average_error = 0.0f;
     }
 
-//    if(dofIndex == 0){
-//        cout << "average error: " << average_error << "\n";
-//    }
-
     if(average_error < current_keypoint_method.iterative_error_threshold){
         return true;
     }
     return false;
 }
 
-void KeypointGenerator::GenerateKeyPointsVelocityChange(const std::vector<MatrixXd> &velocity_profile) {
+void KeypointGenerator::GenerateKeyPointsVelocityChange(const MatrixXd &velocity_profile) {
 
     std::vector<int> full_row(dof, 0);
 
     for(int i = 0; i < dof; i++){
         full_row[i] = i;
     }
-    keypoints.push_back(full_row);
 
-    // Keeps track of interval from last keypoint for this dof
-    std::vector<int> last_keypoint_counter = std::vector<int>(dof, 0);
-    std::vector<double> last_vel_value = std::vector<double>(dof, 0);
-    std::vector<double> last_vel_direction = std::vector<double>(dof, 0);
+    keypoints.assign(horizon, std::vector<int>());
+    keypoints[0] = full_row;
 
-    for(int i = 0; i < dof; i++){
-//        last_vel_value[i] = velocity_profile[0](i, 0);
-        last_vel_value[i] = 0.0;
+    // Velocity changes and magnitudes over the whole horizon, transposed so each dof is a contiguous column.
+    // Row s corresponds to time index t = s + 1.
+    int num_steps = horizon - 1;
+    MatrixXd velocity_directions = (velocity_profile.middleCols(1, num_steps) - velocity_profile.leftCols(num_steps)).transpose();
+    MatrixXd velocity_magnitudes = velocity_profile.middleCols(1, num_steps).cwiseAbs().transpose();
 
-        min_last_velocity[i] = velocity_profile[0](i, 0);
-        max_last_velocity[i] = velocity_profile[0](i, 0);
-    }
-
-    // Loop over the horizon
-    for(int t = 1; t < horizon; t++){
-        std::vector<int> row;
-
-        // Loop over the velocity dofs
-        for(int i = 0; i < dof; i++){
-
-            last_keypoint_counter[i]++;
-            double current_vel_direction = velocity_profile[t](i, 0) - velocity_profile[t - 1](i, 0);
-//            double current_vel_change_since_last_keypoint = velocity_profile[t](i, 0) - last_vel_value[i];
-            last_vel_value[i] += abs(velocity_profile[t](i, 0));
-
-            // If the vel change is above the required threshold
-            if(last_keypoint_counter[i] >= current_keypoint_method.min_N){
-                if(abs(last_vel_value[i]) > current_keypoint_method.velocity_change_thresholds[i]){
-                    row.push_back(i);
-//                    last_vel_value[i] = velocity_profile[t](i, 0);
-                    last_vel_value[i] = 0.0;
-                    last_keypoint_counter[i] = 0;
-                    continue;
-                }
-            }
-
-            // If the interval is greater than min_N
-            if(last_keypoint_counter[i] >= current_keypoint_method.min_N){
-                // If the direction of the velocity has changed
-                if(current_vel_direction * last_vel_direction[i] < 0){
-                    row.push_back(i);
-//                    last_vel_value[i] = velocity_profile[t](i, 0);
-                    last_vel_value[i] = 0.0;
-                    last_keypoint_counter[i] = 0;
+    for(int i = 0; i < dof; i++){
+        const double *directions = velocity_directions.col(i).data();
+        const double *magnitudes = velocity_magnitudes.col(i).data();
+
+        // Interval from last keypoint, accumulated velocity since then and last velocity direction for this dof
+        int last_keypoint_counter = 0;
+        double accumulated_velocity = 0.0;
+        double last_vel_direction = 0.0;
+
+        for(int s = 0; s < num_steps; s++){
+            last_keypoint_counter++;
+            accumulated_velocity += magnitudes[s];
+
+            if(last_keypoint_counter >= MinN(i)){
+                // If the vel change is above the required threshold, or the direction of the velocity has changed
+                if(accumulated_velocity > current_keypoint_method.velocity_change_thresholds[i] ||
+                   directions[s] * last_vel_direction < 0){
+                    keypoints[s + 1].push_back(i);
+                    accumulated_velocity = 0.0;
+                    last_keypoint_counter = 0;
                     continue;
                 }
             }
             else{
-                last_vel_direction[i] = current_vel_direction;
+                last_vel_direction = directions[s];
             }
 
             // If interval is greater than max_N
-            if(last_keypoint_counter[i] >= current_keypoint_method.max_N){
-                row.push_back(i);
-//                last_vel_value[i] = velocity_profile[t](i, 0);
-                last_vel_value[i] = 0.0;
-                last_keypoint_counter[i] = 0;
-                continue;
-            }
-
-            // Update min and max velocities
-            if(velocity_profile[t](i, 0) < min_last_velocity[i]){
-                min_last_velocity[i] = velocity_profile[t](i, 0);
-            }
-
-            if(velocity_profile[t](i, 0) > max_last_velocity[i]){
-                max_last_velocity[i] = velocity_profile[t](i, 0);
+            if(last_keypoint_counter >= MaxN(i)){
+                keypoints[s + 1].push_back(i);
+                accumulated_velocity = 0.0;
+                last_keypoint_counter = 0;
             }
         }
+    }
 
-        keypoints.push_back(row);
+    // Range of velocities over the trajectory
+    for(int i = 0; i < dof; i++){
+        min_last_velocity[i] = velocity_profile.row(i).minCoeff();
+        max_last_velocity[i] = velocity_profile.row(i).maxCoeff();
     }
 
     // Enforce last keypoint for all dofs at horizonLength - 1
@@ -727,83 +694,244 @@ void KeypointGenerator::GenerateKeyPointsVelocityChange(const std::vector<Matrix
     }
 }
 
-void KeypointGenerator::GenerateJerkProfile(const std::vector<MatrixXd> &trajectory_states){
+void KeypointGenerator::StackTrajectory(const std::vector<MatrixXd> &trajectory_states){
+    int state_size = trajectory_states[0].rows();
+    trajectory_matrix.resize(state_size, horizon);
 
-    MatrixXd jerk(dof, 1);
+    for(int t = 0; t < horizon; t++){
+        trajectory_matrix.col(t) = trajectory_states[t].col(0);
+    }
+}
 
-    MatrixXd state1(trajectory_states[0].rows(), 1);
-    MatrixXd state2(trajectory_states[0].rows(), 1);
-    MatrixXd state3(trajectory_states[0].rows(), 1);
+void KeypointGenerator::GenerateJerkProfile(){
+    double dt = physics_simulator->ReturnModelTimeStep();
+    auto velocities = trajectory_matrix.middleRows(dof, dof);
 
-    MatrixXd accell1(dof*2, 1);
-    MatrixXd accell2(dof*2, 1);
+    // Second difference of velocity over the whole trajectory, last two time-steps are zero
+    jerk_profile.setZero(dof, horizon);
+    if(horizon > 2){
+        jerk_profile.leftCols(horizon - 2) = ((velocities.middleCols(2, horizon - 2)
+                                               - 2 * velocities.middleCols(1, horizon - 2)
+                                               + velocities.leftCols(horizon - 2)) / (dt * dt)).cwiseAbs();
+    }
+}
 
-    for(int t = 0; t < horizon - 2; t++){
-        state1 = trajectory_states[t];
-        state2 = trajectory_states[t + 1];
-        state3 = trajectory_states[t + 2];
+void KeypointGenerator::GenerateAccellerationProfile() {
+    auto velocities = trajectory_matrix.middleRows(dof, dof);
 
-        accell1 = (state2 - state1) / physics_simulator->ReturnModelTimeStep();
-        accell2 = (state3 - state2) / physics_simulator->ReturnModelTimeStep();
+    // Change in velocity between consecutive time-steps, last time-step is zero
+    acceleration_profile.setZero(dof, horizon);
+    if(horizon > 1){
+        acceleration_profile.leftCols(horizon - 1) = velocities.middleCols(1, horizon - 1) - velocities.leftCols(horizon - 1);
+    }
+}
 
-        for(int j = 0; j < dof; j++){
-            jerk(j, 0) = abs((accell2(j+dof, 0) - accell1(j+dof, 0)) / physics_simulator->ReturnModelTimeStep());
+void KeypointGenerator::GenerateVelocityProfile() {
+    velocity_profile = trajectory_matrix.middleRows(dof, dof);
+}
+
+std::vector<std::vector<int>> KeypointGenerator::AddContactKeypoints(){
+    std::vector<std::vector<int>> added_keypoints(horizon);
+
+    if(dof_root_bodies.size() != dof){
+        std::cerr << "ERROR: contact keypoints need the root body of every dof \n";
+        exit(1);
+    }
+
+    // Contact pairs (root bodies, smallest first, sorted) at each time index
+    std::vector<std::vector<std::pair<int, int>>> contact_pairs = physics_simulator->TrajectoryContactPairs(horizon);
+
+    for(int t = 1; t < horizon; t++){
+        // Pairs that made or broke contact between t - 1 and t
+        std::vector<std::pair<int, int>> switches;
+        std::set_symmetric_difference(contact_pairs[t - 1].begin(), contact_pairs[t - 1].end(),
+                                      contact_pairs[t].begin(), contact_pairs[t].end(),
+                                      std::back_inserter(switches));
+        if(switches.empty()){
+            continue;
         }
 
-        jerk_profile[t] = jerk;
+        for(int i = 0; i < dof; i++){
+            bool involved = false;
+            for(const auto &contact_pair : switches){
+                if(dof_root_bodies[i] == contact_pair.first || dof_root_bodies[i] == contact_pair.second){
+                    involved = true;
+                    break;
+                }
+            }
+            if(!involved){
+                continue;
+            }
+
+            // Keypoints either side of the switch, so no interpolation spans the contact event
+            for(int index : {t - 1, t}){
+                if(std::find(keypoints[index].begin(), keypoints[index].end(), i) == keypoints[index].end()){
+                    keypoints[index].push_back(i);
+                    added_keypoints[index].push_back(i);
+                }
+            }
+        }
     }
 
-    // Set last two time-steps to zero
-    for(int i = 0; i < dof; i++){
-        jerk_profile[horizon - 2](i, 0) = 0;
-        jerk_profile[horizon - 1](i, 0) = 0;
+    for(int t = 0; t < horizon; t++){
+        std::sort(keypoints[t].begin(), keypoints[t].end());
     }
 
-    // Temp print jerk values
-//    for(int t = 0; t < jerk_profile.size(); t++){
-//        std::cout << "timestep " << t << ": ";
-//        for(int i = 0; i < dof; i++){
-//            std::cout << jerk_profile[t](i, 0) << " ";
-//        }
-//        std::cout << "\n";
-//    }
+    return added_keypoints;
 }
 
-std::vector<MatrixXd> KeypointGenerator::GenerateAccellerationProfile(int horizon, std::vector<MatrixXd> trajectory_states) {
-    int dof = trajectory_states[0].rows() / 2;
-    MatrixXd accel(dof, 1);
+int KeypointGenerator::MinN(int dof_index) const{
+    if(current_keypoint_method.error_estimation && dof_index < dof_min_N.size()){
+        return dof_min_N[dof_index];
+    }
+    return current_keypoint_method.min_N;
+}
 
-    MatrixXd state1(trajectory_states[0].rows(), 1);
-    MatrixXd state2(trajectory_states[0].rows(), 1);
+int KeypointGenerator::MaxN(int dof_index) const{
+    if(current_keypoint_method.error_estimation && dof_index < dof_max_N.size()){
+        return dof_max_N[dof_index];
+    }
+    return current_keypoint_method.max_N;
+}
 
-    std::vector<MatrixXd> accelleration_profile;
+void KeypointGenerator::EstimateInterpolationError(std::vector<MatrixXd> &A, std::vector<MatrixXd> &B){
+    // The iterative error method already measures its own interpolation error and set interval does not use
+    // per dof spacing, so neither needs the estimate
+    if(!current_keypoint_method.error_estimation || current_keypoint_method.name == "iterative_error" ||
+       current_keypoint_method.name == "set_interval"){
+        return;
+    }
 
-    for(int i = 0; i < horizon - 1; i++){
-        state1 = trajectory_states[i];
-        state2 = trajectory_states[i + 1];
+    if(interpolation_knots.size() != dof){
+        return;
+    }
 
-        MatrixXd accell_states = state2 - state1;
+    if(interpolation_error_coefficients.size() != dof){
+        interpolation_error_coefficients.assign(dof, -1.0);
+    }
 
-        for(int j = 0; j < dof; j++){
-            accel(j, 0) = accell_states(j + dof, 0);
+    // Sample budget, at least one sample per dof
+    int total_samples = static_cast<int>(round(current_keypoint_method.error_sample_percentage / 100.0 * horizon * dof));
+    int samples_per_dof = std::max(1, (total_samples + dof - 1) / dof);
+
+    struct error_sample{
+        int dof_index;
+        int time_index;
+        double segment_length;
+        double segment_position;
+        MatrixXd interpolated_cols;
+    };
+    std::vector<error_sample> samples;
+    std::vector<std::vector<int>> cols_to_compute(horizon);
+
+    for(int i = 0; i < dof; i++){
+        const std::vector<int> &knots = interpolation_knots[i];
+        if(knots.size() < 2 || knots.back() < 2){
+            continue;
         }
 
-        accelleration_profile.push_back(accel);
+        std::uniform_int_distribution<int> time_distribution(1, knots.back() - 1);
+        for(int n = 0; n < samples_per_dof; n++){
+            int t = time_distribution(error_sample_generator);
+
+            // Segment that contains t, skip keypoints and already sampled columns
+            auto upper = std::upper_bound(knots.begin(), knots.end(), t);
+            int start = *(upper - 1);
+            int end = *upper;
+            if(start == t || std::find(cols_to_compute[t].begin(), cols_to_compute[t].end(), i) != cols_to_compute[t].end()){
+                continue;
+            }
+
+            error_sample sample;
+            sample.dof_index = i;
+            sample.time_index = t;
+            sample.segment_length = end - start;
+            sample.segment_position = (double)(t - start) / (end - start);
+            sample.interpolated_cols = MatrixXd(A[t].rows(), 2);
+            sample.interpolated_cols.col(0) = A[t].col(i);
+            sample.interpolated_cols.col(1) = A[t].col(i + dof);
+            samples.push_back(sample);
+
+            cols_to_compute[t].push_back(i);
+        }
     }
 
-    return accelleration_profile;
-}
+    if(samples.empty()){
+        return;
+    }
 
-void KeypointGenerator::GenerateVelocityProfile(const std::vector<MatrixXd> &trajectory_states) {
-    int dof = trajectory_states[0].rows() / 2;
+    physics_simulator->InitModelForFiniteDifferencing();
+    ComputeColumnsInParallel(cols_to_compute, A, B);
+    physics_simulator->ResetModelAfterFiniteDifferencing();
 
-    MatrixXd velocities(dof, 1);
+    // Order of the interpolation error in the segment length. Linear is second order, the monotone tangents of
+    // cubic_hermite are second order accurate which makes the interpolant third order, natural splines are fourth
+    // order. The squared error measure scales with twice the order.
+    double error_order = 2.0;
+    if(current_keypoint_method.interpolation == "cubic_hermite"){
+        error_order = 3.0;
+    }
+    else if(current_keypoint_method.interpolation == "natural_spline"){
+        error_order = 4.0;
+    }
 
-    for(int t = 0; t < horizon; t++){
-        for(int i = 0; i < dof; i++){
-            velocities(i, 0) = trajectory_states[t](i+dof, 0);
+    // Same error measure as the iterative error method, mean squared error over the velocity rows of both columns
+    std::vector<double> coefficient_sum(dof, 0.0);
+    std::vector<int> coefficient_count(dof, 0);
+    for(const error_sample &sample : samples){
+        int i = sample.dof_index;
+        int t = sample.time_index;
+        double error = 0.0;
+        int A_rows = static_cast<int>(A[t].rows());
+        for(int j = A_rows - dof; j < A_rows; j++){
+            error += pow(A[t](j, i) - sample.interpolated_cols(j, 0), 2);
+            error += pow(A[t](j, i + dof) - sample.interpolated_cols(j, 1), 2);
         }
-        velocity_profile[t] = velocities;
+        error /= 2 * dof;
+
+        // Interpolation error is largest mid segment, normalise the sample to a mid segment error
+        double position_factor = std::max(0.25, 4 * sample.segment_position * (1 - sample.segment_position));
+        coefficient_sum[i] += error / (pow(sample.segment_length, 2 * error_order) * pow(position_factor, error_order));
+        coefficient_count[i]++;
+    }
+
+    // Update the error model and compute the desired spacing between keypoints per dof
+    std::vector<double> desired_spacing(dof, current_keypoint_method.max_N);
+    double estimated_percentage = 0.0;
+    for(int i = 0; i < dof; i++){
+        if(coefficient_count[i] > 0){
+            double measured = coefficient_sum[i] / coefficient_count[i];
+            if(interpolation_error_coefficients[i] < 0){
+                interpolation_error_coefficients[i] = measured;
+            }
+            else{
+                interpolation_error_coefficients[i] = 0.5 * interpolation_error_coefficients[i] + 0.5 * measured;
+            }
+        }
+
+        if(interpolation_error_coefficients[i] > 0){
+            desired_spacing[i] = pow(current_keypoint_method.iterative_error_threshold / interpolation_error_coefficients[i], 1.0 / (2 * error_order));
+        }
+        desired_spacing[i] = std::clamp(desired_spacing[i], 1.0, (double)current_keypoint_method.max_N);
+        estimated_percentage += 100.0 / (desired_spacing[i] * dof);
+    }
+
+    // Keep the total finite-differencing within the target by spreading keypoints out evenly over all dofs. The
+    // sampled columns are finite-differenced as well, so keypoints get what is left of the target after them.
+    double keypoint_budget = current_keypoint_method.target_percentage_derivs - current_keypoint_method.error_sample_percentage;
+    double spacing_scale = 1.0;
+    if(keypoint_budget <= 0){
+        spacing_scale = horizon;
+    }
+    else if(estimated_percentage > keypoint_budget){
+        spacing_scale = estimated_percentage / keypoint_budget;
+    }
+
+    dof_min_N.resize(dof);
+    dof_max_N.resize(dof);
+    for(int i = 0; i < dof; i++){
+        dof_max_N[i] = std::clamp((int)round(desired_spacing[i] * spacing_scale), 1, horizon);
+        dof_min_N[i] = std::clamp(dof_max_N[i] / 4, std::min(current_keypoint_method.min_N, dof_max_N[i]), dof_max_N[i]);
     }
 }
 
@@ -839,115 +967,182 @@ std::vector<double> KeypointGenerator::ComputePercentageDerivatives(std::vector<
 
 void KeypointGenerator::InterpolateDerivatives(const std::vector<std::vector<int>> &keyPoints, int T,
                             std::vector<MatrixXd> &A, std::vector<MatrixXd> &B,
-                            std::vector<std::vector<MatrixXd>> &r_x, std::vector<std::vector<MatrixXd>> &r_u,
+                            std::vector<MatrixXd> &r_x, std::vector<MatrixXd> &r_u,
                             bool residual_derivs, int num_ctrl){
-    // Interpolation of B matrices
-    MatrixXd startB;
-    MatrixXd endB;
-    MatrixXd addB;
-
-    // Interpolation of position part of A matrices
-    MatrixXd startACol1;
-    MatrixXd endACol1;
-    MatrixXd addACol1;
-
-    // Interpolation of velocity part of A matrices
-    MatrixXd startACol2;
-    MatrixXd endACol2;
-    MatrixXd addACol2;
-
-    // Residual interpolation
-//    int num_residuals = r_x[0].size();
-//    vector<double> start_val_r_x_pos(num_residuals);
-//    vector<double> end_val_r_x_pos(num_residuals);
-//    vector<double> add_val_r_x_pos(num_residuals);
-//
-//    vector<double> start_val_r_x_vel(num_residuals);
-//    vector<double> end_val_r_x_vel(num_residuals);
-//    vector<double> add_val_r_x_vel(num_residuals);
-//
-//    vector<double> start_val_r_u(num_residuals);
-//    vector<double> end_val_r_u(num_residuals);
-//    vector<double> add_val_r_u(num_residuals);
 
-    // Create an array to track startIndices of next interpolation for each dof
-    int startIndices[dof];
-    for(int i = 0; i < dof; i++){
-        startIndices[i] = 0;
+    const std::string &method = current_keypoint_method.interpolation;
+    if(method != "linear" && method != "cubic_hermite" && method != "natural_spline"){
+        std::cerr << "ERROR: interpolation method " << method << " not recognised \n";
+        exit(1);
     }
 
-    // Loop through all the time indices - can skip the first
-    // index as we preload the first index as the start index for all dofs.
+    // Sorted time indices where each dof was computed, built in a single pass over the keypoints. The first index
+    // is always preloaded as the start index for all dofs.
+    interpolation_knots.resize(dof);
+    for(int i = 0; i < dof; i++){
+        interpolation_knots[i].clear();
+        interpolation_knots[i].push_back(0);
+    }
     for(int t = 1; t < T; t++){
-        // Loop through all the dofs
-        for(int i = 0; i < dof; i++){
-            // Check the current vector at that time segment for the current dof
-            std::vector<int> columns = keyPoints[t];
+        for(int i : keyPoints[t]){
+            if(i < dof && interpolation_knots[i].back() != t){
+                interpolation_knots[i].push_back(t);
+            }
+        }
+    }
 
-            // If there are no keypoints, continue onto second run of the loop
-            if(columns.empty()){
-                continue;
+    for(int i = 0; i < dof; i++){
+        const std::vector<int> &knots = interpolation_knots[i];
+        if(knots.size() < 2){
+            continue;
+        }
+
+        // Position and velocity columns of A for this dof
+        InterpolateColumn(knots, A, i);
+        InterpolateColumn(knots, A, i + dof);
+
+        if(i < num_ctrl){
+            InterpolateColumn(knots, B, i);
+        }
+    }
+}
+
+void KeypointGenerator::InterpolateColumn(const std::vector<int> &knots, std::vector<MatrixXd> &matrices, int col){
+    // Matrices are column major, so each column is a contiguous array of rows. All loops below are simple
+    // axpy style loops over these arrays, writing directly into the matrices.
+    int num_knots = static_cast<int>(knots.size());
+    int rows = static_cast<int>(matrices[knots[0]].rows());
+
+    if(current_keypoint_method.interpolation == "linear" || num_knots == 2){
+        interpolation_slope.resize(rows);
+        double *slope = interpolation_slope.data();
+
+        for(int k = 0; k < num_knots - 1; k++){
+            const double *start = matrices[knots[k]].col(col).data();
+            const double *end = matrices[knots[k + 1]].col(col).data();
+            double h = knots[k + 1] - knots[k];
+            for(int r = 0; r < rows; r++){
+                slope[r] = (end[r] - start[r]) / h;
             }
 
-            for(int j = 0; j < columns.size(); j++){
-
-                // If there is a match, interpolate between the start index and the current index
-                // For the given columns
-                if(i == columns[j]){
-//                    cout << "dof: " << i << " end index: " << t << " start index: " << startIndices[i] << "\n";
-                    startACol1 = A[startIndices[i]].block(0, i, 2*dof, 1);
-                    endACol1 = A[t].block(0, i, 2*dof, 1);
-                    addACol1 = (endACol1 - startACol1) / (t - startIndices[i]);
-
-                    // Same again for column 2 which is dof + i
-                    startACol2 = A[startIndices[i]].block(0, i + dof, 2*dof, 1);
-                    endACol2 = A[t].block(0, i + dof, 2*dof, 1);
-                    addACol2 = (endACol2 - startACol2) / (t - startIndices[i]);
-
-//                    if(residual_derivs) {
-//                        for (int resid = 0; resid < num_residuals; resid++) {
-//                            start_val_r_x_pos[resid] = r_x[startIndices[i]][resid](i, 0);
-//                            end_val_r_x_pos[resid] = r_x[t][resid](i, 0);
-//                            add_val_r_x_pos[resid] = (end_val_r_x_pos[resid] - start_val_r_x_pos[resid]) / (t - startIndices[i]);
-//
-//                            start_val_r_x_vel[resid] = r_x[startIndices[i]][resid](i + dof, 0);
-//                            end_val_r_x_vel[resid] = r_x[t][resid](i + dof, 0);
-//                            add_val_r_x_vel[resid] = (end_val_r_x_vel[resid] - start_val_r_x_vel[resid]) / (t - startIndices[i]);
-//                        }
-//
-//                        if(i < num_ctrl){
-//                            for (int resid = 0; resid < num_residuals; resid++) {
-//                                start_val_r_u[resid] = r_u[startIndices[i]][resid](i, 0);
-//                                end_val_r_u[resid] = r_u[t][resid](i, 0);
-//                                add_val_r_u[resid] = (end_val_r_u[resid] - start_val_r_u[resid]) / (t - startIndices[i]);
-//                            }
-//                        }
-//                    }
-
-                    if(i < num_ctrl){
-                        startB = B[startIndices[i]].block(0, i, 2*dof, 1);
-                        endB = B[t].block(0, i, 2*dof, 1);
-                        addB = (endB - startB) / (t - startIndices[i]);
-                    }
-
-                    for(int k = startIndices[i] + 1; k < t; k++){
-                        A[k].block(0, i, 2*dof, 1) = startACol1 + ((k - startIndices[i]) * addACol1);
-
-                        A[k].block(0, i + dof, 2*dof, 1) = startACol2 + ((k - startIndices[i]) * addACol2);
-
-//                        for (int resid = 0; resid < num_residuals; resid++) {
-//                            r_x[k][resid](i, 0) = start_val_r_x_pos[resid] + ((k - startIndices[i]) * add_val_r_x_pos[resid]);
-//                            r_x[k][resid](i + dof, 0) = start_val_r_x_vel[resid] + ((k - startIndices[i]) * add_val_r_x_vel[resid]);
-//                            if(i < num_ctrl)
-//                                r_u[k][resid](i, 0) = start_val_r_u[resid] + ((k - startIndices[i]) * add_val_r_u[resid]);
-//                        }
-
-                        if(i < num_ctrl){
-                            B[k].block(0, i, 2*dof, 1) = startB + ((k - startIndices[i]) * addB);
-                        }
-                    }
-                    startIndices[i] = t;
+            for(int t = knots[k] + 1; t < knots[k + 1]; t++){
+                double *dst = matrices[t].col(col).data();
+                double steps = t - knots[k];
+                for(int r = 0; r < rows; r++){
+                    dst[r] = start[r] + (steps * slope[r]);
+                }
+            }
+        }
+        return;
+    }
+
+    // Knot spacing (h), secant slopes (delta) and tangents (m) per row of the column, one column per segment / knot
+    interpolation_h.resize(num_knots - 1);
+    interpolation_delta.resize(rows, num_knots - 1);
+    interpolation_tangents.resize(rows, num_knots);
+    std::vector<double> &h = interpolation_h;
+    MatrixXd &delta = interpolation_delta;
+    MatrixXd &m = interpolation_tangents;
+
+    for(int k = 0; k < num_knots - 1; k++){
+        const double *start = matrices[knots[k]].col(col).data();
+        const double *end = matrices[knots[k + 1]].col(col).data();
+        double *delta_k = delta.col(k).data();
+        h[k] = knots[k + 1] - knots[k];
+        for(int r = 0; r < rows; r++){
+            delta_k[r] = (end[r] - start[r]) / h[k];
+        }
+    }
+
+    if(current_keypoint_method.interpolation == "cubic_hermite"){
+        // Monotone tangents (Fritsch-Carlson), weighted harmonic mean of neighbouring slopes, zero at turning points
+        m.col(0) = delta.col(0);
+        m.col(num_knots - 1) = delta.col(num_knots - 2);
+        for(int k = 1; k < num_knots - 1; k++){
+            double w1 = 2 * h[k] + h[k - 1];
+            double w2 = h[k] + 2 * h[k - 1];
+            const double *d0 = delta.col(k - 1).data();
+            const double *d1 = delta.col(k).data();
+            double *m_k = m.col(k).data();
+            for(int r = 0; r < rows; r++){
+                if(d0[r] * d1[r] <= 0.0){
+                    m_k[r] = 0.0;
                 }
+                else{
+                    m_k[r] = (w1 + w2) / ((w1 / d0[r]) + (w2 / d1[r]));
+                }
+            }
+        }
+    }
+    else{
+        // Natural cubic spline, solve the tridiagonal system for second derivatives (zero at both ends) with
+        // the Thomas algorithm, all rows of the column share the same system.
+        interpolation_c_prime.assign(num_knots, 0.0);
+        interpolation_second_derivs.setZero(rows, num_knots);
+        interpolation_d_prime.setZero(rows, num_knots);
+        std::vector<double> &c_prime = interpolation_c_prime;
+        MatrixXd &second_derivs = interpolation_second_derivs;
+        MatrixXd &d_prime = interpolation_d_prime;
+
+        for(int k = 1; k < num_knots - 1; k++){
+            double lower = h[k - 1];
+            double diag = 2 * (h[k - 1] + h[k]);
+            double upper = h[k];
+            double denom = diag - lower * c_prime[k - 1];
+            c_prime[k] = upper / denom;
+
+            const double *d0 = delta.col(k - 1).data();
+            const double *d1 = delta.col(k).data();
+            const double *d_prime_last = d_prime.col(k - 1).data();
+            double *d_prime_k = d_prime.col(k).data();
+            for(int r = 0; r < rows; r++){
+                d_prime_k[r] = (6 * (d1[r] - d0[r]) - lower * d_prime_last[r]) / denom;
+            }
+        }
+        for(int k = num_knots - 2; k > 0; k--){
+            const double *d_prime_k = d_prime.col(k).data();
+            const double *next = second_derivs.col(k + 1).data();
+            double *second_derivs_k = second_derivs.col(k).data();
+            for(int r = 0; r < rows; r++){
+                second_derivs_k[r] = d_prime_k[r] - c_prime[k] * next[r];
+            }
+        }
+
+        // Convert to tangents so the spline can be evaluated in Hermite form
+        for(int k = 0; k < num_knots - 1; k++){
+            const double *delta_k = delta.col(k).data();
+            const double *s0 = second_derivs.col(k).data();
+            const double *s1 = second_derivs.col(k + 1).data();
+            double *m_k = m.col(k).data();
+            for(int r = 0; r < rows; r++){
+                m_k[r] = delta_k[r] - h[k] * (2 * s0[r] + s1[r]) / 6;
+            }
+        }
+        int last = num_knots - 1;
+        const double *delta_last = delta.col(last - 1).data();
+        const double *s0 = second_derivs.col(last - 1).data();
+        const double *s1 = second_derivs.col(last).data();
+        double *m_last = m.col(last).data();
+        for(int r = 0; r < rows; r++){
+            m_last[r] = delta_last[r] + h[last - 1] * (s0[r] + 2 * s1[r]) / 6;
+        }
+    }
+
+    // Evaluate the cubic Hermite basis between each pair of knots
+    for(int k = 0; k < num_knots - 1; k++){
+        const double *start = matrices[knots[k]].col(col).data();
+        const double *end = matrices[knots[k + 1]].col(col).data();
+        const double *m0 = m.col(k).data();
+        const double *m1 = m.col(k + 1).data();
+        for(int t = knots[k] + 1; t < knots[k + 1]; t++){
+            double s = (t - knots[k]) / h[k];
+            double h00 = 2*s*s*s - 3*s*s + 1;
+            double h10 = (s*s*s - 2*s*s + s) * h[k];
+            double h01 = -2*s*s*s + 3*s*s;
+            double h11 = (s*s*s - s*s) * h[k];
+            double *dst = matrices[t].col(col).data();
+            for(int r = 0; r < rows; r++){
+                dst[r] = h00 * start[r] + h10 * m0[r] + h01 * end[r] + h11 * m1[r];
             }
         }
     }
@@ -971,4 +1166,4 @@ std::vector<double> KeypointGenerator::ConvertNumKeypointsToPercentages(const st
 
 void KeypointGenerator::ResetCache(){
     keypoints_computed = false;
-}
\ No newline at end of file
+}
@@ -26,6 +26,11 @@ void ModelTranslator::InitModelTranslator(const std::string& yamlFilePath){
     min_N = taskConfig.minN;
     max_N = taskConfig.maxN;
     keypoint_method = taskConfig.keypointMethod;
+    interpolation_method = taskConfig.interpolationMethod;
+    contact_keypoints = taskConfig.contactKeypoints;
+    error_estimation = taskConfig.errorEstimation;
+    error_sample_percentage = taskConfig.errorSamplePercentage;
+    target_percentage_derivs = taskConfig.targetPercentageDerivs;
     auto_adjust = taskConfig.auto_adjust;
     iterative_error_threshold = taskConfig.iterativeErrorThreshold;
     const char* _modelPath = model_file_path.c_str();
@@ -85,6 +90,19 @@ void ModelTranslator::InitModelTranslator(const std::string& yamlFilePath){
     // Init simulator, make xml, make data, init plugins if required
     MuJoCo_helper->InitSimulator(taskConfig.modelTimeStep, _modelPath, use_plugins);
 
+    // Reduced order soft bodies need the rest configuration of the model to group their vertices
+    for(auto & soft_body : full_state_vector.soft_bodies){
+        if(soft_body.num_clusters > 0){
+            MuJoCo_helper->ClusterSoftBodyVertices(soft_body);
+        }
+    }
+
+    // Resolve model handles once, every state vector copied from the full state vector shares them
+    ResolveStateVectorHandles(full_state_vector);
+
+    // Compile typed residuals (if any) now that model ids can be resolved
+    residual_program.Compile(MuJoCo_helper->model, residual_list, ReturnControlActuatorIds());
+
     // Clear optimiser dof and num ctrl so matrices are properly sized
     ResetSVR();
 
@@ -189,6 +207,21 @@ void ModelTranslator::UpdateCurrentStateVector(std::vector<std::string> state_ve
                 // Erases soft body name
                 state_vector_name.erase(found, body_name.length());
 
+                // Reduced order soft bodies name their states by cluster, "_C{i}_{x, y or z}"
+                if(soft_body.num_clusters > 0){
+                    size_t axis_pos = state_vector_name.rfind('_');
+                    int cluster_number = std::atoi(state_vector_name.substr(2, axis_pos - 2).c_str());
+                    std::string axis_suffix = state_vector_name.substr(axis_pos);
+
+                    std::string lin_suffixes[3] = {"_x", "_y", "_z"};
+                    for(int j = 0; j < 3; j++){
+                        if(axis_suffix == lin_suffixes[j]){
+                            soft_body.clusters[cluster_number].active_linear_dof[j] = add_extra_states;
+                        }
+                    }
+                    continue;
+                }
+
                 // String should now be in form "_{i}_{x, y, or z}
                 // we want number i as its the vertex number
 
@@ -311,6 +344,15 @@ void ModelTranslator::Residuals(mjData *d, MatrixXd &residual) {
     exit(1);
 }
 
+void ModelTranslator::ComputeResiduals(mjData *d, MatrixXd &residuals){
+    if(residual_program.Compiled()){
+        residual_program.Evaluate(MuJoCo_helper->model, d, residual_list, residuals);
+    }
+    else{
+        Residuals(d, residuals);
+    }
+}
+
 double ModelTranslator::CostFunction(const MatrixXd &residuals, const struct stateVectorList &state_vector, bool terminal){
     double cost = 0.0;
 
@@ -551,35 +593,31 @@ double ModelTranslator::CostFuntionSoftBody(const soft_body& soft_body, mjData *
 
 void ModelTranslator::CostDerivativesFromResiduals(const struct stateVectorList &state_vector,
                                   MatrixXd &l_x, MatrixXd &l_xx, MatrixXd &l_u, MatrixXd &l_uu,
-                                  const MatrixXd &residuals, const vector<MatrixXd> r_x, const vector<MatrixXd> r_u, bool terminal){
-    l_x.setZero();
-    l_xx.setZero();
-    l_u.setZero();
-    l_uu.setZero();
+                                  const MatrixXd &residuals, const MatrixXd &r_x, const MatrixXd &r_u, bool terminal,
+                                  bool compute_l_xx){
+    VectorXd weights = ResidualHessianWeights(terminal);
+
+    // l_x = J^T W r, l_xx = J^T W J (Gauss newton approximation), one product over all residuals
+    VectorXd weighted_residuals = weights.cwiseProduct(residuals.col(0));
+    l_x.noalias() = r_x.transpose() * weighted_residuals;
+    l_u.noalias() = r_u.transpose() * weighted_residuals;
+
+    if(compute_l_xx){
+        MatrixXd weighted_r_x = weights.asDiagonal() * r_x;
+        l_xx.noalias() = r_x.transpose() * weighted_r_x;
+    }
 
-    double weight_term;
+    MatrixXd weighted_r_u = weights.asDiagonal() * r_u;
+    l_uu.noalias() = r_u.transpose() * weighted_r_u;
+}
 
+VectorXd ModelTranslator::ResidualHessianWeights(bool terminal) const{
+    // Hardcoded norm function is pow(r, 2), so dn/dr = 2r and dn2/dr2 = 2
+    VectorXd weights(residual_list.size());
     for(int i = 0; i < residual_list.size(); i++){
-
-        if(terminal){
-            weight_term = residual_list[i].weight_terminal;
-        }
-        else{
-            weight_term = residual_list[i].weight;
-        }
-
-        // Hardcoded norm function is pow(r, 2)
-        // l_x = w_i * dn/dr * dr/dx (dn/dr = 2r, as n = r^2)
-        l_x += weight_term * 2 * residuals(i) * r_x[i];
-
-        // l_xx = w_i * dn2/dr2 * dr2/dx2 (dr/dx * dr/dx^T) Gauss newton approximation
-        l_xx += weight_term * 2 * r_x[i] * r_x[i].transpose();
-
-        // l_u = w_i * dn/dr * dr/du
-        l_u += weight_term * 2 * residuals(i) * r_u[i];
-        // l_uu = w_i * dn2/dr2 * dr2/du2( dr/du * dr/du^T) Gauss newton approximation
-        l_uu += 2 * weight_term * r_u[i] * r_u[i].transpose();
+        weights(i) = 2 * (terminal ? residual_list[i].weight_terminal : residual_list[i].weight);
     }
+    return weights;
 }
 
 void ModelTranslator::CostDerivatives(mjData* d, const struct stateVectorList &state_vector,
@@ -912,6 +950,85 @@ MatrixXd ModelTranslator::ReturnStateVectorQuaternions(mjData *d, const struct s
     return state_vector_quat;
 }
 
+std::vector<int> ModelTranslator::FullStateIndicesQuat(const struct stateVectorList &state_vector){
+    // Names of every element of the quaternion state representation, in the same order as ReturnStateVectorQuaternions
+    auto element_names = [](const struct stateVectorList &sv){
+        std::vector<std::string> names;
+        std::string lin_suffixes[3] = {"_x", "_y", "_z"};
+        std::string quat_suffixes[4] = {"_qw", "_qx", "_qy", "_qz"};
+
+        for(auto & robot : sv.robots){
+            if(robot.root_name != "-"){
+                for(const auto & suffix : lin_suffixes){
+                    names.push_back(robot.root_name + suffix);
+                }
+                for(const auto & suffix : quat_suffixes){
+                    names.push_back(robot.root_name + suffix);
+                }
+            }
+            for(const auto & joint_name : robot.joint_names){
+                names.push_back(joint_name);
+            }
+        }
+
+        for(auto & body : sv.rigid_bodies){
+            for(int j = 0; j < 3; j++){
+                if(body.active_linear_dof[j]){
+                    names.push_back(body.name + lin_suffixes[j]);
+                }
+            }
+            if(body.active_angular_dof[0] || body.active_angular_dof[1] || body.active_angular_dof[2]){
+                for(const auto & suffix : quat_suffixes){
+                    names.push_back(body.name + suffix);
+                }
+            }
+        }
+
+        for(auto & soft_body : sv.soft_bodies){
+            for(int i = 0; i < soft_body.clusters.size() && soft_body.num_clusters > 0; i++){
+                for(int j = 0; j < 3; j++){
+                    if(soft_body.clusters[i].active_linear_dof[j]){
+                        names.push_back(soft_body.name + "_C" + std::to_string(i) + lin_suffixes[j]);
+                    }
+                }
+            }
+            for(int i = 0; i < soft_body.num_vertices && soft_body.num_clusters == 0; i++){
+                for(int j = 0; j < 3; j++){
+                    if(soft_body.vertices[i].active_linear_dof[j]){
+                        names.push_back(soft_body.name + "_V" + std::to_string(i) + lin_suffixes[j]);
+                    }
+                }
+            }
+        }
+
+        // Velocity elements follow the state names
+        for(const auto & state_name : sv.state_names){
+            names.push_back(state_name + "_vel");
+        }
+
+        return names;
+    };
+
+    std::vector<std::string> full_names = element_names(full_state_vector);
+    std::unordered_map<std::string, int> full_index;
+    for(int i = 0; i < full_names.size(); i++){
+        full_index[full_names[i]] = i;
+    }
+
+    std::vector<std::string> names = element_names(state_vector);
+    std::vector<int> indices(names.size());
+    for(int i = 0; i < names.size(); i++){
+        auto it = full_index.find(names[i]);
+        if(it == full_index.end()){
+            std::cerr << "state vector element: " << names[i] << " not found in full state vector \n";
+            exit(1);
+        }
+        indices[i] = it->second;
+    }
+
+    return indices;
+}
+
 bool ModelTranslator::SetStateVector(MatrixXd state_vector_values, mjData* d, const struct stateVectorList &state_vector){
 
     if(state_vector_values.rows() != state_vector.dof*2){
@@ -950,13 +1067,21 @@ bool ModelTranslator::SetStateVectorQuat(MatrixXd state_vector_values, mjData* d
 }
 
 MatrixXd ModelTranslator::ReturnControlVector(mjData* d, const struct stateVectorList &state_vector){
+    // State vectors built by hand carry no model handles, resolve them on a copy
+    if(!state_vector.HandlesResolved()){
+        struct stateVectorList resolved = state_vector;
+        ResolveStateVectorHandles(resolved);
+        return ReturnControlVector(d, resolved);
+    }
+
     MatrixXd controlVector(state_vector.num_ctrl, 1);
     int current_control_index = 0;
 
     // loop through all the present robots
-    for(auto & robot : state_vector.robots){
-        vector<double> jointControls;
-        MuJoCo_helper->GetRobotJointsControls(robot.name, jointControls, d);
+    for(int i = 0; i < state_vector.robots.size(); i++){
+        const auto &robot = state_vector.robots[i];
+        thread_local vector<double> jointControls;
+        MuJoCo_helper->GetRobotJointsControls(state_vector.robot_handles[i], jointControls, d);
         for(int j = 0; j < robot.actuator_names.size(); j++){
 
             controlVector(current_control_index + j, 0) = jointControls[j];
@@ -993,17 +1118,26 @@ bool ModelTranslator::SetControlVector(MatrixXd control_vector, mjData* d, const
         return false;
     }
 
+    // State vectors built by hand carry no model handles, resolve them on a copy
+    if(!state_vector.HandlesResolved()){
+        struct stateVectorList resolved = state_vector;
+        ResolveStateVectorHandles(resolved);
+        return SetControlVector(control_vector, d, resolved);
+    }
+
     int current_control_index = 0;
 
     // loop through all the present robots
-    for(auto & robot : state_vector.robots){
-        vector<double> jointControls;
+    for(int i = 0; i < state_vector.robots.size(); i++){
+        const auto &robot = state_vector.robots[i];
+        thread_local vector<double> jointControls;
+        jointControls.clear();
         for(int j = 0; j < robot.actuator_names.size(); j++){
 
             jointControls.push_back(control_vector(current_control_index + j));
         }
 
-        MuJoCo_helper->SetRobotJointsControls(robot.name, jointControls, d);
+        MuJoCo_helper->SetRobotJointsControls(state_vector.robot_handles[i], jointControls, d);
 
         current_control_index += static_cast<int>(robot.actuator_names.size());
     }
@@ -1012,15 +1146,23 @@ bool ModelTranslator::SetControlVector(MatrixXd control_vector, mjData* d, const
 }
 
 MatrixXd ModelTranslator::ReturnPositionVector(mjData* d, const struct stateVectorList &state_vector){
+    // State vectors built by hand carry no model handles, resolve them on a copy
+    if(!state_vector.HandlesResolved()){
+        struct stateVectorList resolved = state_vector;
+        ResolveStateVectorHandles(resolved);
+        return ReturnPositionVector(d, resolved);
+    }
+
     MatrixXd position_vector(state_vector.dof, 1);
 
     int current_state_index = 0;
 
     // Loop through all robots in the state vector
-    for(auto &robot : state_vector.robots){
+    for(int i = 0; i < state_vector.robots.size(); i++){
+        const auto &robot = state_vector.robots[i];
         if(robot.root_name != "-"){
             pose_6 root_position;
-            MuJoCo_helper->GetBodyPoseAngle(robot.root_name, root_position, d);
+            MuJoCo_helper->GetBodyPoseAngle(state_vector.robot_root_handles[i], root_position, d);
 
             position_vector(current_state_index, 0) = root_position.position[0];
             position_vector(current_state_index + 1, 0) = root_position.position[1];
@@ -1032,8 +1174,8 @@ MatrixXd ModelTranslator::ReturnPositionVector(mjData* d, const struct stateVect
             current_state_index += 6;
 
         }
-        vector<double> jointPositions;
-        MuJoCo_helper->GetRobotJointsPositions(robot.name, jointPositions, d);
+        thread_local vector<double> jointPositions;
+        MuJoCo_helper->GetRobotJointsPositions(state_vector.robot_handles[i], jointPositions, d);
 
         for(int j = 0; j < robot.joint_names.size(); j++){
             position_vector(current_state_index + j, 0) = jointPositions[j];
@@ -1044,10 +1186,11 @@ MatrixXd ModelTranslator::ReturnPositionVector(mjData* d, const struct stateVect
     }
 
     // ------------------- Rigid body position elements --------------------
-    for(auto & bodiesState : state_vector.rigid_bodies){
+    for(int i = 0; i < state_vector.rigid_bodies.size(); i++){
+        const auto &bodiesState = state_vector.rigid_bodies[i];
         // Get the body's position and orientation
         pose_6 body_pose;
-        MuJoCo_helper->GetBodyPoseAngle(bodiesState.name, body_pose, d);
+        MuJoCo_helper->GetBodyPoseAngle(state_vector.rigid_body_handles[i], body_pose, d);
 
         for(int j = 0; j < 3; j++) {
             // Linear positions
@@ -1066,20 +1209,12 @@ MatrixXd ModelTranslator::ReturnPositionVector(mjData* d, const struct stateVect
     }
 
     //  ------------------ Soft body position elements -----------------------------------
-    for(auto & soft_body : state_vector.soft_bodies){
-        // Get the body's position and orientation
-        pose_6 body_pose;
-
-        for(int i = 0; i < soft_body.num_vertices; i++){
-
-            MuJoCo_helper->GetSoftBodyVertexPos(soft_body.name, i, body_pose, d);
-            for(int j = 0; j < 3; j++){
-                if(soft_body.vertices[i].active_linear_dof[j]){
-                    position_vector(current_state_index, 0) = body_pose.position[j];
-                    current_state_index++;
-                }
-            }
-        }
+    for(int i = 0; i < state_vector.soft_bodies.size(); i++){
+        const auto &soft_body = state_vector.soft_bodies[i];
+        // All active vertex coordinates of the flex in one pass
+        const flex_handle &flex = state_vector.soft_body_handles[i];
+        current_state_index += MuJoCo_helper->GetSoftBodyPositions(flex, soft_body,
+                                                                   position_vector.col(0).tail(position_vector.rows() - current_state_index), d);
     }
 
     return position_vector;
@@ -1087,15 +1222,23 @@ MatrixXd ModelTranslator::ReturnPositionVector(mjData* d, const struct stateVect
 
 // TODO - perhaps this could be compressed, very similar to ReturnPositionVector
 MatrixXd ModelTranslator::ReturnPositionVectorQuat(mjData *d, const struct stateVectorList &state_vector) {
+    // State vectors built by hand carry no model handles, resolve them on a copy
+    if(!state_vector.HandlesResolved()){
+        struct stateVectorList resolved = state_vector;
+        ResolveStateVectorHandles(resolved);
+        return ReturnPositionVectorQuat(d, resolved);
+    }
+
     MatrixXd position_vector(state_vector.dof_quat, 1);
 
     int current_state_index = 0;
 
     // Loop through all robots in the state vector
-    for(auto & robot : state_vector.robots){
+    for(int i = 0; i < state_vector.robots.size(); i++){
+        const auto &robot = state_vector.robots[i];
         if(robot.root_name != "-"){
             pose_7 root_position;
-            MuJoCo_helper->GetBodyPoseQuat(robot.root_name, root_position, d);
+            MuJoCo_helper->GetBodyPoseQuat(state_vector.robot_root_handles[i], root_position, d);
 
             position_vector(current_state_index, 0) = root_position.position[0];
             position_vector(current_state_index + 1, 0) = root_position.position[1];
@@ -1108,8 +1251,8 @@ MatrixXd ModelTranslator::ReturnPositionVectorQuat(mjData *d, const struct state
             current_state_index += 7;
 
         }
-        vector<double> jointPositions;
-        MuJoCo_helper->GetRobotJointsPositions(robot.name, jointPositions, d);
+        thread_local vector<double> jointPositions;
+        MuJoCo_helper->GetRobotJointsPositions(state_vector.robot_handles[i], jointPositions, d);
 
         for(int j = 0; j < robot.joint_names.size(); j++){
             position_vector(current_state_index + j, 0) = jointPositions[j];
@@ -1120,10 +1263,11 @@ MatrixXd ModelTranslator::ReturnPositionVectorQuat(mjData *d, const struct state
     }
 
     // Loop through all bodies in the state vector
-    for(auto & bodiesState : state_vector.rigid_bodies){
+    for(int i = 0; i < state_vector.rigid_bodies.size(); i++){
+        const auto &bodiesState = state_vector.rigid_bodies[i];
         // Get the body's position and orientation
         pose_7 body_pose;
-        MuJoCo_helper->GetBodyPoseQuat(bodiesState.name, body_pose, d);
+        MuJoCo_helper->GetBodyPoseQuat(state_vector.rigid_body_handles[i], body_pose, d);
 
         for(int j = 0; j < 3; j++) {
             // Linear positions
@@ -1151,34 +1295,34 @@ MatrixXd ModelTranslator::ReturnPositionVectorQuat(mjData *d, const struct state
     }
 
     //  ------------------ Soft body position elements -----------------------------------
-    for(auto & soft_body : state_vector.soft_bodies){
-        // Get the body's position and orientation
-        pose_6 body_pose;
-
-        for(int i = 0; i < soft_body.num_vertices; i++){
-
-            MuJoCo_helper->GetSoftBodyVertexPos(soft_body.name, i, body_pose, d);
-            for(int j = 0; j < 3; j++){
-                if(soft_body.vertices[i].active_linear_dof[j]){
-                    position_vector(current_state_index, 0) = body_pose.position[j];
-                    current_state_index++;
-                }
-            }
-        }
+    for(int i = 0; i < state_vector.soft_bodies.size(); i++){
+        const auto &soft_body = state_vector.soft_bodies[i];
+        // All active vertex coordinates of the flex in one pass
+        const flex_handle &flex = state_vector.soft_body_handles[i];
+        current_state_index += MuJoCo_helper->GetSoftBodyPositions(flex, soft_body,
+                                                                   position_vector.col(0).tail(position_vector.rows() - current_state_index), d);
     }
 
     return position_vector;
 }
 
 MatrixXd ModelTranslator::ReturnVelocityVector(mjData* d, const struct stateVectorList &state_vector){
+    // State vectors built by hand carry no model handles, resolve them on a copy
+    if(!state_vector.HandlesResolved()){
+        struct stateVectorList resolved = state_vector;
+        ResolveStateVectorHandles(resolved);
+        return ReturnVelocityVector(d, resolved);
+    }
+
     MatrixXd velocity_vector(state_vector.dof, 1);
     int current_state_index = 0;
 
     // Loop through all robots in the state vector
-    for(auto & robot : state_vector.robots){
+    for(int i = 0; i < state_vector.robots.size(); i++){
+        const auto &robot = state_vector.robots[i];
         if(robot.root_name != "-"){
             pose_6 root_velocity;
-            MuJoCo_helper->GetBodyVelocity(robot.root_name, root_velocity, d);
+            MuJoCo_helper->GetBodyVelocity(state_vector.robot_root_handles[i], root_velocity, d);
 
             velocity_vector(current_state_index, 0) = root_velocity.position[0];
             velocity_vector(current_state_index + 1, 0) = root_velocity.position[1];
@@ -1190,8 +1334,8 @@ MatrixXd ModelTranslator::ReturnVelocityVector(mjData* d, const struct stateVect
             current_state_index += 6;
         }
 
-        vector<double> joint_velocities;
-        MuJoCo_helper->GetRobotJointsVelocities(robot.name, joint_velocities, d);
+        thread_local vector<double> joint_velocities;
+        MuJoCo_helper->GetRobotJointsVelocities(state_vector.robot_handles[i], joint_velocities, d);
 
         for(int j = 0; j < robot.joint_names.size(); j++){
             velocity_vector(current_state_index + j, 0) = joint_velocities[j];
@@ -1203,10 +1347,11 @@ MatrixXd ModelTranslator::ReturnVelocityVector(mjData* d, const struct stateVect
     }
 
     // ------------------- Rigid body velocity elements -------------------
-    for(auto & bodiesState : state_vector.rigid_bodies){
+    for(int i = 0; i < state_vector.rigid_bodies.size(); i++){
+        const auto &bodiesState = state_vector.rigid_bodies[i];
         // Get the body's position and orientation
         pose_6 body_velocities;
-        MuJoCo_helper->GetBodyVelocity(bodiesState.name, body_velocities, d);
+        MuJoCo_helper->GetBodyVelocity(state_vector.rigid_body_handles[i], body_velocities, d);
 
         for(int j = 0; j < 3; j++) {
             // Linear positions
@@ -1225,20 +1370,12 @@ MatrixXd ModelTranslator::ReturnVelocityVector(mjData* d, const struct stateVect
     }
 
     //  ------------------ Soft body velocity elements -----------------------------------
-    for(auto & soft_body : state_vector.soft_bodies){
-        // Get the body's position and orientation
-        pose_6 body_velocities;
-
-        for(int i = 0; i < soft_body.num_vertices; i++){
-
-            MuJoCo_helper->GetSoftBodyVertexVel(soft_body.name, i, body_velocities, d);
-            for(int j = 0; j < 3; j++){
-                if(soft_body.vertices[i].active_linear_dof[j]){
-                    velocity_vector(current_state_index, 0) = body_velocities.position[j];
-                    current_state_index++;
-                }
-            }
-        }
+    for(int i = 0; i < state_vector.soft_bodies.size(); i++){
+        const auto &soft_body = state_vector.soft_bodies[i];
+        // All active vertex coordinates of the flex in one pass
+        const flex_handle &flex = state_vector.soft_body_handles[i];
+        current_state_index += MuJoCo_helper->GetSoftBodyVelocities(flex, soft_body,
+                                                                    velocity_vector.col(0).tail(velocity_vector.rows() - current_state_index), d);
     }
 
     return velocity_vector;
@@ -1293,10 +1430,18 @@ bool ModelTranslator::SetPositionVector(MatrixXd position_vector, mjData* d, con
         return false;
     }
 
+    // State vectors built by hand carry no model handles, resolve them on a copy
+    if(!state_vector.HandlesResolved()){
+        struct stateVectorList resolved = state_vector;
+        ResolveStateVectorHandles(resolved);
+        return SetPositionVector(position_vector, d, resolved);
+    }
+
     int current_state_index = 0;
 
     // Loop through all robots in the state vector
-    for(auto & robot : state_vector.robots){
+    for(int i = 0; i < state_vector.robots.size(); i++){
+        const auto &robot = state_vector.robots[i];
         if(robot.root_name != "-"){
             pose_6 root_position;
 
@@ -1307,27 +1452,30 @@ bool ModelTranslator::SetPositionVector(MatrixXd position_vector, mjData* d, con
             root_position.orientation[1] = position_vector(current_state_index + 4, 0);
             root_position.orientation[2] = position_vector(current_state_index + 5, 0);
 
-            MuJoCo_helper->SetBodyPoseAngle(robot.root_name, root_position, d);
+            MuJoCo_helper->SetBodyPoseAngle(state_vector.robot_root_handles[i], root_position, d);
 
             current_state_index += 6;
         }
-        vector<double> joint_positions;
+        thread_local vector<double> joint_positions;
+        joint_positions.clear();
 
         for(int j = 0; j < robot.joint_names.size(); j++){
             joint_positions.push_back(position_vector(current_state_index + j, 0));
         }
 
-        MuJoCo_helper->SetRobotJointPositions(robot.name, joint_positions, d);
+        MuJoCo_helper->SetRobotJointPositions(state_vector.robot_handles[i], joint_positions, d);
 
         // Increment the current state index by the number of joints in the robot x 2 (for positions and velocities)
         current_state_index += static_cast<int>(robot.joint_names.size());
     }
 
     // -------------------- rigid body position elements ---------------------------
-    for(auto & rigid_body : state_vector.rigid_bodies){
+    for(int i = 0; i < state_vector.rigid_bodies.size(); i++){
+        const auto &rigid_body = state_vector.rigid_bodies[i];
         // Get the body's position and orientation
         pose_6 body_pose;
-        MuJoCo_helper->GetBodyPoseAngle(rigid_body.name, body_pose, d);
+        const body_handle &body = state_vector.rigid_body_handles[i];
+        MuJoCo_helper->GetBodyPoseAngle(body, body_pose, d);
 
         for(int j = 0; j < 3; j++) {
             // Linear positions
@@ -1344,27 +1492,16 @@ bool ModelTranslator::SetPositionVector(MatrixXd position_vector, mjData* d, con
             }
         }
 
-        MuJoCo_helper->SetBodyPoseAngle(rigid_body.name, body_pose, d);
+        MuJoCo_helper->SetBodyPoseAngle(body, body_pose, d);
     }
 
     //  ------------------ Soft body position elements -----------------------------------
-    for(auto & soft_body : state_vector.soft_bodies){
-        // Get the body's position and orientation
-        pose_6 body_pose;
-
-
-        for(int i = 0; i < soft_body.num_vertices; i++){
-
-            MuJoCo_helper->GetSoftBodyVertexPos(soft_body.name, i, body_pose, d);
-            for(int j = 0; j < 3; j++){
-                if(soft_body.vertices[i].active_linear_dof[j]){
-                    body_pose.position[j] = position_vector(current_state_index, 0);
-                    current_state_index++;
-                }
-
-            }
-            MuJoCo_helper->SetSoftBodyVertexPos(soft_body.name, i, body_pose, d);
-        }
+    for(int i = 0; i < state_vector.soft_bodies.size(); i++){
+        const auto &soft_body = state_vector.soft_bodies[i];
+        // All active vertex coordinates of the flex in one pass, inactive coordinates are left untouched
+        const flex_handle &flex = state_vector.soft_body_handles[i];
+        current_state_index += MuJoCo_helper->SetSoftBodyPositions(flex, soft_body,
+                                                                   position_vector.col(0).tail(position_vector.rows() - current_state_index), d);
     }
 
     return true;
@@ -1376,10 +1513,18 @@ bool ModelTranslator::SetPositionVectorQuat(MatrixXd position_vector, mjData* d,
         return false;
     }
 
+    // State vectors built by hand carry no model handles, resolve them on a copy
+    if(!state_vector.HandlesResolved()){
+        struct stateVectorList resolved = state_vector;
+        ResolveStateVectorHandles(resolved);
+        return SetPositionVectorQuat(position_vector, d, resolved);
+    }
+
     int current_state_index = 0;
 
     // Loop through all robots in the state vector
-    for(auto & robot : state_vector.robots){
+    for(int i = 0; i < state_vector.robots.size(); i++){
+        const auto &robot = state_vector.robots[i];
         if(robot.root_name != "-"){
             pose_7 root_position;
 
@@ -1391,28 +1536,31 @@ bool ModelTranslator::SetPositionVectorQuat(MatrixXd position_vector, mjData* d,
             root_position.quat[2] = position_vector(current_state_index + 5, 0);
             root_position.quat[3] = position_vector(current_state_index + 6, 0);
 
-            MuJoCo_helper->SetBodyPoseQuat(robot.root_name, root_position, d);
+            MuJoCo_helper->SetBodyPoseQuat(state_vector.robot_root_handles[i], root_position, d);
 
             current_state_index += 7;
         }
 
-        vector<double> joint_positions;
+        thread_local vector<double> joint_positions;
+        joint_positions.clear();
 
         for(int j = 0; j < robot.joint_names.size(); j++){
             joint_positions.push_back(position_vector(current_state_index + j, 0));
         }
 
-        MuJoCo_helper->SetRobotJointPositions(robot.name, joint_positions, d);
+        MuJoCo_helper->SetRobotJointPositions(state_vector.robot_handles[i], joint_positions, d);
 
         // Increment the current state index by the number of joints in the robot x 2 (for positions and velocities)
         current_state_index += static_cast<int>(robot.joint_names.size());
     }
 
     // -------------------- rigid body position elements ---------------------------
-    for(auto & rigid_body : state_vector.rigid_bodies){
+    for(int i = 0; i < state_vector.rigid_bodies.size(); i++){
+        const auto &rigid_body = state_vector.rigid_bodies[i];
         // Get the body's position and orientation
         pose_7 body_pose;
-        MuJoCo_helper->GetBodyPoseQuat(rigid_body.name, body_pose, d);
+        const body_handle &body = state_vector.rigid_body_handles[i];
+        MuJoCo_helper->GetBodyPoseQuat(body, body_pose, d);
 
         for(int j = 0; j < 3; j++) {
             // Linear positions
@@ -1437,27 +1585,16 @@ bool ModelTranslator::SetPositionVectorQuat(MatrixXd position_vector, mjData* d,
             body_pose.quat[3] = position_vector(current_state_index + 3, 0);
         }
 
-        MuJoCo_helper->SetBodyPoseQuat(rigid_body.name, body_pose, d);
+        MuJoCo_helper->SetBodyPoseQuat(body, body_pose, d);
     }
 
     //  ------------------ Soft body position elements -----------------------------------
-    for(auto & soft_body : state_vector.soft_bodies){
-        // Get the body's position and orientation
-        pose_6 body_pose;
-
-
-        for(int i = 0; i < soft_body.num_vertices; i++){
-
-            MuJoCo_helper->GetSoftBodyVertexPos(soft_body.name, i, body_pose, d);
-            for(int j = 0; j < 3; j++){
-                if(soft_body.vertices[i].active_linear_dof[j]){
-                    body_pose.position[j] = position_vector(current_state_index, 0);
-                    current_state_index++;
-                }
-
-            }
-            MuJoCo_helper->SetSoftBodyVertexPos(soft_body.name, i, body_pose, d);
-        }
+    for(int i = 0; i < state_vector.soft_bodies.size(); i++){
+        const auto &soft_body = state_vector.soft_bodies[i];
+        // All active vertex coordinates of the flex in one pass, inactive coordinates are left untouched
+        const flex_handle &flex = state_vector.soft_body_handles[i];
+        current_state_index += MuJoCo_helper->SetSoftBodyPositions(flex, soft_body,
+                                                                   position_vector.col(0).tail(position_vector.rows() - current_state_index), d);
     }
 
     return true;
@@ -1469,10 +1606,18 @@ bool ModelTranslator::SetVelocityVector(MatrixXd velocity_vector, mjData* d, con
         return false;
     }
 
+    // State vectors built by hand carry no model handles, resolve them on a copy
+    if(!state_vector.HandlesResolved()){
+        struct stateVectorList resolved = state_vector;
+        ResolveStateVectorHandles(resolved);
+        return SetVelocityVector(velocity_vector, d, resolved);
+    }
+
     int current_state_index = 0;
 
     // Loop through all robots in the state vector
-    for(auto & robot : state_vector.robots){
+    for(int i = 0; i < state_vector.robots.size(); i++){
+        const auto &robot = state_vector.robots[i];
         if(robot.root_name != "-"){
             pose_6 root_velocity;
 
@@ -1483,18 +1628,19 @@ bool ModelTranslator::SetVelocityVector(MatrixXd velocity_vector, mjData* d, con
             root_velocity.orientation[1] = velocity_vector(current_state_index + 4, 0);
             root_velocity.orientation[2] = velocity_vector(current_state_index + 5, 0);
 
-            MuJoCo_helper->SetBodyVelocity(robot.root_name, root_velocity, d);
+            MuJoCo_helper->SetBodyVelocity(state_vector.robot_root_handles[i], root_velocity, d);
 
             current_state_index += 6;
         }
 
-        vector<double> joint_velocities;
+        thread_local vector<double> joint_velocities;
+        joint_velocities.clear();
 
         for(int j = 0; j < robot.joint_names.size(); j++){
             joint_velocities.push_back(velocity_vector(current_state_index + j, 0));
         }
         
-        MuJoCo_helper->SetRobotJointsVelocities(robot.name, joint_velocities, d);
+        MuJoCo_helper->SetRobotJointsVelocities(state_vector.robot_handles[i], joint_velocities, d);
 
         // Increment the current state index by the number of joints in the robot x 2 (for positions and velocities)
         current_state_index += static_cast<int>(robot.joint_names.size());
@@ -1502,10 +1648,12 @@ bool ModelTranslator::SetVelocityVector(MatrixXd velocity_vector, mjData* d, con
 
 
     // -------------------- rigid body velocity elemenets --------------------
-    for(auto & bodiesState : state_vector.rigid_bodies){
+    for(int i = 0; i < state_vector.rigid_bodies.size(); i++){
+        const auto &bodiesState = state_vector.rigid_bodies[i];
         // Get the body's position and orientation
         pose_6 body_velocity;
-        MuJoCo_helper->GetBodyVelocity(bodiesState.name, body_velocity, d);
+        const body_handle &body = state_vector.rigid_body_handles[i];
+        MuJoCo_helper->GetBodyVelocity(body, body_velocity, d);
 
         for(int j = 0; j < 3; j++) {
             // Linear positions
@@ -1522,29 +1670,42 @@ bool ModelTranslator::SetVelocityVector(MatrixXd velocity_vector, mjData* d, con
             }
         }
 
-        MuJoCo_helper->SetBodyVelocity(bodiesState.name, body_velocity, d);
+        MuJoCo_helper->SetBodyVelocity(body, body_velocity, d);
     }
 
     //  ------------------ Soft body velocity elements -----------------------------------
-    for(auto & soft_body : state_vector.soft_bodies){
-        // Get the body's position and orientation
-        pose_6 body_pose;
-
-        for(int i = 0; i < soft_body.num_vertices; i++){
-            MuJoCo_helper->GetSoftBodyVertexVel(soft_body.name, i, body_pose, d);
-            for(int j = 0; j < 3; j++){
-                if(soft_body.vertices[i].active_linear_dof[j]){
-                    body_pose.position[j] = velocity_vector(current_state_index, 0);
-                    current_state_index++;
-                }
-            }
-            MuJoCo_helper->SetSoftBodyVertexVel(soft_body.name, i, body_pose, d);
-        }
+    for(int i = 0; i < state_vector.soft_bodies.size(); i++){
+        const auto &soft_body = state_vector.soft_bodies[i];
+        // All active vertex coordinates of the flex in one pass, inactive coordinates are left untouched
+        const flex_handle &flex = state_vector.soft_body_handles[i];
+        current_state_index += MuJoCo_helper->SetSoftBodyVelocities(flex, soft_body,
+                                                                    velocity_vector.col(0).tail(velocity_vector.rows() - current_state_index), d);
     }
 
     return true;
 }
 
+void ModelTranslator::ResolveStateVectorHandles(struct stateVectorList &state_vector) const{
+    state_vector.robot_handles.clear();
+    state_vector.robot_root_handles.clear();
+    state_vector.rigid_body_handles.clear();
+    state_vector.soft_body_handles.clear();
+
+    for(auto & robot : state_vector.robots){
+        state_vector.robot_handles.push_back(MuJoCo_helper->RobotHandle(robot.name));
+        // Fixed base robots have no root body, keep an empty handle so the indices line up
+        state_vector.robot_root_handles.push_back(robot.root_name != "-" ? MuJoCo_helper->BodyHandle(robot.root_name) : body_handle{});
+    }
+
+    for(auto & rigid_body : state_vector.rigid_bodies){
+        state_vector.rigid_body_handles.push_back(MuJoCo_helper->BodyHandle(rigid_body.name));
+    }
+
+    for(auto & soft_body : state_vector.soft_bodies){
+        state_vector.soft_body_handles.push_back(MuJoCo_helper->FlexHandle(soft_body.name));
+    }
+}
+
 void ModelTranslator::ComputeStateDofAdrIndices(mjData* d, const struct stateVectorList &state_vector){
 
     std::string lin_suffixes[3] = {"_x", "_y", "_z"};
@@ -1590,7 +1751,26 @@ void ModelTranslator::ComputeStateDofAdrIndices(mjData* d, const struct stateVec
         }
     }
 
+    // Only reduced order soft body elements move more than one dof
+    state_dof_adr_groups.clear();
+    state_dof_adr_groups.resize(state_dof_adr_indices.size());
+
     for(auto & soft_body: state_vector.soft_bodies){
+        if(soft_body.num_clusters > 0){
+            flex_handle flex = MuJoCo_helper->FlexHandle(soft_body.name);
+            for(int i = 0; i < soft_body.clusters.size(); i++){
+                for(int j = 0; j < 3; j++){
+                    if(soft_body.clusters[i].active_linear_dof[j]){
+                        std::vector<int> dofs = MuJoCo_helper->SoftBodyClusterDofs(flex, soft_body, i, j);
+                        // The axis can be active with no active member vertices, the element then moves no dofs
+                        state_dof_adr_indices.push_back(dofs.empty() ? -1 : dofs[0]);
+                        state_dof_adr_groups.push_back(std::move(dofs));
+                    }
+                }
+            }
+            continue;
+        }
+
         for(int i = 0; i < soft_body.num_vertices; i++){
             for(int j = 0; j < 3; j++){
                 if(soft_body.vertices[i].active_linear_dof[j]){
@@ -1604,6 +1784,7 @@ void ModelTranslator::ComputeStateDofAdrIndices(mjData* d, const struct stateVec
                     const int start = MuJoCo_helper->model->jnt_dofadr[joint_index];
 
                     state_dof_adr_indices.push_back(start + j);
+                    state_dof_adr_groups.emplace_back();
                 }
             }
         }
@@ -1708,6 +1889,91 @@ int ModelTranslator::StateIndexToQposIndex(int state_index, const struct stateVe
     return state_dof_adr_indices[state_index];
 }
 
+void ModelTranslator::SetResidualTarget(const std::string &residual_name, const std::vector<double> &target){
+    bool found = false;
+    for(auto & resid : residual_list){
+        if(resid.name == residual_name){
+            resid.target = target;
+            found = true;
+        }
+    }
+
+    if(!found){
+        std::cerr << "Residual " << residual_name << " not found in the task configuration, exiting \n";
+        exit(1);
+    }
+}
+
+double ModelTranslator::ProjectDofVectorToState(int state_index, const double *dof_vector) const{
+    if(state_dof_adr_indices[state_index] == -1){
+        return 0.0;
+    }
+
+    const std::vector<int> &group = state_dof_adr_groups[state_index];
+    if(group.empty()){
+        return dof_vector[state_dof_adr_indices[state_index]];
+    }
+
+    return StateDirectionDot(state_index, dof_vector) / static_cast<double>(group.size());
+}
+
+void ModelTranslator::LiftStateToDofVector(int state_index, double *dof_vector, double scale) const{
+    if(state_dof_adr_indices[state_index] == -1){
+        return;
+    }
+
+    const std::vector<int> &group = state_dof_adr_groups[state_index];
+    if(group.empty()){
+        dof_vector[state_dof_adr_indices[state_index]] += scale;
+        return;
+    }
+
+    for(int dof_adr : group){
+        dof_vector[dof_adr] += scale;
+    }
+}
+
+double ModelTranslator::StateDirectionDot(int state_index, const double *dof_vector) const{
+    if(state_dof_adr_indices[state_index] == -1){
+        return 0.0;
+    }
+
+    const std::vector<int> &group = state_dof_adr_groups[state_index];
+    if(group.empty()){
+        return dof_vector[state_dof_adr_indices[state_index]];
+    }
+
+    double sum = 0.0;
+    for(int dof_adr : group){
+        sum += dof_vector[dof_adr];
+    }
+    return sum;
+}
+
+std::vector<int> ModelTranslator::ReturnDofRootBodies() const{
+    std::vector<int> root_bodies(current_state_vector.dof);
+    const mjModel *model = MuJoCo_helper->model;
+
+    for(int i = 0; i < current_state_vector.dof; i++){
+        // Elements that move no dofs belong to no body, and are never in contact
+        const int dof_adr = state_dof_adr_indices[i];
+        root_bodies[i] = dof_adr == -1 ? -1 : model->body_rootid[model->dof_bodyid[dof_adr]];
+    }
+
+    return root_bodies;
+}
+
+std::vector<int> ModelTranslator::ReturnControlActuatorIds() const{
+    // Robots are never removed from the state vector, so the full state vector also holds the current controls
+    std::vector<int> actuator_ids;
+    for(const auto & robot : full_state_vector.robots){
+        const std::vector<int> &robot_actuator_ids = MuJoCo_helper->RobotHandle(robot.name).actuator_ids;
+        actuator_ids.insert(actuator_ids.end(), robot_actuator_ids.begin(), robot_actuator_ids.end());
+    }
+
+    return actuator_ids;
+}
+
 void ModelTranslator::InitialiseSystemToStartState(mjData *d) {
 
     // ----------- Reset other variables of the simulation to zero ----------------
@@ -1759,8 +2025,9 @@ void ModelTranslator::InitialiseSystemToStartState(mjData *d) {
             body_vel.orientation[i] = 0.0;
         }
 
-        MuJoCo_helper->SetBodyPoseAngle(rigid_body.name, body_pose, d);
-        MuJoCo_helper->SetBodyVelocity(rigid_body.name, body_vel, d);
+        body_handle body = MuJoCo_helper->BodyHandle(rigid_body.name);
+        MuJoCo_helper->SetBodyPoseAngle(body, body_pose, d);
+        MuJoCo_helper->SetBodyVelocity(body, body_vel, d);
     }
 
     // Initialise soft body poses to start configuration
@@ -255,15 +255,9 @@ void pandaReaching::ReturnRandomGoalState(){
 //    residual_list[0].target[1] = EE_pose.position(1);
 //    residual_list[0].target[2] = EE_pose.position(2);
 
-    // Joint positions
-    for(int i = 0; i < 7; i++){
-        residual_list[0].target[i] = joints_positions[i];
-    }
-
-    // Joint velocities
-    for(int i = 0; i < 7; i++){
-        residual_list[1].target[i] = 0.0;
-    }
+    // Joint positions, then joint velocities (the residual following the joint position rows)
+    SetResidualTarget(residual_list[0].name, joints_positions);
+    SetResidualTarget(residual_list[residual_list[0].resid_dimension].name, std::vector<double>(7, 0.0));
 
 }
 
@@ -0,0 +1,326 @@
+#include "ModelTranslator/ResidualProgram.h"
+
+bool ResidualProgram::Compile(const mjModel *m, const std::vector<residual> &residual_list,
+                              const std::vector<int> &_control_actuator_ids){
+    ops.clear();
+    needs_kinematics = false;
+    control_actuator_ids = _control_actuator_ids;
+
+    int num_typed = 0;
+    for(const auto & resid : residual_list){
+        if(!resid.type.empty()){
+            num_typed++;
+        }
+    }
+
+    if(num_typed == 0){
+        return false;
+    }
+
+    if(num_typed != residual_list.size()){
+        std::cerr << "Either all residuals or none must declare a type, exiting \n";
+        exit(1);
+    }
+
+    ops.reserve(residual_list.size());
+
+    int element = 0;
+    for(int i = 0; i < residual_list.size(); i++){
+        const residual &resid = residual_list[i];
+
+        // Index of this entry within its resid_dimension group
+        if(i > 0 && residual_list[i - 1].name == resid.name){
+            element++;
+        }
+        else{
+            element = 0;
+        }
+
+        residual_op op;
+        op.row = i;
+        op.target_row = i - element;
+        op.analytic = resid.analytic_jacobian;
+
+        if(resid.type == "body_position" || resid.type == "body_velocity"){
+            bool position = resid.type == "body_position";
+            op.type = position ? RESIDUAL_BODY_POSITION : RESIDUAL_BODY_VELOCITY;
+            op.body_a = NameToId(m, mjOBJ_BODY, resid.body, resid.name);
+
+            std::vector<int> axes = resid.axes;
+            if(axes.empty()){
+                axes = {0, 1, 2};
+            }
+
+            for(int axis : axes){
+                if(axis < 0 || axis > (position ? 2 : 5)){
+                    std::cerr << "Invalid axis " << axis << " for residual " << resid.name << ", exiting \n";
+                    exit(1);
+                }
+            }
+
+            if(axes.size() > 3){
+                std::cerr << "Too many axes for residual " << resid.name << ", exiting \n";
+                exit(1);
+            }
+
+            // resid_dimension == 1 gives a single (norm) residual over all axes,
+            // resid_dimension == axes gives a signed residual per axis
+            if(resid.resid_dimension == 1){
+                op.num_axes = static_cast<int>(axes.size());
+                for(int j = 0; j < op.num_axes; j++){
+                    op.axes[j] = axes[j];
+                }
+            }
+            else if(resid.resid_dimension == axes.size()){
+                op.num_axes = 1;
+                op.axes[0] = axes[element];
+                op.target_offset = element;
+            }
+            else{
+                std::cerr << "resid_dimension of " << resid.name << " must be 1 or the number of axes, exiting \n";
+                exit(1);
+            }
+
+            if(position){
+                needs_kinematics = true;
+            }
+            else{
+                // Body velocities are read straight from the free joint, like MuJoCoHelper::GetBodyVelocity
+                if(m->body_jntnum[op.body_a] == 0 || m->jnt_type[m->body_jntadr[op.body_a]] != mjJNT_FREE){
+                    std::cerr << "body_velocity residual " << resid.name << " requires a free body, exiting \n";
+                    exit(1);
+                }
+                op.address = m->jnt_dofadr[m->body_jntadr[op.body_a]];
+            }
+        }
+        else if(resid.type == "body_distance"){
+            op.type = RESIDUAL_BODY_DISTANCE;
+            op.body_a = NameToId(m, mjOBJ_BODY, resid.body, resid.name);
+            op.body_b = NameToId(m, mjOBJ_BODY, resid.body_b, resid.name);
+            needs_kinematics = true;
+        }
+        else if(resid.type == "joint_position" || resid.type == "joint_velocity"){
+            bool position = resid.type == "joint_position";
+            op.type = position ? RESIDUAL_JOINT_POSITION : RESIDUAL_JOINT_VELOCITY;
+
+            if(element >= resid.joints.size()){
+                std::cerr << "Residual " << resid.name << " needs one joint per resid_dimension, exiting \n";
+                exit(1);
+            }
+
+            int joint_id = NameToId(m, mjOBJ_JOINT, resid.joints[element], resid.name);
+            if(m->jnt_type[joint_id] != mjJNT_HINGE && m->jnt_type[joint_id] != mjJNT_SLIDE){
+                std::cerr << "Residual " << resid.name << " only supports hinge and slide joints, exiting \n";
+                exit(1);
+            }
+            op.address = position ? m->jnt_qposadr[joint_id] : m->jnt_dofadr[joint_id];
+            op.dof_address = m->jnt_dofadr[joint_id];
+            op.target_offset = element;
+        }
+        else if(resid.type == "control"){
+            op.type = RESIDUAL_CONTROL;
+
+            if(element >= resid.actuators.size()){
+                std::cerr << "Residual " << resid.name << " needs one actuator per resid_dimension, exiting \n";
+                exit(1);
+            }
+
+            op.address = NameToId(m, mjOBJ_ACTUATOR, resid.actuators[element], resid.name);
+            op.target_offset = element;
+        }
+        else{
+            std::cerr << "Unknown residual type " << resid.type << " for residual " << resid.name << ", exiting \n";
+            exit(1);
+        }
+
+        ops.push_back(op);
+    }
+
+    return true;
+}
+
+void ResidualProgram::Evaluate(const mjModel *m, mjData *d, const std::vector<residual> &residual_list,
+                               MatrixXd &residuals) const{
+
+    if(needs_kinematics){
+        mj_kinematics(m, d);
+    }
+
+    for(const auto & op : ops){
+        const residual &resid = residual_list[op.target_row];
+        double value = 0.0;
+
+        switch(op.type){
+            case RESIDUAL_BODY_POSITION:
+            case RESIDUAL_BODY_VELOCITY: {
+                const mjtNum *source = op.type == RESIDUAL_BODY_POSITION ? d->xpos + 3 * op.body_a
+                                                                          : d->qvel + op.address;
+                if(op.num_axes == 1){
+                    value = source[op.axes[0]] - Target(resid, op.target_offset);
+                }
+                else{
+                    double sum = 0.0;
+                    for(int j = 0; j < op.num_axes; j++){
+                        double diff = source[op.axes[j]] - Target(resid, j);
+                        sum += diff * diff;
+                    }
+                    value = sqrt(sum);
+                }
+                break;
+            }
+            case RESIDUAL_BODY_DISTANCE: {
+                double sum = 0.0;
+                for(int j = 0; j < 3; j++){
+                    double diff = d->xpos[3 * op.body_a + j] - d->xpos[3 * op.body_b + j];
+                    sum += diff * diff;
+                }
+                value = sqrt(sum) - Target(resid, 0);
+                break;
+            }
+            case RESIDUAL_JOINT_POSITION:
+                value = d->qpos[op.address] - Target(resid, op.target_offset);
+                break;
+            case RESIDUAL_JOINT_VELOCITY:
+                value = d->qvel[op.address] - Target(resid, op.target_offset);
+                break;
+            case RESIDUAL_CONTROL:
+                value = d->ctrl[op.address] - Target(resid, op.target_offset);
+                break;
+        }
+
+        residuals(op.row, 0) = value;
+    }
+}
+
+void ResidualProgram::Jacobians(const mjModel *m, mjData *d, const std::vector<residual> &residual_list,
+                                MatrixXd &J_pos, MatrixXd &J_vel, MatrixXd &J_ctrl) const{
+    const int nv = m->nv;
+
+    J_pos.setZero(static_cast<int>(residual_list.size()), nv);
+    J_vel.setZero(static_cast<int>(residual_list.size()), nv);
+    J_ctrl.setZero(static_cast<int>(residual_list.size()), m->nu);
+
+    if(needs_kinematics){
+        // mj_jacBody needs body poses as well as com based dof axes
+        mj_kinematics(m, d);
+        mj_comPos(m, d);
+    }
+
+    mj_markStack(d);
+    mjtNum *jac_a = mj_stackAllocNum(d, 3 * nv);
+    mjtNum *jac_b = mj_stackAllocNum(d, 3 * nv);
+    Map<Matrix<double, 3, Dynamic, RowMajor>> J_a(jac_a, 3, nv);
+    Map<Matrix<double, 3, Dynamic, RowMajor>> J_b(jac_b, 3, nv);
+
+    for(const auto & op : ops){
+        if(!op.analytic){
+            continue;
+        }
+
+        const residual &resid = residual_list[op.target_row];
+
+        switch(op.type){
+            case RESIDUAL_BODY_POSITION:
+            case RESIDUAL_BODY_VELOCITY: {
+                bool position = op.type == RESIDUAL_BODY_POSITION;
+                if(position){
+                    mj_jacBody(m, d, jac_a, nullptr, op.body_a);
+                }
+                const mjtNum *source = position ? d->xpos + 3 * op.body_a : d->qvel + op.address;
+
+                // d|e| / de = e / |e|, a single axis is signed so the gradient is one
+                double norm = 0.0;
+                if(op.num_axes > 1){
+                    for(int j = 0; j < op.num_axes; j++){
+                        double diff = source[op.axes[j]] - Target(resid, j);
+                        norm += diff * diff;
+                    }
+                    norm = sqrt(norm);
+                    if(norm < 1e-12){
+                        break;
+                    }
+                }
+
+                for(int j = 0; j < op.num_axes; j++){
+                    double scale = 1.0;
+                    if(op.num_axes > 1){
+                        scale = (source[op.axes[j]] - Target(resid, j)) / norm;
+                    }
+
+                    if(position){
+                        J_pos.row(op.row) += scale * J_a.row(op.axes[j]);
+                    }
+                    else{
+                        J_vel(op.row, op.address + op.axes[j]) += scale;
+                    }
+                }
+                break;
+            }
+            case RESIDUAL_BODY_DISTANCE: {
+                mj_jacBody(m, d, jac_a, nullptr, op.body_a);
+                mj_jacBody(m, d, jac_b, nullptr, op.body_b);
+
+                Vector3d diff;
+                for(int j = 0; j < 3; j++){
+                    diff(j) = d->xpos[3 * op.body_a + j] - d->xpos[3 * op.body_b + j];
+                }
+                double norm = diff.norm();
+                if(norm < 1e-12){
+                    break;
+                }
+
+                J_pos.row(op.row) = (diff / norm).transpose() * (J_a - J_b);
+                break;
+            }
+            case RESIDUAL_JOINT_POSITION:
+                J_pos(op.row, op.dof_address) = 1.0;
+                break;
+            case RESIDUAL_JOINT_VELOCITY:
+                J_vel(op.row, op.dof_address) = 1.0;
+                break;
+            case RESIDUAL_CONTROL:
+                J_ctrl(op.row, op.address) = 1.0;
+                break;
+        }
+    }
+
+    mj_freeStack(d);
+}
+
+bool ResidualProgram::AllAnalytic() const{
+    if(ops.empty()){
+        return false;
+    }
+
+    for(const auto & op : ops){
+        if(!op.analytic){
+            return false;
+        }
+    }
+    return true;
+}
+
+bool ResidualProgram::AnyAnalytic() const{
+    for(const auto & op : ops){
+        if(op.analytic){
+            return true;
+        }
+    }
+    return false;
+}
+
+double ResidualProgram::Target(const residual &resid, int index){
+    if(index < resid.target.size()){
+        return resid.target[index];
+    }
+    return 0.0;
+}
+
+int ResidualProgram::NameToId(const mjModel *m, mjtObj type, const std::string &name, const std::string &residual_name){
+    int id = mj_name2id(m, type, name.c_str());
+    if(id == -1){
+        std::cerr << "Could not find " << name << " for residual " << residual_name << ", exiting \n";
+        exit(1);
+    }
+    return id;
+}
@@ -10,6 +10,13 @@ GradDescent::GradDescent(std::shared_ptr<ModelTranslator> _modelTranslator, std:
 
     maxHorizon = _maxHorizon;
 
+    // A is kept as a full 2*dof x 2*dof matrix with the identity position block filled in here, the compact
+    // velocity-row layout would be written over that block
+    if(compact_dynamics){
+        std::cerr << "compact_dynamics is not supported by GradDescent, exiting \n";
+        exit(1);
+    }
+
     // initialise all vectors of matrices
     for(int i = 0; i < maxHorizon; i++){
         // Cost matrices
@@ -17,6 +17,11 @@ Optimiser::Optimiser(std::shared_ptr<ModelTranslator> _modelTranslator, std::sha
     activeKeyPointMethod.accell_thresholds = activeModelTranslator->jerk_thresholds;
     activeKeyPointMethod.iterative_error_threshold = activeModelTranslator->iterative_error_threshold;
     activeKeyPointMethod.velocity_change_thresholds = activeModelTranslator->velocity_change_thresholds;
+    activeKeyPointMethod.interpolation = activeModelTranslator->interpolation_method;
+    activeKeyPointMethod.contact_keypoints = activeModelTranslator->contact_keypoints;
+    activeKeyPointMethod.error_estimation = activeModelTranslator->error_estimation;
+    activeKeyPointMethod.error_sample_percentage = activeModelTranslator->error_sample_percentage;
+    activeKeyPointMethod.target_percentage_derivs = activeModelTranslator->target_percentage_derivs;
 
     keypoint_generator = std::make_shared<KeypointGenerator>(activeDifferentiator,
                                                              MuJoCo_helper,
@@ -25,6 +30,76 @@ Optimiser::Optimiser(std::shared_ptr<ModelTranslator> _modelTranslator, std::sha
 
     keypoint_generator->SetKeypointMethod(activeKeyPointMethod);
     keypoint_generator->PrintKeypointMethod();
+
+    // Parallelism settings from the general config file
+    std::vector<int> available_cores = CurrentThreadCores();
+    int workers = activeYamlReader->num_worker_threads;
+    if(workers <= 0){
+        workers = std::max(1, static_cast<int>(available_cores.size()) - 1);
+    }
+
+    // If the simulation thread has a reserved core and no explicit affinity is set, keep workers on the
+    // cores this process is allowed to use, minus that core
+    std::vector<int> cores = activeYamlReader->cpu_affinity;
+    if(cores.empty() && activeYamlReader->sim_thread_core >= 0){
+        for(int core : available_cores){
+            if(core != activeYamlReader->sim_thread_core){
+                cores.push_back(core);
+            }
+        }
+    }
+
+    SetParallelism(workers, activeYamlReader->num_parallel_rollouts, cores);
+
+    derivative_reuse_threshold = activeYamlReader->derivative_reuse_threshold;
+    low_rank_cost_hessian = activeYamlReader->low_rank_cost_hessian;
+
+    compact_dynamics = activeYamlReader->compact_dynamics;
+    if(compact_dynamics && MuJoCo_helper->model->opt.integrator == mjINT_RK4){
+        std::cerr << "compact_dynamics assumes a semi-implicit Euler step, not supported with the RK4 integrator \n";
+        exit(1);
+    }
+}
+
+void Optimiser::SetParallelism(int _num_worker_threads, int _num_parallel_rollouts, const std::vector<int> &_worker_cores){
+    if(_num_worker_threads < 1 || _num_parallel_rollouts < 1){
+        std::cerr << "number of worker threads and parallel rollouts must be at least 1, exiting \n";
+        exit(1);
+    }
+
+    num_worker_threads = _num_worker_threads;
+    worker_cores = _worker_cores;
+
+    // Keep already allocated rollout buffers the same shape when the number of rollouts changes
+    if(!rollout_data.empty() && _num_parallel_rollouts != num_parallel_rollouts){
+        std::vector<mujoco_data_min> data_horizon = rollout_data[0];
+        rollout_data.resize(_num_parallel_rollouts, data_horizon);
+    }
+    num_parallel_rollouts = _num_parallel_rollouts;
+
+    // Derivative workers and forwards pass rollouts each need their own finite differencing data
+    MuJoCo_helper->ResizeFiniteDifferencingData(std::max(num_worker_threads, num_parallel_rollouts));
+    activeDifferentiator->ResizeThreadBuffers(std::max(num_worker_threads, num_parallel_rollouts));
+    keypoint_generator->num_threads = num_worker_threads;
+    keypoint_generator->worker_cores = worker_cores;
+
+    if(verbose_output){
+        std::cout << "optimiser parallelism - worker threads: " << num_worker_threads
+                  << " parallel rollouts: " << num_parallel_rollouts
+                  << " pinned cores: " << worker_cores.size() << "\n";
+    }
+}
+
+void Optimiser::PinWorkerThread(int worker_index) const{
+    if(worker_cores.empty()){
+        return;
+    }
+
+    PinCurrentThreadToCore(worker_cores[worker_index % worker_cores.size()]);
+}
+
+void Optimiser::PinOptimiserThread() const{
+    PinCurrentThreadToCores(worker_cores);
 }
 
 bool Optimiser::CheckForConvergence(double old_cost, double new_cost){
@@ -40,6 +115,121 @@ void Optimiser::Resize(int new_num_dofs, int new_num_ctrl, int new_horizon){
 
 }
 
+void Optimiser::ShiftHorizon(int shift){
+    if(shift <= 0){
+        return;
+    }
+
+    // No overlap between the old and new horizon, nothing to reuse
+    if(shift >= horizon_length || dynamics_cache_valid.size() != horizon_length + 1){
+        InvalidateDerivativeCache();
+        return;
+    }
+
+    ShiftTimeIndexedVector(A, shift);
+    ShiftTimeIndexedVector(B, shift);
+    ShiftTimeIndexedVector(l_x, shift);
+    ShiftTimeIndexedVector(l_xx, shift);
+    ShiftTimeIndexedVector(l_u, shift);
+    ShiftTimeIndexedVector(l_uu, shift);
+    ShiftTimeIndexedVector(r_x, shift);
+    ShiftTimeIndexedVector(r_u, shift);
+
+    ShiftTimeIndexedVector(X_cached, shift);
+    ShiftTimeIndexedVector(U_cached, shift);
+    ShiftTimeIndexedVector(dynamics_cache_valid, shift);
+    ShiftTimeIndexedVector(residual_cache_valid, shift);
+
+    // Padded timesteps at the end of the horizon have never been linearised. The terminal state is also new, as
+    // the old terminal timestep has moved into the middle of the horizon.
+    for(int t = horizon_length - shift; t < horizon_length + 1; t++){
+        std::fill(dynamics_cache_valid[t].begin(), dynamics_cache_valid[t].end(), false);
+        residual_cache_valid[t] = false;
+        X_cached[t] = MatrixXd();
+        if(t < horizon_length){
+            U_cached[t] = MatrixXd();
+        }
+    }
+}
+
+feedback_policy Optimiser::ReturnFeedbackPolicy(){
+    feedback_policy policy;
+    policy.state_vector = activeModelTranslator->current_state_vector;
+    policy.U.assign(U_old.begin(), U_old.begin() + horizon_length);
+
+    std::vector<MatrixXd> gains = ReturnFeedbackGains();
+    int state_dof = policy.state_vector.dof;
+
+    // Open loop policy if there are no gains that match the current state vector
+    if(gains.size() < horizon_length || gains[0].cols() != 2 * state_dof){
+        return policy;
+    }
+    policy.K.assign(gains.begin(), gains.begin() + horizon_length);
+
+    int nq = MuJoCo_helper->model->nq;
+    for(int t = 0; t < horizon_length; t++){
+        mjData *d = MuJoCo_helper->saved_systems_state_list[t];
+        policy.X.push_back(activeModelTranslator->ReturnStateVectorQuaternions(d, policy.state_vector));
+        policy.q_pos.emplace_back(d->qpos, d->qpos + nq);
+    }
+
+    for(int j = 0; j < state_dof; j++){
+        policy.q_pos_indices.push_back(activeModelTranslator->StateIndexToQposIndex(j, policy.state_vector));
+        policy.q_pos_groups.push_back(activeModelTranslator->state_dof_adr_groups[j]);
+    }
+
+    return policy;
+}
+
+MatrixXd Optimiser::FeedbackPolicyControl(const feedback_policy &policy, int t, mjData *d){
+    MatrixXd control = policy.U[t];
+
+    if(t < policy.K.size()){
+        int state_dof = policy.state_vector.dof;
+        int state_dof_quat = policy.state_vector.dof_quat;
+
+        MatrixXd X_current = activeModelTranslator->ReturnStateVectorQuaternions(d, policy.state_vector);
+        MatrixXd state_feedback(2 * state_dof, 1);
+
+        // If there are no angular dofs, simply subtract the two
+        if(state_dof == state_dof_quat){
+            state_feedback = X_current - policy.X[t];
+        }
+        else{
+            std::vector<double> pos_diff(MuJoCo_helper->model->nv);
+            mj_differentiatePos(MuJoCo_helper->model, pos_diff.data(), 1.0, policy.q_pos[t].data(), d->qpos);
+
+            for(int j = 0; j < state_dof; j++){
+                if(policy.q_pos_indices[j] == -1){
+                    state_feedback(j) = 0.0;
+                }
+                else if(policy.q_pos_groups[j].empty()){
+                    state_feedback(j) = pos_diff[policy.q_pos_indices[j]];
+                }
+                else{
+                    double sum = 0.0;
+                    for(int dof_adr : policy.q_pos_groups[j]){
+                        sum += pos_diff[dof_adr];
+                    }
+                    state_feedback(j) = sum / static_cast<double>(policy.q_pos_groups[j].size());
+                }
+                state_feedback(j + state_dof) = X_current(state_dof_quat + j) - policy.X[t](state_dof_quat + j);
+            }
+        }
+
+        control += policy.K[t] * state_feedback;
+    }
+
+    // Clamp torque within limits
+    MatrixXd control_limits = activeModelTranslator->ReturnControlLimits(policy.state_vector);
+    for(int i = 0; i < control.rows(); i++){
+        if(control(i) > control_limits(2*i+1, 0)) control(i) = control_limits(2*i+1, 0);
+        if(control(i) < control_limits(2*i, 0)) control(i) = control_limits(2*i, 0);
+    }
+
+    return control;
+}
+
 keypoint_method Optimiser::ReturnCurrentKeypointMethod(){
     return keypoint_generator->ReturnCurrentKeypointMethod();
 }
@@ -52,12 +242,8 @@ void Optimiser::SetCurrentKeypointMethod(keypoint_method _keypoint_method){
 void Optimiser::SmoothDerivativesAtContact(int smoothing){
     // Get the contact list (this is hard coded for toy piston contact example)
 
-    std::vector<bool> contact_list;
-    for(int t = 0; t < horizon_length; t++){
-        bool contact = MuJoCo_helper->CheckPairForCollisions("piston_rod", "goal",
-                                                             MuJoCo_helper->saved_systems_state_list[t]);
-        contact_list.push_back(contact);
-    }
+    std::vector<bool> contact_list = MuJoCo_helper->TrajectoryPairContacts(MuJoCo_helper->BodyHandle("piston_rod"),
+                                                                          MuJoCo_helper->BodyHandle("goal"), horizon_length);
 
     // Find the contact making point
     int contact_time_step = 0;
@@ -100,6 +286,7 @@ void Optimiser::GenerateDerivatives(){
     average_percent_derivs /= activeModelTranslator->current_state_vector.dof;
 
     percentage_derivs_per_iteration.push_back(average_percent_derivs);
+    percentage_derivs_reused_per_iteration.push_back(percentage_derivs_reused);
 
     // Filter dynamics derivatives if required
     if(filteringMethod != "none"){
@@ -170,6 +357,9 @@ void Optimiser::GenerateDerivatives(){
 
 void Optimiser::ComputeKeypoints(){
     //auto start_keypoint_time = high_resolution_clock::now();
+    if(keypoint_generator->ReturnCurrentKeypointMethod().contact_keypoints){
+        keypoint_generator->dof_root_bodies = activeModelTranslator->ReturnDofRootBodies();
+    }
     keypoint_generator->GenerateKeyPoints(X_old, A, B);
     keypoint_generator->ResetCache();
     //std::cout << "gen keypoints time: " << duration_cast<microseconds>(high_resolution_clock::now() - start_keypoint_time).count() / 1000.0f << " ms\n";
@@ -180,10 +370,25 @@ void Optimiser::ComputeDynamicsDerivatives(){
     // as they have already been computed
     if(activeKeyPointMethod.name != "iterative_error") {
         auto start_fd_time = high_resolution_clock::now();
-        ComputeDynamicsDerivativesAtKeypoints(keypoint_generator->keypoints);
+        UpdateDerivativeCacheTrust();
+        ComputeDynamicsDerivativesAtKeypoints(RemoveCachedKeypoints(keypoint_generator->keypoints));
         auto stop_fd_time = high_resolution_clock::now();
         auto duration_fd_time = duration_cast<microseconds>(stop_fd_time - start_fd_time);
     }
+    else{
+        // Derivatives computed inside the keypoint generator are about the current nominal trajectory
+        InvalidateDerivativeCache();
+        UpdateDerivativeCacheTrust();
+        percentage_derivs_reused = 0.0;
+    }
+
+    // Keypoint columns now hold finite-differenced values, all other columns are about to be overwritten by interpolation
+    for(int t = 0; t < horizon_length; t++){
+        std::fill(dynamics_cache_valid[t].begin(), dynamics_cache_valid[t].end(), false);
+        for(int col : keypoint_generator->keypoints[t]){
+            dynamics_cache_valid[t][col] = true;
+        }
+    }
 
 
 
@@ -192,23 +397,55 @@ void Optimiser::ComputeDynamicsDerivatives(){
     keypoint_generator->InterpolateDerivatives(keypoint_generator->keypoints, horizon_length,
                                                A, B, r_x, r_u, activeYamlReader->costDerivsFD,
                                                activeModelTranslator->current_state_vector.num_ctrl);
+
+    // Measure the interpolation error at a few sampled columns, sets keypoint density for the next iteration
+    keypoint_generator->EstimateInterpolationError(A, B);
 }
 
 void Optimiser::ComputeCostDerivatives(){
     // Compute residual derivatives over the entire trajectory
     auto time_start_residual_derivs = high_resolution_clock::now();
     ComputeResidualDerivatives();
-    // If finite differencing is used for cost derivatives, compute cost derivs from residual derivatives
-    for(int t = 0; t < horizon_length; t++){
-        activeModelTranslator->CostDerivativesFromResiduals(activeModelTranslator->current_state_vector,
-                                                            l_x[t], l_xx[t], l_u[t], l_uu[t],
-                                                            residuals[t], r_x[t], r_u[t], false);
+
+    if(low_rank_cost_hessian){
+        l_xx_factor.resize(horizon_length);
     }
 
-    activeModelTranslator->CostDerivativesFromResiduals(activeModelTranslator->current_state_vector,
-                                                        l_x[horizon_length - 1], l_xx[horizon_length - 1],
-                                                        l_u[horizon_length - 1], l_uu[horizon_length - 1],
-                                                        residuals[horizon_length - 1], r_x[horizon_length - 1], r_u[horizon_length - 1], true);
+    // Cost derivatives from residual derivatives, each timestep writes only its own l_x, l_xx, l_u, l_uu so
+    // the horizon is split across the worker threads
+    std::atomic<int> next_time_index(0);
+    auto worker = [&](int worker_index){
+        PinWorkerThread(worker_index);
+
+        while(true){
+            int t = next_time_index.fetch_add(1);
+            if(t >= horizon_length){
+                break;
+            }
+
+            // Terminal weights at the last timestep
+            bool terminal = t == horizon_length - 1;
+            activeModelTranslator->CostDerivativesFromResiduals(activeModelTranslator->current_state_vector,
+                                                                l_x[t], l_xx[t], l_u[t], l_uu[t],
+                                                                residuals[t], r_x[t], r_u[t], terminal,
+                                                                !low_rank_cost_hessian);
+
+            if(low_rank_cost_hessian){
+                l_xx_factor[t].noalias() = activeModelTranslator->ResidualHessianWeights(terminal).asDiagonal() * r_x[t];
+            }
+        }
+    };
+
+    // The calling thread only waits, pinning it to a single worker core would outlive this pool
+    int threads = std::max(1, std::min(num_worker_threads, horizon_length));
+    std::vector<std::thread> thread_pool;
+    for(int i = 0; i < threads; i++){
+        thread_pool.emplace_back(worker, i);
+    }
+
+    for(std::thread &thread : thread_pool){
+        thread.join();
+    }
 
     auto time_stop_residual_derivs = high_resolution_clock::now();
     std::cout << "time resid derivs: " << duration_cast<microseconds>(time_stop_residual_derivs - time_start_residual_derivs).count() / 1000.0f << " ms\n";
@@ -216,15 +453,28 @@ void Optimiser::ComputeCostDerivatives(){
 
 void Optimiser::ComputeResidualDerivatives(){
 
+    if(residual_cache_valid.size() != horizon_length + 1){
+        UpdateDerivativeCacheTrust();
+    }
+
+    // Only recompute residual derivatives at timesteps that are not reusable from the derivative cache
+    residual_time_indices.clear();
+    for(int t = 0; t < horizon_length + 1; t++){
+        if(!residual_cache_valid[t]){
+            residual_time_indices.push_back(t);
+        }
+    }
+    percentage_residual_derivs_reused = 100.0 * (horizon_length + 1 - static_cast<int>(residual_time_indices.size())) / (horizon_length + 1);
+
     current_iteration = 0;
-    num_threads_iterations = horizon_length + 1;
+    num_threads_iterations = static_cast<int>(residual_time_indices.size());
     tasks_residual_derivs.clear();
 
-    for (int i = 0; i < horizon_length + 1; ++i) {
+    for (int i = 0; i < residual_time_indices.size(); ++i) {
         tasks_residual_derivs.push_back(&Differentiator::ResidualDerivatives);
     }
 
-    const int num_threads = std::thread::hardware_concurrency() - 1;  // Get the number of available CPU cores
+    const int num_threads = num_worker_threads;
     std::vector<std::thread> thread_pool;
     for (int i = 0; i < num_threads; ++i) {
         thread_pool.push_back(std::thread(&Optimiser::WorkerComputeResidualDerivatives, this, i));
@@ -233,34 +483,144 @@ void Optimiser::ComputeResidualDerivatives(){
     for (std::thread& thread : thread_pool) {
         thread.join();
     }
+
+    for(int t : residual_time_indices){
+        residual_cache_valid[t] = true;
+    }
 }
 
+void Optimiser::AddStateCostHessian(int t, MatrixXd &Q_xx) const{
+    if(low_rank_cost_hessian){
+        // Rank num_residuals update, never forms a dense l_xx
+        Q_xx.noalias() += r_x[t].transpose() * l_xx_factor[t];
+    }
+    else{
+        Q_xx += l_xx[t];
+    }
+}
 
-void Optimiser::ComputeDynamicsDerivativesAtKeypoints(std::vector<std::vector<int>> keyPoints){
+void Optimiser::DynamicsProducts(int t, const MatrixXd &V_x, const MatrixXd &V_xx,
+                                 MatrixXd &A_T_V_x, MatrixXd &A_T_V_xx_A, MatrixXd &B_T_V_xx_A) const{
+    const MatrixXd &A_t = A[t];
+    const MatrixXd &B_t = B[t];
+
+    if(A_t.rows() == 2 * dof){
+        MatrixXd V_xx_A = V_xx * A_t;
+        A_T_V_x.noalias() = A_t.transpose() * V_x;
+        A_T_V_xx_A.noalias() = A_t.transpose() * V_xx_A;
+        B_T_V_xx_A.noalias() = B_t.transpose() * V_xx_A;
+        return;
+    }
 
-    MuJoCo_helper->InitModelForFiniteDifferencing();
+    // Compact A holds the velocity rows A_v only. With E = [I 0; 0 0] and C = [h I; I], A = E + C * A_v, so every
+    // product is expanded blockwise and costs roughly a third of the dense products.
+    const double h = MuJoCo_helper->ReturnModelTimeStep();
+    MatrixXd W = h * V_xx.leftCols(dof) + V_xx.rightCols(dof);      // V_xx * C
+    MatrixXd G = h * W.topRows(dof) + W.bottomRows(dof);            // C^T * V_xx * C
+    MatrixXd cross = W.topRows(dof) * A_t;                          // Top rows of E^T * V_xx * C * A_v
 
-    std::vector<int> timeIndices;
-    for(int i = 0; i < keyPoints.size(); i++){
-        if(!keyPoints[i].empty()){
-            timeIndices.push_back(i);
+    A_T_V_x.noalias() = A_t.transpose() * (h * V_x.topRows(dof) + V_x.bottomRows(dof));
+    A_T_V_x.topRows(dof) += V_x.topRows(dof);
+
+    A_T_V_xx_A.noalias() = A_t.transpose() * (G * A_t);
+    A_T_V_xx_A.topRows(dof) += cross;
+    A_T_V_xx_A.leftCols(dof) += cross.transpose();
+    A_T_V_xx_A.topLeftCorner(dof, dof) += V_xx.topLeftCorner(dof, dof);
+
+    B_T_V_xx_A.noalias() = (B_t.transpose() * W) * A_t;
+    B_T_V_xx_A.leftCols(dof) += B_t.transpose() * V_xx.leftCols(dof);
+}
+
+void Optimiser::InvalidateDerivativeCache(){
+    X_cached.assign(horizon_length + 1, MatrixXd());
+    U_cached.assign(horizon_length, MatrixXd());
+    dynamics_cache_valid.assign(horizon_length + 1, std::vector<bool>(activeModelTranslator->current_state_vector.dof, false));
+    residual_cache_valid.assign(horizon_length + 1, false);
+}
+
+void Optimiser::UpdateDerivativeCacheTrust(){
+    int dof_current = activeModelTranslator->current_state_vector.dof;
+
+    // Cache no longer matches the problem dimensions
+    if(X_cached.size() != horizon_length + 1 || U_cached.size() != horizon_length ||
+       dynamics_cache_valid.empty() || dynamics_cache_valid[0].size() != dof_current){
+        InvalidateDerivativeCache();
+    }
+
+    // Filtering modifies the dynamics derivatives in place, so they cannot be reused
+    bool reuse_enabled = derivative_reuse_threshold > 0.0 && filteringMethod == "none";
+
+    // Nothing is reused, so there is no reference trajectory to keep. Clearing it means the cache rebuilds
+    // from scratch if reuse is enabled again
+    if(!reuse_enabled){
+        for(int t = 0; t < horizon_length + 1; t++){
+            X_cached[t] = MatrixXd();
+            if(t < horizon_length){
+                U_cached[t] = MatrixXd();
+            }
+            std::fill(dynamics_cache_valid[t].begin(), dynamics_cache_valid[t].end(), false);
+            residual_cache_valid[t] = false;
         }
+        return;
     }
 
-    // Loop through keypoints and delete any entries that have no keypoints
-    for(int i = 0; i < keyPoints.size(); i++){
-        if(keyPoints[i].empty()){
-            keyPoints.erase(keyPoints.begin() + i);
-            i--;
+    for(int t = 0; t < horizon_length + 1; t++){
+        bool trusted = X_cached[t].rows() == X_old[t].rows();
+
+        if(trusted){
+            double change = (X_old[t] - X_cached[t]).cwiseAbs().maxCoeff();
+            if(t < horizon_length){
+                if(U_cached[t].rows() != U_old[t].rows()){
+                    trusted = false;
+                }
+                else{
+                    change = std::max(change, (U_old[t] - U_cached[t]).cwiseAbs().maxCoeff());
+                }
+            }
+
+            if(change >= derivative_reuse_threshold){
+                trusted = false;
+            }
+        }
+
+        // Not trusted, recompute everything at this timestep about the current nominal trajectory
+        if(!trusted){
+            X_cached[t] = X_old[t];
+            if(t < horizon_length){
+                U_cached[t] = U_old[t];
+            }
+            std::fill(dynamics_cache_valid[t].begin(), dynamics_cache_valid[t].end(), false);
+            residual_cache_valid[t] = false;
         }
     }
+}
 
-    current_iteration = 0;
-    num_threads_iterations = static_cast<int>(keyPoints.size());
-    timeIndicesGlobal = timeIndices;
+std::vector<std::vector<int>> Optimiser::RemoveCachedKeypoints(const std::vector<std::vector<int>> &keyPoints){
+    std::vector<std::vector<int>> keypoints_to_compute(keyPoints.size());
+    int num_cols = 0;
+    int num_reused = 0;
 
-    // TODO - remove this? It is used for WorkerComputeDerivatives function to compute derivatives in parallel
-    keypointsGlobal = keyPoints;
+    for(int t = 0; t < keyPoints.size(); t++){
+        for(int col : keyPoints[t]){
+            num_cols++;
+            if(dynamics_cache_valid[t][col]){
+                num_reused++;
+            }
+            else{
+                keypoints_to_compute[t].push_back(col);
+            }
+        }
+    }
+
+    percentage_derivs_reused = num_cols > 0 ? 100.0 * num_reused / num_cols : 0.0;
+
+    return keypoints_to_compute;
+}
+
+
+void Optimiser::ComputeDynamicsDerivativesAtKeypoints(const std::vector<std::vector<int>> &keyPoints){
+
+    MuJoCo_helper->InitModelForFiniteDifferencing();
 
     // compute derivs serially
 //    for(int i = 0; i < horizon_length; i++){
@@ -270,14 +630,12 @@ void Optimiser::ComputeDynamicsDerivativesAtKeypoints(std::vector<std::vector<in
 //        }
 //    }
 
+    const int num_threads = num_worker_threads;
+
     // Setup all the required tasks
-    tasks_dynamics_derivs.clear();
-    for (int i = 0; i < keyPoints.size(); ++i) {
-        tasks_dynamics_derivs.push_back(&Differentiator::DynamicsDerivatives);
-    }
+    ScheduleFiniteDifferencingTasks(keyPoints, num_threads);
 
-    // Get the number of threads available
-    const int num_threads = std::thread::hardware_concurrency() - 1;  // Get the number of available CPU cores
+    auto time_fd_start = high_resolution_clock::now();
     std::vector<std::thread> thread_pool;
     for (int i = 0; i < num_threads; ++i) {
         thread_pool.push_back(std::thread(&Optimiser::WorkerComputeDerivatives, this, i));
@@ -286,10 +644,49 @@ void Optimiser::ComputeDynamicsDerivativesAtKeypoints(std::vector<std::vector<in
     for (std::thread& thread : thread_pool) {
         thread.join();
     }
+    double time_fd_us = static_cast<double>(duration_cast<microseconds>(high_resolution_clock::now() - time_fd_start).count());
       
     MuJoCo_helper->ResetModelAfterFiniteDifferencing();
 
-    auto time_cost_start = std::chrono::high_resolution_clock::now();
+    // Update the per-step time estimates at each time index from the measured task times
+    std::vector<double> measured_time(fd_step_time_estimate_us.size(), 0.0);
+    std::vector<int> measured_steps(fd_step_time_estimate_us.size(), 0);
+    for(const auto &task : fd_tasks){
+        measured_time[task.time_index] += task.measured_time_us;
+        // + 1 for the unperturbed step every call makes
+        measured_steps[task.time_index] += NumStepsForColumns(task.cols) + 1;
+    }
+
+    for(int t = 0; t < fd_step_time_estimate_us.size(); t++){
+        if(measured_steps[t] == 0){
+            continue;
+        }
+
+        double step_time = measured_time[t] / measured_steps[t];
+        if(fd_step_time_estimate_us[t] <= 0.0){
+            fd_step_time_estimate_us[t] = step_time;
+        }
+        else{
+            fd_step_time_estimate_us[t] = (1 - fd_step_time_smoothing) * fd_step_time_estimate_us[t]
+                                            + fd_step_time_smoothing * step_time;
+        }
+    }
+
+    // Per thread utilisation
+    fd_thread_utilisation.resize(num_threads);
+    for(int i = 0; i < num_threads; i++){
+        fd_thread_utilisation[i] = time_fd_us > 0 ? fd_thread_busy_time_us[i] / time_fd_us : 0.0;
+    }
+
+    if(verbose_output){
+        std::cout << "fd tasks: " << fd_tasks.size() << " | thread utilisation (%): ";
+        for(int i = 0; i < num_threads; i++){
+            std::cout << static_cast<int>(100 * fd_thread_utilisation[i]) << " ";
+        }
+        std::cout << "\n";
+    }
+
+//    auto time_cost_start = std::chrono::high_resolution_clock::now();
 
 //    if(!activeYamlReader->costDerivsFD){
 //        for(int i = 0; i < horizon_length; i++){
@@ -306,34 +703,158 @@ void Optimiser::ComputeDynamicsDerivativesAtKeypoints(std::vector<std::vector<in
 //    std::cout << "time cost derivs: " << duration_cast<microseconds>(high_resolution_clock::now() - time_cost_start).count() / 1000.0f << " ms\n";
 }
 
-void Optimiser::WorkerComputeDerivatives(int threadId) {
-    while (true) {
-        int iteration = current_iteration.fetch_add(1);
-        if (iteration >= num_threads_iterations) {
-            break;  // All iterations done
+int Optimiser::NumStepsForColumns(const std::vector<int> &cols) const{
+    int num_ctrl_current = activeModelTranslator->current_state_vector.num_ctrl;
+    int num_steps = 0;
+    for(int col : cols){
+        // position and velocity perturbations, plus control perturbation if this column has a control
+        num_steps += 4;
+        if(col < num_ctrl_current){
+            num_steps += 2;
+        }
+    }
+    return num_steps;
+}
+
+void Optimiser::ScheduleFiniteDifferencingTasks(const std::vector<std::vector<int>> &keyPoints, int num_threads){
+
+    // Reset step time estimates if the horizon has changed
+    if(fd_step_time_estimate_us.size() != keyPoints.size()){
+        fd_step_time_estimate_us.assign(keyPoints.size(), 0.0);
+    }
+
+    // Fallback step time for time indices not yet measured - the mean of all measured ones
+    double default_step_time = 0.0;
+    int num_measured = 0;
+    for(double step_time : fd_step_time_estimate_us){
+        if(step_time > 0.0){
+            default_step_time += step_time;
+            num_measured++;
+        }
+    }
+    default_step_time = num_measured > 0 ? default_step_time / num_measured : 1.0;
+
+    // Estimated cost of finite-differencing all keypoints at each time index
+    std::vector<double> step_time(keyPoints.size(), default_step_time);
+    double total_cost = 0.0;
+    for(int t = 0; t < keyPoints.size(); t++){
+        if(fd_step_time_estimate_us[t] > 0.0){
+            step_time[t] = fd_step_time_estimate_us[t];
+        }
+        if(!keyPoints[t].empty()){
+            total_cost += (NumStepsForColumns(keyPoints[t]) + 1) * step_time[t];
+        }
+    }
+
+    // Split the time indices into column subsets so that no task is much larger than the target cost
+    double target_cost = total_cost / std::max(1, num_threads * fd_tasks_per_thread);
+
+    fd_tasks.clear();
+    for(int t = 0; t < keyPoints.size(); t++){
+        if(keyPoints[t].empty()){
+            continue;
+        }
+
+        int num_cols = static_cast<int>(keyPoints[t].size());
+        double cost = (NumStepsForColumns(keyPoints[t]) + 1) * step_time[t];
+        int num_splits = 1;
+        if(target_cost > 0.0){
+            num_splits = std::clamp(static_cast<int>(std::ceil(cost / target_cost)), 1, num_cols);
         }
 
-        int timeIndex = timeIndicesGlobal[iteration];
+        for(int i = 0; i < num_splits; i++){
+            fd_task task;
+            task.time_index = t;
+            task.measured_time_us = 0.0;
+            for(int j = i * num_cols / num_splits; j < (i + 1) * num_cols / num_splits; j++){
+                task.cols.push_back(keyPoints[t][j]);
+            }
+            task.estimated_cost = (NumStepsForColumns(task.cols) + 1) * step_time[t];
+            fd_tasks.push_back(task);
+        }
+    }
+
+    // Longest processing time first - assign each task to the queue with the least estimated work
+    std::vector<int> order(fd_tasks.size());
+    for(int i = 0; i < order.size(); i++){
+        order[i] = i;
+    }
+    std::sort(order.begin(), order.end(), [this](int a, int b){
+        return fd_tasks[a].estimated_cost > fd_tasks[b].estimated_cost;
+    });
+
+    fd_task_queues.assign(num_threads, std::deque<int>());
+    if(fd_task_queue_mutexes.size() != num_threads){
+        fd_task_queue_mutexes.clear();
+        for(int i = 0; i < num_threads; i++){
+            fd_task_queue_mutexes.push_back(std::make_unique<std::mutex>());
+        }
+    }
+    fd_thread_busy_time_us.assign(num_threads, 0.0);
+
+    std::vector<double> queue_load(num_threads, 0.0);
+    for(int task_index : order){
+        int least_loaded = static_cast<int>(std::min_element(queue_load.begin(), queue_load.end()) - queue_load.begin());
+        fd_task_queues[least_loaded].push_back(task_index);
+        queue_load[least_loaded] += fd_tasks[task_index].estimated_cost;
+    }
+}
+
+bool Optimiser::PopFiniteDifferencingTask(int thread_id, int &task_index){
+    // Own queue first, largest tasks are at the front
+    {
+        std::lock_guard<std::mutex> lock(*fd_task_queue_mutexes[thread_id]);
+        if(!fd_task_queues[thread_id].empty()){
+            task_index = fd_task_queues[thread_id].front();
+            fd_task_queues[thread_id].pop_front();
+            return true;
+        }
+    }
 
-        std::vector<int> keyPoints;
-        (activeDifferentiator.get()->*(tasks_dynamics_derivs[iteration]))(A[timeIndex], B[timeIndex],
-                                        keypointsGlobal[iteration],
-                                        timeIndex, threadId, true, 1e-6);
+    // Steal the smallest remaining task from another thread
+    int num_queues = static_cast<int>(fd_task_queues.size());
+    for(int i = 1; i < num_queues; i++){
+        int victim = (thread_id + i) % num_queues;
+        std::lock_guard<std::mutex> lock(*fd_task_queue_mutexes[victim]);
+        if(!fd_task_queues[victim].empty()){
+            task_index = fd_task_queues[victim].back();
+            fd_task_queues[victim].pop_back();
+            return true;
+        }
+    }
+
+    return false;
+}
+
+void Optimiser::WorkerComputeDerivatives(int threadId) {
+    PinWorkerThread(threadId);
+
+    int task_index;
+    while (PopFiniteDifferencingTask(threadId, task_index)) {
+        fd_task &task = fd_tasks[task_index];
+
+        // Tasks at the same time index write to disjoint columns of A and B
+        auto time_task_start = high_resolution_clock::now();
+        activeDifferentiator->DynamicsDerivatives(A[task.time_index], B[task.time_index], task.cols,
+                                                  task.time_index, threadId, true, 1e-6);
+        task.measured_time_us = static_cast<double>(duration_cast<microseconds>(high_resolution_clock::now() - time_task_start).count());
+        fd_thread_busy_time_us[threadId] += task.measured_time_us;
     }
 }
 
 void Optimiser::WorkerComputeResidualDerivatives(int threadId){
+    PinWorkerThread(threadId);
+
     while (true) {
         int iteration = current_iteration.fetch_add(1);
         if (iteration >= num_threads_iterations) {
             break;  // All iterations done
         }
 
-//        int timeIndex = timeIndicesGlobal[iteration];
+        int time_index = residual_time_indices[iteration];
 
-        std::vector<int> keyPoints;
-        (activeDifferentiator.get()->*(tasks_residual_derivs[iteration]))(r_x[iteration], r_u[iteration],
-                                                                          iteration, threadId, true, 1e-6);
+        (activeDifferentiator.get()->*(tasks_residual_derivs[iteration]))(r_x[time_index], r_u[time_index],
+                                                                          time_index, threadId, true, 1e-6);
     }
 }
 
@@ -342,7 +863,10 @@ void Optimiser::FilterDynamicsMatrices() {
     // Aliases
     int dof = activeModelTranslator->current_state_vector.dof;
 
-    for(int i = dof; i < 2 * dof; i++){
+    // Velocity rows of A, offset by the position rows unless A is stored compactly
+    int row_offset = compact_dynamics ? 0 : dof;
+
+    for(int i = row_offset; i < row_offset + dof; i++){
         for(int j = 0; j < 2 * dof; j++){
             std::vector<double> unfiltered;
             std::vector<double> filtered;
@@ -464,6 +988,6 @@ void Optimiser::SaveBestRollout(int thread_id){
 
         // Update the residuals of the nominal trajectory
         // TODO (DMackRus) - is this indexing correct, lets double check
-        activeModelTranslator->Residuals(MuJoCo_helper->saved_systems_state_list[t+1], residuals[t+1]);
+        activeModelTranslator->ComputeResiduals(MuJoCo_helper->saved_systems_state_list[t+1], residuals[t+1]);
     }
 }
\ No newline at end of file
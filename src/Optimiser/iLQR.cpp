@@ -92,9 +92,16 @@ void iLQR::Resize(int new_num_dofs, int new_num_ctrl, int new_horizon){
         residuals.clear();
     }
 
-    // dependant on both dofs and num_ctrl
-    B.clear();
-    K.clear();
+    // dependant on both dofs and num_ctrl, only reallocated when the problem size changes so that derivatives
+    // and feedback gains persist between calls to Optimise
+    bool update_any = update_dof || update_ctrl || update_horizon;
+    if(update_any){
+        B.clear();
+        K.clear();
+
+        // Cached derivatives no longer correspond to the allocated matrices
+        InvalidateDerivativeCache();
+    }
 
     int num_dof = activeModelTranslator->current_state_vector.dof;
     int num_dof_quat = activeModelTranslator->current_state_vector.dof_quat;
@@ -103,19 +110,14 @@ void iLQR::Resize(int new_num_dofs, int new_num_ctrl, int new_horizon){
 
         if(update_dof){
             l_x.emplace_back(MatrixXd(2*dof, 1));
-            l_xx.emplace_back(MatrixXd(2*dof, 2*dof));
+            l_xx.emplace_back(low_rank_cost_hessian ? MatrixXd() : MatrixXd(2*dof, 2*dof));
 
-            A.emplace_back(MatrixXd(2*dof, 2*dof));
+            A.emplace_back(MatrixXd(compact_dynamics ? dof : 2*dof, 2*dof));
 
             X_old.emplace_back(MatrixXd(num_dof_quat + num_dof, 1));
             X_new.emplace_back(MatrixXd(num_dof_quat + num_dof, 1));
 
-            vector<MatrixXd> r_x_;
-            for(int i = 0; i < activeModelTranslator->residual_list.size(); i++) {
-                r_x_.emplace_back(MatrixXd(2*dof, 1));
-            }
-
-            r_x.emplace_back(r_x_);
+            r_x.emplace_back(MatrixXd(activeModelTranslator->residual_list.size(), 2*dof));
         }
 
         if(update_ctrl){
@@ -126,36 +128,25 @@ void iLQR::Resize(int new_num_dofs, int new_num_ctrl, int new_horizon){
 
             U_old.emplace_back(MatrixXd(num_ctrl, 1));
 
-            vector<MatrixXd> r_u_;
-            for(int i = 0; i < activeModelTranslator->residual_list.size(); i++) {
-                r_u_.emplace_back(MatrixXd(num_ctrl, 1));
-            }
-
-            r_u.emplace_back(r_u_);
+            r_u.emplace_back(MatrixXd(activeModelTranslator->residual_list.size(), num_ctrl));
         }
 
-        B.emplace_back(MatrixXd(2*dof, num_ctrl));
-        K.emplace_back(MatrixXd(num_ctrl, 2*dof));
+        if(update_any){
+            B.emplace_back(MatrixXd(2*dof, num_ctrl));
+            K.emplace_back(MatrixXd(num_ctrl, 2*dof));
+        }
     }
 
     // One more state than control
     if(update_dof){
         l_x.push_back(MatrixXd(2*dof, 1));
-        l_xx.push_back(MatrixXd(2*dof, 2*dof));
+        l_xx.push_back(low_rank_cost_hessian ? MatrixXd() : MatrixXd(2*dof, 2*dof));
 
         X_old.push_back(MatrixXd(num_dof_quat + num_dof, 1));
         X_new.push_back(MatrixXd(num_dof_quat + num_dof, 1));
 
-        vector<MatrixXd> r_x_;
-        vector<MatrixXd> r_u_;
-        for(int i = 0; i < activeModelTranslator->residual_list.size(); i++) {
-            r_x_.emplace_back(MatrixXd(2*dof, 1));
-            r_u_.emplace_back(MatrixXd(num_ctrl, 1));
-
-        }
-
-        r_x.emplace_back(r_x_);
-        r_u.emplace_back(r_u_);
+        r_x.emplace_back(MatrixXd(activeModelTranslator->residual_list.size(), 2*dof));
+        r_u.emplace_back(MatrixXd(activeModelTranslator->residual_list.size(), num_ctrl));
     }
 
     if(update_horizon){
@@ -199,6 +190,13 @@ void iLQR::Resize(int new_num_dofs, int new_num_ctrl, int new_horizon){
 //    std::cout << "length of A: " << A.size() << ", size of A is: " << A[0].cols() << "\n";
 }
 
+void iLQR::ShiftHorizon(int shift){
+    Optimiser::ShiftHorizon(shift);
+
+    ShiftTimeIndexedVector(K, shift);
+    ShiftTimeIndexedVector(k, shift);
+}
+
 double iLQR::RolloutTrajectory(mjData* d, bool save_states, std::vector<MatrixXd> initial_controls){
     double cost = 0.0;
 
@@ -223,7 +221,7 @@ double iLQR::RolloutTrajectory(mjData* d, bool save_states, std::vector<MatrixXd
 
         // return cost for this state
         double state_cost;
-        activeModelTranslator->Residuals(MuJoCo_helper->main_data, residuals[i]);
+        activeModelTranslator->ComputeResiduals(MuJoCo_helper->main_data, residuals[i]);
         if(i == horizon_length - 1){
             state_cost = activeModelTranslator->CostFunction(residuals[i], activeModelTranslator->full_state_vector, true);
         }
@@ -298,10 +296,12 @@ std::vector<MatrixXd> iLQR::Optimise(mjData *d, std::vector<MatrixXd> initial_co
     avg_surprise = 0.0;
     avg_expected = 0.0;
     avg_percent_derivs = 0;
+    avg_percent_derivs_reused = 0;
     num_iterations = 0;
     avg_dofs = 0.0;
 
     percentage_derivs_per_iteration.clear();
+    percentage_derivs_reused_per_iteration.clear();
     num_dofs.clear();
     cost_history.clear();
     time_backwards_pass_ms.clear();
@@ -370,6 +370,15 @@ std::vector<MatrixXd> iLQR::Optimise(mjData *d, std::vector<MatrixXd> initial_co
     avg_time_get_derivs_ms /= static_cast<int>(time_get_derivs_ms.size());
     avg_percent_derivs /= static_cast<int>(percentage_derivs_per_iteration.size());
 
+    // Percent derivs reused from the derivative cache
+    for(double i : percentage_derivs_reused_per_iteration){
+        avg_percent_derivs_reused += i;
+    }
+
+    if(!percentage_derivs_reused_per_iteration.empty()){
+        avg_percent_derivs_reused /= static_cast<int>(percentage_derivs_reused_per_iteration.size());
+    }
+
     // Time backwards pass
     for(double time_backwards_pass_m : time_backwards_pass_ms){
         avg_time_backwards_pass_ms += time_backwards_pass_m;
@@ -477,6 +486,7 @@ void iLQR::Iteration(int iteration_num, bool &converged, bool &lambda_exit){
         // Create tasks and push them into the vector
         for (int i = 0; i < num_parallel_rollouts; ++i) {
             futures.push_back(std::async(std::launch::async, [this, i, &alphas]() {
+                PinWorkerThread(i);
                 return this->ForwardsPassParallel(i, alphas[i]);
             }));
         }
@@ -507,6 +517,7 @@ void iLQR::Iteration(int iteration_num, bool &converged, bool &lambda_exit){
     if(verbose_output){
         PrintBannerIteration(iteration_num, new_cost, old_cost,
                              1 - (new_cost / old_cost), lambda, percentage_derivs_per_iteration[iteration_num],
+                             percentage_derivs_reused,
                              time_get_derivs_ms[iteration_num], time_backwards_pass_ms[iteration_num], time_forwardsPass_ms[iteration_num],
                              best_alpha);
     }
@@ -535,8 +546,8 @@ void iLQR::Iteration(int iteration_num, bool &converged, bool &lambda_exit){
 bool iLQR::BackwardsPassQuuRegularisation(){
     MatrixXd V_x(2*dof, 2*dof);
     V_x = l_x[horizon_length - 1];
-    MatrixXd V_xx(2*dof, 2*dof);
-    V_xx = l_xx[horizon_length - 1];
+    MatrixXd V_xx = MatrixXd::Zero(2*dof, 2*dof);
+    AddStateCostHessian(horizon_length - 1, V_xx);
     int Quu_pd_check_counter = 0;
     int number_steps_between_pd_checks = 100;
 
@@ -548,9 +559,12 @@ bool iLQR::BackwardsPassQuuRegularisation(){
 
     MatrixXd Q_uu_reg(num_ctrl, num_ctrl);
 
-    MatrixXd A_t(2*dof, 2*dof);
     MatrixXd B_t(2*dof, num_ctrl);
 
+    // Dynamics products, A is either dense or compact (velocity rows only)
+    MatrixXd A_T_V_x(2*dof, 1);
+    MatrixXd A_T_V_xx_A(2*dof, 2*dof);
+
     // Reset delta J
     delta_J = 0.0f;
     double temp_time = 0.0;
@@ -564,20 +578,20 @@ bool iLQR::BackwardsPassQuuRegularisation(){
 
         Quu_pd_check_counter++;
 
-        A_t = A[t].transpose();
         B_t = B[t].transpose();
 
-        Q_x = l_x[t] + (A_t * V_x);
+        // This is the line that takes the most time in the backwards pass.
+        DynamicsProducts(t, V_x, V_xx, A_T_V_x, A_T_V_xx_A, Q_ux);
+
+        Q_x = l_x[t] + A_T_V_x;
 
         Q_u = l_u[t] + (B_t * V_x);
 
-        // This is the line that takes the most time in the backwards pass.
-        Q_xx = l_xx[t] + (A_t * V_xx * A[t]);
+        Q_xx = A_T_V_xx_A;
+        AddStateCostHessian(t, Q_xx);
 
         Q_uu = l_uu[t] + (B_t * V_xx * B[t]);
 
-        Q_ux = (B_t * V_xx * A[t]);
-
         Q_uu_reg = Q_uu.replicate(1, 1);
 
         for(int i = 0; i < Q_uu.rows(); i++){
@@ -720,8 +734,7 @@ double iLQR::ForwardsPass(double _old_cost){
                 // Compute state feedback
                 // position differences
                 for(int j = 0; j < dof; j++){
-                    int q_index = activeModelTranslator->StateIndexToQposIndex(j, activeModelTranslator->current_state_vector);
-                    state_feedback(j) = vel_diff[q_index];
+                    state_feedback(j) = activeModelTranslator->ProjectDofVectorToState(j, vel_diff);
                 }
 
                 // velocity differences
@@ -745,7 +758,7 @@ double iLQR::ForwardsPass(double _old_cost){
                                                     activeModelTranslator->current_state_vector);
 
             double newStateCost;
-            activeModelTranslator->Residuals(MuJoCo_helper->main_data, residuals[t]);
+            activeModelTranslator->ComputeResiduals(MuJoCo_helper->main_data, residuals[t]);
             if(t == horizon_length - 1){
                 newStateCost = activeModelTranslator->CostFunction(residuals[t],
                                                                    activeModelTranslator->full_state_vector, true);
@@ -863,8 +876,7 @@ double iLQR::ForwardsPassParallel(int thread_id, double alpha){
             // Compute state feedback
             // position differences
             for(int j = 0; j < dof; j++){
-                int q_index = activeModelTranslator->StateIndexToQposIndex(j, activeModelTranslator->current_state_vector);
-                state_feedback(j) = vel_diff[q_index];
+                state_feedback(j) = activeModelTranslator->ProjectDofVectorToState(j, vel_diff);
             }
 
             // velocity differences
@@ -899,7 +911,7 @@ double iLQR::ForwardsPassParallel(int thread_id, double alpha){
         double new_state_cost;
         // Terminal state
         MatrixXd residuals_t(activeModelTranslator->residual_list.size(), 1);
-        activeModelTranslator->Residuals(MuJoCo_helper->fd_data[thread_id], residuals_t);
+        activeModelTranslator->ComputeResiduals(MuJoCo_helper->fd_data[thread_id], residuals_t);
         if(t == horizon_length - 1){
             new_state_cost = activeModelTranslator->CostFunction(residuals_t,
                                                                  activeModelTranslator->full_state_vector, true);
@@ -957,6 +969,7 @@ void iLQR::PrintBanner(double time_rollout){
               << std::setw(8)  << "| Eps"
               << std::setw(10) << "| Lambda"
               << std::setw(16) << "| % Derivatives"
+              << std::setw(11) << "| % Reused"
               << std::setw(20) << "| Time Derivs (ms)"
               << std::setw(15) << "| Time BP (ms)"
               << std::setw(15) << "| Time FP (ms)"
@@ -964,7 +977,7 @@ void iLQR::PrintBanner(double time_rollout){
 }
 
 void iLQR::PrintBannerIteration(int iteration, double new_cost, double old_cost, double eps,
-                                double lambda, double percent_derivatives, double time_derivs, double time_bp,
+                                double lambda, double percent_derivatives, double percent_reused, double time_derivs, double time_bp,
                                 double time_fp, double best_alpha){
 
     std::cout << std::left << "|" << std::setw(11) << iteration
@@ -973,6 +986,7 @@ void iLQR::PrintBannerIteration(int iteration, double new_cost, double old_cost,
               << "|" << std::setprecision(3) << std::setw(7)  << eps
               << "|" << std::setw(9) << lambda
               << "|" << std::setw(15) << percent_derivatives
+              << "|" << std::setw(10) << percent_reused
               << "|" << std::setw(19) <<time_derivs
               << "|" << std::setw(14)  << time_bp
               << "|" << std::setw(14) << time_fp
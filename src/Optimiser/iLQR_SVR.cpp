@@ -33,12 +33,12 @@ iLQR_SVR::iLQR_SVR(std::shared_ptr<ModelTranslator> _modelTranslator, std::share
     Resize(activeModelTranslator->current_state_vector.dof,
            activeModelTranslator->current_state_vector.num_ctrl, horizon);
 
+    // Rollouts before the first Optimise call still gather X_old from X_full_old
+    active_state_indices = activeModelTranslator->FullStateIndicesQuat(activeModelTranslator->current_state_vector);
+
 }
 
 void iLQR_SVR::Resize(int new_num_dofs, int new_num_ctrl, int new_horizon){
-    auto start = std::chrono::high_resolution_clock::now();
-    std::cout << "new dofs: " << new_num_dofs << " new ctrl: " << new_num_ctrl << " new horizon: " << new_horizon << std::endl;
-
     bool update_ctrl = false;
     bool update_dof = false;
     bool update_horizon = false;
@@ -57,97 +57,63 @@ void iLQR_SVR::Resize(int new_num_dofs, int new_num_ctrl, int new_horizon){
         update_horizon = true;
     }
 
-    // Clear old matrices
-    if(update_ctrl){
-        // Cost derivatives with respect to control
-        l_u.clear();
-        l_uu.clear();
-
-        // Residual derivatives with respect to control
-        r_u.clear();
-
-        // Old control trajectory
-        U_old.clear();
-
-        // Open-loop feedback control law
-        k.clear();
-    }
-
-    if(update_dof){
-        // Cost derivatives with respect to state
-        l_x.clear();
-        l_xx.clear();
-
-        // Residual derivatives with respect to state
-        r_x.clear();
-
-        // Dynamics derivatives with respect to state
-        A.clear();
-
-        // New and old state trajectories
-        X_old.clear();
-        X_new.clear();
-    }
-
     if(update_horizon){
         residuals.clear();
     }
 
-    // dependant on both dofs and num_ctrl
-    B.clear();
-    K.clear();
+    // Cached derivatives no longer correspond to the problem size
+    bool update_any = update_dof || update_ctrl || update_horizon;
+    if(update_any){
+        InvalidateDerivativeCache();
+    }
 
     int num_dof = activeModelTranslator->current_state_vector.dof;
     int num_dof_quat = activeModelTranslator->current_state_vector.dof_quat;
-
-    for(int t = 0; t < this->horizon_length; t++){
-        // Cost matrices
-
-        if(update_dof){
-            l_x.emplace_back(MatrixXd(2*dof, 1));
-            l_xx.emplace_back(MatrixXd(2*dof, 2*dof));
-
-            A.emplace_back(MatrixXd(2*dof, 2*dof));
-
-            X_old.emplace_back(MatrixXd(num_dof_quat + num_dof, 1));
-            X_new.emplace_back(MatrixXd(num_dof_quat + num_dof, 1));
-
-
-            vector<MatrixXd> r_x_;
-            for(int i = 0; i < activeModelTranslator->residual_list.size(); i++) {
-                r_x_.emplace_back(MatrixXd(2*dof, 1));
-            }
-
-            r_x.emplace_back(r_x_);
-        }
-
-        if(update_ctrl){
-            l_u.emplace_back(MatrixXd(num_ctrl, 1));
-            l_uu.emplace_back(MatrixXd(num_ctrl, num_ctrl));
-
-            k.emplace_back(MatrixXd(num_ctrl, 1));
-
-            U_old.emplace_back(MatrixXd(num_ctrl, 1));
-
-            vector<MatrixXd> r_u_;
-            for(int i = 0; i < activeModelTranslator->residual_list.size(); i++) {
-                r_u_.emplace_back(MatrixXd(num_ctrl, 1));
-            }
-
-            r_u.emplace_back(r_u_);
-        }
-
-        B.emplace_back(MatrixXd(2*dof, num_ctrl));
-        K.emplace_back(MatrixXd(num_ctrl, 2*dof));
+    int num_residuals = static_cast<int>(activeModelTranslator->residual_list.size());
+
+    // Buffers are resized in place rather than cleared and reallocated. Eigen only reallocates a matrix when its
+    // number of elements changes, matrices whose size is unchanged (e.g. everything when nothing changed) keep
+    // their contents, so derivatives and feedback gains persist between calls to Optimise.
+    l_x.resize(horizon_length + 1);
+    l_xx.resize(horizon_length + 1);
+    X_old.resize(horizon_length + 1);
+    X_new.resize(horizon_length + 1);
+    X_full_old.resize(horizon_length + 1);
+
+    A.resize(horizon_length);
+    B.resize(horizon_length);
+    K.resize(horizon_length);
+    k.resize(horizon_length);
+    l_u.resize(horizon_length);
+    l_uu.resize(horizon_length);
+    U_old.resize(horizon_length);
+
+    // Residual derivatives are computed at every state, including the terminal one
+    r_x.resize(horizon_length + 1);
+    r_u.resize(horizon_length + 1);
+
+    for(int t = 0; t < horizon_length + 1; t++){
+        l_x[t].resize(2*dof, 1);
+        // Not materialised when the cost hessian is kept in low-rank form
+        int l_xx_size = low_rank_cost_hessian ? 0 : 2*dof;
+        l_xx[t].resize(l_xx_size, l_xx_size);
+
+        X_old[t].resize(num_dof_quat + num_dof, 1);
+        X_new[t].resize(num_dof_quat + num_dof, 1);
+
+        r_x[t].resize(num_residuals, 2*dof);
+        r_u[t].resize(num_residuals, num_ctrl);
     }
 
-    // One more state than control
-    if(update_dof){
-        l_x.push_back(MatrixXd(2*dof, 1));
-        l_xx.push_back(MatrixXd(2*dof, 2*dof));
+    for(int t = 0; t < horizon_length; t++){
+        A[t].resize(compact_dynamics ? dof : 2*dof, 2*dof);
+        B[t].resize(2*dof, num_ctrl);
+        K[t].resize(num_ctrl, 2*dof);
+        k[t].resize(num_ctrl, 1);
 
-        X_old.push_back(MatrixXd(num_dof_quat + num_dof, 1));
-        X_new.push_back(MatrixXd(num_dof_quat + num_dof, 1));
+        l_u[t].resize(num_ctrl, 1);
+        l_uu[t].resize(num_ctrl, num_ctrl);
+        U_old[t].resize(num_ctrl, 1);
     }
 
     // TODO - validate this method of saving trajectory data works correctly
@@ -186,10 +152,134 @@ void iLQR_SVR::Resize(int new_num_dofs, int new_num_ctrl, int new_horizon){
 
     // Resize Keypoint generator class
     keypoint_generator->Resize(dof, num_ctrl, horizon_length);
+}
+
+void iLQR_SVR::UpdateStateVectorBuffers(const struct stateVectorList &old_state_vector){
+    const struct stateVectorList &new_state_vector = activeModelTranslator->current_state_vector;
+
+    std::vector<int> old_state_indices = active_state_indices;
+    active_state_indices = activeModelTranslator->FullStateIndicesQuat(new_state_vector);
+
+    // Index of every current dof in the previous state vector, -1 for re-added dofs
+    std::unordered_map<std::string, int> old_dof_index;
+    for(int i = 0; i < old_state_vector.state_names.size(); i++){
+        old_dof_index[old_state_vector.state_names[i]] = i;
+    }
+
+    int old_dof = old_state_vector.dof;
+    int new_dof = new_state_vector.dof;
+    bool dofs_added = false;
+    std::vector<int> dof_rows(2 * new_dof);
+    for(int i = 0; i < new_dof; i++){
+        auto it = old_dof_index.find(new_state_vector.state_names[i]);
+        if(it == old_dof_index.end()){
+            dofs_added = true;
+            dof_rows[i] = -1;
+            dof_rows[i + new_dof] = -1;
+        }
+        else{
+            dof_rows[i] = it->second;
+            dof_rows[i + new_dof] = it->second + old_dof;
+        }
+    }
+
+    // State vector unchanged
+    if(!dofs_added && new_dof == old_dof){
+        return;
+    }
+
+    // Compact (and expand) the dof dependant buffers by index permutation. Rows and columns of remaining dofs are
+    // unchanged, so when dofs are only removed the derivative cache stays valid. Feedback gains of re-added dofs are zero.
+    if(A.size() == horizon_length && !A.empty() && A[0].cols() == 2 * old_dof){
+        std::vector<int> ctrl_indices(num_ctrl);
+        std::iota(ctrl_indices.begin(), ctrl_indices.end(), 0);
+        std::vector<int> single_col = {0};
+
+        std::unordered_map<int, int> old_state_position;
+        for(int i = 0; i < old_state_indices.size(); i++){
+            old_state_position[old_state_indices[i]] = i;
+        }
+        std::vector<int> state_rows(active_state_indices.size());
+        for(int i = 0; i < active_state_indices.size(); i++){
+            auto it = old_state_position.find(active_state_indices[i]);
+            state_rows[i] = it == old_state_position.end() ? -1 : it->second;
+        }
+
+        // Compact A only holds the velocity rows
+        std::vector<int> A_rows = dof_rows;
+        if(compact_dynamics){
+            A_rows.resize(new_dof);
+            for(int i = 0; i < new_dof; i++){
+                A_rows[i] = dof_rows[i + new_dof] < 0 ? -1 : dof_rows[i + new_dof] - old_dof;
+            }
+        }
+
+        for(int t = 0; t < horizon_length; t++){
+            A[t] = GatherMatrix(A[t], A_rows, dof_rows);
+            B[t] = GatherMatrix(B[t], dof_rows, ctrl_indices);
+            K[t] = GatherMatrix(K[t], ctrl_indices, dof_rows);
+        }
 
-    std::cout << "time to allocate, " << duration_cast<microseconds>(std::chrono::high_resolution_clock::now() - start).count() / 1000.0 << " ms \n";
+        std::vector<int> residual_rows(activeModelTranslator->residual_list.size());
+        std::iota(residual_rows.begin(), residual_rows.end(), 0);
 
-    std::cout << "length of A: " << A.size() << ", size of A is: " << A[0].cols() << "\n";
+        for(int t = 0; t < horizon_length + 1; t++){
+            l_x[t] = GatherMatrix(l_x[t], dof_rows, single_col);
+            if(l_xx[t].rows() == 2 * old_dof){
+                l_xx[t] = GatherMatrix(l_xx[t], dof_rows, dof_rows);
+            }
+            r_x[t] = GatherMatrix(r_x[t], residual_rows, dof_rows);
+
+            if(t < X_cached.size() && X_cached[t].rows() == old_state_indices.size()){
+                X_cached[t] = GatherMatrix(X_cached[t], state_rows, single_col);
+            }
+
+            if(t < dynamics_cache_valid.size() && dynamics_cache_valid[t].size() == old_dof){
+                std::vector<bool> valid(new_dof);
+                for(int i = 0; i < new_dof; i++){
+                    valid[i] = dof_rows[i] >= 0 && dynamics_cache_valid[t][dof_rows[i]];
+                }
+                dynamics_cache_valid[t] = valid;
+            }
+        }
+
+        this->dof = new_dof;
+    }
+
+    // New rows and columns of the derivatives are unknown
+    if(dofs_added){
+        InvalidateDerivativeCache();
+    }
+
+    Resize(new_dof, new_state_vector.num_ctrl, horizon_length);
+    GatherNominalFromFullState();
+}
+
+void iLQR_SVR::GatherNominalFromFullState(){
+    for(int t = 0; t < horizon_length + 1; t++){
+        for(int i = 0; i < active_state_indices.size(); i++){
+            X_old[t](i, 0) = X_full_old[t](active_state_indices[i], 0);
+        }
+    }
+}
+
+MatrixXd iLQR_SVR::GatherMatrix(const MatrixXd &matrix, const std::vector<int> &rows, const std::vector<int> &cols){
+    MatrixXd gathered(rows.size(), cols.size());
+
+    for(int j = 0; j < cols.size(); j++){
+        for(int i = 0; i < rows.size(); i++){
+            gathered(i, j) = (rows[i] < 0 || cols[j] < 0) ? 0.0 : matrix(rows[i], cols[j]);
+        }
+    }
+
+    return gathered;
+}
+
+void iLQR_SVR::ShiftHorizon(int shift){
+    Optimiser::ShiftHorizon(shift);
+
+    ShiftTimeIndexedVector(K, shift);
+    ShiftTimeIndexedVector(k, shift);
 }
 
 double iLQR_SVR::RolloutTrajectory(mjData* d, bool save_states, std::vector<MatrixXd> initial_controls){
@@ -200,8 +290,11 @@ double iLQR_SVR::RolloutTrajectory(mjData* d, bool save_states, std::vector<Matr
 //    }
     MuJoCo_helper->CopySystemState(MuJoCo_helper->main_data, d);
 
-    X_old[0] = activeModelTranslator->ReturnStateVectorQuaternions(MuJoCo_helper->main_data,
-                                                                   activeModelTranslator->current_state_vector);
+    X_full_old[0] = activeModelTranslator->ReturnStateVectorQuaternions(MuJoCo_helper->main_data,
+                                                                        activeModelTranslator->full_state_vector);
+    for(int j = 0; j < active_state_indices.size(); j++){
+        X_old[0](j, 0) = X_full_old[0](active_state_indices[j], 0);
+    }
 
     if(MuJoCo_helper->CheckIfDataIndexExists(0)){
         MuJoCo_helper->CopySystemState(MuJoCo_helper->saved_systems_state_list[0], MuJoCo_helper->main_data);
@@ -220,7 +313,7 @@ double iLQR_SVR::RolloutTrajectory(mjData* d, bool save_states, std::vector<Matr
 
         // return cost for this state
         double state_cost;
-        activeModelTranslator->Residuals(MuJoCo_helper->main_data, residuals[i]);
+        activeModelTranslator->ComputeResiduals(MuJoCo_helper->main_data, residuals[i]);
         if(i == horizon_length - 1){
             state_cost = activeModelTranslator->CostFunction(residuals[i],
                                                              activeModelTranslator->full_state_vector, true);
@@ -232,8 +325,11 @@ double iLQR_SVR::RolloutTrajectory(mjData* d, bool save_states, std::vector<Matr
 
         // If required to save states to trajectory tracking, then save state
         if(save_states){
-            X_old[i + 1] = activeModelTranslator->ReturnStateVectorQuaternions(MuJoCo_helper->main_data,
-                                                                               activeModelTranslator->current_state_vector);
+            X_full_old[i + 1] = activeModelTranslator->ReturnStateVectorQuaternions(MuJoCo_helper->main_data,
+                                                                                    activeModelTranslator->full_state_vector);
+            for(int j = 0; j < active_state_indices.size(); j++){
+                X_old[i + 1](j, 0) = X_full_old[i + 1](active_state_indices[j], 0);
+            }
             U_old[i] = activeModelTranslator->ReturnControlVector(MuJoCo_helper->main_data,
                                                                   activeModelTranslator->current_state_vector);
             if(MuJoCo_helper->CheckIfDataIndexExists(i + 1)){
@@ -274,6 +370,7 @@ std::vector<MatrixXd> iLQR_SVR::Optimise(mjData *d, std::vector<MatrixXd> initia
     Resize(activeModelTranslator->current_state_vector.dof,
            activeModelTranslator->current_state_vector.num_ctrl,
            horizon_length);
+    active_state_indices = activeModelTranslator->FullStateIndicesQuat(activeModelTranslator->current_state_vector);
 
     // - Initialise variables
     std::vector<MatrixXd> optimisedControls(horizon_length);
@@ -293,10 +390,12 @@ std::vector<MatrixXd> iLQR_SVR::Optimise(mjData *d, std::vector<MatrixXd> initia
     avg_surprise = 0.0;
     avg_expected = 0.0;
     avg_percent_derivs = 0;
+    avg_percent_derivs_reused = 0;
     num_iterations = 0;
     avg_dofs = 0.0;
 
     percentage_derivs_per_iteration.clear();
+    percentage_derivs_reused_per_iteration.clear();
     num_dofs.clear();
     cost_history.clear();
     time_backwards_pass_ms.clear();
@@ -365,6 +464,15 @@ std::vector<MatrixXd> iLQR_SVR::Optimise(mjData *d, std::vector<MatrixXd> initia
     avg_time_get_derivs_ms /= static_cast<int>(time_get_derivs_ms.size());
     avg_percent_derivs /= static_cast<int>(percentage_derivs_per_iteration.size());
 
+    // Percent derivs reused from the derivative cache
+    for(double i : percentage_derivs_reused_per_iteration){
+        avg_percent_derivs_reused += i;
+    }
+
+    if(!percentage_derivs_reused_per_iteration.empty()){
+        avg_percent_derivs_reused /= static_cast<int>(percentage_derivs_reused_per_iteration.size());
+    }
+
     // Time backwards pass
     for(double time_backwards_pass_m : time_backwards_pass_ms){
         avg_time_backwards_pass_ms += time_backwards_pass_m;
@@ -474,6 +582,7 @@ void iLQR_SVR::Iteration(int iteration_num, bool &converged, bool &lambda_exit){
         // Create tasks and push them into the vector
         for (int i = 0; i < num_parallel_rollouts; ++i) {
             futures.push_back(std::async(std::launch::async, [this, i, &alphas]() {
+                PinWorkerThread(i);
                 return this->ForwardsPassParallel(i, alphas[i]);
             }));
         }
@@ -504,6 +613,7 @@ void iLQR_SVR::Iteration(int iteration_num, bool &converged, bool &lambda_exit){
     if(verbose_output){
         PrintBannerIteration(iteration_num, new_cost, old_cost,
                              1 - (new_cost / old_cost), lambda, dof, percentage_derivs_per_iteration[iteration_num],
+                             percentage_derivs_reused,
                              time_get_derivs_ms[iteration_num], time_backwards_pass_ms[iteration_num], time_forwardsPass_ms[iteration_num],
                              best_alpha);
     }
@@ -534,8 +644,8 @@ void iLQR_SVR::Iteration(int iteration_num, bool &converged, bool &lambda_exit){
 bool iLQR_SVR::BackwardsPassQuuRegularisation(){
     MatrixXd V_x(2*dof, 2*dof);
     V_x = l_x[horizon_length - 1];
-    MatrixXd V_xx(2*dof, 2*dof);
-    V_xx = l_xx[horizon_length - 1];
+    MatrixXd V_xx = MatrixXd::Zero(2*dof, 2*dof);
+    AddStateCostHessian(horizon_length - 1, V_xx);
     int Quu_pd_check_counter = 0;
     int number_steps_between_pd_checks = 100;
 
@@ -548,6 +658,10 @@ bool iLQR_SVR::BackwardsPassQuuRegularisation(){
     MatrixXd I(num_ctrl, num_ctrl);
     I.setIdentity();
 
+    // Dynamics products, A is either dense or compact (velocity rows only)
+    MatrixXd A_T_V_x(2*dof, 1);
+    MatrixXd A_T_V_xx_A(2*dof, 2*dof);
+
     // Reset delta J
     delta_J = 0.0f;
 
@@ -556,16 +670,17 @@ bool iLQR_SVR::BackwardsPassQuuRegularisation(){
 
         Quu_pd_check_counter++;
 
-        Q_x = l_x[t] + (A[t].transpose() * V_x);
+        DynamicsProducts(t, V_x, V_xx, A_T_V_x, A_T_V_xx_A, Q_ux);
+
+        Q_x = l_x[t] + A_T_V_x;
 
         Q_u = l_u[t] + (B[t].transpose() * V_x);
 
-        Q_xx = l_xx[t] + (A[t].transpose() * (V_xx * A[t]));
+        Q_xx = A_T_V_xx_A;
+        AddStateCostHessian(t, Q_xx);
 
         Q_uu = l_uu[t] + (B[t].transpose() * (V_xx * B[t]));
 
-        Q_ux = (B[t].transpose() * (V_xx * A[t]));
-
         MatrixXd Q_uu_reg = Q_uu.replicate(1, 1);
 
         for(int i = 0; i < Q_uu.rows(); i++){
@@ -690,8 +805,7 @@ double iLQR_SVR::ForwardsPass(double _old_cost){
                 // Compute state feedback
                 // position differences
                 for(int j = 0; j < dof; j++){
-                    int q_index = activeModelTranslator->StateIndexToQposIndex(j, activeModelTranslator->current_state_vector);
-                    state_feedback(j) = vel_diff[q_index];
+                    state_feedback(j) = activeModelTranslator->ProjectDofVectorToState(j, vel_diff);
                 }
 
                 // velocity differences
@@ -715,7 +829,7 @@ double iLQR_SVR::ForwardsPass(double _old_cost){
                                                     activeModelTranslator->current_state_vector);
 
             double newStateCost;
-            activeModelTranslator->Residuals(MuJoCo_helper->main_data, residuals[t]);
+            activeModelTranslator->ComputeResiduals(MuJoCo_helper->main_data, residuals[t]);
             // Terminal state
             if(t == horizon_length - 1){
                 newStateCost = activeModelTranslator->CostFunction(residuals[t],
@@ -835,8 +949,7 @@ double iLQR_SVR::ForwardsPassParallel(int thread_id, double alpha){
             // Compute state feedback
             // position differences
             for(int j = 0; j < dof; j++){
-                int q_index = activeModelTranslator->StateIndexToQposIndex(j, activeModelTranslator->current_state_vector);
-                state_feedback(j) = vel_diff[q_index];
+                state_feedback(j) = activeModelTranslator->ProjectDofVectorToState(j, vel_diff);
             }
 
             // velocity differences
@@ -862,7 +975,7 @@ double iLQR_SVR::ForwardsPassParallel(int thread_id, double alpha){
         double new_state_cost;
         // Terminal state
         MatrixXd residuals(activeModelTranslator->residual_list.size(), 1);
-        activeModelTranslator->Residuals(MuJoCo_helper->fd_data[thread_id], residuals);
+        activeModelTranslator->ComputeResiduals(MuJoCo_helper->fd_data[thread_id], residuals);
         if(t == horizon_length - 1){
             new_state_cost = activeModelTranslator->CostFunction(residuals,
                                                                activeModelTranslator->full_state_vector, true);
@@ -900,27 +1013,7 @@ std::vector<std::string> iLQR_SVR::LeastImportantDofs(){
 
     // ---------------------------- Eigen vector method ---------------------------------------------
     if(eigen_vector_method){
-        for(int t = 0; t < horizon_length; t += sampling_k_interval) {
-            Eigen::JacobiSVD<Eigen::MatrixXd> svd(K[t], Eigen::ComputeFullV);
-            if (!svd.computeV()) {
-                std::cerr << "SVD decomposition failed!" << std::endl;
-                break;
-            }
-
-//        std::cout << "The singular values of K are:\n" << svd.singularValues() << std::endl;
-//        std::cout << "The right singular vectors of K are:\n" << svd.matrixV() << std::endl;
-
-            // Loop over controls
-//            for (int i = 0; i < num_ctrl; i++) {
-            for (int j = 0; j < dof; j++) {
-                // Loop over first N rows of SVD
-                for(int m = 0; m < 3; m++){
-                    K_dofs_sums[j] += abs(svd.matrixV()(j, m) * svd.singularValues()(m));
-                    K_dofs_sums[j] += abs(svd.matrixV()(j + dof, m) * svd.singularValues()(m));
-                }
-            }
-//            }
-        }
+        K_dofs_sums = DofImportanceEigen();
 
         std::vector<int> sorted_indices = SortIndices(K_dofs_sums, true);
         std::vector<std::string> state_vector_name = activeModelTranslator->current_state_vector.state_names;
@@ -993,44 +1086,134 @@ std::vector<std::string> iLQR_SVR::LeastImportantDofs(){
     return remove_dofs;
 }
 
+std::vector<double> iLQR_SVR::DofImportanceEigen(){
+    std::vector<int> sample_times;
+    for(int t = 0; t < horizon_length; t += sampling_k_interval){
+        sample_times.push_back(t);
+    }
+    int num_samples = static_cast<int>(sample_times.size());
+
+    // Only the first few singular vectors are used, never more than the rank of K
+    int rank = std::min(importance_rank, std::min(num_ctrl, 2 * dof));
+
+    if(importance_subspace.size() != num_samples){
+        importance_subspace.assign(num_samples, MatrixXd());
+    }
+
+    // Each sampled timestep writes only its own column and subspace, so samples can be processed concurrently
+    MatrixXd importance = MatrixXd::Zero(dof, num_samples);
+    std::atomic<int> next_sample(0);
+    auto worker = [&](){
+        while(true){
+            int sample = next_sample.fetch_add(1);
+            if(sample >= num_samples){
+                break;
+            }
+
+            importance.col(sample) = DofImportanceAtTimestep(K[sample_times[sample]], rank, importance_subspace[sample]);
+        }
+    };
+
+    int threads = std::min(num_worker_threads, num_samples);
+    std::vector<std::thread> thread_pool;
+    for(int i = 1; i < threads; i++){
+        thread_pool.emplace_back([this, i, &worker](){
+            PinWorkerThread(i);
+            worker();
+        });
+    }
+    worker();
+
+    for(std::thread &thread : thread_pool){
+        thread.join();
+    }
+
+    // Sum over samples in time order, so the result does not depend on thread scheduling
+    std::vector<double> K_dofs_sums(dof, 0.0);
+    for(int j = 0; j < dof; j++){
+        K_dofs_sums[j] = importance.row(j).sum();
+    }
+
+    return K_dofs_sums;
+}
+
+VectorXd iLQR_SVR::DofImportanceAtTimestep(const MatrixXd &K_t, int rank, MatrixXd &subspace){
+    VectorXd importance = VectorXd::Zero(dof);
+    if(rank <= 0){
+        return importance;
+    }
+
+    // sigma_m * v_m (right singular vectors of K scaled by their singular values) are computed from the eigen
+    // decomposition of the smaller Gram matrix. If K K^T = U S^2 U^T then K^T u_m = sigma_m * v_m, if
+    // K^T K = V S^2 V^T then sigma_m * v_m follows from the eigenvalues directly.
+    bool control_gram = num_ctrl <= 2 * dof;
+    MatrixXd gram = control_gram ? MatrixXd(K_t * K_t.transpose()) : MatrixXd(K_t.transpose() * K_t);
+    int n = static_cast<int>(gram.rows());
+
+    MatrixXd eigen_vectors;
+    VectorXd eigen_values;
+    bool converged = false;
+
+    // Incremental update - one subspace iteration plus Rayleigh-Ritz from the previous iteration's subspace. Only
+    // worthwhile when the Gram matrix is much larger than the subspace.
+    if(subspace.rows() == n && subspace.cols() == rank && n > 4 * rank){
+        MatrixXd Q = HouseholderQR<MatrixXd>(gram * subspace).householderQ() * MatrixXd::Identity(n, rank);
+        MatrixXd GQ = gram * Q;
+        SelfAdjointEigenSolver<MatrixXd> ritz(Q.transpose() * GQ);
+        eigen_vectors = Q * ritz.eigenvectors();
+        eigen_values = ritz.eigenvalues();
+
+        // Accept if the Ritz pairs are accurate, otherwise fall back to the full eigen-solve
+        double residual = (GQ * ritz.eigenvectors() - eigen_vectors * eigen_values.asDiagonal()).norm();
+        converged = residual <= importance_subspace_tolerance * std::max(gram.norm(), 1e-12);
+    }
+
+    if(!converged){
+        SelfAdjointEigenSolver<MatrixXd> solver(gram);
+        eigen_vectors = solver.eigenvectors().rightCols(rank);
+        eigen_values = solver.eigenvalues().tail(rank);
+    }
+
+    subspace = eigen_vectors;
+
+    for(int m = 0; m < rank; m++){
+        VectorXd scaled_singular_vector;
+        if(control_gram){
+            scaled_singular_vector = K_t.transpose() * eigen_vectors.col(m);
+        }
+        else{
+            scaled_singular_vector = eigen_vectors.col(m) * std::sqrt(std::max(eigen_values(m), 0.0));
+        }
+
+        importance += scaled_singular_vector.head(dof).cwiseAbs() + scaled_singular_vector.tail(dof).cwiseAbs();
+    }
+
+    return importance;
+}
+
 void iLQR_SVR::ResampleNewDofs(){
+    struct stateVectorList old_state_vector = activeModelTranslator->current_state_vector;
     std::vector<std::string> re_add_dofs = activeModelTranslator->RandomSampleUnusedDofs(num_dofs_readd);
 
     if(!re_add_dofs.empty()){
         activeModelTranslator->UpdateCurrentStateVector(re_add_dofs, true);
     }
 
-    Resize(activeModelTranslator->current_state_vector.dof,
-           activeModelTranslator->current_state_vector.num_ctrl, horizon_length);
-    X_old.at(0) = activeModelTranslator->ReturnStateVectorQuaternions(
-            MuJoCo_helper->saved_systems_state_list[0],
-            activeModelTranslator->current_state_vector);
-    for(int t = 0; t < horizon_length; t++) {
-        X_old.at(t + 1) = activeModelTranslator->ReturnStateVectorQuaternions(
-                MuJoCo_helper->saved_systems_state_list[t + 1],
-                activeModelTranslator->current_state_vector);
-    }
+    UpdateStateVectorBuffers(old_state_vector);
 }
 
 void iLQR_SVR::RemoveDofs(){
+    struct stateVectorList old_state_vector = activeModelTranslator->current_state_vector;
     if(!activeModelTranslator->candidates_for_removal.empty()){
         activeModelTranslator->UpdateCurrentStateVector(activeModelTranslator->candidates_for_removal, false);
     }
 
-    Resize(activeModelTranslator->current_state_vector.dof,
-           activeModelTranslator->current_state_vector.num_ctrl, horizon_length);
-    X_old.at(0) = activeModelTranslator->ReturnStateVectorQuaternions(
-            MuJoCo_helper->saved_systems_state_list[0],
-            activeModelTranslator->current_state_vector);
-    for(int t = 0; t < horizon_length; t++) {
-        X_old.at(t + 1) = activeModelTranslator->ReturnStateVectorQuaternions(
-                MuJoCo_helper->saved_systems_state_list[t + 1],
-                activeModelTranslator->current_state_vector);
-    }
+    UpdateStateVectorBuffers(old_state_vector);
 }
 
 void iLQR_SVR::AdjustCurrentStateVector(){
     bool update_nominal = false;
+    struct stateVectorList old_state_vector = activeModelTranslator->current_state_vector;
 
     std::vector<std::string> re_add_dofs = activeModelTranslator->RandomSampleUnusedDofs(num_dofs_readd);
 
@@ -1072,24 +1255,18 @@ void iLQR_SVR::AdjustCurrentStateVector(){
 //    std::cout << "\n";
 
     if(update_nominal){
-        Resize(activeModelTranslator->current_state_vector.dof,
-               activeModelTranslator->current_state_vector.num_ctrl, horizon_length);
-        X_old.at(0) = activeModelTranslator->ReturnStateVectorQuaternions(
-                MuJoCo_helper->saved_systems_state_list[0],
-                activeModelTranslator->current_state_vector);
-        for(int t = 0 ; t < horizon_length; t++) {
-            X_old.at(t + 1) = activeModelTranslator->ReturnStateVectorQuaternions(
-                    MuJoCo_helper->saved_systems_state_list[t + 1],
-                    activeModelTranslator->current_state_vector);
-        }
+        UpdateStateVectorBuffers(old_state_vector);
     }
 }
 
 void iLQR_SVR::UpdateNominal(){
     // Update the nominal state and control vector
     for(int t = 0 ; t < horizon_length; t++){
-        X_old.at(t + 1) = activeModelTranslator->ReturnStateVectorQuaternions(MuJoCo_helper->saved_systems_state_list[t + 1],
-                                                                              activeModelTranslator->current_state_vector);
+        X_full_old.at(t + 1) = activeModelTranslator->ReturnStateVectorQuaternions(MuJoCo_helper->saved_systems_state_list[t + 1],
+                                                                                   activeModelTranslator->full_state_vector);
+        for(int i = 0; i < active_state_indices.size(); i++){
+            X_old[t + 1](i, 0) = X_full_old[t + 1](active_state_indices[i], 0);
+        }
         U_old[t] = activeModelTranslator->ReturnControlVector(MuJoCo_helper->saved_systems_state_list[t],
                                                               activeModelTranslator->current_state_vector);
     }
@@ -1108,6 +1285,7 @@ void iLQR_SVR::PrintBanner(double time_rollout){
               << std::setw(10) << "| Lambda"
               << std::setw(11) << "| num dofs"
               << std::setw(16) << "| % Derivatives"
+              << std::setw(11) << "| % Reused"
               << std::setw(20) << "| Time Derivs (ms)"
               << std::setw(15) << "| Time BP (ms)"
               << std::setw(15) << "| Time FP (ms)"
@@ -1115,7 +1293,7 @@ void iLQR_SVR::PrintBanner(double time_rollout){
 }
 
 void iLQR_SVR::PrintBannerIteration(int iteration, double _new_cost, double _old_cost, double eps,
-                                double _lambda, int num_dofs, double percent_derivatives, double time_derivs, double time_bp,
+                                double _lambda, int num_dofs, double percent_derivatives, double percent_reused, double time_derivs, double time_bp,
                                 double time_fp, double best_alpha){
 
     std::cout << std::left << "|" << std::setw(11) << iteration
@@ -1125,6 +1303,7 @@ void iLQR_SVR::PrintBannerIteration(int iteration, double _new_cost, double _old
               << "|" << std::setw(9)<< std::setprecision(5) << _lambda
               << "|" << std::setw(10) << num_dofs
               << "|" << std::setw(15) << percent_derivatives
+              << "|" << std::setw(10) << percent_reused
               << "|" << std::setw(19) << fixed << std::setprecision(0) <<  time_derivs
               << "|" << std::setw(14)  << time_bp
               << "|" << std::setw(14) << time_fp
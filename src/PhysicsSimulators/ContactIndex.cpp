@@ -0,0 +1,92 @@
+#include "ContactIndex.h"
+#include <algorithm>
+
+ContactIndex::ContactIndex(std::shared_ptr<const contact_index_tables> _tables){
+    tables = std::move(_tables);
+
+    body_bits.assign((tables->num_roots + 63) / 64, 0);
+}
+
+std::shared_ptr<const contact_index_tables> ContactIndex::BuildTables(const mjModel *m){
+    auto new_tables = std::make_shared<contact_index_tables>();
+
+    new_tables->root_slot.assign(m->nbody, -1);
+    for(int i = 0; i < m->nbody; i++){
+        if(m->body_rootid[i] == i){
+            new_tables->root_slot[i] = new_tables->num_roots++;
+        }
+    }
+
+    new_tables->geom_root.resize(m->ngeom);
+    for(int i = 0; i < m->ngeom; i++){
+        new_tables->geom_root[i] = m->body_rootid[m->geom_bodyid[i]];
+    }
+
+    new_tables->flex_vert_adr.resize(m->nflex);
+    new_tables->flex_elem_adr.resize(m->nflex);
+    for(int f = 0; f < m->nflex; f++){
+        new_tables->flex_vert_adr[f] = static_cast<int>(new_tables->flex_vert_root.size());
+        for(int v = 0; v < m->flex_vertnum[f]; v++){
+            new_tables->flex_vert_root.push_back(m->body_rootid[m->flex_vertbodyid[m->flex_vertadr[f] + v]]);
+        }
+
+        // Element vertex ids are local to the flex, each element stores dim + 1 of them
+        new_tables->flex_elem_adr[f] = static_cast<int>(new_tables->flex_elem_root.size());
+        const int elem_size = m->flex_dim[f] + 1;
+        for(int e = 0; e < m->flex_elemnum[f]; e++){
+            const int vertex = m->flex_elem[m->flex_elemdataadr[f] + e * elem_size];
+            new_tables->flex_elem_root.push_back(m->body_rootid[m->flex_vertbodyid[m->flex_vertadr[f] + vertex]]);
+        }
+    }
+
+    return new_tables;
+}
+
+void ContactIndex::Build(const mjData *d){
+    if(!tables){
+        std::cerr << "ContactIndex built without model tables, exiting \n";
+        exit(1);
+    }
+
+    std::fill(body_bits.begin(), body_bits.end(), 0);
+    pairs.clear();
+    num_collisions = 0;
+
+    for(int i = 0; i < d->ncon; i++){
+        const int root_1 = tables->ContactRoot(d->contact[i], 0);
+        const int root_2 = tables->ContactRoot(d->contact[i], 1);
+        if(root_1 == -1 || root_2 == -1){
+            continue;
+        }
+
+        pairs.push_back(std::minmax(root_1, root_2));
+
+        // The world body (0) does not count as a collision
+        if(root_2 != 0){
+            SetBit(body_bits, tables->root_slot[root_1]);
+        }
+        if(root_1 != 0){
+            SetBit(body_bits, tables->root_slot[root_2]);
+        }
+        if(root_1 != 0 && root_2 != 0 && root_1 != root_2){
+            num_collisions++;
+        }
+    }
+
+    // Few pairs are in contact at once, a sorted list stays small where a roots x roots bitset would not
+    std::sort(pairs.begin(), pairs.end());
+    pairs.erase(std::unique(pairs.begin(), pairs.end()), pairs.end());
+}
+
+bool ContactIndex::Pair(int body_1, int body_2) const{
+    return std::binary_search(pairs.begin(), pairs.end(), std::minmax(body_1, body_2));
+}
+
+bool ContactIndex::Body(int body) const{
+    const int slot = tables->root_slot[body];
+    if(slot == -1){
+        return false;
+    }
+
+    return TestBit(body_bits, slot);
+}
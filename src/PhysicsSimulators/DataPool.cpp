@@ -0,0 +1,114 @@
+#include "DataPool.h"
+
+// ------------------------------------------ DataLease -------------------------------------------------
+DataLease::DataLease(DataLease &&other) noexcept{
+    pool = other.pool;
+    data = other.data;
+    other.pool = nullptr;
+    other.data = nullptr;
+}
+
+DataLease& DataLease::operator=(DataLease &&other) noexcept{
+    if(this != &other){
+        Reset();
+        pool = other.pool;
+        data = other.data;
+        other.pool = nullptr;
+        other.data = nullptr;
+    }
+    return *this;
+}
+
+DataLease::~DataLease(){
+    Reset();
+}
+
+void DataLease::Reset(){
+    if(pool && data){
+        pool->Release(data);
+    }
+    pool = nullptr;
+    data = nullptr;
+}
+
+// ------------------------------------------ DataPool --------------------------------------------------
+DataPool::~DataPool(){
+    for(auto d : all_data){
+        mj_deleteData(d);
+    }
+}
+
+void DataPool::Init(const mjModel *m){
+    std::lock_guard<std::mutex> lock(mtx);
+    if(!all_data.empty()){
+        std::cerr << "DataPool initialised after data was allocated, exiting \n";
+        exit(1);
+    }
+    model = m;
+}
+
+void DataPool::SetCapacity(int _capacity){
+    std::lock_guard<std::mutex> lock(mtx);
+    if(_capacity < 0 || (_capacity > 0 && _capacity < static_cast<int>(all_data.size()))){
+        std::cerr << "DataPool capacity must be 0 (unlimited) or at least the " << all_data.size()
+                  << " data objects already allocated, exiting \n";
+        exit(1);
+    }
+    capacity = _capacity;
+}
+
+mjData* DataPool::Acquire(){
+    std::lock_guard<std::mutex> lock(mtx);
+
+    mjData *d;
+    if(!free_data.empty()){
+        d = free_data.back();
+        free_data.pop_back();
+    }
+    else{
+        if(model == nullptr){
+            std::cerr << "DataPool used before Init, exiting \n";
+            exit(1);
+        }
+        if(capacity > 0 && all_data.size() >= capacity){
+            std::cerr << "DataPool capacity of " << capacity << " mjData objects exceeded, exiting \n";
+            exit(1);
+        }
+        d = mj_makeData(model);
+        all_data.push_back(d);
+    }
+
+    num_in_use++;
+    high_water_mark = std::max(high_water_mark, num_in_use);
+
+    return d;
+}
+
+void DataPool::Release(mjData *d){
+    if(d == nullptr){
+        return;
+    }
+
+    std::lock_guard<std::mutex> lock(mtx);
+    free_data.push_back(d);
+    num_in_use--;
+}
+
+DataLease DataPool::Lease(){
+    return {this, Acquire()};
+}
+
+int DataPool::NumAllocated() const{
+    std::lock_guard<std::mutex> lock(mtx);
+    return static_cast<int>(all_data.size());
+}
+
+int DataPool::NumInUse() const{
+    std::lock_guard<std::mutex> lock(mtx);
+    return num_in_use;
+}
+
+int DataPool::HighWaterMark() const{
+    std::lock_guard<std::mutex> lock(mtx);
+    return high_water_mark;
+}
@@ -0,0 +1,203 @@
+#include "ModelCache.h"
+#include <unistd.h>
+#include <algorithm>
+#include <sstream>
+
+ModelCache::ModelCache(std::string _cache_directory){
+    cache_directory = std::move(_cache_directory);
+}
+
+mjModel* ModelCache::LoadModel(const std::string &xml_path, char *error, int error_sz){
+    last_load_cached = false;
+    std::string cache_path = CachePath(xml_path);
+
+    if(std::filesystem::exists(cache_path)){
+        // mj_loadModel rejects binaries from a different MuJoCo version, the hash guards against source changes
+        mjModel *m = mj_loadModel(cache_path.c_str(), nullptr);
+        if(m){
+            last_load_cached = true;
+            return m;
+        }
+        std::cerr << "Cached model " << cache_path << " could not be loaded, recompiling \n";
+    }
+
+    return CompileAndSave(xml_path, cache_path, error, error_sz);
+}
+
+bool ModelCache::Prewarm(const std::string &xml_path){
+    char error[1000] = "";
+    mjModel *m = LoadModel(xml_path, error, 1000);
+    if(!m){
+        std::cerr << "Could not compile " << xml_path << ": " << error << "\n";
+        return false;
+    }
+
+    std::cout << (last_load_cached ? "already cached: " : "cached: ") << xml_path << "\n";
+    mj_deleteModel(m);
+    return true;
+}
+
+uint64_t ModelCache::HashModelFiles(const std::string &xml_path) const{
+    // FNV-1a offset basis
+    uint64_t hash = 14695981039346656037ULL;
+
+    int version = mj_version();
+    int header = mjVERSION_HEADER;
+    int num_size = sizeof(mjtNum);
+    HashBytes(&version, sizeof(version), hash);
+    HashBytes(&header, sizeof(header), hash);
+    HashBytes(&num_size, sizeof(num_size), hash);
+
+    std::filesystem::path model_file = std::filesystem::weakly_canonical(xml_path);
+    std::string model_file_string = model_file.string();
+    HashBytes(model_file_string.data(), model_file_string.size(), hash);
+
+    std::vector<std::string> asset_dirs;
+    std::vector<std::string> visited;
+    HashXMLFile(model_file, model_file.parent_path(), asset_dirs, visited, hash);
+
+    return hash;
+}
+
+std::string ModelCache::CachePath(const std::string &xml_path) const{
+    std::stringstream name;
+    name << std::filesystem::path(xml_path).stem().string() << "_" << std::hex << std::setw(16)
+         << std::setfill('0') << HashModelFiles(xml_path) << ".mjb";
+
+    return (std::filesystem::path(cache_directory) / name.str()).string();
+}
+
+void ModelCache::HashXMLFile(const std::filesystem::path &xml_file, const std::filesystem::path &model_dir,
+                             std::vector<std::string> &asset_dirs, std::vector<std::string> &visited, uint64_t &hash) const{
+
+    std::string canonical = std::filesystem::weakly_canonical(xml_file).string();
+    if(std::find(visited.begin(), visited.end(), canonical) != visited.end()){
+        return;
+    }
+    visited.push_back(canonical);
+
+    std::ifstream file(xml_file, std::ios::binary);
+    std::string text((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+    HashBytes(text.data(), text.size(), hash);
+
+    // Drop comments so commented out includes / assets are not resolved
+    size_t comment_start;
+    while((comment_start = text.find("<!--")) != std::string::npos){
+        size_t comment_end = text.find("-->", comment_start);
+        text.erase(comment_start, comment_end == std::string::npos ? std::string::npos : comment_end + 3 - comment_start);
+    }
+
+    // Compiler directories can appear in any (included) file, they are collected as files are visited
+    for(const char *attribute : {"meshdir", "texturedir", "assetdir"}){
+        for(const std::string &dir : AttributeValues(text, attribute)){
+            if(std::find(asset_dirs.begin(), asset_dirs.end(), dir) == asset_dirs.end()){
+                asset_dirs.push_back(dir);
+            }
+        }
+    }
+
+    for(const std::string &file_name : AttributeValues(text, "file")){
+        HashBytes(file_name.data(), file_name.size(), hash);
+
+        std::vector<std::filesystem::path> candidates = {model_dir / file_name, xml_file.parent_path() / file_name};
+        for(const std::string &dir : asset_dirs){
+            candidates.push_back(model_dir / dir / file_name);
+        }
+
+        for(const auto &candidate : candidates){
+            if(!std::filesystem::is_regular_file(candidate)){
+                continue;
+            }
+
+            if(candidate.extension() == ".xml"){
+                HashXMLFile(candidate, model_dir, asset_dirs, visited, hash);
+            }
+            else{
+                HashFileContents(candidate, hash);
+            }
+            break;
+        }
+    }
+}
+
+bool ModelCache::HashFileContents(const std::filesystem::path &file, uint64_t &hash){
+    std::ifstream stream(file, std::ios::binary);
+    if(!stream){
+        return false;
+    }
+
+    char buffer[1 << 16];
+    while(stream){
+        stream.read(buffer, sizeof(buffer));
+        HashBytes(buffer, static_cast<size_t>(stream.gcount()), hash);
+    }
+    return true;
+}
+
+void ModelCache::HashBytes(const void *data, size_t size, uint64_t &hash){
+    // 64 bit FNV-1a
+    const auto *bytes = static_cast<const unsigned char*>(data);
+    for(size_t i = 0; i < size; i++){
+        hash ^= bytes[i];
+        hash *= 1099511628211ULL;
+    }
+}
+
+std::vector<std::string> ModelCache::AttributeValues(const std::string &text, const std::string &attribute){
+    std::vector<std::string> values;
+
+    size_t pos = 0;
+    while((pos = text.find(attribute, pos)) != std::string::npos){
+        size_t cursor = pos + attribute.size();
+        bool preceded_by_space = pos > 0 && std::isspace(static_cast<unsigned char>(text[pos - 1]));
+        pos = cursor;
+        if(!preceded_by_space){
+            continue;
+        }
+
+        while(cursor < text.size() && std::isspace(static_cast<unsigned char>(text[cursor]))){
+            cursor++;
+        }
+        if(cursor >= text.size() || text[cursor] != '='){
+            continue;
+        }
+        cursor++;
+        while(cursor < text.size() && std::isspace(static_cast<unsigned char>(text[cursor]))){
+            cursor++;
+        }
+        if(cursor >= text.size() || (text[cursor] != '"' && text[cursor] != '\'')){
+            continue;
+        }
+
+        char quote = text[cursor];
+        size_t value_end = text.find(quote, cursor + 1);
+        if(value_end == std::string::npos){
+            break;
+        }
+        values.push_back(text.substr(cursor + 1, value_end - cursor - 1));
+        pos = value_end + 1;
+    }
+
+    return values;
+}
+
+mjModel* ModelCache::CompileAndSave(const std::string &xml_path, const std::string &cache_path, char *error, int error_sz) const{
+    mjModel *m = mj_loadXML(xml_path.c_str(), nullptr, error, error_sz);
+    if(!m){
+        return nullptr;
+    }
+
+    std::error_code ec;
+    std::filesystem::create_directories(cache_directory, ec);
+
+    // Write to a per-process temporary file then rename, so parallel launches never read a partial binary
+    std::string temp_path = cache_path + ".tmp" + std::to_string(getpid());
+    mj_saveModel(m, temp_path.c_str(), nullptr, 0);
+    std::filesystem::rename(temp_path, cache_path, ec);
+    if(ec){
+        std::filesystem::remove(temp_path, ec);
+        std::cerr << "Could not write model cache file " << cache_path << "\n";
+    }
+
+    return m;
+}
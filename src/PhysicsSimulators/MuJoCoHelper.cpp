@@ -3,6 +3,9 @@
 //
 
 #include "MuJoCoHelper.h"
+#include <limits>
+
+std::string MuJoCoHelper::model_cache_directory;
 
 // Empty constructor
 MuJoCoHelper::MuJoCoHelper(vector<robot> _robots, vector<string> _bodies) {
@@ -11,255 +14,293 @@ MuJoCoHelper::MuJoCoHelper(vector<robot> _robots, vector<string> _bodies) {
     bodies = _bodies;
 }
 
-// ------------------------------------    ROBOT UTILITY   --------------------------------------------
-// Checks whether a robot of this name exists in the simulation
-bool MuJoCoHelper::IsValidRobotName(const string& robot_name, int &robot_index, string &robot_base_joint_name){
-    bool valid_robot = false;
-    for(int i = 0; i < robots.size(); i++){
-        if(robots[i].name == robot_name){
-            valid_robot = true;
-            if(robots[i].joint_names.size() > 0){
-                robot_base_joint_name = robots[i].joint_names[0];
+// ------------------------------------    HANDLES   --------------------------------------------------
+void MuJoCoHelper::BuildHandleTables(){
+    body_ids.clear();
+    joint_ids.clear();
+    actuator_ids.clear();
+    flex_ids.clear();
+    sensor_ids.clear();
+    robot_indices.clear();
+    robot_handles.clear();
+
+    auto add_names = [this](mjtObj type, int num, std::unordered_map<string, int> &table){
+        for(int i = 0; i < num; i++){
+            const char *name = mj_id2name(model, type, i);
+            if(name != nullptr){
+                table.emplace(name, i);
             }
-            else{
-                robot_base_joint_name = "";
-            }
-
-            robot_index = i;
+        }
+    };
+
+    add_names(mjOBJ_BODY, model->nbody, body_ids);
+    add_names(mjOBJ_JOINT, model->njnt, joint_ids);
+    add_names(mjOBJ_ACTUATOR, model->nu, actuator_ids);
+    add_names(mjOBJ_FLEX, model->nflex, flex_ids);
+    add_names(mjOBJ_SENSOR, model->nsensor, sensor_ids);
+
+    contact_tables = ContactIndex::BuildTables(model);
+
+    flex_vertex_qpos_adr.assign(model->nflex, {});
+    flex_vertex_dof_adr.assign(model->nflex, {});
+    for(int f = 0; f < model->nflex; f++){
+        for(int v = 0; v < model->flex_vertnum[f]; v++){
+            const int joint_index = model->body_jntadr[model->flex_vertbodyid[model->flex_vertadr[f] + v]];
+            flex_vertex_qpos_adr[f].push_back(joint_index == -1 ? -1 : model->jnt_qposadr[joint_index]);
+            flex_vertex_dof_adr[f].push_back(joint_index == -1 ? -1 : model->jnt_dofadr[joint_index]);
         }
     }
 
-    return valid_robot;
-}
+    for(int i = 0; i < robots.size(); i++){
+        robot_handle handle;
+        handle.index = i;
 
-// Sets a robot joint positions the given values
-void MuJoCoHelper::SetRobotJointPositions(const string& robot_name, vector<double> joint_positions, mjData *d){
+        for(const auto &joint_name : robots[i].joint_names){
+            joint_handle joint = JointHandle(joint_name);
+            handle.qpos_adr.push_back(joint.qpos_adr);
+            handle.dof_adr.push_back(joint.dof_adr);
+        }
 
-    // Check if the robot exists in the simulation
-    int robot_index;
-    string robot_base_joint_name;
-    if(IsValidRobotName(robot_name, robot_index, robot_base_joint_name)){
-        if(joint_positions.size() != robots[robot_index].joint_names.size()){
-            std::cerr << "Invalid number of joint positions\n";
-            exit(1);
+        for(const auto &actuator_name : robots[i].actuator_names){
+            handle.actuator_ids.push_back(ActuatorHandle(actuator_name).id);
         }
-    }
-    else{
-        std::cerr << "That robot doesnt exist in the simulation\n";
-        exit(1);
-    }
 
-    for(int i = 0; i < joint_positions.size(); i++){
-        int joint_id = mj_name2id(model, mjOBJ_JOINT, robots[robot_index].joint_names[i].c_str());
-        if(joint_id == -1){
-            std::cerr << "Invalid bodyId for robot: " << robots[robot_index].joint_names[i].c_str() << "\n";
-            exit(1);
+        if(!handle.dof_adr.empty()){
+            handle.base_dof_adr = handle.dof_adr[0];
         }
-        int q_pos_index = model->jnt_qposadr[joint_id];
-        d->qpos[q_pos_index] = joint_positions[i];
+
+        robot_indices.emplace(robots[i].name, i);
+        robot_handles.push_back(handle);
     }
 }
 
-// Sets a robot joint velocities the given values
-void MuJoCoHelper::SetRobotJointsVelocities(const string& robot_name, vector<double> joint_velocities, mjData *d){
-
-    // Check if the robot exists in the simulation
-    int robot_index;
-    string robot_base_joint_name;
-    if(IsValidRobotName(robot_name, robot_index, robot_base_joint_name)){
-        if(joint_velocities.size() != robots[robot_index].joint_names.size()){
-            std::cerr << "Invalid number of joint positions\n";
-            exit(1);
-        }
-    }
-    else{
-        std::cerr << "That robot doesnt exist in the simulation\n";
+body_handle MuJoCoHelper::BodyHandle(const string& body_name) const{
+    auto it = body_ids.find(body_name);
+    if(it == body_ids.end()){
+        std::cerr << "Body " << body_name << " not found in the model, exiting \n";
         exit(1);
     }
 
-    for(int i = 0; i < joint_velocities.size(); i++){
-        int joint_id = mj_name2id(model, mjOBJ_JOINT, robots[robot_index].joint_names[i].c_str());
-        if(joint_id == -1){
-            std::cerr << "Invalid bodyId for robot: " << robots[robot_index].joint_names[i].c_str() << "\n";
-            exit(1);
-        }
-        int dof_index = model->jnt_dofadr[joint_id];
-        d->qvel[dof_index] = joint_velocities[i];
+    body_handle handle;
+    handle.id = it->second;
+    const int joint_index = model->body_jntadr[handle.id];
+    if(joint_index != -1){
+        handle.qpos_adr = model->jnt_qposadr[joint_index];
+        handle.dof_adr = model->jnt_dofadr[joint_index];
     }
-}
 
-void MuJoCoHelper::SetRobotJointsControls(const string& robot_name, vector<double> joint_controls, mjData *d){
+    return handle;
+}
 
-    // Check if the robot exists in the simulation
-    int robot_index;
-    string robot_base_joint_name;
-    if(IsValidRobotName(robot_name, robot_index, robot_base_joint_name)){
-        if(joint_controls.size() != robots[robot_index].actuator_names.size()){
-            std::cerr << "Invalid number of joint positions\n";
-            exit(1);
-        }
-    }
-    else{
-        std::cerr << "That robot doesnt exist in the simulation\n";
+joint_handle MuJoCoHelper::JointHandle(const string& joint_name) const{
+    auto it = joint_ids.find(joint_name);
+    if(it == joint_ids.end()){
+        std::cerr << "Joint " << joint_name << " not found in the model, exiting \n";
         exit(1);
     }
 
-    for(int i = 0; i < joint_controls.size(); i++){
-        int actuator_id = mj_name2id(model, mjOBJ_ACTUATOR, robots[robot_index].actuator_names[i].c_str());
-        d->ctrl[actuator_id] = joint_controls[i];
-    }
-}
+    joint_handle handle;
+    handle.id = it->second;
+    handle.qpos_adr = model->jnt_qposadr[handle.id];
+    handle.dof_adr = model->jnt_dofadr[handle.id];
 
-void MuJoCoHelper::GetRobotJointsPositions(const string& robot_name, vector<double> &joint_positions, mjData *d){
-    int robot_index;
-    string robot_base_joint_name;
+    return handle;
+}
 
-    if(!IsValidRobotName(robot_name, robot_index, robot_base_joint_name)){
-        std::cerr << "That robot doesnt exist in the simulation\n";
+actuator_handle MuJoCoHelper::ActuatorHandle(const string& actuator_name) const{
+    auto it = actuator_ids.find(actuator_name);
+    if(it == actuator_ids.end()){
+        std::cerr << "Actuator " << actuator_name << " not found in the model, exiting \n";
         exit(1);
     }
 
-    joint_positions.resize(robots[robot_index].joint_names.size());
+    return {it->second};
+}
 
-    for(int i = 0; i < robots[robot_index].joint_names.size(); i++){
-        int joint_id = mj_name2id(model, mjOBJ_JOINT, robots[robot_index].joint_names[i].c_str());
-        if(joint_id == -1){
-            std::cerr << "Invalid bodyId for robot: " << robots[robot_index].joint_names[i].c_str() << "\n";
-            exit(1);
-        }
-        int qpos_index = model->jnt_qposadr[joint_id];
-        joint_positions[i] = d->qpos[qpos_index];
+flex_handle MuJoCoHelper::FlexHandle(const string& flex_name) const{
+    auto it = flex_ids.find(flex_name);
+    if(it == flex_ids.end()){
+        std::cerr << "Flex " << flex_name << " not found in the model, exiting \n";
+        exit(1);
     }
+
+    flex_handle handle;
+    handle.id = it->second;
+    handle.vert_adr = model->flex_vertadr[handle.id];
+    handle.num_vertices = model->flex_vertnum[handle.id];
+
+    return handle;
 }
 
-void MuJoCoHelper::GetRobotJointsVelocities(const string& robot_name, vector<double> &joint_velocities, mjData *d) {
-    int robot_index;
-    string robot_base_joint_name;
+sensor_handle MuJoCoHelper::SensorHandle(const string& sensor_name) const{
+    sensor_handle handle;
 
-    if(!IsValidRobotName(robot_name, robot_index, robot_base_joint_name)){
+    // Missing sensors are not fatal, SensorState reports them and returns nullptr
+    auto it = sensor_ids.find(sensor_name);
+    if(it != sensor_ids.end()){
+        handle.id = it->second;
+        handle.adr = model->sensor_adr[handle.id];
+    }
+
+    return handle;
+}
+
+const robot_handle& MuJoCoHelper::RobotHandle(const string& robot_name) const{
+    auto it = robot_indices.find(robot_name);
+    if(it == robot_indices.end()){
         std::cerr << "That robot doesnt exist in the simulation\n";
         exit(1);
     }
 
-    joint_velocities.resize(robots[robot_index].joint_names.size());
+    return robot_handles[it->second];
+}
 
-    for(int i = 0; i < robots[robot_index].joint_names.size(); i++){
-        int joint_id = mj_name2id(model, mjOBJ_JOINT, robots[robot_index].joint_names[i].c_str());
-        if(joint_id == -1){
-            std::cerr << "Invalid bodyId for robot: " << robots[robot_index].joint_names[i].c_str() << "\n";
-            exit(1);
-        }
-        int dof_index = model->jnt_dofadr[joint_id];
-        joint_velocities[i] = d->qvel[dof_index];
+// --------------------------------- END OF HANDLES ---------------------------------------------
+
+// ------------------------------------    ROBOT UTILITY   --------------------------------------------
+// Checks whether a robot of this name exists in the simulation
+bool MuJoCoHelper::IsValidRobotName(const string& robot_name, int &robot_index, string &robot_base_joint_name){
+    auto it = robot_indices.find(robot_name);
+    if(it == robot_indices.end()){
+        return false;
     }
+
+    robot_index = it->second;
+    if(!robots[robot_index].joint_names.empty()){
+        robot_base_joint_name = robots[robot_index].joint_names[0];
+    }
+    else{
+        robot_base_joint_name = "";
+    }
+
+    return true;
 }
 
-void MuJoCoHelper::GetRobotJointsAccelerations(const string& robot_name, vector<double> &joint_accelerations, mjData *d){
-    int robot_index;
-    string robot_base_joint_name;
+// Sets a robot joint positions the given values
+void MuJoCoHelper::SetRobotJointPositions(const string& robot_name, vector<double> joint_positions, mjData *d){
+    SetRobotJointPositions(RobotHandle(robot_name), joint_positions, d);
+}
 
-    if(!IsValidRobotName(robot_name, robot_index, robot_base_joint_name)){
-        std::cerr << "That robot doesnt exist in the simulation\n";
+void MuJoCoHelper::SetRobotJointPositions(const robot_handle &robot, const vector<double> &joint_positions, mjData *d) const{
+    if(joint_positions.size() != robot.qpos_adr.size()){
+        std::cerr << "Invalid number of joint positions\n";
         exit(1);
     }
 
-    joint_accelerations.resize(robots[robot_index].joint_names.size());
+    for(int i = 0; i < joint_positions.size(); i++){
+        d->qpos[robot.qpos_adr[i]] = joint_positions[i];
+    }
+}
 
-    // Get the body id of the base link of the robot
-    int jointId = mj_name2id(model, mjOBJ_JOINT, robot_base_joint_name.c_str());
+// Sets a robot joint velocities the given values
+void MuJoCoHelper::SetRobotJointsVelocities(const string& robot_name, vector<double> joint_velocities, mjData *d){
+    SetRobotJointsVelocities(RobotHandle(robot_name), joint_velocities, d);
+}
 
-    if(jointId == -1){
-        std::cerr << "Base link of robot not found\n";
+void MuJoCoHelper::SetRobotJointsVelocities(const robot_handle &robot, const vector<double> &joint_velocities, mjData *d) const{
+    if(joint_velocities.size() != robot.dof_adr.size()){
+        std::cerr << "Invalid number of joint positions\n";
         exit(1);
     }
-    int startIndex = model->jnt_dofadr[jointId];
 
-    if(startIndex == -1){
-        std::cerr << "Invalid bodyId for robot\n";
+    for(int i = 0; i < joint_velocities.size(); i++){
+        d->qvel[robot.dof_adr[i]] = joint_velocities[i];
+    }
+}
+
+void MuJoCoHelper::SetRobotJointsControls(const string& robot_name, vector<double> joint_controls, mjData *d){
+    SetRobotJointsControls(RobotHandle(robot_name), joint_controls, d);
+}
+
+void MuJoCoHelper::SetRobotJointsControls(const robot_handle &robot, const vector<double> &joint_controls, mjData *d) const{
+    if(joint_controls.size() != robot.actuator_ids.size()){
+        std::cerr << "Invalid number of joint positions\n";
         exit(1);
     }
 
-    for(int i = 0; i < robots[robot_index].joint_names.size(); i++){
-        joint_accelerations[i] = d->qacc[startIndex + i];
+    for(int i = 0; i < joint_controls.size(); i++){
+        d->ctrl[robot.actuator_ids[i]] = joint_controls[i];
     }
 }
 
-void MuJoCoHelper::GetRobotJointsControls(const string& robot_name, vector<double> &joint_controls, mjData *d) {
-
-    // Check if the robot exists in the simulation
-    int robot_index = 0;
+void MuJoCoHelper::GetRobotJointsPositions(const string& robot_name, vector<double> &joint_positions, mjData *d){
+    GetRobotJointsPositions(RobotHandle(robot_name), joint_positions, d);
+}
 
-    joint_controls.resize(robots[robot_index].actuator_names.size());
+void MuJoCoHelper::GetRobotJointsPositions(const robot_handle &robot, vector<double> &joint_positions, mjData *d) const{
+    joint_positions.resize(robot.qpos_adr.size());
 
-    for(int i = 0; i < robots[robot_index].actuator_names.size(); i++){
-        int actuator_id = mj_name2id(model, mjOBJ_ACTUATOR, robots[robot_index].actuator_names[i].c_str());
-        joint_controls[i] = (d->ctrl[actuator_id]);
+    for(int i = 0; i < robot.qpos_adr.size(); i++){
+        joint_positions[i] = d->qpos[robot.qpos_adr[i]];
     }
 }
 
-void MuJoCoHelper::GetRobotJointsGravityCompensationControls(const string& robot_name, vector<double> &joint_controls, mjData *d){
-    int robot_index;
-    string robot_base_joint_name;
+void MuJoCoHelper::GetRobotJointsVelocities(const string& robot_name, vector<double> &joint_velocities, mjData *d) {
+    GetRobotJointsVelocities(RobotHandle(robot_name), joint_velocities, d);
+}
 
-    if(!IsValidRobotName(robot_name, robot_index, robot_base_joint_name)){
-        std::cerr << "That robot doesnt exist in the simulation\n";
-        exit(1);
-    }
+void MuJoCoHelper::GetRobotJointsVelocities(const robot_handle &robot, vector<double> &joint_velocities, mjData *d) const{
+    joint_velocities.resize(robot.dof_adr.size());
 
-    // Get the body id of the base link of the robot
-    int joint_id = mj_name2id(model, mjOBJ_JOINT, robot_base_joint_name.c_str());
+    for(int i = 0; i < robot.dof_adr.size(); i++){
+        joint_velocities[i] = d->qvel[robot.dof_adr[i]];
+    }
+}
 
-    joint_controls.resize(robots[robot_index].joint_names.size());
+void MuJoCoHelper::GetRobotJointsAccelerations(const string& robot_name, vector<double> &joint_accelerations, mjData *d){
+    GetRobotJointsAccelerations(RobotHandle(robot_name), joint_accelerations, d);
+}
 
-    if(joint_id == -1){
+void MuJoCoHelper::GetRobotJointsAccelerations(const robot_handle &robot, vector<double> &joint_accelerations, mjData *d) const{
+    if(robot.base_dof_adr == -1){
         std::cerr << "Base link of robot not found\n";
         exit(1);
     }
 
-    int start_index = model->jnt_dofadr[joint_id];
+    joint_accelerations.resize(robot.dof_adr.size());
 
-    if(start_index == -1){
-        std::cerr << "Invalid bodyId for robot\n";
-        exit(1);
+    for(int i = 0; i < robot.dof_adr.size(); i++){
+        joint_accelerations[i] = d->qacc[robot.base_dof_adr + i];
     }
+}
 
-    // TODO (DMackRus) - Check if this is needed?
-    mj_forward(model, d);
+void MuJoCoHelper::GetRobotJointsControls(const string& robot_name, vector<double> &joint_controls, mjData *d) {
+    GetRobotJointsControls(RobotHandle(robot_name), joint_controls, d);
+}
+
+void MuJoCoHelper::GetRobotJointsControls(const robot_handle &robot, vector<double> &joint_controls, mjData *d) const{
+    joint_controls.resize(robot.actuator_ids.size());
 
-    for(int i = 0; i < robots[robot_index].joint_names.size(); i++){
-        joint_controls[i] = d->qfrc_bias[start_index + i];
+    for(int i = 0; i < robot.actuator_ids.size(); i++){
+        joint_controls[i] = d->ctrl[robot.actuator_ids[i]];
     }
 }
 
-void MuJoCoHelper::GetRobotControlLimits(const string& robot_name, vector<double> &control_limits){
+void MuJoCoHelper::GetRobotJointsGravityCompensationControls(const string& robot_name, vector<double> &joint_controls, mjData *d){
+    const robot_handle &robot = RobotHandle(robot_name);
 
-    // Check if the robot exists in the simulation
-    int robot_index;
-    string robot_base_joint_name;
-    if(!IsValidRobotName(robot_name, robot_index, robot_base_joint_name)){
-        std::cerr << "That robot doesnt exist in the simulation\n";
+    if(robot.base_dof_adr == -1){
+        std::cerr << "Base link of robot not found\n";
         exit(1);
     }
 
-    // Get the body id of the base link of the robot
-//    int joint_id = mj_name2id(model, mjOBJ_JOINT, robot_base_joint_name.c_str());
+    joint_controls.resize(robot.dof_adr.size());
 
-    control_limits.resize(2 * robots[robot_index].actuator_names.size());
+    // TODO (DMackRus) - Check if this is needed?
+    mj_forward(model, d);
 
-//    if(joint_id == -1){
-//        std::cerr << "Base link of robot not found\n";
-//        exit(1);
-//    }
+    for(int i = 0; i < robot.dof_adr.size(); i++){
+        joint_controls[i] = d->qfrc_bias[robot.base_dof_adr + i];
+    }
+}
 
-//    int start_index = model->jnt_dofadr[joint_id];
-//
-//    if(start_index == -1){
-//        std::cerr << "Invalid bodyId for robot\n";
-//        exit(1);
-//    }
+void MuJoCoHelper::GetRobotControlLimits(const string& robot_name, vector<double> &control_limits){
+    const robot_handle &robot = RobotHandle(robot_name);
+
+    control_limits.resize(2 * robot.actuator_ids.size());
 
     // TOD_ (dmackrus) I think this doesnt accomadate for multiple robots
-    for(int i = 0; i < 2 * robots[robot_index].actuator_names.size(); i++){
+    for(int i = 0; i < 2 * robot.actuator_ids.size(); i++){
         control_limits[i] = model->actuator_ctrlrange[i];
     }
 }
@@ -273,19 +314,18 @@ void MuJoCoHelper::GetRobotJointLimits(const string& robot_name, vector<double>
 // ------------------------------------- BODY UTILITY -------------------------------------------
 
 bool MuJoCoHelper::BodyExists(const string& body_name, int &body_index){
-    bool body_exists = false;
-
-    body_index = mj_name2id(model, mjOBJ_BODY, body_name.c_str());
-    if(body_index != -1){
-        body_exists = true;
+    auto it = body_ids.find(body_name);
+    if(it == body_ids.end()){
+        body_index = -1;
+        return false;
     }
 
-    return body_exists;
+    body_index = it->second;
+    return true;
 }
 
 void MuJoCoHelper::SetBodyColor(const string& body_name, const float color[4]) const{
-    int body_id = mj_name2id(model, mjOBJ_BODY, body_name.c_str());
-    int geom_id = model->body_geomadr[body_id];
+    int geom_id = model->body_geomadr[BodyHandle(body_name).id];
 
     model->geom_rgba[geom_id * 4]     = color[0]; // Red
     model->geom_rgba[geom_id * 4 + 1] = color[1]; // Green
@@ -294,77 +334,77 @@ void MuJoCoHelper::SetBodyColor(const string& body_name, const float color[4]) c
 }
 
 void MuJoCoHelper::SetBodyPoseQuat(const string& body_name, pose_7 pose, mjData *d) const{
-    int body_id = mj_name2id(model, mjOBJ_BODY, body_name.c_str());
-    const int joint_index = model->body_jntadr[body_id];
-    const int qpos_index = model->jnt_qposadr[joint_index];
+    SetBodyPoseQuat(BodyHandle(body_name), pose, d);
+}
 
+void MuJoCoHelper::SetBodyPoseQuat(const body_handle &body, const pose_7 &pose, mjData *d) const{
     for(int i = 0; i < 3; i++){
-        d->qpos[qpos_index + i] = pose.position(i);
+        d->qpos[body.qpos_adr + i] = pose.position(i);
     }
 
     for(int i = 0; i < 4; i++){
-        d->qpos[qpos_index + 3 + i] = pose.quat(i);
+        d->qpos[body.qpos_adr + 3 + i] = pose.quat(i);
     }
 }
 
 void MuJoCoHelper::SetBodyPoseAngle(const string& body_name, pose_6 pose, mjData *d) const{
-    int body_id = mj_name2id(model, mjOBJ_BODY, body_name.c_str());
-    const int joint_index = model->body_jntadr[body_id];
-    const int qpos_index = model->jnt_qposadr[joint_index];
+    SetBodyPoseAngle(BodyHandle(body_name), pose, d);
+}
 
+void MuJoCoHelper::SetBodyPoseAngle(const body_handle &body, const pose_6 &pose, mjData *d) const{
 //    m_quat q = eul2Quat(pose.orientation);
     m_quat q = axis2Quat(pose.orientation);
 
     for(int i = 0; i < 3; i++){
-        d->qpos[qpos_index + i] = pose.position(i);
+        d->qpos[body.qpos_adr + i] = pose.position(i);
     }
 
     for(int i = 0; i < 4; i++){
-        d->qpos[qpos_index + 3 + i] = q(i);
+        d->qpos[body.qpos_adr + 3 + i] = q(i);
     }
 }
 
 void MuJoCoHelper::SetBodyVelocity(const string& body_name, pose_6 velocity, mjData *d) const{
-    int body_id = mj_name2id(model, mjOBJ_BODY, body_name.c_str());
-    const int joint_index = model->body_jntadr[body_id];
-    const int qvel_index = model->jnt_dofadr[joint_index];
+    SetBodyVelocity(BodyHandle(body_name), velocity, d);
+}
 
+void MuJoCoHelper::SetBodyVelocity(const body_handle &body, const pose_6 &velocity, mjData *d) const{
     for(int i = 0; i < 3; i++){
-        d->qvel[qvel_index + i] = velocity.position(i);
+        d->qvel[body.dof_adr + i] = velocity.position(i);
     }
 
     for(int i = 0; i < 3; i++){
-        d->qvel[qvel_index + 3 + i] = velocity.orientation(i);
+        d->qvel[body.dof_adr + 3 + i] = velocity.orientation(i);
     }
 }
 
 void MuJoCoHelper::GetBodyPoseQuat(const string& body_name, pose_7 &pose, mjData *d) const{
-    int body_id = mj_name2id(model, mjOBJ_BODY, body_name.c_str());
-    const int joint_index = model->body_jntadr[body_id];
-    const int qpos_index = model->jnt_qposadr[joint_index];
+    GetBodyPoseQuat(BodyHandle(body_name), pose, d);
+}
 
+void MuJoCoHelper::GetBodyPoseQuat(const body_handle &body, pose_7 &pose, mjData *d) const{
     for(int i = 0; i < 3; i++){
-        pose.position(i) = d->qpos[qpos_index + i];
+        pose.position(i) = d->qpos[body.qpos_adr + i];
     }
 
     for(int i = 0; i < 4; i++){
-        pose.quat(i) = d->qpos[qpos_index + 3 + i];
+        pose.quat(i) = d->qpos[body.qpos_adr + 3 + i];
     }
 }
 
 void MuJoCoHelper::GetBodyPoseAngle(const string& body_name, pose_6 &pose, mjData *d) const{
-    int body_id = mj_name2id(model, mjOBJ_BODY, body_name.c_str());
-    const int joint_index = model->body_jntadr[body_id];
-    const int qpos_index = model->jnt_qposadr[joint_index];
+    GetBodyPoseAngle(BodyHandle(body_name), pose, d);
+}
 
+void MuJoCoHelper::GetBodyPoseAngle(const body_handle &body, pose_6 &pose, mjData *d) const{
     for(int i = 0; i < 3; i++){
-        pose.position(i) = d->qpos[qpos_index + i];
+        pose.position(i) = d->qpos[body.qpos_adr + i];
     }
 
     m_quat quat;
 
     for(int i = 0; i < 4; i++){
-        quat(i) = d->qpos[qpos_index + 3 + i];
+        quat(i) = d->qpos[body.qpos_adr + 3 + i];
     }
 
 //    m_point euler = quat2Eul(quat);
@@ -377,16 +417,18 @@ void MuJoCoHelper::GetBodyPoseAngle(const string& body_name, pose_6 &pose, mjDat
 }
 
 void MuJoCoHelper::GetBodyPoseAngleViaXpos(const string& body_name, pose_6 &pose, mjData *d) const{
-    int body_id = mj_name2id(model, mjOBJ_BODY, body_name.c_str());
+    GetBodyPoseAngleViaXpos(BodyHandle(body_name), pose, d);
+}
 
+void MuJoCoHelper::GetBodyPoseAngleViaXpos(const body_handle &body, pose_6 &pose, mjData *d) const{
     for(int i = 0; i < 3; i++){
-        pose.position(i) = d->xpos[(3 * body_id) + i];
+        pose.position(i) = d->xpos[(3 * body.id) + i];
     }
 
     m_quat quat;
 
     for(int i = 0; i < 4; i++){
-        quat(i) = d->xpos[(4 * body_id) + i];
+        quat(i) = d->xpos[(4 * body.id) + i];
     }
 
     // TODO - hmmm not sure about this whether it should be euler or axis
@@ -398,62 +440,67 @@ void MuJoCoHelper::GetBodyPoseAngleViaXpos(const string& body_name, pose_6 &pose
 }
 
 void MuJoCoHelper::GetBodyPoseQuatViaXpos(const string& body_name, pose_7 &pose, mjData *d) const{
-    int body_id = mj_name2id(model, mjOBJ_BODY, body_name.c_str());
+    GetBodyPoseQuatViaXpos(BodyHandle(body_name), pose, d);
+}
 
+void MuJoCoHelper::GetBodyPoseQuatViaXpos(const body_handle &body, pose_7 &pose, mjData *d) const{
     for(int i = 0; i < 3; i++){
-        pose.position(i) = d->xpos[(3 * body_id) + i];
+        pose.position(i) = d->xpos[(3 * body.id) + i];
     }
 
     for(int i = 0; i < 4; i++){
-        pose.quat(i) = d->xquat[(4 * body_id) + i];
+        pose.quat(i) = d->xquat[(4 * body.id) + i];
     }
 }
 
 void MuJoCoHelper::GetBodyVelocity(const string& body_name, pose_6 &velocity, mjData *d) const{
-    int body_id = mj_name2id(model, mjOBJ_BODY, body_name.c_str());
-    const int joint_index = model->body_jntadr[body_id];
-    const int qvel_index = model->jnt_dofadr[joint_index];
+    GetBodyVelocity(BodyHandle(body_name), velocity, d);
+}
 
+void MuJoCoHelper::GetBodyVelocity(const body_handle &body, pose_6 &velocity, mjData *d) const{
     for(int i = 0; i < 3; i++){
-        velocity.position(i) = d->qvel[qvel_index + i];
+        velocity.position(i) = d->qvel[body.dof_adr + i];
     }
 
     for(int i = 0; i < 3; i++){
-        velocity.orientation(i) = d->qvel[qvel_index + 3 + i];
+        velocity.orientation(i) = d->qvel[body.dof_adr + 3 + i];
     }
 }
 
 void MuJoCoHelper::GetBodyAcceleration(const string& body_name, pose_6 &acceleration, mjData *d) const{
-    int body_id = mj_name2id(model, mjOBJ_BODY, body_name.c_str());
-    const int joint_index = model->body_jntadr[body_id];
-    const int qvel_index = model->jnt_dofadr[joint_index];
+    GetBodyAcceleration(BodyHandle(body_name), acceleration, d);
+}
 
+void MuJoCoHelper::GetBodyAcceleration(const body_handle &body, pose_6 &acceleration, mjData *d) const{
     for(int i = 0; i < 3; i++){
-        acceleration.position(i) = d->qacc[qvel_index + i];
+        acceleration.position(i) = d->qacc[body.dof_adr + i];
     }
 
     for(int i = 0; i < 3; i++){
-        acceleration.orientation(i) = d->qacc[qvel_index + 3 + i];
+        acceleration.orientation(i) = d->qacc[body.dof_adr + 3 + i];
     }
 }
 // --------------------------------- END OF BODY UTILITY ---------------------------------------
 
 // ---------------------------------- SOFT BODY UTILITY ----------------------------------------
 
-void MuJoCoHelper::SetSoftBodyVertexPos(const string& flex_name, int vertex_id, pose_6 &pose, mjData *d) const{
-    int flex_id = mj_name2id(model, mjOBJ_FLEX, flex_name.c_str());
-    int first_vert_address = model->flex_vertadr[flex_id];
-    int num_vertices = model->flex_vertnum[flex_id];
-
-    // Safety check to make sure vertex_id < num_vertices inside flex object
-    if(vertex_id > num_vertices){
-        std::cerr << "Vertex id in set soft body pos, vertex id: " << vertex_id << "num vertices: " << num_vertices << "\n";
+// Safety check to make sure vertex_id < num_vertices inside flex object, returns the vertex body id
+int MuJoCoHelper::SoftBodyVertexBody(const flex_handle &flex, int vertex_id, const char* caller) const{
+    if(vertex_id > flex.num_vertices){
+        std::cerr << "Vertex id in " << caller << ", vertex id: " << vertex_id << "num vertices: " << flex.num_vertices << "\n";
         exit(1);
     }
 
-    int body_id = model->flex_vertbodyid[first_vert_address + vertex_id];
-    const int joint_index = model->body_jntadr[body_id];
-    const int qpos_index = model->jnt_qposadr[joint_index];
+    return model->flex_vertbodyid[flex.vert_adr + vertex_id];
+}
+
+void MuJoCoHelper::SetSoftBodyVertexPos(const string& flex_name, int vertex_id, pose_6 &pose, mjData *d) const{
+    SetSoftBodyVertexPos(FlexHandle(flex_name), vertex_id, pose, d);
+}
+
+void MuJoCoHelper::SetSoftBodyVertexPos(const flex_handle &flex, int vertex_id, const pose_6 &pose, mjData *d) const{
+    int body_id = SoftBodyVertexBody(flex, vertex_id, "set soft body pos");
+    const int qpos_index = model->jnt_qposadr[model->body_jntadr[body_id]];
 
     d->qpos[qpos_index + 0] = pose.position[0];
     d->qpos[qpos_index + 1] = pose.position[1];
@@ -461,19 +508,12 @@ void MuJoCoHelper::SetSoftBodyVertexPos(const string& flex_name, int vertex_id,
 }
 
 void MuJoCoHelper::SetSoftBodyVertexVel(const string& flex_name, int vertex_id, pose_6 &pose, mjData *d) const{
-    int flex_id = mj_name2id(model, mjOBJ_FLEX, flex_name.c_str());
-    int first_vert_address = model->flex_vertadr[flex_id];
-    int num_vertices = model->flex_vertnum[flex_id];
-
-    // Safety check to make sure vertex_id < num_vertices inside flex object
-    if(vertex_id > num_vertices){
-        std::cerr << "Vertex id in set soft body vel, vertex id: " << vertex_id << "num vertices: " << num_vertices << "\n";
-        exit(1);
-    }
+    SetSoftBodyVertexVel(FlexHandle(flex_name), vertex_id, pose, d);
+}
 
-    int body_id = model->flex_vertbodyid[first_vert_address + vertex_id];
-    const int joint_index = model->body_jntadr[body_id];
-    const int qvel_index = model->jnt_dofadr[joint_index];
+void MuJoCoHelper::SetSoftBodyVertexVel(const flex_handle &flex, int vertex_id, const pose_6 &pose, mjData *d) const{
+    int body_id = SoftBodyVertexBody(flex, vertex_id, "set soft body vel");
+    const int qvel_index = model->jnt_dofadr[model->body_jntadr[body_id]];
 
     d->qvel[qvel_index + 0] = pose.position[0];
     d->qvel[qvel_index + 1] = pose.position[1];
@@ -481,20 +521,12 @@ void MuJoCoHelper::SetSoftBodyVertexVel(const string& flex_name, int vertex_id,
 }
 
 void MuJoCoHelper::GetSoftBodyVertexPos(const string& flex_name, int vertex_id, pose_6 &pose, mjData *d) const{
+    GetSoftBodyVertexPos(FlexHandle(flex_name), vertex_id, pose, d);
+}
 
-    int flex_id = mj_name2id(model, mjOBJ_FLEX, flex_name.c_str());
-    int first_vertex_adr = model->flex_vertadr[flex_id];
-    int num_vertices = model->flex_vertnum[flex_id];
-
-    // Safety check to make sure vertex_id < num_vertices inside flex object
-    if(vertex_id > num_vertices){
-        std::cerr << "Vertex id in get soft body pos, vertex id: " << vertex_id << "num vertices: " << num_vertices << "\n";
-        exit(1);
-    }
-
-    int body_id = model->flex_vertbodyid[first_vertex_adr + vertex_id];
-    const int joint_index = model->body_jntadr[body_id];
-    const int qpos_index = model->jnt_qposadr[joint_index];
+void MuJoCoHelper::GetSoftBodyVertexPos(const flex_handle &flex, int vertex_id, pose_6 &pose, mjData *d) const{
+    int body_id = SoftBodyVertexBody(flex, vertex_id, "get soft body pos");
+    const int qpos_index = model->jnt_qposadr[model->body_jntadr[body_id]];
 
     pose.position[0] = d->qpos[qpos_index + 0];
     pose.position[1] = d->qpos[qpos_index + 1];
@@ -507,19 +539,11 @@ void MuJoCoHelper::GetSoftBodyVertexPos(const string& flex_name, int vertex_id,
 }
 
 void MuJoCoHelper::GetSoftBodyVertexPosGlobal(const string& flex_name, int vertex_id, pose_6 &pose, mjData *d) const{
-    int flex_id = mj_name2id(model, mjOBJ_FLEX, flex_name.c_str());
-    int first_vertex_adr = model->flex_vertadr[flex_id];
-    int num_vertices = model->flex_vertnum[flex_id];
-
-    // Safety check to make sure vertex_id < num_vertices inside flex object
-    if(vertex_id > num_vertices){
-        std::cerr << "Vertex id in get soft body pos, vertex id: " << vertex_id << "num vertices: " << num_vertices << "\n";
-        exit(1);
-    }
+    GetSoftBodyVertexPosGlobal(FlexHandle(flex_name), vertex_id, pose, d);
+}
 
-    int body_id = model->flex_vertbodyid[first_vertex_adr + vertex_id];
-    const int joint_index = model->body_jntadr[body_id];
-    const int qpos_index = model->jnt_qposadr[joint_index];
+void MuJoCoHelper::GetSoftBodyVertexPosGlobal(const flex_handle &flex, int vertex_id, pose_6 &pose, mjData *d) const{
+    int body_id = SoftBodyVertexBody(flex, vertex_id, "get soft body pos");
 
     pose.position[0] = d->xpos[(3 *body_id) + 0];
     pose.position[1] = d->xpos[(3 * body_id) + 1];
@@ -532,23 +556,16 @@ void MuJoCoHelper::GetSoftBodyVertexPosGlobal(const string& flex_name, int verte
 }
 
 void MuJoCoHelper::GetSoftBodyVertexVel(const string& flex_name, int vertex_id, pose_6 &pose, mjData *d) const{
-    int flex_id = mj_name2id(model, mjOBJ_FLEX, flex_name.c_str());
-    int first_vertex_adr = model->flex_vertadr[flex_id];
-    int num_vertices = model->flex_vertnum[flex_id];
-
-    // Safety check to make sure vertex_id < num_vertices inside flex object
-    if(vertex_id > num_vertices){
-        std::cerr << "Vertex id in get soft body vel, vertex id: " << vertex_id << "num vertices: " << num_vertices << "\n";
-        exit(1);
-    }
+    GetSoftBodyVertexVel(FlexHandle(flex_name), vertex_id, pose, d);
+}
 
-    int body_id = model->flex_vertbodyid[first_vertex_adr + vertex_id];
-    const int joint_index = model->body_jntadr[body_id];
-    const int qpos_index = model->jnt_dofadr[joint_index];
+void MuJoCoHelper::GetSoftBodyVertexVel(const flex_handle &flex, int vertex_id, pose_6 &pose, mjData *d) const{
+    int body_id = SoftBodyVertexBody(flex, vertex_id, "get soft body vel");
+    const int qvel_index = model->jnt_dofadr[model->body_jntadr[body_id]];
 
-    pose.position[0] = d->qvel[qpos_index + 0];
-    pose.position[1] = d->qvel[qpos_index + 1];
-    pose.position[2] = d->qvel[qpos_index + 2];
+    pose.position[0] = d->qvel[qvel_index + 0];
+    pose.position[1] = d->qvel[qvel_index + 1];
+    pose.position[2] = d->qvel[qvel_index + 2];
 
     // Jus to initialise values to something, not used
     pose.orientation[0] = 0.0;
@@ -556,18 +573,275 @@ void MuJoCoHelper::GetSoftBodyVertexVel(const string& flex_name, int vertex_id,
     pose.orientation[2] = 0.0;
 }
 
+int MuJoCoHelper::GetSoftBodyPositions(const flex_handle &flex, const soft_body &body, Ref<VectorXd> segment, mjData *d) const{
+    const std::vector<int> &vertex_adr = SoftBodyVertexAddresses(flex_vertex_qpos_adr, flex, body);
+    if(body.num_clusters > 0){
+        return GatherSoftBodyClusters(vertex_adr, body, d->qpos, segment);
+    }
+    return GatherSoftBodyVertices(vertex_adr, body, d->qpos, segment);
+}
+
+int MuJoCoHelper::GetSoftBodyVelocities(const flex_handle &flex, const soft_body &body, Ref<VectorXd> segment, mjData *d) const{
+    const std::vector<int> &vertex_adr = SoftBodyVertexAddresses(flex_vertex_dof_adr, flex, body);
+    if(body.num_clusters > 0){
+        return GatherSoftBodyClusters(vertex_adr, body, d->qvel, segment);
+    }
+    return GatherSoftBodyVertices(vertex_adr, body, d->qvel, segment);
+}
+
+int MuJoCoHelper::SetSoftBodyPositions(const flex_handle &flex, const soft_body &body, const Ref<const VectorXd> &segment, mjData *d) const{
+    const std::vector<int> &vertex_adr = SoftBodyVertexAddresses(flex_vertex_qpos_adr, flex, body);
+    if(body.num_clusters > 0){
+        return ScatterSoftBodyClusters(vertex_adr, body, segment, d->qpos);
+    }
+    return ScatterSoftBodyVertices(vertex_adr, body, segment, d->qpos);
+}
+
+int MuJoCoHelper::SetSoftBodyVelocities(const flex_handle &flex, const soft_body &body, const Ref<const VectorXd> &segment, mjData *d) const{
+    const std::vector<int> &vertex_adr = SoftBodyVertexAddresses(flex_vertex_dof_adr, flex, body);
+    if(body.num_clusters > 0){
+        return ScatterSoftBodyClusters(vertex_adr, body, segment, d->qvel);
+    }
+    return ScatterSoftBodyVertices(vertex_adr, body, segment, d->qvel);
+}
+
+void MuJoCoHelper::ClusterSoftBodyVertices(soft_body &body){
+    flex_handle flex = FlexHandle(body.name);
+    const std::vector<int> &qpos_adr = SoftBodyVertexAddresses(flex_vertex_qpos_adr, flex, body);
+
+    std::vector<int> movable;
+    for(int i = 0; i < body.num_vertices; i++){
+        if(qpos_adr[i] != -1){
+            movable.push_back(i);
+        }
+    }
+
+    if(movable.empty()){
+        std::cerr << "Soft body " << body.name << " has no vertices with joints to cluster, exiting \n";
+        exit(1);
+    }
+
+    // Vertex positions in the rest configuration
+    std::vector<Eigen::Vector3d> points;
+    {
+        DataLease rest = data_pool.Lease();
+        mj_resetData(model, rest.get());
+        mj_kinematics(model, rest.get());
+
+        for(int vertex : movable){
+            int body_id = model->flex_vertbodyid[model->flex_vertadr[flex.id] + vertex];
+            points.emplace_back(rest->xpos[3 * body_id], rest->xpos[3 * body_id + 1], rest->xpos[3 * body_id + 2]);
+        }
+    }
+
+    const int num_points = static_cast<int>(points.size());
+    const int num_clusters = std::min(body.num_clusters, num_points);
+
+    // Farthest point initialisation from the first vertex, deterministic so the state layout is reproducible
+    std::vector<Eigen::Vector3d> centres = {points[0]};
+    std::vector<double> min_dist(num_points, std::numeric_limits<double>::max());
+    while(centres.size() < num_clusters){
+        int farthest = 0;
+        for(int k = 0; k < num_points; k++){
+            min_dist[k] = std::min(min_dist[k], (points[k] - centres.back()).squaredNorm());
+            if(min_dist[k] > min_dist[farthest]){
+                farthest = k;
+            }
+        }
+        centres.push_back(points[farthest]);
+    }
+
+    // Lloyd iterations until the assignment settles
+    std::vector<int> assignment(num_points, -1);
+    for(int iteration = 0; iteration < 100; iteration++){
+        bool changed = false;
+        for(int k = 0; k < num_points; k++){
+            int nearest = 0;
+            for(int c = 1; c < num_clusters; c++){
+                if((points[k] - centres[c]).squaredNorm() < (points[k] - centres[nearest]).squaredNorm()){
+                    nearest = c;
+                }
+            }
+            if(assignment[k] != nearest){
+                assignment[k] = nearest;
+                changed = true;
+            }
+        }
+
+        if(!changed){
+            break;
+        }
+
+        std::vector<Eigen::Vector3d> sums(num_clusters, Eigen::Vector3d::Zero());
+        std::vector<int> counts(num_clusters, 0);
+        for(int k = 0; k < num_points; k++){
+            sums[assignment[k]] += points[k];
+            counts[assignment[k]]++;
+        }
+        for(int c = 0; c < num_clusters; c++){
+            if(counts[c] > 0){
+                centres[c] = sums[c] / counts[c];
+            }
+        }
+    }
+
+    // Coincident vertices can leave clusters empty, those are dropped
+    body.clusters.clear();
+    for(int c = 0; c < num_clusters; c++){
+        soft_body_cluster cluster{};
+        for(int k = 0; k < num_points; k++){
+            if(assignment[k] != c){
+                continue;
+            }
+            cluster.vertices.push_back(movable[k]);
+            for(int j = 0; j < 3; j++){
+                cluster.active_linear_dof[j] = cluster.active_linear_dof[j] || body.vertices[movable[k]].active_linear_dof[j];
+            }
+        }
+
+        if(!cluster.vertices.empty()){
+            body.clusters.push_back(cluster);
+        }
+    }
+}
+
+std::vector<int> MuJoCoHelper::SoftBodyClusterDofs(const flex_handle &flex, const soft_body &body, int cluster, int axis) const{
+    const std::vector<int> &dof_adr = SoftBodyVertexAddresses(flex_vertex_dof_adr, flex, body);
+
+    std::vector<int> dofs;
+    for(int vertex : body.clusters[cluster].vertices){
+        if(body.vertices[vertex].active_linear_dof[axis]){
+            dofs.push_back(dof_adr[vertex] + axis);
+        }
+    }
+
+    return dofs;
+}
+
+const std::vector<int>& MuJoCoHelper::SoftBodyVertexAddresses(const std::vector<std::vector<int>> &table, const flex_handle &flex,
+                                                              const soft_body &body) const{
+    // Single bounds check for the whole flex instead of one per vertex
+    if(body.num_vertices > flex.num_vertices || body.vertices.size() < body.num_vertices){
+        std::cerr << "Soft body " << body.name << " has " << body.num_vertices << " vertices, flex has "
+                  << flex.num_vertices << "\n";
+        exit(1);
+    }
+
+    return table[flex.id];
+}
+
+int MuJoCoHelper::GatherSoftBodyVertices(const std::vector<int> &vertex_adr, const soft_body &body, const mjtNum *source,
+                                         Ref<VectorXd> segment){
+    int index = 0;
+    for(int i = 0; i < body.num_vertices; i++){
+        const bool *active = body.vertices[i].active_linear_dof;
+        const int adr = vertex_adr[i];
+        for(int j = 0; j < 3; j++){
+            if(active[j]){
+                segment(index++) = adr == -1 ? 0.0 : source[adr + j];
+            }
+        }
+    }
+
+    return index;
+}
+
+int MuJoCoHelper::ScatterSoftBodyVertices(const std::vector<int> &vertex_adr, const soft_body &body,
+                                          const Ref<const VectorXd> &segment, mjtNum *dest){
+    int index = 0;
+    for(int i = 0; i < body.num_vertices; i++){
+        const bool *active = body.vertices[i].active_linear_dof;
+        const int adr = vertex_adr[i];
+        for(int j = 0; j < 3; j++){
+            if(active[j]){
+                if(adr != -1){
+                    dest[adr + j] = segment(index);
+                }
+                index++;
+            }
+        }
+    }
+
+    return index;
+}
+
+int MuJoCoHelper::GatherSoftBodyClusters(const std::vector<int> &vertex_adr, const soft_body &body, const mjtNum *source,
+                                         Ref<VectorXd> segment){
+    int index = 0;
+    for(const auto &cluster : body.clusters){
+        for(int j = 0; j < 3; j++){
+            if(!cluster.active_linear_dof[j]){
+                continue;
+            }
+
+            double sum = 0.0;
+            int count = 0;
+            for(int vertex : cluster.vertices){
+                if(body.vertices[vertex].active_linear_dof[j] && vertex_adr[vertex] != -1){
+                    sum += source[vertex_adr[vertex] + j];
+                    count++;
+                }
+            }
+
+            // A cluster axis can be active with no active member vertices left (e.g. re-added to the state vector)
+            segment(index++) = count == 0 ? 0.0 : sum / count;
+        }
+    }
+
+    return index;
+}
+
+int MuJoCoHelper::ScatterSoftBodyClusters(const std::vector<int> &vertex_adr, const soft_body &body,
+                                          const Ref<const VectorXd> &segment, mjtNum *dest){
+    int index = 0;
+    for(const auto &cluster : body.clusters){
+        for(int j = 0; j < 3; j++){
+            if(!cluster.active_linear_dof[j]){
+                continue;
+            }
+
+            double sum = 0.0;
+            int count = 0;
+            for(int vertex : cluster.vertices){
+                if(body.vertices[vertex].active_linear_dof[j] && vertex_adr[vertex] != -1){
+                    sum += dest[vertex_adr[vertex] + j];
+                    count++;
+                }
+            }
+
+            // No active member vertices, nothing to move
+            if(count == 0){
+                index++;
+                continue;
+            }
+
+            // Shift the cluster so its centroid matches, keeping the vertex offsets within the cluster
+            const double shift = segment(index++) - sum / count;
+            for(int vertex : cluster.vertices){
+                if(body.vertices[vertex].active_linear_dof[j] && vertex_adr[vertex] != -1){
+                    dest[vertex_adr[vertex] + j] += shift;
+                }
+            }
+        }
+    }
+
+    return index;
+}
+
 // -------------------------------END OF SOFT BODY UTILITY -------------------------------------
 
 // - TODO create jacobian dynamically for the robot
 Eigen::MatrixXd MuJoCoHelper::GetJacobian(const std::string& body_name, mjData *d) const{
+    return GetJacobian(BodyHandle(body_name), d);
+}
+
+Eigen::MatrixXd MuJoCoHelper::GetJacobian(const body_handle &body, mjData *d) const{
     Eigen::MatrixXd jacobian(6, 7);
 
     Matrix<double, Dynamic, Dynamic, RowMajor> J_p(3, model->nv);
     Matrix<double, Dynamic, Dynamic, RowMajor> J_r(3, model->nv);
 
-    int bodyId = mj_name2id(model, mjOBJ_BODY, body_name.c_str());
-
-    mj_jacBody(model, d, J_p.data(), J_r.data(), bodyId);
+    mj_jacBody(model, d, J_p.data(), J_r.data(), body.id);
 
     // Linear elements
     for (int i = 0; i < 3; i++) {
@@ -587,28 +861,16 @@ Eigen::MatrixXd MuJoCoHelper::GetJacobian(const std::string& body_name, mjData *
 }
 
 int MuJoCoHelper::CheckSystemForCollisions(mjData *d) const{
-    // TODO(DMackRus) - check if this is needed
+    // Callers often set qpos directly before querying, the contact list must match the current positions
     mj_forward(model, d);
 
-    int num_contacts = d->ncon;
     int num_collisions = 0;
+    for(int i = 0; i < d->ncon; i++){
+        const int root_1 = contact_tables->ContactRoot(d->contact[i], 0);
+        const int root_2 = contact_tables->ContactRoot(d->contact[i], 1);
 
-    for(int i = 0; i < num_contacts; i++){
-        auto contact = d->contact[i];
-
-        int body_contact_1 = model->body_rootid[model->geom_bodyid[contact.geom1]];
-        int body_contact_2 = model->body_rootid[model->geom_bodyid[contact.geom2]];
-
-        // Get name of bodies in contact
-//        string body_name_1 = mj_id2name(model, mjOBJ_BODY, bodyInContact1);
-//        string body_name_2 = mj_id2name(model, mjOBJ_BODY, bodyInContact2);
-
-        // Checks if bodies in contact are the plane.
-        if(body_contact_1 == 0 || body_contact_2 == 0 || (body_contact_1 == body_contact_2)){
-
-        }
-        else{
-//            cout << "bodies in contact: " << bodyName1 << " " << bodyName2 << endl;
+        // Contacts with the world body, or within one root body, are not collisions
+        if(root_1 > 0 && root_2 > 0 && root_1 != root_2){
             num_collisions++;
         }
     }
@@ -617,59 +879,92 @@ int MuJoCoHelper::CheckSystemForCollisions(mjData *d) const{
 }
 
 bool MuJoCoHelper::CheckBodyForCollisions(const string& body_name, mjData *d) const{
+    return CheckBodyForCollisions(BodyHandle(body_name), d);
+}
 
-    // TODO(DMackRus) - Check if this is necessary
+bool MuJoCoHelper::CheckBodyForCollisions(const body_handle &body, mjData *d) const{
     mj_forward(model, d);
 
-    int num_contacts = d->ncon;
+    for(int i = 0; i < d->ncon; i++){
+        const int root_1 = contact_tables->ContactRoot(d->contact[i], 0);
+        const int root_2 = contact_tables->ContactRoot(d->contact[i], 1);
+        if(root_1 == -1 || root_2 == -1){
+            continue;
+        }
 
-    int body_id = mj_name2id(model, mjOBJ_BODY, body_name.c_str());
-    bool body_collision_found = false;
+        if((root_1 == body.id && root_2 != 0) || (root_2 == body.id && root_1 != 0)){
+            return true;
+        }
+    }
 
-    for(int i = 0; i < num_contacts; i++) {
-        auto contact = d->contact[i];
+    return false;
+}
 
-        int body_contact_1 = model->body_rootid[model->geom_bodyid[contact.geom1]];
-        int body_contact_2 = model->body_rootid[model->geom_bodyid[contact.geom2]];
+bool MuJoCoHelper::CheckPairForCollisions(const string& body_name_1, const string& body_name_2, mjData *d) const{
+    return CheckPairForCollisions(BodyHandle(body_name_1), BodyHandle(body_name_2), d);
+}
 
-        if(body_contact_1 == body_id && body_contact_2 != 0){
-            body_collision_found = true;
-            break;
-        }
+bool MuJoCoHelper::CheckPairForCollisions(const body_handle &body_1, const body_handle &body_2, mjData *d) const{
+    mj_forward(model, d);
 
-        if(body_contact_2 == body_id && body_contact_1 != 0){
-            body_collision_found = true;
-            break;
+    for(int i = 0; i < d->ncon; i++){
+        const int root_1 = contact_tables->ContactRoot(d->contact[i], 0);
+        const int root_2 = contact_tables->ContactRoot(d->contact[i], 1);
+
+        if((root_1 == body_1.id && root_2 == body_2.id) || (root_1 == body_2.id && root_2 == body_1.id)){
+            return true;
         }
     }
 
-    return body_collision_found;
+    return false;
 }
 
-bool MuJoCoHelper::CheckPairForCollisions(const string& body_name_1, const string& body_name_2, mjData *d) const{
+ContactIndex MuJoCoHelper::BuildContactIndex(mjData *d) const{
+    ContactIndex index(contact_tables);
+    BuildContactIndex(d, index);
+    return index;
+}
 
-        // TODO (DMackRus) - Check if this is necessary
-        mj_forward(model, d);
+void MuJoCoHelper::BuildContactIndex(mjData *d, ContactIndex &index) const{
+    // Saved states hold the contacts from before their last step, refresh them for the stored positions
+    mj_forward(model, d);
 
-        int num_contacts = d->ncon;
-        bool pair_collision_found = false;
+    index.Build(d);
+}
 
-        int body_id_1 = mj_name2id(model, mjOBJ_BODY, body_name_1.c_str());
-        int body_id_2 = mj_name2id(model, mjOBJ_BODY, body_name_2.c_str());
+void MuJoCoHelper::CheckTrajectoryLength(int num_states) const{
+    if(num_states > saved_systems_state_list.size()){
+        std::cerr << "Contacts requested for " << num_states << " states, only "
+                  << saved_systems_state_list.size() << " are saved, exiting \n";
+        exit(1);
+    }
+}
 
-        for(int i = 0; i < num_contacts; i++){
-            auto contact = d->contact[i];
+std::vector<std::vector<std::pair<int, int>>> MuJoCoHelper::TrajectoryContactPairs(int num_states) const{
+    CheckTrajectoryLength(num_states);
 
-            int body_contact_1 = model->body_rootid[model->geom_bodyid[contact.geom1]];
-            int body_contact_2 = model->body_rootid[model->geom_bodyid[contact.geom2]];
+    // One index is rebuilt per state, only the pairs in contact are kept for each state
+    ContactIndex index(contact_tables);
+    std::vector<std::vector<std::pair<int, int>>> pairs(num_states);
+    for(int t = 0; t < num_states; t++){
+        BuildContactIndex(saved_systems_state_list[t], index);
+        pairs[t] = index.Pairs();
+    }
 
-            if((body_contact_1 == body_id_1 && body_contact_2 == body_id_2) || (body_contact_1 == body_id_2 && body_contact_2 == body_id_1)){
-                pair_collision_found = true;
-                break;
-            }
-        }
+    return pairs;
+}
+
+std::vector<bool> MuJoCoHelper::TrajectoryPairContacts(const body_handle &body_1, const body_handle &body_2, int num_states) const{
+    CheckTrajectoryLength(num_states);
 
-        return pair_collision_found;
+    ContactIndex index(contact_tables);
+    std::vector<bool> mask(num_states);
+    for(int t = 0; t < num_states; t++){
+        BuildContactIndex(saved_systems_state_list[t], index);
+        mask[t] = index.Pair(body_1.id, body_2.id);
+    }
+
+    return mask;
 }
 
 std::vector<int> MuJoCoHelper::GetContactList(mjData *d) const{
@@ -680,13 +975,14 @@ std::vector<int> MuJoCoHelper::GetContactList(mjData *d) const{
     int num_contacts = d->ncon;
 
     for(int i = 0; i < num_contacts; i++){
-        auto contact = d->contact[i];
-
-        int body_contact_1 = model->body_rootid[model->geom_bodyid[contact.geom1]];
-        int body_contact_2 = model->body_rootid[model->geom_bodyid[contact.geom2]];
+        const int root_1 = contact_tables->ContactRoot(d->contact[i], 0);
+        const int root_2 = contact_tables->ContactRoot(d->contact[i], 1);
+        if(root_1 == -1 || root_2 == -1){
+            continue;
+        }
 
-        contact_list.push_back(body_contact_1);
-        contact_list.push_back(body_contact_2);
+        contact_list.push_back(root_1);
+        contact_list.push_back(root_2);
     }
 
     return contact_list;
@@ -695,7 +991,7 @@ std::vector<int> MuJoCoHelper::GetContactList(mjData *d) const{
 // ------------------------------- System State Functions -----------------------------------------------
 bool MuJoCoHelper::AppendSystemStateToEnd(mjData *d){
 
-    saved_systems_state_list.push_back(mj_makeData(model));
+    saved_systems_state_list.push_back(data_pool.Acquire());
 
     CpMjData(model, saved_systems_state_list.back(), d);
 
@@ -714,7 +1010,7 @@ bool MuJoCoHelper::CopySystemState(mjData *d_dest, mjData *d_src) const{
 }
 
 bool MuJoCoHelper::DeleteSystemStateFromIndex(int list_index){
-    mj_deleteData(saved_systems_state_list[list_index]);
+    data_pool.Release(saved_systems_state_list[list_index]);
     saved_systems_state_list.erase(saved_systems_state_list.begin() + list_index);
 
     return true;
@@ -722,7 +1018,7 @@ bool MuJoCoHelper::DeleteSystemStateFromIndex(int list_index){
 
 bool MuJoCoHelper::ClearSystemStateList(){
     for(auto & i : saved_systems_state_list){
-        mj_deleteData(i);
+        data_pool.Release(i);
     }
     saved_systems_state_list.clear();
 
@@ -883,7 +1179,14 @@ void MuJoCoHelper::InitSimulator(double timestep, const char* file_name, bool us
     
     char error[1000];
     auto load_start = std::chrono::high_resolution_clock::now();
-    model = mj_loadXML(file_name, nullptr, error, 1000);
+    if(model_cache_directory.empty()){
+        model = mj_loadXML(file_name, nullptr, error, 1000);
+    }
+    else{
+        ModelCache model_cache(model_cache_directory);
+        model = model_cache.LoadModel(file_name, error, 1000);
+        std::cout << (model_cache.last_load_cached ? "model loaded from cache" : "model compiled and cached") << std::endl;
+    }
 
     if( !model ) {
         printf("%s\n", error);
@@ -912,14 +1215,35 @@ void MuJoCoHelper::InitSimulator(double timestep, const char* file_name, bool us
     master_reset_data = mj_makeData(model);
     vis_data = mj_makeData(model);
 
+    data_pool.Init(model);
+
+    // Resolve names once, accessors then only index the model arrays
+    BuildHandleTables();
+
     // Get the number of available cores
     int numCores = static_cast<int>(std::thread::hardware_concurrency());
     for(int i = 0; i < numCores; i++){
-        fd_data.push_back(mj_makeData(model));
+        fd_data.push_back(data_pool.Acquire());
     }
     std::cout << "time to load and make data: " << std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::high_resolution_clock::now() - load_start).count() << "ms" << std::endl;
 }
 
+void MuJoCoHelper::ResizeFiniteDifferencingData(int num_data){
+    if(num_data < 1){
+        std::cerr << "number of finite differencing data must be at least 1, exiting \n";
+        exit(1);
+    }
+
+    while(fd_data.size() < num_data){
+        fd_data.push_back(data_pool.Acquire());
+    }
+
+    while(fd_data.size() > num_data){
+        data_pool.Release(fd_data.back());
+        fd_data.pop_back();
+    }
+}
+
 void MuJoCoHelper::InitModelForFiniteDifferencing(){
     save_iterations = model->opt.iterations;
     save_tolerance = model->opt.tolerance;
@@ -939,14 +1263,17 @@ double MuJoCoHelper::ReturnModelTimeStep() const {
 }
 
 double* MuJoCoHelper::SensorState(mjData *d, const std::string& sensor_name){
-
-    int id = mj_name2id(model, mjOBJ_SENSOR, sensor_name.c_str());
-    if (id == -1) {
+    sensor_handle sensor = SensorHandle(sensor_name);
+    if (sensor.id == -1) {
         std::cerr << "sensor \"" << sensor_name << "\" not found.\n";
         return nullptr;
-    } else {
-        return d->sensordata + model->sensor_adr[id];
     }
+
+    return SensorState(d, sensor);
+}
+
+double* MuJoCoHelper::SensorState(mjData *d, const sensor_handle &sensor) const{
+    return d->sensordata + sensor.adr;
 }
 
 void MuJoCoHelper::SaveDataMin(mjData* d, mujoco_data_min &data_min){
@@ -972,6 +1299,13 @@ void MuJoCoHelper::LoadDataMin(mjData* d, const mujoco_data_min &data_min){
 }
 
 void MuJoCoHelper::InitialisePlugins(){
+    // Plugin libraries can only be registered once per process (e.g. after pre-warming the model cache)
+    static bool plugins_loaded = false;
+    if(plugins_loaded){
+        return;
+    }
+    plugins_loaded = true;
+
     int nplugin = mjp_pluginCount();
     if (nplugin) {
         std::printf("Built-in plugins:\n");
@@ -3,6 +3,11 @@
 //
 
 #include "StdInclude.h"
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#include <thread>
+#endif
 
 bool randInitialised = false;
 
@@ -283,3 +288,67 @@ bool endsWith(const std::string& mainString, const std::string& subString) {
 
     return mainString.substr(mainString.length() - subString.length()) == subString;
 }
+
+bool PinCurrentThreadToCore(int core){
+    if(core < 0){
+        return false;
+    }
+
+#ifdef __linux__
+    cpu_set_t cpu_set;
+    CPU_ZERO(&cpu_set);
+    CPU_SET(core, &cpu_set);
+    if(pthread_setaffinity_np(pthread_self(), sizeof(cpu_set_t), &cpu_set) != 0){
+        std::cerr << "failed to pin thread to core " << core << "\n";
+        return false;
+    }
+    return true;
+#else
+    return false;
+#endif
+}
+
+bool PinCurrentThreadToCores(const std::vector<int> &cores){
+    if(cores.empty()){
+        return false;
+    }
+
+#ifdef __linux__
+    cpu_set_t cpu_set;
+    CPU_ZERO(&cpu_set);
+    for(int core : cores){
+        CPU_SET(core, &cpu_set);
+    }
+
+    if(pthread_setaffinity_np(pthread_self(), sizeof(cpu_set_t), &cpu_set) != 0){
+        std::cerr << "failed to set thread affinity to " << cores.size() << " cores\n";
+        return false;
+    }
+    return true;
+#else
+    return false;
+#endif
+}
+
+std::vector<int> CurrentThreadCores(){
+    std::vector<int> cores;
+
+#ifdef __linux__
+    cpu_set_t cpu_set;
+    CPU_ZERO(&cpu_set);
+    if(sched_getaffinity(0, sizeof(cpu_set_t), &cpu_set) == 0){
+        for(int i = 0; i < CPU_SETSIZE; i++){
+            if(CPU_ISSET(i, &cpu_set)){
+                cores.push_back(i);
+            }
+        }
+        return cores;
+    }
+#endif
+
+    int hardware_threads = static_cast<int>(std::thread::hardware_concurrency());
+    for(int i = 0; i < hardware_threads; i++){
+        cores.push_back(i);
+    }
+    return cores;
+}
@@ -71,13 +71,19 @@ void worker();
 
 void change_cost_func_push_soft();
 
-double avg_opt_time, avg_percent_derivs, avg_time_derivs, avg_time_bp, avg_time_fp;
+void PrewarmModelCache(const std::string &cache_directory);
+
+double avg_opt_time, avg_percent_derivs, avg_percent_derivs_reused, avg_time_derivs, avg_time_bp, avg_time_fp;
 
 bool stop_mpc = false;
 
 int mpc_num_controls_apply = 80;
 int num_steps_replan = 1;
 
+// Feedback policy from the last replan, applied by the simulation thread if use_feedback_policy is set
+feedback_policy mpc_policy;
+bool use_feedback_policy = false;
+
 volatile bool reoptimise = false;
 
 int main(int argc, char **argv) {
@@ -106,11 +112,22 @@ int main(int argc, char **argv) {
     async_mpc = yamlReader->async_mpc;
     record_trajectory = yamlReader->record_trajectory;
 
+    // Models are only loaded through the cache when it is enabled, pre-warming on its own just fills it
+    if(yamlReader->model_cache){
+        MuJoCoHelper::model_cache_directory = yamlReader->model_cache_directory;
+    }
+
+    if(yamlReader->prewarm_model_cache){
+        PrewarmModelCache(yamlReader->model_cache_directory);
+    }
+
     // Instantiate model translator as specified by the config file.
     if(assign_task() == EXIT_FAILURE){
         return EXIT_FAILURE;
     }
 
+    activeModelTranslator->MuJoCo_helper->data_pool.SetCapacity(yamlReader->data_pool_capacity);
+
     activeDifferentiator = std::make_shared<Differentiator>(activeModelTranslator, activeModelTranslator->MuJoCo_helper);
 
 //    for(int j = 0; j < 5; j++){
@@ -201,6 +218,27 @@ int main(int argc, char **argv) {
 
         return myTestingObject.GenDataOpenLoopMultipleMethods(task_horizon);
     }
+    if(runMode == "Tune_keypoint_parameters"){
+        GenTestingData myTestingObject(activeOptimiser, activeModelTranslator,
+                                       activeDifferentiator, activeVisualiser, yamlReader);
+
+        int task_horizon = activeModelTranslator->openloop_horizon;
+        int num_configs = 32;
+        int max_tasks = 16;
+
+        // Optimisation horizon, number of sampled configurations, test scenes in final rung
+        if(argc > 2){
+            task_horizon = std::atoi(argv[2]);
+        }
+        if(argc > 3){
+            num_configs = std::atoi(argv[3]);
+        }
+        if(argc > 4){
+            max_tasks = std::atoi(argv[4]);
+        }
+
+        return myTestingObject.TuneKeypointParameters(task_horizon, num_configs, max_tasks);
+    }
     if(runMode == "Generate_asynchronus_mpc_data"){
         GenTestingData myTestingObject(activeOptimiser, activeModelTranslator,
                                        activeDifferentiator, activeVisualiser, yamlReader);
@@ -251,6 +289,19 @@ int main(int argc, char **argv) {
         return myTestingObject.AnalyseToyContact(task_horizon);
     }
 
+    if(runMode == "Benchmark_state_vector"){
+        GenTestingData myTestingObject(activeOptimiser, activeModelTranslator,
+                                       activeDifferentiator, activeVisualiser, yamlReader);
+
+        int num_repeats = 10000;
+
+        if(argc > 2){
+            num_repeats = std::atoi(argv[2]);
+        }
+
+        return myTestingObject.BenchmarkStateVector(num_repeats);
+    }
+
     if(runMode == "Analyse_toy_contact_keypoints"){
         GenTestingData myTestingObject(activeOptimiser, activeModelTranslator,
                                        activeDifferentiator, activeVisualiser, yamlReader);
@@ -368,6 +419,7 @@ void OpenLoopOptimisation(int opt_horizon){
     std::vector<MatrixXd> optimisedControls = activeOptimiser->Optimise(activeModelTranslator->MuJoCo_helper->saved_systems_state_list[0],
                                                                         init_opt_controls, yamlReader->maxIter,
                                                                         yamlReader->minIter, opt_horizon);
+    std::cout << "mjData pool high-water mark: " << activeModelTranslator->MuJoCo_helper->data_pool.HighWaterMark() << "\n";
 
     // Stitch together setup controls with init control + optimised controls
     init_controls.insert(init_controls.end(), init_opt_controls.begin(), init_opt_controls.end());
@@ -419,6 +471,8 @@ void OpenLoopOptimisation(int opt_horizon){
 }
 
 void worker(){
+    // Keep the optimiser, and every pool it spawns, off the core reserved for the simulation thread
+    activeOptimiser->PinOptimiserThread();
     MPCUntilComplete(activeModelTranslator->MPC_horizon);
 }
 
@@ -432,6 +486,11 @@ void AsyncMPC(){
 
     // Whether Optimiser will output useful information
     activeOptimiser->verbose_output = true;
+
+    // Replanning less often trades tracking error for CPU, the feedback policy recovers some of the tracking
+    num_steps_replan = yamlReader->mpc_replan_interval;
+    use_feedback_policy = yamlReader->mpc_feedback_policy;
+
     // Visualise MPC trajectory live
     mpc_visualise = true;
     reoptimise = true;
@@ -440,6 +499,10 @@ void AsyncMPC(){
     std::thread MPC_controls_thread;
     MPC_controls_thread = std::thread(&worker);
 
+    // Reserve a core for the simulation thread so optimiser workers dont preempt it. Pinned after the optimiser
+    // thread is created, threads inherit the affinity of their creator.
+    PinCurrentThreadToCore(yamlReader->sim_thread_core);
+
     int vis_counter = 0;
     MatrixXd next_control;
 
@@ -482,7 +545,14 @@ void AsyncMPC(){
             if(activeVisualiser->current_control_index < mpc_num_controls_apply && activeVisualiser->current_control_index < activeVisualiser->controlBuffer.size()){
 //            if(activeVisualiser->current_control_index < activeVisualiser->controlBuffer.size()){
 
-                next_control = activeVisualiser->controlBuffer[activeVisualiser->current_control_index];
+                if(use_feedback_policy){
+                    std::unique_lock<std::mutex> lock(mtx);
+                    next_control = activeOptimiser->FeedbackPolicyControl(mpc_policy, activeVisualiser->current_control_index,
+                                                                          activeModelTranslator->MuJoCo_helper->vis_data);
+                }
+                else{
+                    next_control = activeVisualiser->controlBuffer[activeVisualiser->current_control_index];
+                }
                 // Increment the current control index
                 activeVisualiser->current_control_index++;
 
@@ -607,7 +677,7 @@ void AsyncMPC(){
         }
 
         MatrixXd residuals(activeModelTranslator->residual_list.size(), 1);
-        activeModelTranslator->Residuals(activeModelTranslator->MuJoCo_helper->vis_data, residuals);
+        activeModelTranslator->ComputeResiduals(activeModelTranslator->MuJoCo_helper->vis_data, residuals);
         cost += activeModelTranslator->CostFunction(residuals, activeModelTranslator->full_state_vector, terminal);
         if(i % 5 == 0){
             activeVisualiser->render("");
@@ -620,9 +690,11 @@ void AsyncMPC(){
     std::cout << "final cost of entire MPC trajectory was: " << cost << "\n";
     std::cout << "avg opt time: " << avg_opt_time << " ms \n";
     std::cout << "avg percent derivs: " << avg_percent_derivs << " % \n";
+    std::cout << "avg percent derivs reused: " << avg_percent_derivs_reused << " % \n";
     std::cout << "avg time derivs: " << avg_time_derivs << " ms \n";
     std::cout << "avg time BP: " << avg_time_bp << " ms \n";
     std::cout << "avg time FP: " << avg_time_fp << " ms \n";
+    std::cout << "mjData pool high-water mark: " << activeModelTranslator->MuJoCo_helper->data_pool.HighWaterMark() << "\n";
 }
 
 // Before calling this function, we should setup the activeModelTranslator with the correct initial state and the
@@ -633,6 +705,7 @@ void MPCUntilComplete(int OPT_HORIZON){
     std::vector<double> time_bp;
     std::vector<double> time_fp;
     std::vector<double> percent_derivs_computed;
+    std::vector<double> percent_derivs_reused;
 
     std::vector<MatrixXd> optimised_controls;
 
@@ -668,6 +741,9 @@ void MPCUntilComplete(int OPT_HORIZON){
                 optimised_controls.push_back(last_control);
             }
 
+            // Shift derivatives and feedback gains so the overlapping part of the horizon is warm started
+            activeOptimiser->ShiftHorizon(current_control_index);
+
             optimised_controls = activeOptimiser->Optimise(activeModelTranslator->MuJoCo_helper->saved_systems_state_list[0], optimised_controls, 1, 1, OPT_HORIZON);
             current_mpc_state_vector = activeModelTranslator->current_state_vector;
 
@@ -676,6 +752,7 @@ void MPCUntilComplete(int OPT_HORIZON){
             time_bp.push_back(activeOptimiser->avg_time_backwards_pass_ms);
             time_fp.push_back(activeOptimiser->avg_time_forwards_pass_ms);
             percent_derivs_computed.push_back(activeOptimiser->avg_percent_derivs);
+            percent_derivs_reused.push_back(activeOptimiser->avg_percent_derivs_reused);
 
             int optTimeToTimeSteps = activeOptimiser->opt_time_ms / (activeModelTranslator->MuJoCo_helper->ReturnModelTimeStep() * 1000);
 
@@ -706,11 +783,17 @@ void MPCUntilComplete(int OPT_HORIZON){
             }
             bestMatchingStateIndex = 1;
 
+            feedback_policy new_policy;
+            if(use_feedback_policy){
+                new_policy = activeOptimiser->ReturnFeedbackPolicy();
+            }
+
             // Mutex lock
             {
                 std::unique_lock<std::mutex> lock(mtx);
 
                 activeVisualiser->controlBuffer = optimised_controls;
+                mpc_policy = std::move(new_policy);
 
                 // Set the current control index to the best matching state index
                 activeVisualiser->current_control_index = bestMatchingStateIndex;
@@ -727,18 +810,21 @@ void MPCUntilComplete(int OPT_HORIZON){
     avg_time_bp = 0.0;
     avg_time_fp = 0.0;
     avg_percent_derivs = 0.0;
+    avg_percent_derivs_reused = 0.0;
 
     for(int i = 0; i < time_get_derivs.size(); i++){
         avg_time_derivs += time_get_derivs[i];
         avg_time_bp += time_bp[i];
         avg_time_fp += time_fp[i];
         avg_percent_derivs += percent_derivs_computed[i];
+        avg_percent_derivs_reused += percent_derivs_reused[i];
     }
 
     avg_time_derivs /= time_get_derivs.size();
     avg_time_bp /= time_bp.size();
     avg_time_fp /= time_fp.size();
     avg_percent_derivs /= percent_derivs_computed.size();
+    avg_percent_derivs_reused /= percent_derivs_reused.size();
 
     avg_opt_time = avg_time_derivs + avg_time_bp + avg_time_fp;
 }
@@ -843,4 +929,33 @@ void change_cost_func_push_soft(){
 //        activeModelTranslator->full_state_vector.soft_bodies[0].linearPosCost[0] = 1;
 //        activeModelTranslator->full_state_vector.soft_bodies[0].linearPosCost[0] = 1;
 //    }
-}
\ No newline at end of file
+}
+
+void PrewarmModelCache(const std::string &cache_directory){
+    ModelCache model_cache(cache_directory);
+    std::vector<std::string> model_files;
+    auto prewarm_start = std::chrono::high_resolution_clock::now();
+
+    for(const auto &task_config_file : yamlReader->TaskConfigFiles()){
+        // The global task name shadows the task struct
+        struct task task_config;
+        yamlReader->ReadModelConfigFile(task_config_file, task_config);
+
+        // Several tasks share a scene
+        if(std::find(model_files.begin(), model_files.end(), task_config.modelFilePath) != model_files.end()){
+            continue;
+        }
+        model_files.push_back(task_config.modelFilePath);
+
+        // Soft body scenes need the plugin libraries to compile
+        if(!task_config.soft_bodies.empty()){
+            MuJoCoHelper::InitialisePlugins();
+        }
+
+        model_cache.Prewarm(task_config.modelFilePath);
+    }
+
+    std::cout << "pre-warmed model cache with " << model_files.size() << " models in "
+              << std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::high_resolution_clock::now() - prewarm_start).count()
+              << "ms" << std::endl;
+}
@@ -196,6 +196,99 @@ TEST(Derivatives, humanoid)
     compare_dynamics_derivatives();
 }
 
+TEST(Derivatives, analytic_residuals_match_finite_differences)
+{
+    std::cout << "Begin test - Analytic residual derivatives vs finite differences \n";
+    std::shared_ptr<threeDTestClass> pushing_3D = std::make_shared<threeDTestClass>();
+    model_translator = pushing_3D;
+
+    differentiator = std::make_shared<Differentiator>(model_translator, model_translator->MuJoCo_helper);
+
+    model_translator->InitialiseSystemToStartState(model_translator->MuJoCo_helper->master_reset_data);
+
+    pose_6 goal_vel;
+    model_translator->MuJoCo_helper->GetBodyVelocity("goal", goal_vel, model_translator->MuJoCo_helper->master_reset_data);
+    goal_vel.position(0) = 0.3;
+    goal_vel.position(1) = -0.2;
+    model_translator->MuJoCo_helper->SetBodyVelocity("goal", goal_vel, model_translator->MuJoCo_helper->master_reset_data);
+
+    MatrixXd control_vector(model_translator->current_state_vector.num_ctrl, 1);
+    control_vector.setConstant(0.5);
+    model_translator->SetControlVector(control_vector,
+                                       model_translator->MuJoCo_helper->master_reset_data,
+                                       model_translator->current_state_vector);
+
+    model_translator->MuJoCo_helper->AppendSystemStateToEnd(model_translator->MuJoCo_helper->master_reset_data);
+
+    // Typed residuals covering every residual op type
+    std::vector<residual> &residual_list = model_translator->residual_list;
+    residual_list.clear();
+    residual_list.resize(6);
+    residual_list[0].name = "goal_pos";
+    residual_list[0].type = "body_position";
+    residual_list[0].body = "goal";
+    residual_list[0].axes = {0, 1};
+    residual_list[0].target = {0.9, 0.1};
+
+    residual_list[1].name = "goal_vel";
+    residual_list[1].type = "body_velocity";
+    residual_list[1].body = "goal";
+    residual_list[1].axes = {0, 1};
+
+    residual_list[2].name = "reach";
+    residual_list[2].type = "body_distance";
+    residual_list[2].body = "franka_gripper";
+    residual_list[2].body_b = "goal";
+
+    residual_list[3].name = "joint_4_pos";
+    residual_list[3].type = "joint_position";
+    residual_list[3].joints = {"panda0_joint4"};
+    residual_list[3].target = {-2.0};
+
+    residual_list[4].name = "joint_2_vel";
+    residual_list[4].type = "joint_velocity";
+    residual_list[4].joints = {"panda0_joint2"};
+
+    residual_list[5].name = "control_1";
+    residual_list[5].type = "control";
+    residual_list[5].actuators = {"panda0_joint1"};
+
+    for(auto & resid : residual_list){
+        resid.resid_dimension = 1;
+        resid.weight = 1;
+        resid.weight_terminal = 1;
+    }
+
+    int dof = model_translator->current_state_vector.dof;
+    int num_ctrl = model_translator->current_state_vector.num_ctrl;
+    int num_residuals = static_cast<int>(residual_list.size());
+    MatrixXd r_x_analytic = MatrixXd::Zero(num_residuals, 2 * dof);
+    MatrixXd r_u_analytic = MatrixXd::Zero(num_residuals, num_ctrl);
+    MatrixXd r_x_fd = MatrixXd::Zero(num_residuals, 2 * dof);
+    MatrixXd r_u_fd = MatrixXd::Zero(num_residuals, num_ctrl);
+
+    ASSERT_TRUE(model_translator->residual_program.Compile(model_translator->MuJoCo_helper->model, residual_list,
+                                                           model_translator->ReturnControlActuatorIds()));
+    differentiator->ResidualDerivatives(r_x_analytic, r_u_analytic, 0, 0, true, 1e-6);
+
+    // Force the finite-difference fallback for every term
+    for(auto & resid : residual_list){
+        resid.analytic_jacobian = false;
+    }
+    model_translator->residual_program.Compile(model_translator->MuJoCo_helper->model, residual_list,
+                                               model_translator->ReturnControlActuatorIds());
+    differentiator->ResidualDerivatives(r_x_fd, r_u_fd, 0, 0, true, 1e-6);
+
+    for(int j = 0; j < num_residuals; j++){
+        for(int i = 0; i < 2 * dof; i++){
+            EXPECT_NEAR(r_x_analytic(j, i), r_x_fd(j, i), 1e-5) << residual_list[j].name << " state index " << i;
+        }
+        for(int i = 0; i < num_ctrl; i++){
+            EXPECT_NEAR(r_u_analytic(j, i), r_u_fd(j, i), 1e-5) << residual_list[j].name << " control index " << i;
+        }
+    }
+}
+
 //TEST(Derivatives, pushing_3D_rotated)
 //{
 //    std::cout << "Begin test - Compare derivatives 3D - rotated \n";
@@ -4,6 +4,7 @@
 #include "Differentiator.h"
 #include "ModelTranslator/ModelTranslator.h"
 #include "test_acrobot.h"
+#include "3D_test_class.h"
 
 std::shared_ptr<ModelTranslator> model_translator;
 
@@ -230,8 +231,8 @@ TEST(Interpolate, basic_interpolation){
     std::vector<MatrixXd> trajectory_states;
     std::vector<MatrixXd> A;
     std::vector<MatrixXd> B;
-    std::vector<std::vector<MatrixXd>> r_x;
-    std::vector<std::vector<MatrixXd>> r_u;
+    std::vector<MatrixXd> r_x;
+    std::vector<MatrixXd> r_u;
 
     // Allocate heap memory
     for(int t = 0; t < T; t++){
@@ -307,6 +308,149 @@ TEST(Interpolate, basic_interpolation){
     }
 }
 
+TEST(Interpolate, higher_order_methods_on_constructed_derivatives){
+    std::shared_ptr<Acrobot> acrobot = std::make_shared<Acrobot>();
+    model_translator = acrobot;
+
+    int T = 9;
+    int interval = 4;
+    int dof = model_translator->current_state_vector.dof;
+    int num_ctrl = model_translator->current_state_vector.num_ctrl;
+
+    std::shared_ptr<Differentiator> differentiator =
+            std::make_shared<Differentiator>(model_translator, model_translator->MuJoCo_helper);
+
+    std::shared_ptr<KeypointGenerator> keypoint_generator =
+            std::make_shared<KeypointGenerator>(differentiator,
+                                                model_translator->MuJoCo_helper,
+                                                dof, T);
+
+    keypoint_method keypoint_method;
+    keypoint_method.name = "set_interval";
+    keypoint_method.auto_adjust = false;
+    keypoint_method.min_N = interval;
+
+    // Knots at 0, 4 and 8 with values 0, 1, 0. Midpoints of the two segments, by hand:
+    //  linear            - 0.5
+    //  cubic_hermite     - tangents 1/4, 0 (turning point), -1/4, giving 0.625
+    //  natural_spline    - second derivative -3/16 at the middle knot, giving 0.6875
+    std::vector<std::pair<std::string, double>> methods = {{"linear", 0.5},
+                                                           {"cubic_hermite", 0.625},
+                                                           {"natural_spline", 0.6875}};
+
+    for(const auto &method : methods){
+        keypoint_method.interpolation = method.first;
+        keypoint_generator->SetKeypointMethod(keypoint_method);
+
+        std::vector<MatrixXd> trajectory_states;
+        std::vector<MatrixXd> A(T, MatrixXd::Zero(dof*2, dof*2));
+        std::vector<MatrixXd> B(T, MatrixXd::Zero(dof*2, num_ctrl));
+        std::vector<MatrixXd> r_x;
+        std::vector<MatrixXd> r_u;
+
+        keypoint_generator->GenerateKeyPoints(trajectory_states, A, B);
+
+        // Every dof is computed at the knots only, dof finite-differenced columns per knot
+        int num_fd_columns = 0;
+        for(int t = 0; t < T; t++){
+            bool knot = t % interval == 0;
+            ASSERT_EQ(static_cast<int>(keypoint_generator->keypoints[t].size()), knot ? dof : 0) << method.first << " t = " << t;
+            num_fd_columns += static_cast<int>(keypoint_generator->keypoints[t].size());
+        }
+        EXPECT_EQ(num_fd_columns, 3 * dof) << method.first;
+
+        A[interval].setOnes();
+        B[interval].setOnes();
+
+        keypoint_generator->InterpolateDerivatives(keypoint_generator->keypoints, T, A, B, r_x, r_u, false, num_ctrl);
+
+        // Knots are never changed by interpolation
+        EXPECT_TRUE(A[0].isZero(0.0)) << method.first;
+        EXPECT_TRUE(A[interval].isOnes(0.0)) << method.first;
+        EXPECT_TRUE(A[2 * interval].isZero(0.0)) << method.first;
+
+        for(int t : {interval / 2, 3 * interval / 2}){
+            for(int r = 0; r < dof*2; r++){
+                for(int c = 0; c < dof*2; c++){
+                    ASSERT_NEAR(A[t](r, c), method.second, 1.0e-12) << method.first << " t = " << t;
+                }
+                for(int c = 0; c < num_ctrl; c++){
+                    ASSERT_NEAR(B[t](r, c), method.second, 1.0e-12) << method.first << " t = " << t;
+                }
+            }
+        }
+    }
+}
+
+TEST(keypoints, contact_keypoints){
+    std::shared_ptr<threeDTestClass> pushing_3D = std::make_shared<threeDTestClass>();
+    model_translator = pushing_3D;
+    std::shared_ptr<MuJoCoHelper> MuJoCo_helper = model_translator->MuJoCo_helper;
+
+    int T = 10;
+    int dof = model_translator->current_state_vector.dof;
+    const std::vector<std::string> &state_names = model_translator->current_state_vector.state_names;
+
+    // Free bodies have several dofs per qpos entry offset, so their state elements must map through dof_bodyid
+    std::vector<int> dof_root_bodies = model_translator->ReturnDofRootBodies();
+    ASSERT_EQ(dof_root_bodies.size(), dof);
+    for(int i = 0; i < dof; i++){
+        for(const char *body_name : {"goal", "obstacle_1", "obstacle_2"}){
+            if(state_names[i].rfind(std::string(body_name) + "_", 0) == 0){
+                ASSERT_EQ(dof_root_bodies[i], MuJoCo_helper->BodyHandle(body_name).id) << state_names[i];
+            }
+        }
+    }
+
+    // Goal is clear of obstacle_1 for the first half of the trajectory and pushed into it for the second half
+    model_translator->InitialiseSystemToStartState(MuJoCo_helper->master_reset_data);
+    pose_6 goal_pose;
+    pose_6 obstacle_pose;
+    MuJoCo_helper->GetBodyPoseAngle("goal", goal_pose, MuJoCo_helper->master_reset_data);
+    MuJoCo_helper->GetBodyPoseAngle("obstacle_1", obstacle_pose, MuJoCo_helper->master_reset_data);
+
+    MuJoCo_helper->ClearSystemStateList();
+    for(int t = 0; t < T; t++){
+        if(t == T / 2){
+            goal_pose.position(0) = obstacle_pose.position(0) - 0.07;
+            // Offset in y keeps the goal clear of obstacle_2
+            goal_pose.position(1) = obstacle_pose.position(1) - 0.03;
+            MuJoCo_helper->SetBodyPoseAngle("goal", goal_pose, MuJoCo_helper->master_reset_data);
+        }
+        MuJoCo_helper->AppendSystemStateToEnd(MuJoCo_helper->master_reset_data);
+    }
+
+    std::shared_ptr<Differentiator> differentiator = std::make_shared<Differentiator>(model_translator, MuJoCo_helper);
+    std::shared_ptr<KeypointGenerator> keypoint_generator =
+            std::make_shared<KeypointGenerator>(differentiator, MuJoCo_helper, dof, T);
+
+    // Interval longer than the horizon, so only contact keypoints are added between the two ends
+    keypoint_method keypoint_method;
+    keypoint_method.name = "set_interval";
+    keypoint_method.min_N = 2 * T;
+    keypoint_method.auto_adjust = false;
+    keypoint_method.contact_keypoints = true;
+    keypoint_generator->SetKeypointMethod(keypoint_method);
+    keypoint_generator->dof_root_bodies = dof_root_bodies;
+
+    std::vector<MatrixXd> trajectory_states;
+    std::vector<MatrixXd> A;
+    std::vector<MatrixXd> B;
+    keypoint_generator->GenerateKeyPoints(trajectory_states, A, B);
+
+    const int goal_id = MuJoCo_helper->BodyHandle("goal").id;
+    const int obstacle_1_id = MuJoCo_helper->BodyHandle("obstacle_1").id;
+    for(int i = 0; i < dof; i++){
+        bool in_contact_switch = dof_root_bodies[i] == goal_id || dof_root_bodies[i] == obstacle_1_id;
+        for(int t = 1; t < T - 1; t++){
+            const std::vector<int> &keypoints = keypoint_generator->keypoints[t];
+            bool has_keypoint = std::find(keypoints.begin(), keypoints.end(), i) != keypoints.end();
+            bool expected = in_contact_switch && (t == T / 2 - 1 || t == T / 2);
+            ASSERT_EQ(has_keypoint, expected) << state_names[i] << " at t = " << t;
+        }
+    }
+}
+
 // TODO - Write a test for auto adjust keypoint methods.
 //TEST(keypoints, auto_adjust){
 //
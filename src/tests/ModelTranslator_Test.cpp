@@ -3,6 +3,10 @@
 #include "ModelTranslator/ModelTranslator.h"
 #include "test_acrobot.h"
 #include "3D_test_class.h"
+#include "soft_body_test_class.h"
+#include "test_reaching.h"
+#include "ModelCache.h"
+#include <set>
 
 std::shared_ptr<ModelTranslator> model_translator;
 
@@ -172,6 +176,477 @@ TEST(ModelTranslator, set_state_remove_names_return_state){
     }
 }
 
+TEST(ModelTranslator, gather_reduced_state_from_full_state){
+
+    std::shared_ptr<threeDTestClass> threeD_test = std::make_shared<threeDTestClass>();
+    model_translator = threeD_test;
+
+    std::shared_ptr<MuJoCoHelper> MuJoCo_helper = model_translator->MuJoCo_helper;
+
+    MatrixXd test_state_vector(model_translator->current_state_vector.dof*2, 1);
+
+    test_state_vector << 0, -0.183, 0, -3.1, 0, 1.34, 0, 0, 0,
+            0.5, 0.2, 0.1, 0.1, 0.2, 0.3,
+            0.6, 0.2, 0.1, 0, 0, 0.4,
+            0.7, 0.1, 0.1, 0, 0, 0,
+            0, 0.1, 0, 0.2, 0, 0, 0, 0, 0,
+            0.1, 0.2, 0.3, 0.4, 0.5, 0.6,
+            0, 0, 0, 0, 0, 0,
+            0, 0.3, 0, 0, 0, 0;
+
+    model_translator->SetStateVector(test_state_vector, MuJoCo_helper->master_reset_data,
+                                     model_translator->current_state_vector);
+
+    MatrixXd full_state = model_translator->ReturnStateVectorQuaternions(MuJoCo_helper->master_reset_data,
+                                                                         model_translator->full_state_vector);
+
+    // Remove all angular dofs of goal, some angular dofs of obstacle 2 (quaternion is still required)
+    std::vector<std::string> remove_names = {"goal_roll", "goal_pitch", "goal_yaw",
+                                             "obstacle_1_x", "obstacle_1_y", "obstacle_1_z",
+                                             "obstacle_2_roll", "obstacle_2_x", "obstacle_2_pitch"};
+
+    model_translator->UpdateCurrentStateVector(remove_names, false);
+
+    std::vector<int> indices = model_translator->FullStateIndicesQuat(model_translator->current_state_vector);
+    MatrixXd expected_state = model_translator->ReturnStateVectorQuaternions(MuJoCo_helper->master_reset_data,
+                                                                             model_translator->current_state_vector);
+
+    ASSERT_EQ(indices.size(), expected_state.rows());
+    for(int i = 0; i < indices.size(); i++){
+        EXPECT_EQ(expected_state(i), full_state(indices[i]));
+    }
+}
+
+TEST(ModelTranslator, residual_program_matches_helper_getters){
+
+    std::shared_ptr<threeDTestClass> threeD_test = std::make_shared<threeDTestClass>();
+    model_translator = threeD_test;
+
+    std::shared_ptr<MuJoCoHelper> MuJoCo_helper = model_translator->MuJoCo_helper;
+    mjData *d = MuJoCo_helper->master_reset_data;
+
+    MatrixXd test_state_vector(model_translator->current_state_vector.dof*2, 1);
+    test_state_vector << 0, -0.183, 0, -3.1, 0, 1.34, 0, 0, 0,
+            0.5, 0.2, 0.1, 0.1, 0.2, 0.3,
+            0.6, 0.2, 0.1, 0, 0, 0.4,
+            0.7, 0.1, 0.1, 0, 0, 0,
+            0, 0.1, 0, 0.2, 0, 0, 0, 0, 0,
+            0.1, 0.2, 0.3, 0.4, 0.5, 0.6,
+            0, 0, 0, 0, 0, 0,
+            0, 0.3, 0, 0, 0, 0;
+
+    model_translator->SetStateVector(test_state_vector, d, model_translator->current_state_vector);
+
+    std::vector<residual> residual_list(6);
+    residual_list[0].name = "goal_pos";
+    residual_list[0].type = "body_position";
+    residual_list[0].body = "goal";
+    residual_list[0].axes = {0, 1};
+    residual_list[0].target = {0.7, 0.0};
+
+    residual_list[1].name = "goal_vel";
+    residual_list[1].type = "body_velocity";
+    residual_list[1].body = "goal";
+    residual_list[1].axes = {0, 1};
+
+    residual_list[2].name = "goal_obstacle_dist";
+    residual_list[2].type = "body_distance";
+    residual_list[2].body = "goal";
+    residual_list[2].body_b = "obstacle_1";
+    residual_list[2].target = {0.05};
+
+    for(int i = 0; i < 2; i++){
+        residual_list[3 + i].name = "joint_pos";
+        residual_list[3 + i].type = "joint_position";
+        residual_list[3 + i].joints = {"panda0_joint2", "panda0_joint4"};
+        residual_list[3 + i].target = {0.1, -2.0};
+        residual_list[3 + i].resid_dimension = 2;
+    }
+
+    residual_list[5].name = "joint_2_vel";
+    residual_list[5].type = "joint_velocity";
+    residual_list[5].joints = {"panda0_joint2"};
+
+    for(int i = 0; i < residual_list.size(); i++){
+        if(residual_list[i].resid_dimension != 2){
+            residual_list[i].resid_dimension = 1;
+        }
+    }
+
+    ResidualProgram program;
+    ASSERT_TRUE(program.Compile(MuJoCo_helper->model, residual_list));
+    ASSERT_EQ(program.ops.size(), residual_list.size());
+
+    MatrixXd residuals(residual_list.size(), 1);
+    program.Evaluate(MuJoCo_helper->model, d, residual_list, residuals);
+
+    pose_6 goal_pose, goal_vel, obstacle_pose;
+    MuJoCo_helper->GetBodyPoseAngle("goal", goal_pose, d);
+    MuJoCo_helper->GetBodyVelocity("goal", goal_vel, d);
+    MuJoCo_helper->GetBodyPoseAngle("obstacle_1", obstacle_pose, d);
+    std::vector<double> joint_positions, joint_velocities;
+    MuJoCo_helper->GetRobotJointsPositions("panda", joint_positions, d);
+    MuJoCo_helper->GetRobotJointsVelocities("panda", joint_velocities, d);
+
+    EXPECT_NEAR(residuals(0), sqrt(pow(goal_pose.position(0) - 0.7, 2) + pow(goal_pose.position(1), 2)), 1e-9);
+    EXPECT_NEAR(residuals(1), sqrt(pow(goal_vel.position(0), 2) + pow(goal_vel.position(1), 2)), 1e-9);
+    EXPECT_NEAR(residuals(2), (goal_pose.position - obstacle_pose.position).norm() - 0.05, 1e-9);
+    EXPECT_NEAR(residuals(3), joint_positions[1] - 0.1, 1e-9);
+    EXPECT_NEAR(residuals(4), joint_positions[3] + 2.0, 1e-9);
+    EXPECT_NEAR(residuals(5), joint_velocities[1], 1e-9);
+}
+
+TEST(ModelTranslator, residual_program_targets_from_saved_reaching_task){
+
+    std::shared_ptr<reachingTestClass> reaching_test = std::make_shared<reachingTestClass>();
+    model_translator = reaching_test;
+    std::shared_ptr<MuJoCoHelper> MuJoCo_helper = model_translator->MuJoCo_helper;
+    mjData *d = MuJoCo_helper->main_data;
+
+    // Saved tasks store the goal only in the first entry of each resid_dimension group
+    std::shared_ptr<FileHandler> yaml_reader = std::make_shared<FileHandler>();
+    yaml_reader->LoadTaskFromFile(model_translator->model_name, 0, model_translator->full_state_vector,
+                                  model_translator->residual_list);
+    std::vector<double> goal = model_translator->residual_list[0].target;
+    ASSERT_EQ(goal.size(), 7);
+
+    MuJoCo_helper->CopySystemState(d, MuJoCo_helper->master_reset_data);
+    MuJoCo_helper->SetRobotJointPositions("panda", goal, d);
+    for(int i = 0; i < MuJoCo_helper->model->nv; i++){
+        d->qvel[i] = 0.0;
+    }
+
+    MatrixXd residuals(model_translator->residual_list.size(), 1);
+    model_translator->ComputeResiduals(d, residuals);
+
+    for(int i = 0; i < residuals.rows(); i++){
+        EXPECT_NEAR(residuals(i), 0.0, 1e-9) << model_translator->residual_list[i].name << " row " << i;
+    }
+}
+
+TEST(ModelTranslator, model_cache_round_trip){
+
+    std::shared_ptr<threeDTestClass> threeD_test = std::make_shared<threeDTestClass>();
+    model_translator = threeD_test;
+    mjModel *compiled_model = model_translator->MuJoCo_helper->model;
+
+    std::filesystem::path temp_dir = std::filesystem::temp_directory_path() / "model_cache_test";
+    std::filesystem::remove_all(temp_dir);
+
+    // Copy the acrobot model so an included file can be edited
+    std::string test_xml_dir = model_translator->model_file_path.substr(0, model_translator->model_file_path.find_last_of("/\\"));
+    std::filesystem::copy(test_xml_dir + "/Acrobot", temp_dir / "Acrobot", std::filesystem::copy_options::recursive);
+
+    ModelCache model_cache((temp_dir / "cache").string());
+    char error[1000] = "";
+
+    // First load compiles and saves, second load is read from the binary cache
+    mjModel *first = model_cache.LoadModel(model_translator->model_file_path, error, 1000);
+    ASSERT_NE(first, nullptr);
+    EXPECT_FALSE(model_cache.last_load_cached);
+
+    mjModel *second = model_cache.LoadModel(model_translator->model_file_path, error, 1000);
+    ASSERT_NE(second, nullptr);
+    EXPECT_TRUE(model_cache.last_load_cached);
+
+    EXPECT_EQ(second->nq, compiled_model->nq);
+    EXPECT_EQ(second->nv, compiled_model->nv);
+    EXPECT_EQ(second->nu, compiled_model->nu);
+    EXPECT_EQ(second->nbody, compiled_model->nbody);
+    EXPECT_EQ(second->ngeom, compiled_model->ngeom);
+    EXPECT_EQ(second->nmesh, compiled_model->nmesh);
+
+    mj_deleteModel(first);
+    mj_deleteModel(second);
+
+    // Editing an included file must invalidate the cache entry
+    std::string acrobot_xml = (temp_dir / "Acrobot" / "acrobot.xml").string();
+    uint64_t hash_before = model_cache.HashModelFiles(acrobot_xml);
+    EXPECT_EQ(hash_before, model_cache.HashModelFiles(acrobot_xml));
+
+    std::ofstream materials(temp_dir / "Acrobot" / "common" / "materials.xml", std::ios::app);
+    materials << "\n<!-- edited -->\n";
+    materials.close();
+
+    EXPECT_NE(hash_before, model_cache.HashModelFiles(acrobot_xml));
+
+    std::filesystem::remove_all(temp_dir);
+}
+
+TEST(ModelTranslator, data_pool_reuses_released_data){
+
+    std::shared_ptr<threeDTestClass> threeD_test = std::make_shared<threeDTestClass>();
+    model_translator = threeD_test;
+    std::shared_ptr<MuJoCoHelper> MuJoCo_helper = model_translator->MuJoCo_helper;
+    DataPool &pool = MuJoCo_helper->data_pool;
+
+    MuJoCo_helper->ClearSystemStateList();
+    int in_use_before = pool.NumInUse();
+
+    for(int i = 0; i < 3; i++){
+        MuJoCo_helper->AppendSystemStateToEnd(MuJoCo_helper->master_reset_data);
+    }
+    int allocated = pool.NumAllocated();
+    EXPECT_EQ(pool.NumInUse(), in_use_before + 3);
+
+    // A new horizon of the same length reuses the released data instead of allocating
+    MuJoCo_helper->ClearSystemStateList();
+    EXPECT_EQ(pool.NumInUse(), in_use_before);
+    for(int i = 0; i < 3; i++){
+        MuJoCo_helper->AppendSystemStateToEnd(MuJoCo_helper->master_reset_data);
+    }
+    EXPECT_EQ(pool.NumAllocated(), allocated);
+    EXPECT_EQ(MuJoCo_helper->saved_systems_state_list[2]->qpos[0], MuJoCo_helper->master_reset_data->qpos[0]);
+
+    // Leases return their data when they go out of scope
+    {
+        DataLease lease = pool.Lease();
+        ASSERT_TRUE(lease);
+        MuJoCo_helper->CopySystemState(lease.get(), MuJoCo_helper->master_reset_data);
+        EXPECT_EQ(pool.NumInUse(), in_use_before + 4);
+
+        DataLease moved = std::move(lease);
+        EXPECT_FALSE(lease);
+        EXPECT_EQ(pool.NumInUse(), in_use_before + 4);
+    }
+    EXPECT_EQ(pool.NumInUse(), in_use_before + 3);
+    EXPECT_GE(pool.HighWaterMark(), in_use_before + 4);
+}
+
+TEST(ModelTranslator, handle_accessors_match_name_accessors){
+
+    std::shared_ptr<threeDTestClass> threeD_test = std::make_shared<threeDTestClass>();
+    model_translator = threeD_test;
+    std::shared_ptr<MuJoCoHelper> MuJoCo_helper = model_translator->MuJoCo_helper;
+    mjData *d = MuJoCo_helper->master_reset_data;
+
+    body_handle goal = MuJoCo_helper->BodyHandle("goal");
+    EXPECT_EQ(goal.id, mj_name2id(MuJoCo_helper->model, mjOBJ_BODY, "goal"));
+
+    pose_6 set_pose;
+    set_pose.position << 0.4, -0.1, 0.2;
+    set_pose.orientation << 0.1, 0.2, 0.3;
+    MuJoCo_helper->SetBodyPoseAngle(goal, set_pose, d);
+
+    pose_6 by_name, by_handle;
+    MuJoCo_helper->GetBodyPoseAngle("goal", by_name, d);
+    MuJoCo_helper->GetBodyPoseAngle(goal, by_handle, d);
+    for(int i = 0; i < 3; i++){
+        EXPECT_NEAR(by_name.position(i), set_pose.position(i), 1e-9);
+        EXPECT_NEAR(by_handle.position(i), by_name.position(i), 1e-12);
+        EXPECT_NEAR(by_handle.orientation(i), by_name.orientation(i), 1e-12);
+    }
+
+    const robot_handle &panda = MuJoCo_helper->RobotHandle("panda");
+    std::vector<double> positions_by_name, positions_by_handle;
+    MuJoCo_helper->GetRobotJointsPositions("panda", positions_by_name, d);
+    MuJoCo_helper->GetRobotJointsPositions(panda, positions_by_handle, d);
+    ASSERT_EQ(positions_by_name.size(), positions_by_handle.size());
+    for(int i = 0; i < positions_by_name.size(); i++){
+        EXPECT_EQ(positions_by_name[i], positions_by_handle[i]);
+    }
+}
+
+TEST(ModelTranslator, reduced_soft_body_state_names){
+    struct stateVectorList state_vector;
+
+    soft_body cloth;
+    cloth.name = "cloth";
+    cloth.num_vertices = 4;
+    for(int i = 0; i < cloth.num_vertices; i++){
+        cloth.vertices.push_back({{true, true, false}, {0, 0, 0}, {0, 0, 0}});
+    }
+    state_vector.soft_bodies.push_back(cloth);
+
+    // One state per active vertex coordinate
+    state_vector.Update();
+    EXPECT_EQ(state_vector.dof, 8);
+
+    // Two clusters, the optimiser state only holds their centroids
+    state_vector.soft_bodies[0].num_clusters = 2;
+    state_vector.soft_bodies[0].clusters.push_back({{0, 1}, {true, true, false}});
+    state_vector.soft_bodies[0].clusters.push_back({{2, 3}, {true, true, false}});
+    state_vector.Update();
+
+    std::vector<std::string> expected = {"cloth_C0_x", "cloth_C0_y", "cloth_C1_x", "cloth_C1_y"};
+    EXPECT_EQ(state_vector.dof, 4);
+    EXPECT_EQ(state_vector.dof_quat, 4);
+    EXPECT_TRUE(check_state_vectors_match(expected, state_vector.state_names));
+}
+
+TEST(ModelTranslator, reduced_soft_body_positions_round_trip){
+    std::shared_ptr<softBodyTestClass> soft_body_test = std::make_shared<softBodyTestClass>();
+    model_translator = soft_body_test;
+    std::shared_ptr<MuJoCoHelper> MuJoCo_helper = model_translator->MuJoCo_helper;
+    mjData *d = MuJoCo_helper->master_reset_data;
+
+    const soft_body &jelly = model_translator->current_state_vector.soft_bodies[0];
+    flex_handle flex = MuJoCo_helper->FlexHandle(jelly.name);
+    ASSERT_FALSE(jelly.clusters.empty());
+
+    VectorXd segment(model_translator->current_state_vector.dof);
+    int size = MuJoCo_helper->GetSoftBodyPositions(flex, jelly, segment, d);
+
+    // Move every cluster centroid, reading the centroids back must return the segment that was set
+    VectorXd desired = segment.head(size);
+    for(int i = 0; i < size; i++){
+        desired(i) += 0.01 * (i + 1);
+    }
+    EXPECT_EQ(MuJoCo_helper->SetSoftBodyPositions(flex, jelly, desired, d), size);
+
+    VectorXd actual(size);
+    MuJoCo_helper->GetSoftBodyPositions(flex, jelly, actual, d);
+    for(int i = 0; i < size; i++){
+        EXPECT_NEAR(actual(i), desired(i), 1.0e-12);
+    }
+}
+
+TEST(ModelTranslator, reduced_soft_body_lift_then_project){
+    std::shared_ptr<softBodyTestClass> soft_body_test = std::make_shared<softBodyTestClass>();
+    model_translator = soft_body_test;
+    int nv = model_translator->MuJoCo_helper->model->nv;
+    int dof = model_translator->current_state_vector.dof;
+
+    // Lifting a unit step along one state element and projecting back must give that unit vector
+    std::vector<double> dof_vector(nv);
+    for(int i = 0; i < dof; i++){
+        std::fill(dof_vector.begin(), dof_vector.end(), 0.0);
+        model_translator->LiftStateToDofVector(i, dof_vector.data(), 1.0);
+
+        for(int j = 0; j < dof; j++){
+            EXPECT_NEAR(model_translator->ProjectDofVectorToState(j, dof_vector.data()), i == j ? 1.0 : 0.0, 1.0e-12)
+                << model_translator->current_state_vector.state_names[i] << " projected onto "
+                << model_translator->current_state_vector.state_names[j];
+        }
+    }
+}
+
+TEST(ModelTranslator, reduced_soft_body_empty_cluster_axis){
+    std::shared_ptr<softBodyTestClass> soft_body_test = std::make_shared<softBodyTestClass>();
+    model_translator = soft_body_test;
+    int nv = model_translator->MuJoCo_helper->model->nv;
+
+    // Cluster z axes stay active while none of their member vertices have an active z dof
+    for(auto &vertex : model_translator->full_state_vector.soft_bodies[0].vertices){
+        vertex.active_linear_dof[2] = false;
+    }
+    model_translator->ResetSVR();
+
+    int dof = model_translator->current_state_vector.dof;
+    std::vector<double> dof_vector(nv);
+    int num_empty = 0;
+    for(int i = 0; i < dof; i++){
+        const std::string &state_name = model_translator->current_state_vector.state_names[i];
+        if(state_name.substr(state_name.size() - 2) != "_z"){
+            continue;
+        }
+        num_empty++;
+
+        // Moves no dofs, and nothing projects onto it
+        EXPECT_EQ(model_translator->state_dof_adr_indices[i], -1) << state_name;
+        std::fill(dof_vector.begin(), dof_vector.end(), 0.0);
+        model_translator->LiftStateToDofVector(i, dof_vector.data(), 1.0);
+        for(double value : dof_vector){
+            EXPECT_EQ(value, 0.0) << state_name;
+        }
+
+        std::fill(dof_vector.begin(), dof_vector.end(), 1.0);
+        EXPECT_EQ(model_translator->ProjectDofVectorToState(i, dof_vector.data()), 0.0) << state_name;
+    }
+    EXPECT_GT(num_empty, 0);
+
+    std::vector<int> root_bodies = model_translator->ReturnDofRootBodies();
+    EXPECT_EQ(static_cast<int>(root_bodies.size()), dof);
+}
+
+// Reference root body of one side of a contact, resolved straight from the model
+int scanned_contact_root(const mjModel *m, const mjContact &contact, int side){
+    if(contact.geom[side] >= 0){
+        return m->body_rootid[m->geom_bodyid[contact.geom[side]]];
+    }
+
+    const int flex = contact.flex[side];
+    int vertex = contact.vert[side];
+    if(vertex < 0){
+        vertex = m->flex_elem[m->flex_elemdataadr[flex] + contact.elem[side] * (m->flex_dim[flex] + 1)];
+    }
+    return m->body_rootid[m->flex_vertbodyid[m->flex_vertadr[flex] + vertex]];
+}
+
+void check_contact_index_matches_scan(const std::shared_ptr<MuJoCoHelper> &MuJoCo_helper, mjData *d){
+    mjModel *m = MuJoCo_helper->model;
+
+    ContactIndex index = MuJoCo_helper->BuildContactIndex(d);
+
+    // Reference, scan the contact list directly
+    std::set<std::pair<int, int>> scanned_pairs;
+    int scanned_collisions = 0;
+    for(int i = 0; i < d->ncon; i++){
+        int root_1 = scanned_contact_root(m, d->contact[i], 0);
+        int root_2 = scanned_contact_root(m, d->contact[i], 1);
+        scanned_pairs.insert(std::minmax(root_1, root_2));
+        if(root_1 != 0 && root_2 != 0 && root_1 != root_2){
+            scanned_collisions++;
+        }
+    }
+
+    EXPECT_EQ(index.NumCollisions(), scanned_collisions);
+    EXPECT_EQ(MuJoCo_helper->CheckSystemForCollisions(d), scanned_collisions);
+    std::set<std::pair<int, int>> indexed_pairs(index.Pairs().begin(), index.Pairs().end());
+    EXPECT_EQ(indexed_pairs, scanned_pairs);
+
+    for(int body_1 = 0; body_1 < m->nbody; body_1++){
+        bool scanned_body = false;
+        for(const auto &pair : scanned_pairs){
+            scanned_body |= (pair.first == body_1 && pair.second != 0) || (pair.second == body_1 && pair.first != 0);
+        }
+        EXPECT_EQ(index.Body(body_1), scanned_body);
+
+        body_handle handle_1;
+        handle_1.id = body_1;
+        EXPECT_EQ(MuJoCo_helper->CheckBodyForCollisions(handle_1, d), scanned_body);
+
+        for(int body_2 = 0; body_2 < m->nbody; body_2++){
+            EXPECT_EQ(index.Pair(body_1, body_2), scanned_pairs.count(std::minmax(body_1, body_2)) > 0);
+        }
+    }
+
+    // Single pair queries scan the contact list, check them on the pairs that are in contact
+    for(const auto &pair : scanned_pairs){
+        body_handle handle_1, handle_2;
+        handle_1.id = pair.first;
+        handle_2.id = pair.second;
+        EXPECT_TRUE(MuJoCo_helper->CheckPairForCollisions(handle_1, handle_2, d));
+    }
+}
+
+TEST(ModelTranslator, contact_index_matches_contact_scan){
+
+    std::shared_ptr<threeDTestClass> threeD_test = std::make_shared<threeDTestClass>();
+    model_translator = threeD_test;
+    check_contact_index_matches_scan(model_translator->MuJoCo_helper, model_translator->MuJoCo_helper->master_reset_data);
+
+    // Flex contacts have no geom on the flex side, the bodies come from the flex vertices
+    std::shared_ptr<softBodyTestClass> soft_body_test = std::make_shared<softBodyTestClass>();
+    model_translator = soft_body_test;
+    std::shared_ptr<MuJoCoHelper> MuJoCo_helper = model_translator->MuJoCo_helper;
+    mjData *d = MuJoCo_helper->main_data;
+    MuJoCo_helper->CopySystemState(d, MuJoCo_helper->master_reset_data);
+
+    // Let the jelly settle onto the floor
+    bool flex_contact = false;
+    for(int step = 0; step < 500 && !flex_contact; step++){
+        MuJoCo_helper->ForwardSimulator(d);
+        mj_forward(MuJoCo_helper->model, d);
+        for(int i = 0; i < d->ncon; i++){
+            flex_contact |= d->contact[i].flex[0] >= 0 || d->contact[i].flex[1] >= 0;
+        }
+    }
+    ASSERT_TRUE(flex_contact);
+
+    check_contact_index_matches_scan(MuJoCo_helper, d);
+}
+
 int main(int argc, char* argv[]){
     testing::InitGoogleTest(&argc, argv);
     return RUN_ALL_TESTS();
@@ -0,0 +1,205 @@
+#include <gtest/gtest.h>
+
+#include "Optimiser/Optimiser.h"
+#include "Optimiser/iLQR_SVR.h"
+#include "test_acrobot.h"
+
+std::shared_ptr<ModelTranslator> model_translator;
+
+// Exposes the backwards pass building blocks of the optimiser base class
+class optimiserTestClass : public Optimiser{
+public:
+
+    optimiserTestClass(std::shared_ptr<ModelTranslator> _model_translator, std::shared_ptr<FileHandler> _yaml_reader,
+                       std::shared_ptr<Differentiator> _differentiator) :
+            Optimiser(_model_translator, _model_translator->MuJoCo_helper, _yaml_reader, _differentiator){
+
+    }
+
+    double RolloutTrajectory(mjData *d, bool save_states, std::vector<MatrixXd> control_sequence) override{
+        return 0.0;
+    }
+
+    std::vector<MatrixXd> Optimise(mjData *d, std::vector<MatrixXd> initial_controls, int max_iterations,
+                                   int min_iterations, int _horizonLength) override{
+        return initial_controls;
+    }
+
+    using Optimiser::AddStateCostHessian;
+    using Optimiser::DynamicsProducts;
+};
+
+std::shared_ptr<optimiserTestClass> CreateOptimiser(int dof, int num_ctrl, int T){
+    std::shared_ptr<Acrobot> acrobot = std::make_shared<Acrobot>();
+    model_translator = acrobot;
+
+    std::shared_ptr<Differentiator> differentiator =
+            std::make_shared<Differentiator>(model_translator, model_translator->MuJoCo_helper);
+    std::shared_ptr<FileHandler> yaml_reader = std::make_shared<FileHandler>();
+    yaml_reader->num_worker_threads = 1;
+
+    // The products only depend on the sizes and the model timestep, not on the acrobot dofs
+    std::shared_ptr<optimiserTestClass> optimiser = std::make_shared<optimiserTestClass>(model_translator, yaml_reader, differentiator);
+    optimiser->dof = dof;
+    optimiser->num_ctrl = num_ctrl;
+    optimiser->horizon_length = T;
+
+    return optimiser;
+}
+
+MatrixXd RandomSymmetric(int size){
+    MatrixXd M = MatrixXd::Random(size, size);
+    return (M + M.transpose()) / 2;
+}
+
+// Riccati recursion of the iLQR backwards pass, returns the feedback gains K and open loop gains k
+void BackwardsPass(const std::shared_ptr<optimiserTestClass> &optimiser, std::vector<MatrixXd> &K, std::vector<MatrixXd> &k){
+    int dof = optimiser->dof;
+    int num_ctrl = optimiser->num_ctrl;
+    int T = optimiser->horizon_length;
+
+    MatrixXd V_x = optimiser->l_x[T - 1];
+    MatrixXd V_xx = MatrixXd::Zero(2*dof, 2*dof);
+    optimiser->AddStateCostHessian(T - 1, V_xx);
+
+    MatrixXd A_T_V_x(2*dof, 1);
+    MatrixXd A_T_V_xx_A(2*dof, 2*dof);
+    MatrixXd Q_ux(num_ctrl, 2*dof);
+
+    K.assign(T, MatrixXd());
+    k.assign(T, MatrixXd());
+    for(int t = T - 1; t >= 0; t--){
+        optimiser->DynamicsProducts(t, V_x, V_xx, A_T_V_x, A_T_V_xx_A, Q_ux);
+
+        MatrixXd Q_x = optimiser->l_x[t] + A_T_V_x;
+        MatrixXd Q_u = optimiser->l_u[t] + optimiser->B[t].transpose() * V_x;
+        MatrixXd Q_xx = A_T_V_xx_A;
+        optimiser->AddStateCostHessian(t, Q_xx);
+        MatrixXd Q_uu = optimiser->l_uu[t] + optimiser->B[t].transpose() * V_xx * optimiser->B[t];
+
+        auto Q_uu_ldlt = Q_uu.ldlt();
+        k[t] = -Q_uu_ldlt.solve(Q_u);
+        K[t] = -Q_uu_ldlt.solve(Q_ux);
+
+        V_x = Q_x + K[t].transpose() * (Q_uu * k[t]) + K[t].transpose() * Q_u + Q_ux.transpose() * k[t];
+        V_xx = Q_xx + K[t].transpose() * (Q_uu * K[t]) + K[t].transpose() * Q_ux + Q_ux.transpose() * K[t];
+        V_xx = (V_xx + V_xx.transpose()) / 2;
+    }
+}
+
+TEST(Optimiser, compact_dynamics_products_match_dense){
+    int dof = 5;
+    int num_ctrl = 3;
+    std::shared_ptr<optimiserTestClass> optimiser = CreateOptimiser(dof, num_ctrl, 1);
+    double h = model_translator->MuJoCo_helper->ReturnModelTimeStep();
+
+    // Semi-implicit Euler step, A = E + C * A_v with E = [I 0; 0 0] and C = [h I; I]
+    MatrixXd A_v = MatrixXd::Random(dof, 2*dof);
+    MatrixXd A_dense(2*dof, 2*dof);
+    A_dense.topRows(dof) = h * A_v;
+    A_dense.topLeftCorner(dof, dof) += MatrixXd::Identity(dof, dof);
+    A_dense.bottomRows(dof) = A_v;
+
+    MatrixXd B = MatrixXd::Random(2*dof, num_ctrl);
+    MatrixXd V_x = MatrixXd::Random(2*dof, 1);
+    MatrixXd V_xx = RandomSymmetric(2*dof);
+
+    MatrixXd A_T_V_x(2*dof, 1);
+    MatrixXd A_T_V_xx_A(2*dof, 2*dof);
+    MatrixXd B_T_V_xx_A(num_ctrl, 2*dof);
+
+    optimiser->A = {A_v};
+    optimiser->B = {B};
+    optimiser->DynamicsProducts(0, V_x, V_xx, A_T_V_x, A_T_V_xx_A, B_T_V_xx_A);
+
+    EXPECT_TRUE(A_T_V_x.isApprox(A_dense.transpose() * V_x, 1.0e-10));
+    EXPECT_TRUE(A_T_V_xx_A.isApprox(A_dense.transpose() * V_xx * A_dense, 1.0e-10));
+    EXPECT_TRUE(B_T_V_xx_A.isApprox(B.transpose() * V_xx * A_dense, 1.0e-10));
+
+    // The dense path must give the same products
+    MatrixXd dense_A_T_V_x(2*dof, 1);
+    MatrixXd dense_A_T_V_xx_A(2*dof, 2*dof);
+    MatrixXd dense_B_T_V_xx_A(num_ctrl, 2*dof);
+
+    optimiser->A = {A_dense};
+    optimiser->DynamicsProducts(0, V_x, V_xx, dense_A_T_V_x, dense_A_T_V_xx_A, dense_B_T_V_xx_A);
+
+    EXPECT_TRUE(dense_A_T_V_x.isApprox(A_T_V_x, 1.0e-10));
+    EXPECT_TRUE(dense_A_T_V_xx_A.isApprox(A_T_V_xx_A, 1.0e-10));
+    EXPECT_TRUE(dense_B_T_V_xx_A.isApprox(B_T_V_xx_A, 1.0e-10));
+}
+
+TEST(Optimiser, low_rank_cost_hessian_matches_dense){
+    int dof = 4;
+    int num_ctrl = 2;
+    int num_residuals = 3;
+    int T = 20;
+    std::shared_ptr<optimiserTestClass> optimiser = CreateOptimiser(dof, num_ctrl, T);
+
+    optimiser->A.clear();
+    optimiser->B.clear();
+    optimiser->l_x.clear();
+    optimiser->l_u.clear();
+    optimiser->l_uu.clear();
+    optimiser->l_xx.clear();
+    optimiser->r_x.clear();
+    optimiser->l_xx_factor.clear();
+    for(int t = 0; t < T; t++){
+        // Stable dynamics so the value function stays well scaled over the horizon
+        optimiser->A.push_back(MatrixXd::Identity(2*dof, 2*dof) + 0.05 * MatrixXd::Random(2*dof, 2*dof));
+        optimiser->B.push_back(MatrixXd::Random(2*dof, num_ctrl));
+        optimiser->l_x.push_back(MatrixXd::Random(2*dof, 1));
+        optimiser->l_u.push_back(MatrixXd::Random(num_ctrl, 1));
+        optimiser->l_uu.push_back(MatrixXd::Identity(num_ctrl, num_ctrl));
+
+        // Gauss-Newton cost hessian r_x^T * W * r_x, rank num_residuals
+        MatrixXd r_x = MatrixXd::Random(num_residuals, 2*dof);
+        MatrixXd W = (VectorXd::Random(num_residuals).array().abs() + 0.1).matrix().asDiagonal();
+        optimiser->r_x.push_back(r_x);
+        optimiser->l_xx_factor.push_back(W * r_x);
+        optimiser->l_xx.push_back(r_x.transpose() * W * r_x);
+    }
+
+    std::vector<MatrixXd> K_dense, k_dense;
+    optimiser->low_rank_cost_hessian = false;
+    BackwardsPass(optimiser, K_dense, k_dense);
+
+    std::vector<MatrixXd> K_low_rank, k_low_rank;
+    optimiser->low_rank_cost_hessian = true;
+    BackwardsPass(optimiser, K_low_rank, k_low_rank);
+
+    for(int t = 0; t < T; t++){
+        EXPECT_TRUE(K_low_rank[t].isApprox(K_dense[t], 1.0e-9)) << "t = " << t;
+        EXPECT_TRUE(k_low_rank[t].isApprox(k_dense[t], 1.0e-9)) << "t = " << t;
+    }
+}
+
+TEST(Optimiser, svr_rollout_before_optimise_fills_X_old){
+    int T = 20;
+    std::shared_ptr<Acrobot> acrobot = std::make_shared<Acrobot>();
+    model_translator = acrobot;
+    std::shared_ptr<MuJoCoHelper> MuJoCo_helper = model_translator->MuJoCo_helper;
+
+    std::shared_ptr<Differentiator> differentiator = std::make_shared<Differentiator>(model_translator, MuJoCo_helper);
+    std::shared_ptr<FileHandler> yaml_reader = std::make_shared<FileHandler>();
+    yaml_reader->num_worker_threads = 1;
+    std::shared_ptr<iLQR_SVR> optimiser = std::make_shared<iLQR_SVR>(model_translator, MuJoCo_helper, differentiator,
+                                                                     T, nullptr, yaml_reader);
+
+    int num_ctrl = model_translator->current_state_vector.num_ctrl;
+    std::vector<MatrixXd> controls(T, MatrixXd::Constant(num_ctrl, 1, 0.5));
+
+    // Roll out without an Optimise call first, like the testing data generators do
+    optimiser->RolloutTrajectory(MuJoCo_helper->master_reset_data, true, controls);
+
+    for(int t = 0; t < T + 1; t++){
+        MatrixXd expected = model_translator->ReturnStateVectorQuaternions(MuJoCo_helper->saved_systems_state_list[t],
+                                                                           model_translator->current_state_vector);
+        EXPECT_TRUE(optimiser->X_old[t].isApprox(expected, 1.0e-12)) << "t = " << t;
+    }
+}
+
+int main(int argc, char* argv[]){
+    testing::InitGoogleTest(&argc, argv);
+    return RUN_ALL_TESTS();
+}
@@ -0,0 +1,15 @@
+#include "ModelTranslator/ModelTranslator.h"
+
+class softBodyTestClass : virtual public ModelTranslator{
+public:
+
+    softBodyTestClass(){
+        std::string yamlFilePath = "/src/tests/test_configs/softBodyClusterTest.yaml";
+
+        InitModelTranslator(yamlFilePath);
+    }
+
+    void Residuals(mjData *d, MatrixXd &residual){
+
+    }
+};
@@ -0,0 +1,15 @@
+#include "ModelTranslator/ModelTranslator.h"
+
+class reachingTestClass : virtual public ModelTranslator{
+public:
+
+    reachingTestClass(){
+        std::string yamlFilePath = "/TaskConfigs/free_motion/reaching.yaml";
+
+        InitModelTranslator(yamlFilePath);
+    }
+
+    void Residuals(mjData *d, MatrixXd &residual){
+
+    }
+};